@@ -0,0 +1,40 @@
+//
+//  Chaos-game generator (chaos.h) scaling from 1 to N threads, checking
+//  that every thread count reproduces the single-thread points exactly.
+//
+//      make bench/chaos_scaling && ./bench/chaos_scaling [points] [max threads]
+//
+
+#include "chaos.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], NULL, 10) : size_t(1) << 25;
+    unsigned max_threads = argc > 2 ? unsigned(std::atoi(argv[2]))
+        : std::max(1u, std::thread::hardware_concurrency());
+
+    ChaosGame<2> game({vec<2>(-1, -1), vec<2>(0, 1), vec<2>(1, -1)}, 0.5, 2021);
+    game.set_start(vec<2>(0.25, 0.5));
+
+    VertexArray<2> reference(count), points(count);
+    game.generate(reference, 1);
+
+    double base = 0;
+    for (unsigned threads = 1; threads <= max_threads; threads = NextThreadCount(threads, max_threads)) {
+        auto start = std::chrono::steady_clock::now();
+        game.generate(points, threads);
+        auto stop = std::chrono::steady_clock::now();
+
+        double s = std::chrono::duration<double>(stop - start).count();
+        if (threads == 1) base = s;
+        bool same = std::memcmp(points.component(0), reference.component(0), count * sizeof(GLfloat)) == 0
+                 && std::memcmp(points.component(1), reference.component(1), count * sizeof(GLfloat)) == 0;
+
+        std::printf("%3u threads  %8.1f Mpoints/s  speedup %5.2fx  %s\n",
+            threads, count / s * 1e-6, base / s, same ? "identical" : "OUTPUT DIFFERS");
+    }
+    return 0;
+}
@@ -0,0 +1,191 @@
+//
+//  CommandBuffer (command_buffer.h) replayed into RecordingGL: each case
+//  records a few draws and compares the calls submit() makes with the
+//  list GL should see, redundant state left out.  Prints each case and
+//  exits 1 if any list differs.
+//
+//      make bench/command_buffer_check && ./bench/command_buffer_check
+//
+
+#include "command_buffer.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+void expect(const char* name, const CommandBuffer& cb, const RecordingGL& gl,
+            const std::vector<std::string>& want) {
+    bool ok = gl.calls == want && cb.stats().issued == gl.calls.size();
+    std::printf("%-36s %3zu calls  %s\n", name, gl.calls.size(), ok ? "ok" : "DIFFERS");
+    if (ok) return;
+    failures++;
+    std::printf("    %-52s %s\n", "expected", "issued");
+    for (size_t i = 0; i < std::max(want.size(), gl.calls.size()); i++) {
+        const char* w = i < want.size() ? want[i].c_str() : "";
+        const char* g = i < gl.calls.size() ? gl.calls[i].c_str() : "";
+        std::printf("  %s %-52s %s\n", std::string(w) == g ? " " : "*", w, g);
+    }
+    if (cb.stats().issued != gl.calls.size())
+        std::printf("    stats count %zu issued\n", cb.stats().issued);
+}
+
+// VAO 1 reading two floats per vertex from buffer 7
+void setup(CommandBuffer& cb) {
+    cb.bindVertexArray(1);
+    cb.bindBuffer(GL_ARRAY_BUFFER, 7);
+    cb.enableVertexAttribArray(0);
+    cb.vertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE);
+}
+
+void redundant() {
+    CommandBuffer cb;
+    RecordingGL gl;
+    setup(cb);
+    setup(cb);                              // all of it already holds
+    cb.useProgram(3);
+    cb.uniform(5, 1.0f);
+    cb.drawArrays(GL_TRIANGLES, 0, 3);
+    cb.useProgram(3);                       // the same state again
+    cb.bindVertexArray(1);
+    cb.uniform(5, 1.0f);
+    cb.uniform(-1, 4);                      // no such uniform
+    cb.drawArrays(GL_TRIANGLES, 3, 3);
+    cb.uniform(5, 2.0);                     // only the uniform changes
+    cb.drawArrays(GL_TRIANGLES, 6, 3);
+    cb.bindTexture(0, GL_TEXTURE_2D, 9);
+    cb.drawArrays(GL_TRIANGLES, 9, 3);
+    cb.useProgram(8);                       // no draw follows
+    cb.bindVertexArray(2);
+
+    cb.submit(gl);
+    expect("redundant state elided", cb, gl, {
+        "glBindBuffer(0x8892, 7)",
+        "glBindVertexArray(1)",
+        "glEnableVertexAttribArray(0)",
+        "glVertexAttribPointer(0, 2, 0x1406, GL_FALSE, 0, 0)",
+        "glUseProgram(3)",
+        "glUniform1fv(5, 1)",
+        "glDrawArrays(0x0004, 0, 3)",
+        "glDrawArrays(0x0004, 3, 3)",
+        "glUniform1fv(5, 2)",
+        "glDrawArrays(0x0004, 6, 3)",
+        "glActiveTexture(GL_TEXTURE0)",
+        "glBindTexture(0x0de1, 9)",
+        "glDrawArrays(0x0004, 9, 3)",
+    });
+    if (cb.stats().recorded != 22 || cb.stats().draws != 4) {
+        std::printf("    stats count %zu recorded, %zu draws\n", cb.stats().recorded, cb.stats().draws);
+        failures++;
+    }
+
+    // bindings are issued again; VAO setup and uniform values are not,
+    // except where a later draw left another value
+    gl.clear();
+    cb.submit(gl);
+    expect("second submit", cb, gl, {
+        "glBindBuffer(0x8892, 7)",
+        "glUseProgram(3)",
+        "glBindVertexArray(1)",
+        "glUniform1fv(5, 1)",
+        "glDrawArrays(0x0004, 0, 3)",
+        "glDrawArrays(0x0004, 3, 3)",
+        "glUniform1fv(5, 2)",
+        "glDrawArrays(0x0004, 6, 3)",
+        "glActiveTexture(GL_TEXTURE0)",
+        "glBindTexture(0x0de1, 9)",
+        "glDrawArrays(0x0004, 9, 3)",
+    });
+
+    gl.clear();
+    cb.invalidate();
+    cb.submit(gl);
+    expect("submit after invalidate()", cb, gl, {
+        "glBindBuffer(0x8892, 7)",
+        "glBindVertexArray(1)",
+        "glEnableVertexAttribArray(0)",
+        "glVertexAttribPointer(0, 2, 0x1406, GL_FALSE, 0, 0)",
+        "glUseProgram(3)",
+        "glUniform1fv(5, 1)",
+        "glDrawArrays(0x0004, 0, 3)",
+        "glDrawArrays(0x0004, 3, 3)",
+        "glUniform1fv(5, 2)",
+        "glDrawArrays(0x0004, 6, 3)",
+        "glActiveTexture(GL_TEXTURE0)",
+        "glBindTexture(0x0de1, 9)",
+        "glDrawArrays(0x0004, 9, 3)",
+    });
+}
+
+// programs 3 and 4 alternating, each draw with its own uniform value
+void sorted() {
+    CommandBuffer cb;
+    RecordingGL gl;
+    setup(cb);
+    for (int i = 0; i < 5; i++) {
+        if (i == 2) cb.barrier();
+        cb.useProgram(i % 2 || i == 4 ? 3 : 4);
+        cb.uniform(5, GLint(i));
+        cb.drawArrays(GL_POINTS, i, 1);
+    }
+    cb.sort();
+    cb.submit(gl);
+    expect("sort() groups draws up to barrier()", cb, gl, {
+        "glBindBuffer(0x8892, 7)",
+        "glBindVertexArray(1)",
+        "glEnableVertexAttribArray(0)",
+        "glVertexAttribPointer(0, 2, 0x1406, GL_FALSE, 0, 0)",
+        "glUseProgram(3)",
+        "glUniform1iv(5, 1)",
+        "glDrawArrays(0x0000, 1, 1)",
+        "glUseProgram(4)",
+        "glUniform1iv(5, 0)",
+        "glDrawArrays(0x0000, 0, 1)",
+        "glUseProgram(3)",
+        "glUniform1iv(5, 3)",
+        "glDrawArrays(0x0000, 3, 1)",
+        "glUniform1iv(5, 4)",
+        "glDrawArrays(0x0000, 4, 1)",
+        "glUseProgram(4)",
+        "glUniform1iv(5, 2)",
+        "glDrawArrays(0x0000, 2, 1)",
+    });
+}
+
+// the element buffer binding belongs to the VAO
+void elements() {
+    CommandBuffer cb;
+    RecordingGL gl;
+    cb.useProgram(3);
+    cb.bindVertexArray(2);
+    cb.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 8);
+    cb.drawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT);
+    cb.bindVertexArray(1);
+    cb.drawArrays(GL_TRIANGLES, 0, 3);
+    cb.bindVertexArray(2);
+    cb.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 8);
+    cb.drawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, BUFFER_OFFSET(24));
+    cb.submit(gl);
+    expect("element buffers kept per VAO", cb, gl, {
+        "glBindVertexArray(2)",
+        "glBindBuffer(0x8893, 8)",
+        "glUseProgram(3)",
+        "glDrawElements(0x0004, 6, 0x1405, 0)",
+        "glBindVertexArray(1)",
+        "glDrawArrays(0x0004, 0, 3)",
+        "glBindVertexArray(2)",
+        "glDrawElements(0x0004, 6, 0x1405, 24)",
+    });
+}
+
+}   // namespace
+
+int main() {
+    redundant();
+    sorted();
+    elements();
+    if (failures) std::printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+//
+//  Long chained vec/mat expressions: fused expression templates (expr.h)
+//  against the eager one-temporary-per-operator implementation they
+//  replaced, reproduced below as `eager<N>`.
+//
+//      make bench/expr_chain && ./bench/expr_chain
+//
+
+#include "sand.h"
+#include <chrono>
+#include <cstdio>
+
+namespace {
+
+// The pre-expression-template vec operators, verbatim in behaviour
+template<int N>
+struct eager {
+    std::array<GLfloat, N> v;
+
+    eager(GLfloat s = GLfloat(0.0)) { v.fill(s); }
+    eager(const std::array<GLfloat, N>& _v) : v(_v) {}
+
+    eager operator+ (const eager& _v) const {
+        std::array<GLfloat, N> res;
+        std::transform(v.begin(), v.end(), _v.v.begin(), res.begin(), std::plus<>{});
+        return eager(res);
+    }
+
+    eager operator- (const eager& _v) const {
+        std::array<GLfloat, N> res;
+        std::transform(v.begin(), v.end(), _v.v.begin(), res.begin(), std::minus<>{});
+        return eager(res);
+    }
+
+    eager operator * (const GLfloat s) const {
+        std::array<GLfloat, N> res;
+        std::transform(v.begin(), v.end(), res.begin(),
+            [s](GLfloat x) -> GLfloat { return s * x; });
+        return eager(res);
+    }
+
+    eager operator * (const eager& _v) const {
+        std::array<GLfloat, N> res;
+        std::transform(v.begin(), v.end(), _v.v.begin(), res.begin(), std::multiplies<>{});
+        return eager(res);
+    }
+
+    eager operator / (const GLfloat s) const {
+        GLfloat r = 1.0 / s;
+        return *this * r;
+    }
+};
+
+template<typename V, int N>
+void fill(std::vector<V>& a, GLfloat seed) {
+    for (size_t i = 0; i < a.size(); i++)
+        for (int k = 0; k < N; k++)
+            a[i].v[k] = seed + GLfloat((i * 7 + k * 3) % 17) * 0.125f;
+}
+
+// r = ((a + b) * 0.5 - c * d + e / 3.0 - a) * b
+template<typename V>
+void chain(const std::vector<V>& a, const std::vector<V>& b, const std::vector<V>& c,
+           const std::vector<V>& d, const std::vector<V>& e, std::vector<V>& r) {
+    for (size_t i = 0; i < r.size(); i++)
+        r[i] = ((a[i] + b[i]) * 0.5 - c[i] * d[i] + e[i] / 3.0 - a[i]) * b[i];
+}
+
+template<typename V>
+double run(int reps, size_t count, GLfloat& checksum) {
+    std::vector<V> a(count), b(count), c(count), d(count), e(count), r(count);
+    constexpr int N = sizeof(V::v) / sizeof(GLfloat);
+    fill<V, N>(a, 1); fill<V, N>(b, 2); fill<V, N>(c, 3); fill<V, N>(d, 4); fill<V, N>(e, 5);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int k = 0; k < reps; k++)
+        chain(a, b, c, d, e, r);
+    auto stop = std::chrono::steady_clock::now();
+
+    checksum = 0;
+    for (auto& x : r) checksum += x.v[0];
+    return std::chrono::duration<double, std::nano>(stop - start).count() / (double(reps) * count);
+}
+
+template<int N>
+void compare(int reps, size_t count) {
+    GLfloat ce, cf;
+    double te = run<eager<N>>(reps, count, ce);
+    double tf = run<vec<N>>(reps, count, cf);
+    std::printf("vec<%d>  eager %7.2f ns/op   fused %7.2f ns/op   speedup %5.2fx   (%s)\n",
+        N, te, tf, te / tf, ce == cf ? "same result" : "RESULT MISMATCH");
+}
+
+} // namespace
+
+int main() {
+    const int reps = 200;
+    const size_t count = 1 << 14;
+    compare<2>(reps, count);
+    compare<3>(reps, count);
+    compare<4>(reps, count);
+    compare<8>(reps, count);
+    compare<16>(reps, count);
+    return 0;
+}
@@ -0,0 +1,168 @@
+//
+//  Worst-case error of the fastmath tiers (fastmath.h) against libm in
+//  double precision, checked against the bounds the header documents:
+//  rsqrt and rcp over every float in one period of their estimate tables
+//  plus random normal floats, sin and cos over a sweep of [2^-20, 8192],
+//  normalize over random vectors of many scales.  The batch functions
+//  must agree bit for bit with the per-item ones (Fast vec3 Normalize
+//  with exact normalize, which it runs).
+//
+//      make bench/fastmath_accuracy && ./bench/fastmath_accuracy
+//
+
+#include "fastmath.h"
+#include "philox.h"
+#include <cstdio>
+#include <cstring>
+
+using namespace Sand::fastmath;
+
+namespace {
+
+const char* const Tiers[] = {"exact", "fast", "fastest"};
+
+// |got - ref| in ulp of the float nearest ref, or of `floor` if larger
+double Ulps(float got, double ref, double floor = 0) {
+    float r = std::fabs(float(ref));
+    r = std::max(r, float(floor));
+    if (r < std::numeric_limits<float>::min()) r = std::numeric_limits<float>::min();
+    double ulp = double(std::nextafter(r, std::numeric_limits<float>::infinity())) - r;
+    if (!std::isfinite(got)) return std::isfinite(ref) ? INFINITY : 0;
+    return std::fabs(double(got) - ref) / ulp;
+}
+
+float FloatFromBits(uint32_t bits) {
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+uint32_t Bits(float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+// random normal floats whose reciprocals are normal too
+float RandomNormal(Philox& rng, uint64_t i) {
+    uint32_t w = rng.word(i);
+    uint32_t exponent = 2 + w % 250;
+    return FloatFromBits((w & 0x80000000u) | exponent << 23 | (rng.word(i + (1ull << 40)) & 0x7fffff));
+}
+
+struct Worst {
+    double ulp = 0;
+    float at = 0;
+    void add(double u, float x) { if (u > ulp || u != u) { ulp = u; at = x; } }
+};
+
+int failures = 0;
+
+void report(const char* name, Accuracy a, const Worst& w, const double* bounds) {
+    double bound = bounds[int(a)];
+    bool ok = w.ulp <= bound;
+    failures += !ok;
+    std::printf("%-10s %-8s %12.3f ulp  (bound %6g, at %.9g)  %s\n", name, Tiers[int(a)], w.ulp, bound,
+                double(w.at), ok ? "ok" : "EXCEEDS BOUND");
+}
+
+template<Accuracy A>
+void check_rsqrt_rcp(Philox& rng) {
+    Worst rs, rc;
+    auto check = [&](float x) {
+        rs.add(Ulps(rsqrt<A>(x), 1 / std::sqrt(double(x))), x);
+        rc.add(Ulps(rcp<A>(x), 1 / double(x)), x);
+    };
+    // the estimate tables repeat every two binades
+    for (uint32_t b = Bits(1.0f); b < Bits(4.0f); b++) check(FloatFromBits(b));
+    for (uint64_t i = 0; i < (1 << 22); i++) {
+        float x = RandomNormal(rng, i);
+        rc.add(Ulps(rcp<A>(x), 1 / double(x)), x);
+        x = std::fabs(x);
+        rs.add(Ulps(rsqrt<A>(x), 1 / std::sqrt(double(x))), x);
+    }
+    report("rsqrt", A, rs, RsqrtMaxUlp);
+    report("rcp", A, rc, RcpMaxUlp);
+}
+
+template<Accuracy A>
+void check_sincos() {
+    Worst ws, wc;
+    bool batch = true;
+    const size_t block = 4096;
+    std::vector<float> x(block), s(block), c(block);
+    size_t n = 0;
+    auto flush = [&]() {
+        SinCos(x.data(), s.data(), c.data(), n, A);
+        for (size_t i = 0; i < n; i++) {
+            float si, ci;
+            sincos<A>(x[i], si, ci);
+            batch &= Bits(si) == Bits(s[i]) && Bits(ci) == Bits(c[i]);
+            ws.add(Ulps(s[i], std::sin(double(x[i])), SinCosFloor), x[i]);
+            wc.add(Ulps(c[i], std::cos(double(x[i])), SinCosFloor), x[i]);
+        }
+        n = 0;
+    };
+    // every 61st float of either sign, an odd stride to vary the mantissas
+    for (uint32_t b = Bits(0x1p-20f); b <= Bits(8192.0f); b += 61) {
+        x[n++] = FloatFromBits(b);
+        x[n++] = -FloatFromBits(b);
+        if (n == block) flush();
+    }
+    flush();
+    report("sin", A, ws, SinCosMaxUlp);
+    report("cos", A, wc, SinCosMaxUlp);
+    if (!batch) {
+        std::printf("SinCos %s differs from sincos\n", Tiers[int(A)]);
+        failures++;
+    }
+}
+
+template<Accuracy A, int N>
+void check_normalize(Philox& rng) {
+    const size_t count = 1 << 20;
+    std::vector<vec<N>> v(count), out(count);
+    for (size_t i = 0; i < count; i++) {
+        double scale = std::ldexp(1.0, int(rng.word(i * 5) % 41) - 20);
+        for (int k = 0; k < N; k++)
+            v[i][k] = float((Philox::uniform(rng.word(i * 5 + 1 + k)) * 2 - 1) * scale);
+    }
+    Normalize(v.data(), out.data(), count, A);
+
+    Worst w;
+    bool batch = true;
+    for (size_t i = 0; i < count; i++) {
+        double len2 = 0;
+        for (int k = 0; k < N; k++) len2 += double(v[i][k]) * v[i][k];
+        vec<N> single = normalize<N == 3 && A == Accuracy::Fast ? Accuracy::Exact : A>(v[i]);
+        for (int k = 0; k < N; k++) {
+            // in ulp of numbers just below 1
+            w.add(std::fabs(out[i][k] - v[i][k] / std::sqrt(len2)) / 0x1p-24, v[i][k]);
+            batch &= Bits(single[k]) == Bits(out[i][k]);
+        }
+    }
+    report(N == 3 ? "normalize3" : "normalize4", A, w, NormalizeMaxUlp);
+    if (!batch) {
+        std::printf("Normalize %s differs from normalize\n", Tiers[int(A)]);
+        failures++;
+    }
+}
+
+template<Accuracy A>
+void check_tier() {
+    Philox rng(2022);
+    check_rsqrt_rcp<A>(rng);
+    check_sincos<A>();
+    check_normalize<A, 3>(rng);
+    check_normalize<A, 4>(rng);
+}
+
+}   // namespace
+
+int main() {
+    check_tier<Accuracy::Exact>();
+    check_tier<Accuracy::Fast>();
+    check_tier<Accuracy::Fastest>();
+    if (failures) std::printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,235 @@
+#ifndef __BENCH_HARNESS_H__
+#define __BENCH_HARNESS_H__
+
+//
+//  Minimal benchmark harness for the programs in bench/.
+//
+//  Each case is a callable taking an iteration count.  The harness grows
+//  the count until one sample takes at least --min-time / --samples, then
+//  times --samples such samples.  It reports the median ns/op (robust to
+//  the odd descheduled sample), the spread across samples as a
+//  coefficient of variation, and items per second.
+//
+//  --json FILE       write the results, one JSON object per line inside an
+//                    array, so runs can be kept and diffed
+//  --baseline FILE   compare against an earlier --json file; cases slower
+//                    by more than --threshold percent (default 10) are
+//                    flagged and make the program exit with status 1
+//  --filter TEXT     only run cases whose name contains TEXT
+//
+//  Built with -DSAND_TRACK_ALLOCATIONS (make alloccheck), the harness also
+//  counts heap allocations made by the calling thread during the timed
+//  samples.  Cases run between allocationFree(true) and
+//  allocationFree(false) must not allocate at all; any that do are
+//  reported and make the program exit with status 1.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "alloc_tracker.h"
+
+namespace bench {
+
+// Keeps the compiler from discarding a value or hoisting its computation
+template<typename T>
+inline void DoNotOptimize(const T& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+struct Result {
+    std::string name;
+    double nsPerOp = 0;     // median over samples
+    double stddev = 0;      // ns/op across samples
+    double cv = 0;          // stddev / mean
+    double itemsPerSec = 0;
+    size_t iterations = 0;  // per sample
+    double allocsPerOp = 0; // with SAND_TRACK_ALLOCATIONS only
+};
+
+class Harness {
+    std::vector<Result> results;
+    std::string jsonFile, baselineFile, filter;
+    double threshold = 10, minTime = 0.5;
+    int samples = 10;
+    bool noAllocations = false;
+    int allocationFailures = 0;
+
+public:
+    Harness(int argc, char** argv) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+            if (value == NULL) {
+                usage(argv[0]);
+            } else if (arg == "--json") {
+                jsonFile = value;
+            } else if (arg == "--baseline") {
+                baselineFile = value;
+            } else if (arg == "--threshold") {
+                threshold = std::atof(value);
+            } else if (arg == "--filter") {
+                filter = value;
+            } else if (arg == "--samples") {
+                samples = std::max(2, std::atoi(value));
+            } else if (arg == "--min-time") {
+                minTime = std::atof(value) * 1e-3;
+            } else {
+                usage(argv[0]);
+            }
+            i++;
+        }
+        std::printf("%-34s %12s %8s %14s\n", "case", "ns/op", "cv", "items/s");
+    }
+
+    // Cases from here on must not allocate (checked in tracking builds)
+    void allocationFree(bool on) { noAllocations = on; }
+
+    // f(n) performs n operations of `items` items each
+    template<typename F>
+    void run(const std::string& name, F&& f, double items = 1) {
+        if (!filter.empty() && name.find(filter) == std::string::npos) return;
+        typedef std::chrono::steady_clock clock;
+
+        auto time = [&](size_t n) {
+            auto start = clock::now();
+            f(n);
+            return std::chrono::duration<double>(clock::now() - start).count();
+        };
+
+        // calibrate: one sample should last minTime / samples
+        const double target = minTime / samples;
+        size_t n = 1;
+        for (double t = time(n); t < target; t = time(n)) {
+            double grow = t > 0 ? target / t * 1.2 : 10;
+            n = size_t(std::ceil(n * std::min(std::max(grow, 1.5), 100.0)));
+        }
+
+        std::vector<double> ns(samples);
+        Sand::AllocationCounts before = Sand::ThreadAllocations();
+        for (double& s : ns) s = time(n) * 1e9 / double(n);
+        size_t allocs = Sand::ThreadAllocations().allocations - before.allocations;
+
+        double mean = 0, var = 0;
+        for (double s : ns) mean += s;
+        mean /= samples;
+        for (double s : ns) var += (s - mean) * (s - mean);
+        var /= samples - 1;
+
+        std::sort(ns.begin(), ns.end());
+
+        Result r;
+        r.name = name;
+        r.nsPerOp = samples % 2 ? ns[samples / 2] : (ns[samples / 2 - 1] + ns[samples / 2]) / 2;
+        r.stddev = std::sqrt(var);
+        r.cv = mean > 0 ? r.stddev / mean : 0;
+        r.itemsPerSec = items * 1e9 / r.nsPerOp;
+        r.iterations = n;
+        r.allocsPerOp = double(allocs) / double(n * samples);
+        results.push_back(r);
+
+        std::printf("%-34s %12.2f %7.1f%% %14.4g", name.c_str(), r.nsPerOp, r.cv * 100,
+                    r.itemsPerSec);
+        if (Sand::TrackingAllocations) {
+            bool failed = noAllocations && allocs > 0;
+            allocationFailures += failed;
+            std::printf(" %10.3g allocs/op%s", r.allocsPerOp, failed ? "  ALLOCATES" : "");
+        }
+        std::printf("\n");
+        std::fflush(stdout);
+    }
+
+    // Writes and compares results; returns the process exit status
+    int finish() const {
+        if (!jsonFile.empty() && !write(jsonFile)) {
+            std::fprintf(stderr, "Failed to write %s\n", jsonFile.c_str());
+            return EXIT_FAILURE;
+        }
+        if (allocationFailures) {
+            std::printf("%d allocation-free case%s allocated\n", allocationFailures,
+                        allocationFailures == 1 ? "" : "s");
+            return EXIT_FAILURE;
+        }
+        return baselineFile.empty() ? EXIT_SUCCESS : compare(baselineFile);
+    }
+
+private:
+    static void usage(const char* program) {
+        std::fprintf(stderr, "usage: %s [--json FILE] [--baseline FILE] [--threshold PCT]\n"
+                             "       [--filter TEXT] [--samples N] [--min-time MS]\n", program);
+        std::exit(EXIT_FAILURE);
+    }
+
+    bool write(const std::string& file) const {
+        std::ofstream out(file);
+        out << "[\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            char line[512];
+            std::snprintf(line, sizeof(line),
+                "  {\"name\": \"%s\", \"ns_per_op\": %.6g, \"stddev\": %.6g, \"cv\": %.6g, "
+                "\"items_per_sec\": %.6g, \"iterations\": %zu}%s\n",
+                r.name.c_str(), r.nsPerOp, r.stddev, r.cv, r.itemsPerSec, r.iterations,
+                i + 1 < results.size() ? "," : "");
+            out << line;
+        }
+        out << "]\n";
+        return bool(out);
+    }
+
+    // name -> ns_per_op from a file written by write()
+    static std::map<std::string, double> read(const std::string& file) {
+        std::map<std::string, double> res;
+        std::ifstream in(file);
+        for (std::string line; std::getline(in, line); ) {
+            size_t name = line.find("\"name\": \"");
+            size_t ns = line.find("\"ns_per_op\": ");
+            if (name == std::string::npos || ns == std::string::npos) continue;
+            name += 9;
+            res[line.substr(name, line.find('"', name) - name)] = std::atof(line.c_str() + ns + 13);
+        }
+        return res;
+    }
+
+    int compare(const std::string& file) const {
+        std::map<std::string, double> base = read(file);
+        if (base.empty()) {
+            std::fprintf(stderr, "No results in baseline %s\n", file.c_str());
+            return EXIT_FAILURE;
+        }
+
+        std::printf("\nagainst %s (threshold %.1f%%)\n", file.c_str(), threshold);
+        int regressions = 0;
+        for (const Result& r : results) {
+            auto b = base.find(r.name);
+            if (b == base.end()) {
+                std::printf("%-34s %12s\n", r.name.c_str(), "new");
+                continue;
+            }
+            double change = (r.nsPerOp / b->second - 1) * 100;
+            bool slower = change > threshold;
+            regressions += slower;
+            std::printf("%-34s %12.2f -> %10.2f %+7.1f%%%s\n", r.name.c_str(), b->second,
+                        r.nsPerOp, change, slower ? "  REGRESSION" : "");
+        }
+        std::printf("%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+        return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+};
+
+} // namespace bench
+
+#endif // __BENCH_HARNESS_H__
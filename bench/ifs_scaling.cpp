@@ -0,0 +1,43 @@
+//
+//  IFS density histogram (ifs_density.h) scaling from 1 to N threads,
+//  checking that every thread count reproduces the single-thread counts
+//  exactly.  The system is the Barnsley fern, whose weights are far from
+//  uniform.
+//
+//      make bench/ifs_scaling && ./bench/ifs_scaling [iterations] [max threads]
+//
+
+#include "ifs_density.h"
+#include "parallel.h"
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+int main(int argc, char** argv) {
+    uint64_t count = argc > 1 ? std::strtoull(argv[1], NULL, 10) : uint64_t(1) << 27;
+    unsigned max_threads = argc > 2 ? unsigned(std::atoi(argv[2]))
+        : std::max(1u, std::thread::hardware_concurrency());
+
+    const std::vector<AffineMap> fern = {
+        {mat<3>(0.00, 0.00, 0.00, 0.00, 0.16, 0.00, 0, 0, 1), 0.01},
+        {mat<3>(0.85, 0.04, 0.00, -0.04, 0.85, 1.60, 0, 0, 1), 0.85},
+        {mat<3>(0.20, -0.26, 0.00, 0.23, 0.22, 1.60, 0, 0, 1), 0.07},
+        {mat<3>(-0.15, 0.28, 0.00, 0.26, 0.24, 0.44, 0, 0, 1), 0.07},
+    };
+
+    IfsDensity reference(fern, 1024, 1024, vec<2>(-3, 0), vec<2>(3, 10), 2021);
+    reference.run(count, 1);
+    double base = reference.stats().seconds;
+
+    for (unsigned threads = 1; threads <= max_threads; threads = NextThreadCount(threads, max_threads)) {
+        IfsDensity density(fern, 1024, 1024, vec<2>(-3, 0), vec<2>(3, 10), 2021);
+        density.run(count, threads);
+
+        const IfsDensity::Stats& st = density.stats();
+        bool same = density.counts() == reference.counts();
+        std::printf("%3u threads  %8.1f Miter/s  %6.2f Giter/min  merge %6.2f ms  speedup %5.2fx  %s\n",
+            threads, count / st.seconds * 1e-6, count / st.seconds * 60e-9, st.mergeSeconds * 1e3,
+            base / st.seconds, same ? "identical" : "COUNTS DIFFER");
+    }
+    return 0;
+}
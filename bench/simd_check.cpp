@@ -0,0 +1,196 @@
+//
+//  The simd.h paths of vec<3>, vec<4> and mat<4> against the generic
+//  template they replace at run time: the loops vec.h and mat.h still run
+//  in constant evaluation, restated here for run-time inputs.  Element-wise
+//  expressions must match bit for bit (see ExactElementwise); dot, length,
+//  normalize, cross and the products sum in a different order, so they
+//  must stay within the rounding error bound of an N-term float sum on
+//  either side.
+//
+//      make bench/simd_check && ./bench/simd_check [iterations]
+//
+
+#include "sand.h"
+#include "philox.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+const double Eps = std::numeric_limits<GLfloat>::epsilon();
+
+// With FMA in the target GCC fuses a * b + c (-ffp-contract=fast), and not
+// in the same places on both paths, so element-wise results are only held
+// to bit identity without it
+#ifdef __FMA__
+const bool ExactElementwise = false;
+#else
+const bool ExactElementwise = true;
+#endif
+
+// the constant-evaluation branches of vec.h and mat.h
+namespace generic {
+
+template<int N>
+GLfloat dot(const vec<N>& u, const vec<N>& v) {
+    GLfloat s = 0;
+    for (int i = 0; i < N; i++) s = s + u[i] * v[i];
+    return s;
+}
+
+template<int N>
+GLfloat length(const vec<N>& v) { return std::sqrt(generic::dot(v, v)); }
+
+template<int N>
+vec<N> normalize(const vec<N>& v) {
+    GLfloat l = generic::length(v);
+    vec<N> res;
+    for (int i = 0; i < N; i++) res[i] = v[i] / l;
+    return res;
+}
+
+vec<3> cross(const vec<3>& u, const vec<3>& v) {
+    return vec<3>(u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]);
+}
+
+GLfloat product(const mat<4>& a, const mat<4>& b, int i, int j) {
+    GLfloat s = 0;
+    for (int k = 0; k < 4; k++) s += a.at(i, k) * b.at(k, j);
+    return s;
+}
+
+} // namespace generic
+
+struct Check {
+    const char* name;
+    size_t count = 0, exact = 0;
+    double worst = 0;       // error over its bound
+    bool bitwise;
+
+    Check(const char* name, bool bitwise = false) : name(name), bitwise(bitwise) {}
+
+    // got and ref may differ by bound unless bitwise
+    void add(GLfloat got, GLfloat ref, double bound) {
+        count++;
+        if (std::memcmp(&got, &ref, sizeof(got)) == 0) { exact++; return; }
+        double e = std::fabs(double(got) - ref);
+        worst = std::max(worst, bound > 0 && !bitwise ? e / bound : INFINITY);
+    }
+};
+
+int failures = 0;
+
+void report(const Check& c) {
+    bool ok = c.worst <= 1;
+    failures += !ok;
+    std::printf("%-14s %9zu values  %6.2f%% bit-identical  worst %.3f of bound  %s\n", c.name, c.count,
+                100.0 * c.exact / c.count, c.worst, ok ? "ok" : c.bitwise ? "DIFFERS" : "EXCEEDS BOUND");
+}
+
+// floats over many binades, either sign
+GLfloat random(Philox& rng, uint64_t& n) {
+    uint32_t w = rng.word(n++);
+    GLfloat mantissa = Philox::uniform(rng.word(n++)) + 0.5f;
+    return std::ldexp(w & 1 ? -mantissa : mantissa, int(w >> 1) % 17 - 8);
+}
+
+template<int N>
+vec<N> random_vec(Philox& rng, uint64_t& n) {
+    vec<N> v;
+    for (int i = 0; i < N; i++) v[i] = random(rng, n);
+    return v;
+}
+
+// a sum of N products each rounded once, summed in any order
+template<int N>
+double sum_bound(const vec<N>& u, const vec<N>& v) {
+    double s = 0;
+    for (int i = 0; i < N; i++) s += std::fabs(double(u[i]) * v[i]);
+    return 2 * (N + 1) * Eps * s;
+}
+
+template<int N>
+void check_vec(Philox& rng, size_t iterations) {
+    const bool three = N == 3;
+    Check add(three ? "vec3 + - *" : "vec4 + - *", ExactElementwise), dot(three ? "vec3 dot" : "vec4 dot");
+    Check length(three ? "vec3 length" : "vec4 length"), normalize(three ? "vec3 normalize" : "vec4 normalize");
+    Check cross("vec3 cross");
+
+    uint64_t n = uint64_t(N) << 40;
+    for (size_t it = 0; it < iterations; it++) {
+        vec<N> u = random_vec<N>(rng, n), v = random_vec<N>(rng, n);
+        GLfloat s = random(rng, n);
+
+        vec<N> e = u + v * s - u * v;
+        for (int i = 0; i < N; i++) add.add(e[i], (u[i] + v[i] * s) - u[i] * v[i],
+                    2 * Eps * (std::fabs(u[i]) + std::fabs(v[i] * s) + std::fabs(u[i] * v[i])));
+
+        dot.add(Sand::dot(u, v), generic::dot(u, v), sum_bound(u, v));
+
+        GLfloat len = generic::length(u);
+        length.add(Sand::length(u), len, (N + 2) * Eps * len);
+
+        vec<N> un = Sand::normalize(u), gn = generic::normalize(u);
+        for (int i = 0; i < N; i++) normalize.add(un[i], gn[i], 2 * (N + 3) * Eps);
+
+        if constexpr (N == 3) {
+            vec<3> c = Sand::cross(u, v), g = generic::cross(u, v);
+            for (int i = 0; i < 3; i++) {
+                int j = (i + 1) % 3, k = (i + 2) % 3;
+                double b = 2 * Eps * (std::fabs(double(u[j]) * v[k]) + std::fabs(double(u[k]) * v[j]));
+                cross.add(c[i], g[i], b);
+            }
+        }
+    }
+    report(add);
+    report(dot);
+    report(length);
+    report(normalize);
+    if (N == 3) report(cross);
+}
+
+void check_mat(Philox& rng, size_t iterations) {
+    Check mm("mat4 * mat4"), mv("mat4 * vec4"), add("mat4 + - *", ExactElementwise);
+
+    uint64_t n = uint64_t(5) << 40;
+    for (size_t it = 0; it < iterations; it++) {
+        mat<4> a, b;
+        for (int i = 0; i < 4; i++) {
+            a[i] = random_vec<4>(rng, n);
+            b[i] = random_vec<4>(rng, n);
+        }
+        vec<4> v = random_vec<4>(rng, n);
+        GLfloat s = random(rng, n);
+
+        mat<4> p = a * b;
+        vec<4> w = a * v;
+        mat<4> e = a + b * s - a;
+        for (int i = 0; i < 4; i++) {
+            vec<4> row = a[i];
+            mv.add(w[i], generic::dot(row, v), sum_bound(row, v));
+            for (int j = 0; j < 4; j++) {
+                vec<4> col(b.at(0, j), b.at(1, j), b.at(2, j), b.at(3, j));
+                mm.add(p.at(i, j), generic::product(a, b, i, j), sum_bound(row, col));
+                add.add(e.at(i, j), (a.at(i, j) + b.at(i, j) * s) - a.at(i, j),
+                        2 * Eps * (2 * std::fabs(a.at(i, j)) + std::fabs(b.at(i, j) * s)));
+            }
+        }
+    }
+    report(mm);
+    report(mv);
+    report(add);
+}
+
+}   // namespace
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? std::strtoull(argv[1], NULL, 10) : size_t(1) << 20;
+    Philox rng(2001);
+    check_vec<3>(rng, iterations);
+    check_vec<4>(rng, iterations);
+    check_mat(rng, iterations);
+    if (failures) std::printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+//
+//  PointGrid and KdTree (spatial_index.h) against brute force: nearest,
+//  k nearest, radius and rectangle queries over the example21 gasket in
+//  2D and clustered points in 3D, with query points inside and around
+//  the data.  Prints build times and the mean time per query; exits 1 if
+//  any answer differs from the brute-force one.
+//
+//      make bench/spatial_queries && ./bench/spatial_queries [points] [queries]
+//
+
+#include "spatial_index.h"
+#include "chaos.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+int failures = 0;
+
+template<int D>
+struct Brute {
+    const std::vector<vec<D>>& pts;
+
+    std::vector<uint32_t> nearest(const vec<D>& q, size_t k, GLfloat maxDist) const {
+        std::vector<std::pair<GLfloat, uint32_t>> all;
+        for (size_t i = 0; i < pts.size(); i++) {
+            GLfloat d2 = detail::distance2(pts[i], q);
+            if (d2 <= maxDist * maxDist) all.push_back({d2, uint32_t(i)});
+        }
+        k = std::min(k, all.size());
+        std::partial_sort(all.begin(), all.begin() + k, all.end());
+        std::vector<uint32_t> res;
+        for (size_t i = 0; i < k; i++) res.push_back(all[i].second);
+        return res;
+    }
+
+    std::vector<uint32_t> radius(const vec<D>& q, GLfloat r) const {
+        std::vector<uint32_t> res;
+        for (size_t i = 0; i < pts.size(); i++)
+            if (detail::distance2(pts[i], q) <= r * r) res.push_back(uint32_t(i));
+        return res;
+    }
+
+    std::vector<uint32_t> rect(const vec<D>& lo, const vec<D>& hi) const {
+        std::vector<uint32_t> res;
+        for (size_t i = 0; i < pts.size(); i++)
+            if (detail::inside(pts[i], lo, hi)) res.push_back(uint32_t(i));
+        return res;
+    }
+};
+
+void check(bool same, const char* index, const char* query, size_t q) {
+    if (same) return;
+    if (failures++ < 10) std::printf("%s %s differs from brute force at query %zu\n", index, query, q);
+}
+
+std::vector<uint32_t> sorted(std::vector<uint32_t> v) {
+    std::sort(v.begin(), v.end());
+    return v;
+}
+
+template<int D, typename Index>
+void run(const char* name, const std::vector<vec<D>>& pts, const std::vector<vec<D>>& queries,
+         GLfloat r) {
+    Brute<D> brute{pts};
+    Index index(pts.data(), pts.size(), 1);
+    double serial = index.buildSeconds();
+    index.build(pts.data(), pts.size());
+    std::printf("%-8s %zu points: build %7.1f ms on 1 thread, %7.1f ms on %u\n", name, pts.size(),
+                serial * 1e3, index.buildSeconds() * 1e3, ThreadCount());
+
+    // timed over every query first, then checked
+    std::vector<uint32_t> out;
+    double seconds[4] = {};
+    size_t found = 0;
+    for (const vec<D>& q : queries) {
+        vec<D> lo, hi;
+        for (int k = 0; k < D; k++) { lo[k] = q[k] - r; hi[k] = q[k] + 2 * r; }
+        auto t0 = Clock::now();
+        found += index.nearest(q) != Index::None;
+        auto t1 = Clock::now();
+        index.nearest(q, 16, out);
+        auto t2 = Clock::now();
+        index.radius(q, r, out);
+        auto t3 = Clock::now();
+        index.rect(lo, hi, out);
+        auto t4 = Clock::now();
+        seconds[0] += std::chrono::duration<double>(t1 - t0).count();
+        seconds[1] += std::chrono::duration<double>(t2 - t1).count();
+        seconds[2] += std::chrono::duration<double>(t3 - t2).count();
+        seconds[3] += std::chrono::duration<double>(t4 - t3).count();
+    }
+    double n = double(queries.size());
+    std::printf("         per query: nearest %6.2f us, 16 nearest %6.2f us, radius %6.2f us, rect %6.2f us\n",
+                seconds[0] / n * 1e6, seconds[1] / n * 1e6, seconds[2] / n * 1e6, seconds[3] / n * 1e6);
+
+    for (size_t i = 0; i < queries.size(); i++) {
+        const vec<D>& q = queries[i];
+        vec<D> lo, hi;
+        for (int k = 0; k < D; k++) { lo[k] = q[k] - r; hi[k] = q[k] + 2 * r; }
+
+        std::vector<uint32_t> one = brute.nearest(q, 1, std::numeric_limits<GLfloat>::infinity());
+        check(index.nearest(q) == one[0], name, "nearest", i);
+        check(index.nearest(q, r) == (brute.nearest(q, 1, r).empty() ? Index::None : one[0]),
+              name, "nearest within r", i);
+        index.nearest(q, 16, out);
+        check(out == brute.nearest(q, 16, std::numeric_limits<GLfloat>::infinity()), name, "16 nearest", i);
+        index.nearest(q, 16, out, r);
+        check(out == brute.nearest(q, 16, r), name, "16 nearest within r", i);
+        index.radius(q, r, out);
+        check(sorted(out) == brute.radius(q, r), name, "radius", i);
+        index.rect(lo, hi, out);
+        check(sorted(out) == brute.rect(lo, hi), name, "rect", i);
+    }
+}
+
+}   // namespace
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], NULL, 10) : size_t(1) << 20;
+    size_t nq = argc > 2 ? std::strtoull(argv[2], NULL, 10) : 200;
+    Philox rng(2025);
+
+    // the gasket, queried over a box a little larger than it
+    VertexArray<2> gasket(count);
+    ChaosGame<2> game({vec<2>(-1, -1), vec<2>(0, 1), vec<2>(1, -1)}, 0.5);
+    game.set_start(vec<2>(0.25, 0.5));
+    game.generate(gasket);
+    std::vector<vec<2>> p2 = detail::Gather(gasket), q2(nq);
+    for (size_t i = 0; i < nq; i++)
+        q2[i] = vec<2>(Philox::uniform(rng.word(2 * i)) * 2.4f - 1.2f,
+                       Philox::uniform(rng.word(2 * i + 1)) * 2.4f - 1.2f);
+    run<2, PointGrid<2>>("grid 2D", p2, q2, 0.01f);
+    run<2, KdTree<2>>("kd 2D", p2, q2, 0.01f);
+
+    // 64 tight clusters in the unit cube, with every 16th point repeated
+    // to exercise ties
+    std::vector<vec<3>> p3(count), q3(nq);
+    for (size_t i = 0; i < count; i++) {
+        Philox::block b = rng((uint64_t(1) << 40) + i);
+        uint32_t c = b[0] % 64;
+        vec<3> center(GLfloat(c & 3) / 3, GLfloat(c >> 2 & 3) / 3, GLfloat(c >> 4) / 3);
+        GLfloat spread = 0.002f + 0.02f * GLfloat(c % 5);
+        p3[i] = i % 16 == 15 ? p3[i - 1]
+              : center + vec<3>(Philox::uniform(b[1]) - 0.5f, Philox::uniform(b[2]) - 0.5f,
+                                Philox::uniform(b[3]) - 0.5f) * spread;
+    }
+    for (size_t i = 0; i < nq; i++) {
+        Philox::block b = rng((uint64_t(1) << 41) + i);
+        // half near a point, half anywhere in and around the cube
+        q3[i] = i & 1 ? p3[b[0] % count] + vec<3>(0.001f, -0.002f, 0.0015f)
+                      : vec<3>(Philox::uniform(b[1]) * 1.4f - 0.2f, Philox::uniform(b[2]) * 1.4f - 0.2f,
+                               Philox::uniform(b[3]) * 1.4f - 0.2f);
+    }
+    run<3, PointGrid<3>>("grid 3D", p3, q3, 0.005f);
+    run<3, KdTree<3>>("kd 3D", p3, q3, 0.005f);
+
+    if (failures) std::printf("%d queries failed\n", failures);
+    return failures ? 1 : 0;
+}
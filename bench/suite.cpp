@@ -0,0 +1,856 @@
+//
+//  Benchmark suite behind `make bench`: vec/mat operators, the transform
+//  builders, quaternions, the transform hierarchy, frustum culling, packed
+//  vertex formats and files, point LOD, profiler scopes, the example21
+//  chaos-game loop and its density histogram, point picking indexes and
+//  shader source loading.
+//
+//      make bench                          run, save bench/results.json
+//      make bench BASELINE=old.json        ... and flag regressions
+//      ./bench/suite --help                all options (see harness.h)
+//
+//  Inputs cycle through small tables filled at run time, so nothing folds
+//  into a constant even though vec/mat are constexpr.
+//
+
+#include "sand.h"
+#include "chaos.h"
+#include "ifs_density.h"
+#include "spatial_index.h"
+#include "command_buffer.h"
+#include "cpu_features.h"
+#include "culling.h"
+#include "fastmath.h"
+#include "mat_batch.h"
+#include "philox.h"
+#include "point_lod.h"
+#include "profiler.h"
+#include "quat.h"
+#include "shader_source.h"
+#include "spsc_queue.h"
+#include "transform_graph.h"
+#include "vertex_file.h"
+#include "vertex_format.h"
+#include "harness.h"
+#include <filesystem>
+#include <thread>
+
+using bench::DoNotOptimize;
+
+namespace {
+
+const size_t Table = 256;   // inputs per case, a power of two
+
+template<int N>
+std::vector<vec<N>> random_vecs(uint64_t seed) {
+    Philox rng(seed);
+    std::vector<vec<N>> res(Table);
+    for (size_t i = 0; i < Table; i++)
+        for (int k = 0; k < N; k++)
+            res[i][k] = Philox::uniform(rng.word(i * N + k)) * 2 - 1;
+    return res;
+}
+
+template<int N>
+std::vector<mat<N>> random_mats(uint64_t seed) {
+    std::vector<vec<N>> rows = random_vecs<N>(seed);
+    std::vector<mat<N>> res(Table);
+    for (size_t i = 0; i < Table; i++)
+        for (int r = 0; r < N; r++) {
+            res[i][r] = rows[(i + r) % Table];
+            res[i][r][r] += 2;   // diagonally dominant, so well-conditioned
+        }
+    return res;
+}
+
+void vec_ops(bench::Harness& h) {
+    auto a3 = random_vecs<3>(1), b3 = random_vecs<3>(2);
+    auto a4 = random_vecs<4>(3), b4 = random_vecs<4>(4), c4 = random_vecs<4>(5);
+
+    h.run("vec4 a + b", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            vec<4> r = a4[i % Table] + b4[i % Table];
+            DoNotOptimize(r);
+        }
+    });
+    h.run("vec4 (a + b) * 0.5 - c", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            vec<4> r = (a4[i % Table] + b4[i % Table]) * 0.5 - c4[i % Table];
+            DoNotOptimize(r);
+        }
+    });
+    h.run("vec4 dot", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            GLfloat r = dot(a4[i % Table], b4[i % Table]);
+            DoNotOptimize(r);
+        }
+    });
+    h.run("vec3 cross", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            vec<3> r = cross(a3[i % Table], b3[i % Table]);
+            DoNotOptimize(r);
+        }
+    });
+    h.run("vec3 normalize", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            vec<3> r = normalize(a3[i % Table] + vec<3>(2));
+            DoNotOptimize(r);
+        }
+    });
+}
+
+void mat_ops(bench::Harness& h) {
+    auto a = random_mats<4>(6), b = random_mats<4>(7);
+    auto a3 = random_mats<3>(8);
+    auto v = random_vecs<4>(9);
+    auto v3 = random_vecs<3>(10);
+
+    h.run("mat4 * mat4", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            mat<4> r = a[i % Table] * b[i % Table];
+            DoNotOptimize(r);
+        }
+    });
+    h.run("mat4 * vec4", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            vec<4> r = a[i % Table] * v[i % Table];
+            DoNotOptimize(r);
+        }
+    });
+    h.run("mat4 + mat4 * 2", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            mat<4> r = a[i % Table] + b[i % Table] * 2;
+            DoNotOptimize(r);
+        }
+    });
+    h.run("mat4 transpose", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            mat<4> r = transpose(a[i % Table]);
+            DoNotOptimize(r);
+        }
+    });
+    h.run("mat3 * vec3", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            vec<3> r = a3[i % Table] * v3[i % Table];
+            DoNotOptimize(r);
+        }
+    });
+    h.run("mat4 determinant", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            GLfloat r = determinant(a[i % Table]);
+            DoNotOptimize(r);
+        }
+    });
+    h.run("mat4 inverse, Gauss-Jordan", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            mat<4> r = detail::gaussJordan(a[i % Table]);
+            DoNotOptimize(r);
+        }
+    });
+    h.run("mat4 inverse", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            mat<4> r = inverse(a[i % Table]);
+            DoNotOptimize(r);
+        }
+    });
+    h.run("mat4 inverseAffine", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            mat<4> r = inverseAffine(a[i % Table]);
+            DoNotOptimize(r);
+        }
+    });
+    h.run("mat4 inverseRigid", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            mat<4> r = inverseRigid(a[i % Table]);
+            DoNotOptimize(r);
+        }
+    });
+}
+
+// The batch kernels once per instruction set this CPU has, forced, so the
+// levels can be compared side by side
+void mat_batches(bench::Harness& h) {
+    const size_t count = 4096;
+    auto table = random_mats<4>(30);
+    auto vecs = random_vecs<4>(31);
+    auto points3 = random_vecs<3>(32);
+    std::vector<mat<4>> models(count), views(count), out(count);
+    std::vector<vec<4>> v(count), transformed(count);
+    std::vector<vec<3>> points(count);
+    for (size_t i = 0; i < count; i++) {
+        models[i] = table[i % Table];
+        views[i] = table[(i * 7 + 3) % Table];
+        v[i] = vecs[i % Table];
+        points[i] = points3[(i * 5) % Table];
+    }
+    const mat<4> vp = table[0] * table[1];
+
+    for (int level = 0; level <= int(Isa::AVX512); level++) {
+        Isa isa = Isa(level);
+        if (!ForceIsa(isa)) continue;
+        const std::string at = std::string(", ") + IsaName(isa);
+
+        h.run("MulMat4 VP * M[i], 4K" + at, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                MulMat4(vp, models.data(), out.data(), count);
+                DoNotOptimize(out[i % count][0]);
+            }
+        }, count);
+        h.run("MulMat4 V[i] * M[i], 4K" + at, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                MulMat4(views.data(), models.data(), out.data(), count);
+                DoNotOptimize(out[i % count][0]);
+            }
+        }, count);
+        h.run("TransformVec4 M * v[i], 4K" + at, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                TransformVec4(vp, v.data(), transformed.data(), count);
+                DoNotOptimize(transformed[i % count][0]);
+            }
+        }, count);
+        h.run("TransformVec4 M[i] * v[i], 4K" + at, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                TransformVec4(models.data(), v.data(), transformed.data(), count);
+                DoNotOptimize(transformed[i % count][0]);
+            }
+        }, count);
+        h.run("TransformPoints M * p[i], 4K" + at, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                TransformPoints(vp, points.data(), transformed.data(), count);
+                DoNotOptimize(transformed[i % count][0]);
+            }
+        }, count);
+    }
+    ResetIsa();
+}
+
+// The three accuracy tiers side by side; bench/fastmath_accuracy checks
+// their errors
+void fast_math(bench::Harness& h) {
+    using namespace fastmath;
+    const size_t count = 4096;
+    auto table = random_vecs<3>(33);
+    std::vector<vec<3>> v(count), normalized(count);
+    std::vector<GLfloat> x(count), s(count), c(count);
+    for (size_t i = 0; i < count; i++) {
+        v[i] = table[i % Table] + vec<3>(2);
+        x[i] = table[i % Table][0] * 100;
+    }
+
+    const Accuracy tiers[] = {Accuracy::Exact, Accuracy::Fast, Accuracy::Fastest};
+    const char* const names[] = {"exact", "fast", "fastest"};
+    for (Accuracy a : tiers) {
+        const std::string tier = names[int(a)];
+        h.run("rsqrt x4, " + tier, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                simd::f32x4 len2 = simd::load3(v[i % count]);
+                simd::f32x4 r = a == Accuracy::Exact ? rsqrt<Accuracy::Exact>(len2)
+                              : a == Accuracy::Fast ? rsqrt<Accuracy::Fast>(len2)
+                              : rsqrt<Accuracy::Fastest>(len2);
+                DoNotOptimize(r);
+            }
+        });
+        h.run("Normalize 4K vec3, " + tier, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                Normalize(v.data(), normalized.data(), count, a);
+                DoNotOptimize(normalized[i % count][0]);
+            }
+        }, count);
+        h.run("SinCos 4K, " + tier, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                SinCos(x.data(), s.data(), c.data(), count, a);
+                DoNotOptimize(s[i % count]);
+            }
+        }, count);
+    }
+}
+
+void transforms(bench::Harness& h) {
+    auto eye = random_vecs<4>(11), at = random_vecs<4>(12);
+    auto m = random_mats<4>(13);
+    std::vector<GLfloat> fovy(Table);
+    for (size_t i = 0; i < Table; i++) fovy[i] = 30 + GLfloat(i % 60);
+
+    h.run("LookAt", [&](size_t n) {
+        const vec<4> up(0, 1, 0, 0);
+        for (size_t i = 0; i < n; i++) {
+            vec<4> e = eye[i % Table];
+            e[2] += 4;
+            e[3] = 1;
+            mat<4> r = LookAt(e, at[i % Table], up);
+            DoNotOptimize(r);
+        }
+    });
+    h.run("Perspective", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            mat<4> r = Perspective(fovy[i % Table], 1.5, 0.1, 100);
+            DoNotOptimize(r);
+        }
+    });
+    h.run("Normal", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            mat<3> r = Normal(m[i % Table]);
+            DoNotOptimize(r);
+        }
+    });
+}
+
+std::vector<quat> random_quats(uint64_t seed) {
+    std::vector<vec<4>> v = random_vecs<4>(seed);
+    std::vector<quat> res(Table);
+    for (size_t i = 0; i < Table; i++)
+        res[i] = normalize(quat(v[i][0], v[i][1], v[i][2], v[i][3] + 2));
+    return res;
+}
+
+// quaternion paths next to the mat<4> operations they replace
+void rotations(bench::Harness& h) {
+    auto a = random_quats(14), b = random_quats(15);
+    auto v = random_vecs<3>(16);
+    std::vector<mat<4>> ma(Table), mb(Table);
+    std::vector<dualquat> da(Table), db(Table);
+    for (size_t i = 0; i < Table; i++) {
+        da[i] = dualquat(a[i], v[i]);
+        db[i] = dualquat(b[i], v[(i + 1) % Table]);
+        ma[i] = mat<4>(da[i]);
+        mb[i] = mat<4>(db[i]);
+    }
+
+    h.run("quat * quat", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            quat r = a[i % Table] * b[i % Table];
+            DoNotOptimize(r);
+        }
+    });
+    h.run("dualquat * dualquat", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            dualquat r = da[i % Table] * db[i % Table];
+            DoNotOptimize(r);
+        }
+    });
+    h.run("rigid mat4 * mat4", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            mat<4> r = ma[i % Table] * mb[i % Table];
+            DoNotOptimize(r);
+        }
+    });
+    h.run("quat rotate vec3", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            vec<3> r = rotate(a[i % Table], v[i % Table]);
+            DoNotOptimize(r);
+        }
+    });
+    h.run("quat slerp", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            quat r = slerp(a[i % Table], b[i % Table], GLfloat(i % 16) / 16);
+            DoNotOptimize(r);
+        }
+    });
+    h.run("quat nlerp", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            quat r = nlerp(a[i % Table], b[i % Table], GLfloat(i % 16) / 16);
+            DoNotOptimize(r);
+        }
+    });
+
+    std::vector<mat<4>> out(Table);
+    h.run("mat4(quat), one at a time", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            for (size_t k = 0; k < Table; k++) out[k] = mat<4>(a[k]);
+            DoNotOptimize(out[i % Table]);
+        }
+    }, Table);
+    h.run("QuatToMat4 batch", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            QuatToMat4(a.data(), out.data(), Table);
+            DoNotOptimize(out[i % Table]);
+        }
+    }, Table);
+    h.run("DualQuatToMat4 batch", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            DualQuatToMat4(da.data(), out.data(), Table);
+            DoNotOptimize(out[i % Table]);
+        }
+    }, Table);
+    std::vector<quat> back(Table);
+    h.run("Mat4ToQuat batch", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            Mat4ToQuat(ma.data(), back.data(), Table);
+            DoNotOptimize(back[i % Table]);
+        }
+    }, Table);
+}
+
+// 64 roots x 32 groups x 64 leaves: 133K nodes, 3 levels
+void hierarchy(bench::Harness& h) {
+    typedef TransformGraph::Node Node;
+    TransformGraph graph;
+    std::vector<Node> roots, groups;
+    for (int r = 0; r < 64; r++) {
+        roots.push_back(graph.add(TransformGraph::None, Translate(GLfloat(r), 0, 0)));
+        for (int g = 0; g < 32; g++) {
+            groups.push_back(graph.add(roots.back(), RotateY(GLfloat(g))));
+            for (int l = 0; l < 64; l++)
+                graph.add(groups.back(), Translate(0, GLfloat(l), 0) * Scale(0.5, 0.5, 0.5));
+        }
+    }
+    graph.update();
+    const double nodes = double(graph.size());
+
+    h.run("hierarchy, every world recomputed", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            for (Node r : roots) graph.setLocal(r, RotateX(GLfloat(i % 90)));
+            DoNotOptimize(graph.update());
+        }
+    }, nodes);
+    h.run("hierarchy, 1% of groups moved", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            for (size_t g = i % 100; g < groups.size(); g += 100)
+                graph.setLocal(groups[g], RotateY(GLfloat(i % 90)));
+            DoNotOptimize(graph.update());
+        }
+    }, nodes);
+    h.run("hierarchy, nothing moved", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) DoNotOptimize(graph.update());
+    }, nodes);
+}
+
+// 128K objects scattered through a 400-unit cube, about 4% visible
+void culling(bench::Harness& h) {
+    const size_t count = 1 << 17;
+    Philox rng(17);
+    std::vector<AABB> boxes(count);
+    std::vector<Sphere> spheres(count);
+    for (size_t i = 0; i < count; i++) {
+        vec<3> c;
+        for (int k = 0; k < 3; k++) c[k] = (Philox::uniform(rng.word(i * 4 + k)) * 2 - 1) * 200;
+        GLfloat s = Philox::uniform(rng.word(i * 4 + 3)) * 2 + 0.1f;
+        boxes[i] = AABB(vec<3>(c - vec<3>(s)), vec<3>(c + vec<3>(s)));
+        spheres[i] = Sphere(c, s);
+    }
+    BoxSet boxSet(boxes.data(), count);
+    SphereSet sphereSet(spheres.data(), count);
+    BVH bvh(boxes.data(), count);
+
+    // the camera orbits, so every sample sees a different set
+    std::vector<ViewFrustum> views;
+    for (size_t i = 0; i < 16; i++) {
+        GLfloat a = GLfloat(i) * 22.5f * DegreesToRadians;
+        vec<4> eye(40 * std::cos(a), 10, 40 * std::sin(a), 1);
+        views.push_back(ViewFrustum(Perspective(60, 1.5, 0.5, 150) *
+                                    LookAt(eye, vec<4>(0, 0, 0, 1), vec<4>(0, 1, 0, 0))));
+    }
+
+    std::vector<uint32_t> visible;
+    h.run("cull 128K boxes, scalar", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            const ViewFrustum& f = views[i % views.size()];
+            visible.clear();
+            for (uint32_t k = 0; k < count; k++)
+                if (f.intersects(boxes[k])) visible.push_back(k);
+            DoNotOptimize(visible.size());
+        }
+    }, count);
+    h.run("cull 128K boxes, SIMD", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            Cull(views[i % views.size()], boxSet, visible);
+            DoNotOptimize(visible.size());
+        }
+    }, count);
+    h.run("cull 128K spheres, SIMD", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            Cull(views[i % views.size()], sphereSet, visible);
+            DoNotOptimize(visible.size());
+        }
+    }, count);
+    h.run("cull 128K boxes, BVH", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            bvh.cull(views[i % views.size()], visible);
+            DoNotOptimize(visible.size());
+        }
+    }, count);
+}
+
+// 256K vec<3> positions in [-1, 1]
+void vertex_formats(bench::Harness& h) {
+    const size_t count = 1 << 18;
+    Philox rng(15);
+    std::vector<vec<3>> points(count), decoded(count);
+    for (size_t i = 0; i < count; i++)
+        for (int k = 0; k < 3; k++) points[i][k] = Philox::uniform(rng.word(i * 3 + k)) * 2 - 1;
+    std::vector<uint32_t> packed(count * 2);
+
+    const struct { const char* pack; const char* unpack; VertexFormat f; } formats[] = {
+        {"pack 256K vec<3> to half", "unpack 256K vec<3> from half", VertexFormat::Half},
+        {"pack 256K vec<3> to snorm16", "unpack 256K vec<3> from snorm16", VertexFormat::Snorm16},
+        {"pack 256K vec<3> to 10_10_10_2", "unpack 256K vec<3> from 10_10_10_2",
+         VertexFormat::Snorm10_10_10_2},
+    };
+    for (const auto& fmt : formats) {
+        h.run(fmt.pack, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                PackVertices(fmt.f, points.data(), packed.data(), count);
+                DoNotOptimize(packed[i % packed.size()]);
+            }
+        }, count);
+        h.run(fmt.unpack, [&](size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                UnpackVertices(fmt.f, packed.data(), decoded.data(), count);
+                DoNotOptimize(decoded[i % count][0]);
+            }
+        }, count);
+    }
+}
+
+// 4M snorm16 points (24 MB) in 1M-point chunks, read three ways; the file
+// is in the page cache after the first sample, so this measures the
+// loading path rather than the disk
+void vertex_files(bench::Harness& h) {
+    const size_t count = 1 << 22;
+    std::error_code ec;
+    std::string path = (std::filesystem::temp_directory_path(ec) / "sand_bench.svx").string();
+    {
+        Philox rng(16);
+        VertexArray<3> points(count);
+        for (int k = 0; k < 3; k++)
+            for (size_t i = 0; i < count; i++)
+                points.component(k)[i] = Philox::uniform(rng.word(i * 3 + k)) * 2 - 1;
+        VertexFileWriter writer(path, {VertexAttribute("position", VertexFormat::Snorm16, 3)});
+        if (!writer.write(points) || !writer.close()) {
+            std::fprintf(stderr, "vertex files skipped: cannot write %s\n", path.c_str());
+            return;
+        }
+    }
+
+    // what a parser-free loader without mapping still does: copy everything
+    std::vector<char> copy;
+    h.run("vertex file 4M points, read into memory", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            std::ifstream in(path, std::ios::binary);
+            copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            DoNotOptimize(copy[copy.size() / 2]);
+        }
+    }, count);
+
+    // every chunk's span, touching each page as glBufferData would
+    h.run("vertex file 4M points, mapped", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            VertexFile file(path);
+            unsigned sum = 0;
+            for (size_t c = 0; c < file.chunkCount(); c++) {
+                FileSpan s = file.vertices(0, c);
+                for (size_t b = 0; b < s.bytes; b += 4096) sum += ((const unsigned char*)s.data)[b];
+            }
+            DoNotOptimize(sum);
+        }
+    }, count);
+    h.run("vertex file 4M points, streamed", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            VertexFileStream stream(path);
+            unsigned sum = 0;
+            while (stream.next()) {
+                FileSpan s = stream.vertices(0);
+                for (size_t b = 0; b < s.bytes; b += 4096) sum += ((const unsigned char*)s.data)[b];
+            }
+            DoNotOptimize(sum);
+        }
+    }, count);
+    std::filesystem::remove(path, ec);
+}
+
+// 2M points on a sphere of radius 10; the selection is timed for a camera
+// moving out from 15 to 400 units, where the points drawn fall from all of
+// them to a few percent
+void point_lod(bench::Harness& h) {
+    const size_t count = 1 << 21;
+    Philox rng(17);
+    VertexArray<3> points(count);
+    for (size_t i = 0; i < count; i++) {
+        GLfloat u = Philox::uniform(rng.word(i * 2)) * 2 - 1;
+        GLfloat t = Philox::uniform(rng.word(i * 2 + 1)) * 2 * GLfloat(M_PI);
+        GLfloat r = std::sqrt(1 - u * u) * 10;
+        points.set(i, vec<3>(r * std::cos(t), r * std::sin(t), u * 10));
+    }
+
+    PointLOD lod;
+    h.run("point LOD build 2M points", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            lod.build(points);
+            DoNotOptimize(lod.count(lod.maxLevel()));
+        }
+    }, count);
+
+    const mat<4> projection = Perspective(60, 16.0f / 9, 0.1f, 1000);
+    std::vector<mat<4>> views;
+    for (size_t i = 0; i < 16; i++) {
+        GLfloat d = 15 * std::pow(400.0f / 15, GLfloat(i) / 15);
+        views.push_back(LookAt(vec<4>(0, 2, d, 1), vec<4>(0, 0, 0, 1), vec<4>(0, 1, 0, 0)));
+    }
+    h.run("point LOD select, 1080p", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            lod.select(views[i % views.size()], projection, 1080);
+            DoNotOptimize(lod.stats().points);
+        }
+    });
+}
+
+// The SPSC ring on one thread, where it costs the least, and between two
+// threads, where the counters' cache lines move between cores
+void spsc_queue(bench::Harness& h) {
+    SpscQueue<uint64_t> q(1024);
+    h.run("spsc queue push + pop", [&](size_t n) {
+        uint64_t v = 0;
+        for (size_t i = 0; i < n; i++) {
+            q.push(i);
+            q.pop(v);
+        }
+        DoNotOptimize(v);
+    });
+}
+
+void spsc_transfer(bench::Harness& h) {
+    SpscQueue<uint64_t> q(1024);
+    h.run("spsc queue, producer thread to consumer", [&](size_t n) {
+        std::thread producer([&]() {
+            for (size_t i = 0; i < n; i++) {
+                while (!q.push(i)) std::this_thread::yield();
+            }
+        });
+        uint64_t v = 0, sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            while (!q.pop(v)) std::this_thread::yield();
+            sum += v;
+        }
+        producer.join();
+        DoNotOptimize(sum);
+    });
+}
+
+// GL entry points that only count
+class NullGL : public GLDispatch {
+public:
+    size_t calls = 0;
+    void useProgram(GLuint) override { calls++; }
+    void bindVertexArray(GLuint) override { calls++; }
+    void activeTexture(GLenum) override { calls++; }
+    void bindTexture(GLenum, GLuint) override { calls++; }
+    void bindBuffer(GLenum, GLuint) override { calls++; }
+    void enableVertexAttribArray(GLuint) override { calls++; }
+    void disableVertexAttribArray(GLuint) override { calls++; }
+    void vertexAttribPointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const GLvoid*) override { calls++; }
+    void uniform(GLint, UniformType, const void*) override { calls++; }
+    void drawArrays(GLenum, GLint, GLsizei) override { calls++; }
+    void drawElements(GLenum, GLsizei, GLenum, const GLvoid*) override { calls++; }
+};
+
+// A frame of 4K draws as an app without a command buffer would make them:
+// every draw binds its program, VAO and texture and sets its uniforms,
+// over 8 programs, 64 VAOs and 16 textures in random order.  The CPU cost
+// of recording and replaying, and the GL calls left.
+void command_buffer(bench::Harness& h) {
+    const size_t draws = 4096;
+    struct Draw {
+        GLuint program, vao, texture;
+        mat<4> model;
+    };
+    Philox rng(23);
+    std::vector<Draw> scene(draws);
+    for (size_t i = 0; i < draws; i++) {
+        uint32_t w = rng.word(i);
+        scene[i] = Draw{1 + (w & 7), 1 + (w >> 3 & 63), 1 + (w >> 9 & 15), Translate(GLfloat(i), 0, 0)};
+    }
+    const vec<4> color(1, 0.5f, 0.25f, 1);
+
+    CommandBuffer cb;
+    auto record = [&]() {
+        cb.clear();
+        for (const Draw& d : scene) {
+            cb.useProgram(d.program);
+            cb.bindVertexArray(d.vao);
+            cb.bindTexture(0, GL_TEXTURE_2D, d.texture);
+            cb.uniform(0, d.model);
+            cb.uniform(1, color);
+            cb.drawArrays(GL_TRIANGLES, 0, 36);
+        }
+    };
+    NullGL gl;
+
+    h.run("command buffer 4K draws, record", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            record();
+            DoNotOptimize(cb.bytes());
+        }
+    }, draws);
+    h.run("command buffer 4K draws, record + submit", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            record();
+            cb.submit(gl);
+        }
+    }, draws);
+    size_t unsorted = cb.stats().issued;
+    h.run("command buffer 4K draws, record + sort + submit", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            record();
+            cb.sort();
+            cb.submit(gl);
+        }
+    }, draws);
+    DoNotOptimize(gl.calls);
+    if (cb.stats().recorded == 0) return;     // filtered out
+    std::fprintf(stderr, "command buffer: %zu calls recorded, %zu issued in order, %zu sorted\n",
+                 cb.stats().recorded, unsorted, cb.stats().issued);
+}
+
+// What a SAND_PROFILE_SCOPE costs when profiling is compiled in: two clock
+// reads and a ring write (the ring wraps; frame() counts the overwritten)
+void profiler(bench::Harness& h) {
+    h.run("profile scope", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            ProfileScope scope("bench");
+            DoNotOptimize(scope.start());
+        }
+    });
+    GetProfiler().frame();
+}
+
+void chaos(bench::Harness& h) {
+    const std::vector<vec<2>> vertices = {vec<2>(-1, -1), vec<2>(0, 1), vec<2>(1, -1)};
+    ChaosGame<2> game(vertices, 0.5);
+    game.set_start(vec<2>(0.25, 0.5));
+
+    // one chunk on one thread, then enough chunks to occupy every core
+    VertexArray<2> small(ChaosGame<2>::chunk), large(ChaosGame<2>::chunk * 16);
+
+    h.run("chaos game 64K points, 1 thread", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            game.generate(small, 1);
+            DoNotOptimize(small.component(0)[small.size() - 1]);
+        }
+    }, small.size());
+    h.run("chaos game 1M points, all threads", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            game.generate(large);
+            DoNotOptimize(large.component(0)[large.size() - 1]);
+        }
+    }, large.size());
+
+    // the same gasket counted into a 512x512 density histogram
+    std::vector<AffineMap> maps;
+    for (const vec<2>& v : vertices)
+        maps.push_back({mat<3>(0.5, 0.0, v[0] / 2, 0.0, 0.5, v[1] / 2, 0.0, 0.0, 1.0)});
+    IfsDensity density(maps, 512, 512);
+    h.run("IFS density 1M iterations, all threads", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) density.run(IfsDensity::ChunkSize * 16);
+        DoNotOptimize(density.count(256, 256));
+    }, IfsDensity::ChunkSize * 16);
+}
+
+// Picking on 1M gasket points: builds, and queries from the mouse
+// positions of the example, next to the points or out in the holes
+void spatial_index(bench::Harness& h) {
+    const size_t count = size_t(1) << 20;
+    VertexArray<2> gasket(count);
+    ChaosGame<2> game({vec<2>(-1, -1), vec<2>(0, 1), vec<2>(1, -1)}, 0.5);
+    game.set_start(vec<2>(0.25, 0.5));
+    game.generate(gasket);
+    std::vector<vec<2>> points(count);
+    for (size_t i = 0; i < count; i++) points[i] = gasket[i];
+
+    Philox rng(25);
+    std::vector<vec<2>> near(256), anywhere(256);
+    for (size_t i = 0; i < near.size(); i++) {
+        near[i] = points[rng.word(3 * i) % count] + vec<2>(0.002f, -0.001f);
+        anywhere[i] = vec<2>(Philox::uniform(rng.word(3 * i + 1)) * 2 - 1,
+                             Philox::uniform(rng.word(3 * i + 2)) * 2 - 1);
+    }
+
+    PointGrid<2> grid;
+    KdTree<2> tree;
+    h.run("grid build 1M points", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            grid.build(points.data(), count);
+            DoNotOptimize(grid.cellCount());
+        }
+    }, count);
+    h.run("k-d tree build 1M points", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            tree.build(points.data(), count);
+            DoNotOptimize(tree.depth());
+        }
+    }, count);
+
+    std::vector<uint32_t> out;
+    h.run("grid nearest, near a point", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) DoNotOptimize(grid.nearest(near[i & 255]));
+    });
+    h.run("k-d tree nearest, near a point", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) DoNotOptimize(tree.nearest(near[i & 255]));
+    });
+    h.run("k-d tree nearest, anywhere", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) DoNotOptimize(tree.nearest(anywhere[i & 255]));
+    });
+    h.run("k-d tree 16 nearest, near a point", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            tree.nearest(near[i & 255], 16, out);
+            DoNotOptimize(out.data());
+        }
+    });
+    h.run("grid radius 8 px at 512x512", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            grid.radius(near[i & 255], 8.0f / 256, out);
+            DoNotOptimize(out.size());
+        }
+    });
+}
+
+void shader_loading(bench::Harness& h) {
+    ShaderSources& sources = GetShaderSources();
+    const char* files[2] = {"vshader21.glsl", "fshader21.glsl"};
+    for (const char* f : files) {
+        if (sources.get(f) == NULL) {
+            std::fprintf(stderr, "shader loading skipped: run from the repository root\n");
+            return;
+        }
+    }
+
+    h.run("shader source load (cold)", [&](size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            sources.invalidate(files[i & 1]);
+            DoNotOptimize(sources.get(files[i & 1])->size());
+        }
+    });
+    h.run("shader source load (memoized)", [&](size_t n) {
+        for (size_t i = 0; i < n; i++)
+            DoNotOptimize(sources.get(files[i & 1])->size());
+    });
+}
+
+}   // namespace
+
+int main(int argc, char** argv) {
+    bench::Harness h(argc, argv);
+
+    // the math paths must not touch the heap (checked by make alloccheck)
+    h.allocationFree(true);
+    vec_ops(h);
+    mat_ops(h);
+    mat_batches(h);
+    fast_math(h);
+    transforms(h);
+    rotations(h);
+    culling(h);
+    vertex_formats(h);
+    spsc_queue(h);
+    h.allocationFree(false);
+
+    hierarchy(h);   // threads allocate their start-up state
+    vertex_files(h);
+    point_lod(h);
+    command_buffer(h);
+    spsc_transfer(h);
+    profiler(h);
+    chaos(h);
+    spatial_index(h);
+    shader_loading(h);
+    return h.finish();
+}
@@ -0,0 +1,141 @@
+//
+//  Vertex files (vertex_file.h) written and read back: a point cloud cut
+//  into chunks and an indexed mesh go through VertexFileWriter, then
+//  VertexFile and VertexFileStream must return the same blocks.  Then the
+//  failure cases: indices past their vertices, refused by the writer and,
+//  patched into a file, by both readers; and a truncated file.  Prints
+//  each case and exits 1 if any fails.
+//
+//      make bench/vertex_file_check && ./bench/vertex_file_check
+//
+
+#include "vertex_file.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    std::printf("%-56s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+bool same(FileSpan s, const void* data, size_t bytes) {
+    return s.bytes == bytes && (bytes == 0 || std::memcmp(s.data, data, bytes) == 0);
+}
+
+std::vector<char> slurp(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void spill(const std::string& path, const std::vector<char>& bytes) {
+    std::ofstream(path, std::ios::binary).write(bytes.data(), std::streamsize(bytes.size()));
+}
+
+}   // namespace
+
+int main() {
+    const std::string dir = (std::filesystem::temp_directory_path() / "sand_vertex_file_check").string();
+    std::filesystem::create_directories(dir);
+    const std::string path = dir + "/mesh.svx";
+
+    // 10 points in chunks of 4, then a quad of 4 vertices and 6 indices
+    const size_t points = 10, quad = 4;
+    std::vector<GLfloat> pos(3 * (points + quad)), color(4 * (points + quad));
+    for (size_t i = 0; i < pos.size(); i++) pos[i] = GLfloat(i) * 0.25f - 3;
+    for (size_t i = 0; i < color.size(); i++) color[i] = GLfloat(i % 5) / 4;
+    const uint32_t quadIndices[6] = {0, 1, 2, 2, 3, 0};
+    const std::vector<VertexAttribute> attribs = {
+        VertexAttribute("position", VertexFormat::Float, 3),
+        VertexAttribute("color", VertexFormat::Unorm16, 4),
+    };
+
+    {
+        VertexFileWriter w(path, attribs, GL_TRIANGLES, 64);
+        const GLfloat* cloud[2] = {pos.data(), color.data()};
+        const GLfloat* mesh[2] = {pos.data() + 3 * points, color.data() + 4 * points};
+        bool ok = w.write(points, cloud, NULL, 0, 4) && w.write(quad, mesh, quadIndices, 6);
+        check(w.close() && ok, "writer: point chunks and an indexed chunk");
+    }
+
+    // what every reader must return
+    std::vector<uint16_t> packed(4 * (points + quad));
+    PackVertices(VertexFormat::Unorm16, 4, color.data(), packed.data(), points + quad);
+    const size_t firsts[5] = {0, 4, 8, 10, 14};
+    auto chunkOk = [&](size_t c, FileSpan p, FileSpan col, FileSpan idx) {
+        size_t first = firsts[c], n = firsts[c + 1] - first;
+        return same(p, &pos[3 * first], 3 * n * sizeof(GLfloat)) &&
+               same(col, &packed[4 * first], 4 * n * sizeof(uint16_t)) &&
+               (c == 3 ? same(idx, quadIndices, sizeof(quadIndices)) : idx.bytes == 0);
+    };
+
+    {
+        VertexFile f(path);
+        bool ok = f.isOpen() && f.chunkCount() == 4 && f.vertexCount() == points + quad &&
+                  f.indexCount() == 6 && f.primitive() == GL_TRIANGLES && f.find("color") == 1;
+        for (size_t c = 0; ok && c < 4; c++)
+            ok = f.chunk(c).firstVertex == firsts[c] &&
+                 chunkOk(c, f.vertices(0, c), f.vertices(1, c), f.indices(c));
+        check(ok, "VertexFile reads back what was written");
+    }
+    {
+        VertexFileStream s(path);
+        size_t c = 0;
+        bool ok = s.isOpen();
+        for (; ok && s.next(); c++) ok = chunkOk(c, s.vertices(0), s.vertices(1), s.indices());
+        check(ok && c == 4, "VertexFileStream reads back what was written");
+    }
+
+    {
+        const std::string bad = dir + "/bad.svx";
+        VertexFileWriter w(bad, attribs);
+        const uint32_t past[3] = {0, 1, uint32_t(quad)};
+        const GLfloat* mesh[2] = {pos.data(), color.data()};
+        bool wrote = w.write(quad, mesh, past, 3);
+        check(!wrote && !w.ok() && !w.close() && !std::filesystem::exists(bad),
+              "writer refuses an index past its vertices");
+    }
+
+    // the quad's last index patched to 4: the file opens, chunk 3's
+    // indices come back empty and the other chunks are untouched
+    std::vector<char> bytes = slurp(path);
+    auto at = std::search(bytes.begin(), bytes.end(), (const char*)quadIndices,
+                          (const char*)quadIndices + sizeof(quadIndices));
+    if (at == bytes.end()) {
+        check(false, "index block found in the file");
+    } else {
+        const uint32_t past = uint32_t(quad);
+        std::memcpy(&*at + 5 * sizeof(uint32_t), &past, sizeof(past));
+        const std::string corrupt = dir + "/corrupt.svx";
+        spill(corrupt, bytes);
+
+        VertexFile f(corrupt);
+        bool ok = f.isOpen() && f.indices(3).bytes == 0;
+        for (size_t c = 0; ok && c < 3; c++)
+            ok = chunkOk(c, f.vertices(0, c), f.vertices(1, c), f.indices(c));
+        check(ok, "VertexFile: empty indices for a corrupt chunk only");
+
+        VertexFileStream s(corrupt);
+        size_t c = 0;
+        ok = s.isOpen();
+        for (; ok && s.next(); c++)
+            ok = c == 3 ? s.indices().bytes == 0 : chunkOk(c, s.vertices(0), s.vertices(1), s.indices());
+        check(ok && c == 4, "VertexFileStream: empty indices for a corrupt chunk only");
+
+        bytes.resize(bytes.size() - 8);
+        spill(corrupt, bytes);
+        check(!VertexFile(corrupt).isOpen() && !VertexFileStream(corrupt).isOpen(),
+              "both readers refuse a truncated file");
+    }
+
+    std::filesystem::remove_all(dir);
+    if (failures) std::printf("%d check%s failed\n", failures, failures == 1 ? "" : "s");
+    return failures ? 1 : 0;
+}
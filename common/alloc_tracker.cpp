@@ -0,0 +1,102 @@
+#include "alloc_tracker.h"
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+
+namespace Sand {
+
+	// constant-initialized, so usable from operator new at any point in a
+	// thread's life
+	static thread_local AllocationCounts threadCounts;
+
+	AllocationCounts ThreadAllocations() { return threadCounts; }
+
+	AllocationCounts AllocationScope::counts() const {
+		AllocationCounts now = ThreadAllocations(), res;
+		res.allocations = now.allocations - start.allocations;
+		res.frees = now.frees - start.frees;
+		res.bytes = now.bytes - start.bytes;
+		return res;
+	}
+
+	AllocationScope::~AllocationScope() {
+		AllocationCounts c = counts();
+		if (fatal && c.allocations) {
+			std::cerr << name << ": " << c.allocations << " allocation(s) of "
+					  << c.bytes << " bytes in an allocation-free scope" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+
+}  // namespace Sand
+
+
+#ifdef SAND_TRACK_ALLOCATIONS
+
+static void* Allocate(std::size_t size, std::size_t align = 0) {
+	Sand::threadCounts.allocations++;
+	Sand::threadCounts.bytes += size;
+	if (size == 0) { size = 1; }
+
+	void* p;
+	if (align <= alignof(std::max_align_t)) {
+		p = std::malloc(size);
+	} else {
+#if defined(_WIN32)
+		p = _aligned_malloc(size, align);
+#else
+		p = std::aligned_alloc(align, (size + align - 1) / align * align);
+#endif
+	}
+	return p;
+}
+
+static void Free(void* p, std::size_t align = 0) {
+	if (p == NULL) { return; }
+	Sand::threadCounts.frees++;
+#if defined(_WIN32)
+	if (align > alignof(std::max_align_t)) {
+		_aligned_free(p);
+		return;
+	}
+#endif
+	(void)align;
+	std::free(p);
+}
+
+static void* AllocateOrThrow(std::size_t size, std::size_t align = 0) {
+	void* p = Allocate(size, align);
+	if (p == NULL) { throw std::bad_alloc(); }
+	return p;
+}
+
+void* operator new(std::size_t size) { return AllocateOrThrow(size); }
+void* operator new[](std::size_t size) { return AllocateOrThrow(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+
+void* operator new(std::size_t size, std::align_val_t a) { return AllocateOrThrow(size, std::size_t(a)); }
+void* operator new[](std::size_t size, std::align_val_t a) { return AllocateOrThrow(size, std::size_t(a)); }
+void* operator new(std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept {
+	return Allocate(size, std::size_t(a));
+}
+void* operator new[](std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept {
+	return Allocate(size, std::size_t(a));
+}
+
+void operator delete(void* p) noexcept { Free(p); }
+void operator delete[](void* p) noexcept { Free(p); }
+void operator delete(void* p, std::size_t) noexcept { Free(p); }
+void operator delete[](void* p, std::size_t) noexcept { Free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { Free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { Free(p); }
+
+void operator delete(void* p, std::align_val_t a) noexcept { Free(p, std::size_t(a)); }
+void operator delete[](void* p, std::align_val_t a) noexcept { Free(p, std::size_t(a)); }
+void operator delete(void* p, std::size_t, std::align_val_t a) noexcept { Free(p, std::size_t(a)); }
+void operator delete[](void* p, std::size_t, std::align_val_t a) noexcept { Free(p, std::size_t(a)); }
+void operator delete(void* p, std::align_val_t a, const std::nothrow_t&) noexcept { Free(p, std::size_t(a)); }
+void operator delete[](void* p, std::align_val_t a, const std::nothrow_t&) noexcept { Free(p, std::size_t(a)); }
+
+#endif // SAND_TRACK_ALLOCATIONS
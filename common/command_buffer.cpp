@@ -0,0 +1,587 @@
+#include "command_buffer.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+
+namespace Sand {
+
+	size_t UniformSize(UniformType t) {
+		switch (t) {
+			case UniformType::Int:
+			case UniformType::Float: return 1;
+			case UniformType::Vec2: return 2;
+			case UniformType::Vec3: return 3;
+			case UniformType::Vec4: return 4;
+			case UniformType::Mat3: return 9;
+			case UniformType::Mat4: return 16;
+		}
+		return 0;
+	}
+
+
+	//
+	//  --- Dispatch ---
+	//
+
+	class SystemGL : public GLDispatch {
+	public:
+		void useProgram(GLuint program) override { glUseProgram(program); }
+		void bindVertexArray(GLuint vao) override { glBindVertexArray(vao); }
+		void activeTexture(GLenum unit) override { glActiveTexture(unit); }
+		void bindTexture(GLenum target, GLuint texture) override { glBindTexture(target, texture); }
+		void bindBuffer(GLenum target, GLuint buffer) override { glBindBuffer(target, buffer); }
+		void enableVertexAttribArray(GLuint index) override { glEnableVertexAttribArray(index); }
+		void disableVertexAttribArray(GLuint index) override { glDisableVertexAttribArray(index); }
+
+		void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+								 GLsizei stride, const GLvoid* offset) override {
+			glVertexAttribPointer(index, size, type, normalized, stride, offset);
+		}
+
+		void uniform(GLint location, UniformType t, const void* value) override {
+			const GLfloat* f = (const GLfloat*)value;
+			switch (t) {
+				case UniformType::Int: glUniform1iv(location, 1, (const GLint*)value); break;
+				case UniformType::Float: glUniform1fv(location, 1, f); break;
+				case UniformType::Vec2: glUniform2fv(location, 1, f); break;
+				case UniformType::Vec3: glUniform3fv(location, 1, f); break;
+				case UniformType::Vec4: glUniform4fv(location, 1, f); break;
+				case UniformType::Mat3: glUniformMatrix3fv(location, 1, GL_TRUE, f); break;
+				case UniformType::Mat4: glUniformMatrix4fv(location, 1, GL_TRUE, f); break;
+			}
+		}
+
+		void drawArrays(GLenum mode, GLint first, GLsizei count) override { glDrawArrays(mode, first, count); }
+
+		void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* offset) override {
+			glDrawElements(mode, count, type, offset);
+		}
+	};
+
+	GLDispatch& GetGL() {
+		static SystemGL gl;
+		return gl;
+	}
+
+	static std::string Format(const char* fmt, ...) {
+		char line[512];
+		va_list args;
+		va_start(args, fmt);
+		vsnprintf(line, sizeof(line), fmt, args);
+		va_end(args);
+		return line;
+	}
+
+	size_t RecordingGL::count(const std::string& name) const {
+		return size_t(std::count_if(calls.begin(), calls.end(), [&](const std::string& c) {
+			return c.size() > name.size() && c.compare(0, name.size(), name) == 0 && c[name.size()] == '(';
+		}));
+	}
+
+	void RecordingGL::useProgram(GLuint program) {
+		calls.push_back(Format("glUseProgram(%u)", program));
+		if (forward) { forward->useProgram(program); }
+	}
+
+	void RecordingGL::bindVertexArray(GLuint vao) {
+		calls.push_back(Format("glBindVertexArray(%u)", vao));
+		if (forward) { forward->bindVertexArray(vao); }
+	}
+
+	void RecordingGL::activeTexture(GLenum unit) {
+		calls.push_back(Format("glActiveTexture(GL_TEXTURE%u)", unit - GL_TEXTURE0));
+		if (forward) { forward->activeTexture(unit); }
+	}
+
+	void RecordingGL::bindTexture(GLenum target, GLuint texture) {
+		calls.push_back(Format("glBindTexture(0x%04x, %u)", target, texture));
+		if (forward) { forward->bindTexture(target, texture); }
+	}
+
+	void RecordingGL::bindBuffer(GLenum target, GLuint buffer) {
+		calls.push_back(Format("glBindBuffer(0x%04x, %u)", target, buffer));
+		if (forward) { forward->bindBuffer(target, buffer); }
+	}
+
+	void RecordingGL::enableVertexAttribArray(GLuint index) {
+		calls.push_back(Format("glEnableVertexAttribArray(%u)", index));
+		if (forward) { forward->enableVertexAttribArray(index); }
+	}
+
+	void RecordingGL::disableVertexAttribArray(GLuint index) {
+		calls.push_back(Format("glDisableVertexAttribArray(%u)", index));
+		if (forward) { forward->disableVertexAttribArray(index); }
+	}
+
+	void RecordingGL::vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+										  GLsizei stride, const GLvoid* offset) {
+		calls.push_back(Format("glVertexAttribPointer(%u, %d, 0x%04x, %s, %d, %zu)", index, size, type,
+							   normalized ? "GL_TRUE" : "GL_FALSE", stride, size_t(offset)));
+		if (forward) { forward->vertexAttribPointer(index, size, type, normalized, stride, offset); }
+	}
+
+	void RecordingGL::uniform(GLint location, UniformType t, const void* value) {
+		static const char* const names[] = {
+			"glUniform1iv", "glUniform1fv", "glUniform2fv", "glUniform3fv", "glUniform4fv",
+			"glUniformMatrix3fv", "glUniformMatrix4fv"
+		};
+		std::string c = Format("%s(%d", names[int(t)], location);
+		for (size_t i = 0; i < UniformSize(t); i++) {
+			c += t == UniformType::Int ? Format(", %d", ((const GLint*)value)[i])
+									   : Format(", %g", ((const GLfloat*)value)[i]);
+		}
+		calls.push_back(c + ")");
+		if (forward) { forward->uniform(location, t, value); }
+	}
+
+	void RecordingGL::drawArrays(GLenum mode, GLint first, GLsizei count) {
+		calls.push_back(Format("glDrawArrays(0x%04x, %d, %d)", mode, first, count));
+		if (forward) { forward->drawArrays(mode, first, count); }
+	}
+
+	void RecordingGL::drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* offset) {
+		calls.push_back(Format("glDrawElements(0x%04x, %d, 0x%04x, %zu)", mode, count, type, size_t(offset)));
+		if (forward) { forward->drawElements(mode, count, type, offset); }
+	}
+
+
+	//
+	//  --- Commands ---
+	//
+
+	enum CommandType : uint32_t { DrawCommand, BufferCommand, EnableCommand, PointerCommand, BarrierCommand };
+
+	// The stored forms.  Each starts with its type and its length in words,
+	// and is read back with memcpy, so none needs aligned storage.
+
+	struct DrawCmd {
+		uint32_t header;
+		GLenum mode, indexType;         // indexType 0 for glDrawArrays
+		GLint first;
+		GLsizei count;
+		uint32_t program, vao, textureSet, uniformSet, pad;
+		uint64_t offset;
+	};
+
+	struct BufferCmd {
+		uint32_t header;
+		GLenum target;
+		GLuint buffer, vao;
+	};
+
+	struct EnableCmd {
+		uint32_t header;
+		GLuint index, vao, enable;
+	};
+
+	struct PointerCmd {
+		uint32_t header;
+		GLuint index, vao, buffer;
+		GLint size;
+		GLenum type;
+		GLsizei stride;
+		uint32_t normalized;
+		uint64_t offset;
+	};
+
+	struct BarrierCmd {
+		uint32_t header;
+	};
+
+	static_assert(sizeof(DrawCmd) == 48, "[CommandBuffer] : draw records are padded");
+
+	template<typename Cmd>
+	static constexpr uint32_t Header(CommandType type) {
+		return uint32_t(type) | uint32_t(sizeof(Cmd) / sizeof(uint32_t)) << 8;
+	}
+
+	static inline CommandType TypeOf(uint32_t header) { return CommandType(header & 0xff); }
+
+	template<typename Cmd>
+	void CommandBuffer::append(const Cmd& c) {
+		static_assert(sizeof(Cmd) % sizeof(uint32_t) == 0, "[CommandBuffer] : commands are whole words");
+		size_t at = words.size();
+		words.resize(at + sizeof(Cmd) / sizeof(uint32_t));
+		memcpy(&words[at], &c, sizeof(Cmd));
+		order.push_back(at);
+	}
+
+	template<typename Cmd>
+	Cmd CommandBuffer::read(size_t at) const {
+		Cmd c;
+		memcpy(&c, &words[at], sizeof(Cmd));
+		return c;
+	}
+
+	void CommandBuffer::clear() {
+		words.clear();
+		order.clear();
+		textureSets.clear();
+		textureHashes.clear();
+		uniformSets.clear();
+		uniformPool.clear();
+		textureSet = None;
+		for (ProgramState& p : programs) { p.set = None; }
+		st = Stats();
+	}
+
+
+	//
+	//  --- Recording ---
+	//
+
+	CommandBuffer::ProgramState& CommandBuffer::programState(std::vector<ProgramState>& list, GLuint program) {
+		for (ProgramState& p : list) {
+			if (p.program == program) { return p; }
+		}
+		list.push_back(ProgramState{program, {}, None});
+		return list.back();
+	}
+
+	void CommandBuffer::useProgram(GLuint p) {
+		st.recorded++;
+		program = p;
+	}
+
+	void CommandBuffer::bindVertexArray(GLuint v) {
+		st.recorded++;
+		vao = v;
+	}
+
+	void CommandBuffer::bindTexture(unsigned unit, GLenum target, GLuint texture) {
+		if (unit >= TextureUnits) {
+			std::cerr << "[CommandBuffer::bindTexture] : texture unit " << unit << " past "
+					  << TextureUnits - 1 << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		st.recorded++;
+		TextureBinding b;
+		b.target = target;
+		b.texture = texture;
+		if (textures[unit] != b) {
+			textures[unit] = b;
+			textureSet = None;
+		}
+	}
+
+	void CommandBuffer::setUniform(GLint location, UniformType t, const void* value) {
+		st.recorded++;
+		if (location < 0) { return; }      // GL ignores -1 too
+
+		UniformValue u;
+		u.location = location;
+		u.type = t;
+		memset(u.data, 0, sizeof(u.data));
+		memcpy(u.data, value, UniformSize(t) * sizeof(uint32_t));
+
+		ProgramState& p = programState(programs, program);
+		auto it = std::lower_bound(p.values.begin(), p.values.end(), location,
+								   [](const UniformValue& v, GLint l) { return v.location < l; });
+		if (it != p.values.end() && it->location == location) {
+			if (it->type == t && memcmp(it->data, u.data, sizeof(u.data)) == 0) { return; }
+			*it = u;
+		} else {
+			p.values.insert(it, u);
+		}
+		p.set = None;
+	}
+
+	void CommandBuffer::uniform(GLint location, GLint v) { setUniform(location, UniformType::Int, &v); }
+	void CommandBuffer::uniform(GLint location, GLfloat v) { setUniform(location, UniformType::Float, &v); }
+	void CommandBuffer::uniform(GLint location, GLdouble v) { uniform(location, GLfloat(v)); }
+
+	void CommandBuffer::uniform(GLint location, const vec<2>& v) {
+		setUniform(location, UniformType::Vec2, static_cast<const GLfloat*>(v));
+	}
+
+	void CommandBuffer::uniform(GLint location, const vec<3>& v) {
+		setUniform(location, UniformType::Vec3, static_cast<const GLfloat*>(v));
+	}
+
+	void CommandBuffer::uniform(GLint location, const vec<4>& v) {
+		setUniform(location, UniformType::Vec4, static_cast<const GLfloat*>(v));
+	}
+
+	void CommandBuffer::uniform(GLint location, const mat<3>& m) {
+		setUniform(location, UniformType::Mat3, static_cast<const GLfloat*>(m));
+	}
+
+	void CommandBuffer::uniform(GLint location, const mat<4>& m) {
+		setUniform(location, UniformType::Mat4, static_cast<const GLfloat*>(m));
+	}
+
+	void CommandBuffer::bindBuffer(GLenum target, GLuint buffer) {
+		st.recorded++;
+		if (target == GL_ARRAY_BUFFER) { arrayBuffer = buffer; }
+		append(BufferCmd{Header<BufferCmd>(BufferCommand), target, buffer, vao});
+	}
+
+	void CommandBuffer::enableVertexAttribArray(GLuint index) {
+		st.recorded++;
+		append(EnableCmd{Header<EnableCmd>(EnableCommand), index, vao, 1});
+	}
+
+	void CommandBuffer::disableVertexAttribArray(GLuint index) {
+		st.recorded++;
+		append(EnableCmd{Header<EnableCmd>(EnableCommand), index, vao, 0});
+	}
+
+	void CommandBuffer::vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+											GLsizei stride, const GLvoid* offset) {
+		st.recorded++;
+		append(PointerCmd{Header<PointerCmd>(PointerCommand), index, vao, arrayBuffer, size, type, stride,
+						  uint32_t(normalized), uint64_t(size_t(offset))});
+	}
+
+	void CommandBuffer::barrier() {
+		append(BarrierCmd{Header<BarrierCmd>(BarrierCommand)});
+	}
+
+	void CommandBuffer::draw(GLenum mode, GLint first, GLsizei count, GLenum indexType, const GLvoid* offset) {
+		st.recorded++;
+		st.draws++;
+
+		if (textureSet == None) {
+			if (!textureSets.empty() && textureSets.back() == textures) {
+				textureSet = uint32_t(textureSets.size() - 1);
+			} else {
+				textureSet = uint32_t(textureSets.size());
+				textureSets.push_back(textures);
+				// only groups equal sets for sort(): a cheap mix will do
+				uint64_t h = 0;
+				for (const TextureBinding& b : textures) {
+					if (b.target == 0) { continue; }
+					h = (h ^ (uint64_t(b.target) << 32 | b.texture)) * 0x9E3779B97F4A7C15ull;
+					h ^= h >> 29;
+				}
+				textureHashes.push_back(h);
+			}
+		}
+
+		uint32_t uniforms = None;
+		for (ProgramState& p : programs) {
+			if (p.program != program) { continue; }
+			if (p.set == None && !p.values.empty()) {
+				p.set = uint32_t(uniformSets.size());
+				uniformSets.push_back(UniformSet{uint32_t(uniformPool.size()), uint32_t(p.values.size())});
+				uniformPool.insert(uniformPool.end(), p.values.begin(), p.values.end());
+			}
+			uniforms = p.set;
+			break;
+		}
+
+		append(DrawCmd{Header<DrawCmd>(DrawCommand), mode, indexType, first, count,
+					   program, vao, textureSet, uniforms, 0, uint64_t(size_t(offset))});
+	}
+
+	void CommandBuffer::drawArrays(GLenum mode, GLint first, GLsizei count) {
+		draw(mode, first, count, 0, NULL);
+	}
+
+	void CommandBuffer::drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* offset) {
+		draw(mode, 0, count, type, offset);
+	}
+
+	void CommandBuffer::sort() {
+		for (size_t i = 0; i < order.size(); ) {
+			if (TypeOf(words[order[i]]) != DrawCommand) {
+				i++;
+				continue;
+			}
+			size_t begin = i;
+			sortItems.clear();
+			for (; i < order.size() && TypeOf(words[order[i]]) == DrawCommand; i++) {
+				DrawCmd d = read<DrawCmd>(order[i]);
+				sortItems.push_back(SortItem{d.program, d.vao, textureHashes[d.textureSet], d.uniformSet, order[i]});
+			}
+			// offsets grow in recorded order: a total order, so std::sort is
+			// stable here and needs no scratch memory
+			std::sort(sortItems.begin(), sortItems.end(), [](const SortItem& a, const SortItem& b) {
+				if (a.program != b.program) { return a.program < b.program; }
+				if (a.vao != b.vao) { return a.vao < b.vao; }
+				if (a.textures != b.textures) { return a.textures < b.textures; }
+				if (a.uniforms != b.uniforms) { return a.uniforms < b.uniforms; }
+				return a.at < b.at;
+			});
+			for (size_t k = 0; k < sortItems.size(); k++) { order[begin + k] = sortItems[k].at; }
+		}
+	}
+
+
+	//
+	//  --- Replay ---
+	//
+
+	void CommandBuffer::invalidate() {
+		glPrograms.clear();
+		glVaos.clear();
+	}
+
+	CommandBuffer::VaoState& CommandBuffer::vaoState(GLuint v) {
+		for (VaoState& s : glVaos) {
+			if (s.vao == v) { return s; }
+		}
+		glVaos.push_back(VaoState{v, None, {}});
+		return glVaos.back();
+	}
+
+	CommandBuffer::AttribState& CommandBuffer::attribState(VaoState& v, GLuint index) {
+		for (AttribState& a : v.attribs) {
+			if (a.index == index) { return a; }
+		}
+		v.attribs.emplace_back();
+		v.attribs.back().index = index;
+		return v.attribs.back();
+	}
+
+	void CommandBuffer::bindVao(GLDispatch& gl, GLuint v) {
+		if (glVao == v) { return; }
+		gl.bindVertexArray(v);
+		glVao = v;
+		st.issued++;
+	}
+
+	void CommandBuffer::bindBufferNow(GLDispatch& gl, GLenum target, GLuint buffer) {
+		auto it = std::find_if(glBuffers.begin(), glBuffers.end(),
+							   [&](const std::pair<GLenum, GLuint>& b) { return b.first == target; });
+		if (it != glBuffers.end() && it->second == buffer) { return; }
+		if (it == glBuffers.end()) {
+			glBuffers.emplace_back(target, buffer);
+		} else {
+			it->second = buffer;
+		}
+		gl.bindBuffer(target, buffer);
+		st.issued++;
+	}
+
+	void CommandBuffer::replaySetup(GLDispatch& gl, size_t at) {
+		switch (TypeOf(words[at])) {
+			case BufferCommand: {
+				BufferCmd c = read<BufferCmd>(at);
+				if (c.target != GL_ELEMENT_ARRAY_BUFFER) {
+					bindBufferNow(gl, c.target, c.buffer);
+					break;
+				}
+				// part of the VAO
+				VaoState& v = vaoState(c.vao);
+				if (v.elementBuffer == c.buffer) { break; }
+				bindVao(gl, c.vao);
+				gl.bindBuffer(c.target, c.buffer);
+				v.elementBuffer = c.buffer;
+				st.issued++;
+				break;
+			}
+			case EnableCommand: {
+				EnableCmd c = read<EnableCmd>(at);
+				AttribState& a = attribState(vaoState(c.vao), c.index);
+				if (a.enabled == int(c.enable)) { break; }
+				bindVao(gl, c.vao);
+				if (c.enable) {
+					gl.enableVertexAttribArray(c.index);
+				} else {
+					gl.disableVertexAttribArray(c.index);
+				}
+				a.enabled = int(c.enable);
+				st.issued++;
+				break;
+			}
+			case PointerCommand: {
+				PointerCmd c = read<PointerCmd>(at);
+				AttribState& a = attribState(vaoState(c.vao), c.index);
+				const GLvoid* offset = (const GLvoid*)size_t(c.offset);
+				if (a.pointerKnown && a.buffer == c.buffer && a.size == c.size && a.type == c.type &&
+					a.normalized == GLboolean(c.normalized) && a.stride == c.stride && a.offset == offset) {
+					break;
+				}
+				bindVao(gl, c.vao);
+				bindBufferNow(gl, GL_ARRAY_BUFFER, c.buffer);
+				gl.vertexAttribPointer(c.index, c.size, c.type, GLboolean(c.normalized), c.stride, offset);
+				a.pointerKnown = true;
+				a.buffer = c.buffer;
+				a.size = c.size;
+				a.type = c.type;
+				a.normalized = GLboolean(c.normalized);
+				a.stride = c.stride;
+				a.offset = offset;
+				st.issued++;
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	void CommandBuffer::replayDraw(GLDispatch& gl, size_t at) {
+		DrawCmd d = read<DrawCmd>(at);
+
+		if (glProgram != d.program) {
+			gl.useProgram(d.program);
+			glProgram = d.program;
+			st.issued++;
+		}
+		bindVao(gl, d.vao);
+
+		const TextureSet& set = textureSets[d.textureSet];
+		for (unsigned unit = 0; unit < TextureUnits; unit++) {
+			if (set[unit].target == 0 || glTextures[unit] == set[unit]) { continue; }
+			if (glUnit != unit) {
+				gl.activeTexture(GL_TEXTURE0 + unit);
+				glUnit = unit;
+				st.issued++;
+			}
+			gl.bindTexture(set[unit].target, set[unit].texture);
+			glTextures[unit] = set[unit];
+			st.issued++;
+		}
+
+		if (d.uniformSet != None) {
+			const UniformSet& u = uniformSets[d.uniformSet];
+			ProgramState& p = programState(glPrograms, d.program);
+			auto known = p.values.begin();
+			for (uint32_t k = u.first; k < u.first + u.count; k++) {
+				const UniformValue& v = uniformPool[k];
+				// both lists are sorted by location
+				known = std::lower_bound(known, p.values.end(), v.location,
+										 [](const UniformValue& a, GLint l) { return a.location < l; });
+				if (known != p.values.end() && known->location == v.location) {
+					if (known->type == v.type && memcmp(known->data, v.data, sizeof(v.data)) == 0) { continue; }
+					*known = v;
+				} else {
+					known = p.values.insert(known, v);
+				}
+				gl.uniform(v.location, v.type, v.data);
+				st.issued++;
+			}
+		}
+
+		if (d.indexType == 0) {
+			gl.drawArrays(d.mode, d.first, d.count);
+		} else {
+			gl.drawElements(d.mode, d.count, d.indexType, (const GLvoid*)size_t(d.offset));
+		}
+		st.issued++;
+	}
+
+	void CommandBuffer::submit(GLDispatch& gl) {
+		// bindings may have changed since the last submit
+		glProgram = glVao = glUnit = None;
+		glTextures = TextureSet();
+		glBuffers.clear();
+		st.issued = 0;
+
+		for (size_t at : order) {
+			if (TypeOf(words[at]) == DrawCommand) {
+				replayDraw(gl, at);
+			} else {
+				replaySetup(gl, at);
+			}
+		}
+	}
+
+	std::ostream& operator << (std::ostream& os, const CommandBuffer::Stats& s) {
+		return os << s.recorded << " calls recorded (" << s.draws << " draws), " << s.issued
+				  << " issued, " << s.elided() << " elided";
+	}
+
+}  // namespace Sand
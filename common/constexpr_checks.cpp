@@ -0,0 +1,90 @@
+#include "sand.h"
+
+
+//
+//  Compile-time checks of the constexpr vec/mat API: every value below is
+//  a constexpr variable or static_assert operand, so a function that
+//  stops being evaluable at compile time breaks the build of every
+//  target rather than quietly moving to run time.
+//
+
+namespace Sand {
+
+	namespace {
+
+		constexpr bool Near(GLfloat a, GLfloat b, GLfloat tol = 1e-6f) {
+			return a - b <= tol && b - a <= tol;
+		}
+
+		template<int N>
+		constexpr bool Near(const vec<N>& u, const vec<N>& v, GLfloat tol = 1e-6f) {
+			for (int i = 0; i < N; i++)
+				if (!Near(u[i], v[i], tol)) return false;
+			return true;
+		}
+
+		template<int N>
+		constexpr bool Near(const mat<N>& a, const mat<N>& b, GLfloat tol = 1e-6f) {
+			for (int i = 0; i < N; i++)
+				if (!Near(a[i], b[i], tol)) return false;
+			return true;
+		}
+
+		// ct:: math
+		static_assert(ct::sqrt(4.0f) == 2.0f);
+		static_assert(ct::sqrt(0.0f) == 0.0f);
+		static_assert(Near(ct::sqrt(2.0f), 1.41421356f));
+		static_assert(Near(ct::sin(0.0f), 0.0f));
+		static_assert(Near(ct::sin(GLfloat(M_PI / 6)), 0.5f));
+		static_assert(Near(ct::sin(GLfloat(-M_PI / 2)), -1.0f));
+		static_assert(Near(ct::cos(GLfloat(M_PI / 3)), 0.5f));
+		static_assert(Near(ct::cos(GLfloat(M_PI)), -1.0f));
+		static_assert(Near(ct::cos(GLfloat(7 * M_PI)), -1.0f, 1e-5f));     // range reduction
+		static_assert(Near(ct::tan(GLfloat(M_PI / 4)), 1.0f));
+
+		// vec
+		constexpr vec<3> X(1, 0, 0), Y(0, 1, 0), Z(0, 0, 1);
+		static_assert(Near(vec<3>(X + Y * 2 - Z), vec<3>(1, 2, -1)));
+		static_assert(dot(vec<3>(1, 2, 3), vec<3>(4, 5, 6)) == 32);
+		static_assert(length(vec<4>(1, 2, 2, 4)) == 5);
+		static_assert(Near(normalize(vec<2>(3, 4)), vec<2>(0.6f, 0.8f)));
+		static_assert(Near(cross(X, Y), Z));
+		static_assert(Near(cross(vec<4>(Y, 0), vec<4>(Z, 0)), X));
+
+		// mat
+		constexpr mat<4> I;
+		constexpr mat<3> A(1, 2, 3, 4, 5, 6, 7, 8, 10);
+		static_assert(I.at(2, 2) == 1 && I.at(2, 3) == 0);
+		static_assert(Near(A * mat<3>(), A));
+		static_assert(Near(A * vec<3>(1, 0, -1), vec<3>(-2, -2, -3)));
+		static_assert(Near(transpose(A)[0], vec<3>(1, 4, 7)));
+		static_assert(Near(determinant(A), -3.0f, 1e-5f));
+		static_assert(Near(A * inverse(A), mat<3>(), 1e-5f));
+
+		// transforms
+		static_assert(Near(RotateX(90) * vec<4>(0, 1, 0, 1), vec<4>(0, 0, 1, 1)));
+		static_assert(Near(RotateY(90) * vec<4>(0, 0, 1, 1), vec<4>(1, 0, 0, 1)));
+		static_assert(Near(RotateZ(90) * vec<4>(1, 0, 0, 1), vec<4>(0, 1, 0, 1)));
+		static_assert(Near(RotateZ(30) * RotateZ(60), RotateZ(90)));
+		static_assert(Near(Translate(1, 2, 3) * vec<4>(1, 1, 1, 1), vec<4>(2, 3, 4, 1)));
+		static_assert(Near(Translate(vec<3>(1, 2, 3)), Translate(1, 2, 3)));
+		static_assert(Near(Scale(2, 3, 4) * vec<4>(1, 1, 1, 1), vec<4>(2, 3, 4, 1)));
+
+		// projections: the near corners land on the NDC cube's faces
+		constexpr mat<4> O = Ortho(-2, 2, -1, 1, 1, 3);
+		static_assert(Near(O * vec<4>(2, 1, -1, 1), vec<4>(1, 1, -1, 1)));
+		static_assert(Near(O * vec<4>(-2, -1, -3, 1), vec<4>(-1, -1, 1, 1)));
+		static_assert(Near(Ortho2D(0, 4, 0, 2) * vec<4>(2, 1, 0, 1), vec<4>(0, 0, 0, 1)));
+		constexpr mat<4> F = Frustum(-1, 1, -1, 1, 1, 10);
+		static_assert(Near(F * vec<4>(1, 1, -1, 1), vec<4>(1, 1, -1, 1)));
+		static_assert(Near(F * vec<4>(0, 0, -10, 1), vec<4>(0, 0, 10, 10), 1e-5f));
+		static_assert(Near(Perspective(90, 1, 1, 10), F, 1e-6f));
+
+		// the camera at +z looking at the origin is a plain translation
+		constexpr mat<4> V = LookAt(vec<4>(0, 0, 5, 1), vec<4>(0, 0, 0, 1), vec<4>(0, 1, 0, 0));
+		static_assert(Near(V, Translate(0, 0, -5)));
+		static_assert(Near(V * vec<4>(1, 2, 0, 1), vec<4>(1, 2, -5, 1)));
+
+	}   // namespace
+
+}  // namespace Sand
@@ -0,0 +1,75 @@
+#include "cpu_features.h"
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+
+namespace Sand {
+
+	Isa DetectIsa() {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(SAND_NO_SIMD)
+		// checks the OS saves the wider registers, too
+		static const Isa isa = []() {
+			__builtin_cpu_init();
+			if (!__builtin_cpu_supports("sse4.1")) { return Isa::Baseline; }
+			if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma")) { return Isa::SSE41; }
+			if (!__builtin_cpu_supports("avx512f")) { return Isa::AVX2; }
+			return Isa::AVX512;
+		}();
+		return isa;
+#else
+		return Isa::Baseline;
+#endif
+	}
+
+	static const int Unset = -1;
+	static std::atomic<int> active(Unset);
+
+	Isa ActiveIsa() {
+		int isa = active.load(std::memory_order_relaxed);
+		if (isa != Unset) { return Isa(isa); }
+
+		Isa chosen = DetectIsa();
+		if (const char* env = std::getenv("SAND_ISA")) {
+			Isa wanted;
+			if (!ParseIsa(env, wanted)) {
+				std::cerr << "SAND_ISA: unknown instruction set " << env << std::endl;
+			} else if (wanted > chosen) {
+				std::cerr << "SAND_ISA: this CPU has no " << IsaName(wanted) << ", using "
+						  << IsaName(chosen) << std::endl;
+			} else {
+				chosen = wanted;
+			}
+		}
+		// a racing first call picks the same
+		active.store(int(chosen), std::memory_order_relaxed);
+		return chosen;
+	}
+
+	bool ForceIsa(Isa isa) {
+		if (isa > DetectIsa()) { return false; }
+		active.store(int(isa), std::memory_order_relaxed);
+		return true;
+	}
+
+	void ResetIsa() {
+		active.store(int(DetectIsa()), std::memory_order_relaxed);
+	}
+
+	static const char* const IsaNames[] = {"baseline", "sse4.1", "avx2", "avx512"};
+
+	const char* IsaName(Isa isa) {
+		return IsaNames[int(isa)];
+	}
+
+	bool ParseIsa(const std::string& name, Isa& isa) {
+		for (int i = 0; i <= int(Isa::AVX512); i++) {
+			if (name == IsaNames[i]) {
+				isa = Isa(i);
+				return true;
+			}
+		}
+		return false;
+	}
+
+}  // namespace Sand
@@ -0,0 +1,347 @@
+#include "culling.h"
+#include "profiler.h"
+#include "simd.h"
+#include <limits>
+
+
+namespace Sand {
+
+	//
+	//  --- ViewFrustum ---
+	//
+
+	// Gribb & Hartmann: with clip = M p, -w <= x <= w gives the planes
+	// row3 + row0 and row3 - row0, and likewise for y and z
+	ViewFrustum::ViewFrustum(const mat<4>& m) {
+		planes[Left]   = vec<4>(m[3] + m[0]);
+		planes[Right]  = vec<4>(m[3] - m[0]);
+		planes[Bottom] = vec<4>(m[3] + m[1]);
+		planes[Top]    = vec<4>(m[3] - m[1]);
+		planes[Near]   = vec<4>(m[3] + m[2]);
+		planes[Far]    = vec<4>(m[3] - m[2]);
+
+		for (vec<4>& p : planes) {
+			GLfloat len = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+			if (len > DivideByZeroTolerance) { p = vec<4>(p * (1 / len)); }
+		}
+	}
+
+	bool ViewFrustum::contains(const vec<3>& p) const {
+		for (int i = 0; i < 6; i++) {
+			if (distance(i, p) < 0) { return false; }
+		}
+		return true;
+	}
+
+	bool ViewFrustum::intersects(const AABB& box) const {
+		vec<3> c = box.center(), e = box.extent();
+		for (int i = 0; i < 6; i++) {
+			const vec<4>& q = planes[i];
+			GLfloat r = std::fabs(q[0]) * e[0] + std::fabs(q[1]) * e[1] + std::fabs(q[2]) * e[2];
+			if (distance(i, c) + r < 0) { return false; }
+		}
+		return true;
+	}
+
+	bool ViewFrustum::intersects(const Sphere& sphere) const {
+		for (int i = 0; i < 6; i++) {
+			if (distance(i, sphere.center) + sphere.radius < 0) { return false; }
+		}
+		return true;
+	}
+
+
+	//
+	//  --- BoxSet, SphereSet ---
+	//
+
+	void BoxSet::assign(const AABB* boxes, size_t n) {
+		count = n;
+		blocks.assign((n + Lanes - 1) / Lanes, Block());
+		for (size_t i = 0; i < n; i++) { set(i, boxes[i]); }
+	}
+
+	void BoxSet::set(size_t i, const AABB& box) {
+		Block& b = blocks[i / Lanes];
+		size_t k = i % Lanes;
+		vec<3> c = box.center(), e = box.extent();
+		b.cx[k] = c[0]; b.cy[k] = c[1]; b.cz[k] = c[2];
+		b.ex[k] = e[0]; b.ey[k] = e[1]; b.ez[k] = e[2];
+	}
+
+	void SphereSet::assign(const Sphere* spheres, size_t n) {
+		count = n;
+		blocks.assign((n + Lanes - 1) / Lanes, Block());
+		for (size_t i = 0; i < n; i++) { set(i, spheres[i]); }
+	}
+
+	void SphereSet::set(size_t i, const Sphere& sphere) {
+		Block& b = blocks[i / Lanes];
+		size_t k = i % Lanes;
+		b.cx[k] = sphere.center[0]; b.cy[k] = sphere.center[1]; b.cz[k] = sphere.center[2];
+		b.r[k] = sphere.radius;
+	}
+
+
+	//
+	//  --- Batched tests ---
+	//
+	//  An object is outside when, for some plane, distance + radius < 0 (the
+	//  box radius along a normal n being |n| . extent).  The minimum over
+	//  the six planes goes negative exactly then, so its sign bits are the
+	//  culled lanes.
+	//
+
+	// Plane coefficients broadcast once per call (ax, ay, az: |normal|)
+	struct Planes4 {
+		simd::f32x4 nx[6], ny[6], nz[6], d[6], ax[6], ay[6], az[6];
+	};
+
+	static void Broadcast(const ViewFrustum& f, Planes4& p) {
+		for (int i = 0; i < 6; i++) {
+			const vec<4>& q = f.planes[i];
+			p.nx[i] = simd::splat(q[0]); p.ny[i] = simd::splat(q[1]);
+			p.nz[i] = simd::splat(q[2]); p.d[i] = simd::splat(q[3]);
+			p.ax[i] = simd::splat(std::fabs(q[0])); p.ay[i] = simd::splat(std::fabs(q[1]));
+			p.az[i] = simd::splat(std::fabs(q[2]));
+		}
+	}
+
+	static inline simd::f32x4 Dist4(const Planes4& p, int i,
+									const float* cx, const float* cy, const float* cz) {
+		using namespace simd;
+		f32x4 x = mul(p.nx[i], load(cx)), y = mul(p.ny[i], load(cy)), z = mul(p.nz[i], load(cz));
+		return add(add(x, y), add(z, p.d[i]));
+	}
+
+#if defined(SAND_SIMD_AVX)
+	struct Planes8 {
+		__m256 nx[6], ny[6], nz[6], d[6], ax[6], ay[6], az[6];
+	};
+
+	static void Broadcast(const ViewFrustum& f, Planes8& p) {
+		for (int i = 0; i < 6; i++) {
+			const vec<4>& q = f.planes[i];
+			p.nx[i] = _mm256_set1_ps(q[0]); p.ny[i] = _mm256_set1_ps(q[1]);
+			p.nz[i] = _mm256_set1_ps(q[2]); p.d[i] = _mm256_set1_ps(q[3]);
+			p.ax[i] = _mm256_set1_ps(std::fabs(q[0])); p.ay[i] = _mm256_set1_ps(std::fabs(q[1]));
+			p.az[i] = _mm256_set1_ps(std::fabs(q[2]));
+		}
+	}
+
+	static inline __m256 Dist8(const Planes8& p, int i,
+							   const float* cx, const float* cy, const float* cz) {
+		__m256 x = _mm256_mul_ps(p.nx[i], _mm256_load_ps(cx));
+		__m256 y = _mm256_mul_ps(p.ny[i], _mm256_load_ps(cy));
+		__m256 z = _mm256_mul_ps(p.nz[i], _mm256_load_ps(cz));
+		return _mm256_add_ps(_mm256_add_ps(x, y), _mm256_add_ps(z, p.d[i]));
+	}
+#endif
+
+	// lanes [0, count) of a block; bit i set when lane i is visible
+	static inline unsigned ValidLanes(size_t count, size_t block) {
+		size_t left = count - block * BoxSet::Lanes;
+		return left >= BoxSet::Lanes ? 0xFFu : (1u << left) - 1;
+	}
+
+	static inline void Emit(unsigned bits, uint32_t base, std::vector<uint32_t>& visible) {
+		for (uint32_t i = 0; bits; i++, bits >>= 1) {
+			if (bits & 1) { visible.push_back(base + i); }
+		}
+	}
+
+	void Cull(const ViewFrustum& f, const BoxSet& set, std::vector<uint32_t>& visible) {
+		visible.clear();
+		visible.reserve(set.count);
+
+#if defined(SAND_SIMD_AVX)
+		Planes8 p;
+		Broadcast(f, p);
+		for (size_t b = 0; b < set.blocks.size(); b++) {
+			const BoxSet::Block& k = set.blocks[b];
+			__m256 ex = _mm256_load_ps(k.ex), ey = _mm256_load_ps(k.ey), ez = _mm256_load_ps(k.ez);
+			__m256 m = _mm256_set1_ps(std::numeric_limits<float>::max());
+			for (int i = 0; i < 6; i++) {
+				__m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p.ax[i], ex), _mm256_mul_ps(p.ay[i], ey)),
+										 _mm256_mul_ps(p.az[i], ez));
+				m = _mm256_min_ps(m, _mm256_add_ps(Dist8(p, i, k.cx, k.cy, k.cz), r));
+			}
+			unsigned outside = unsigned(_mm256_movemask_ps(m));
+			Emit(~outside & ValidLanes(set.count, b), uint32_t(b * BoxSet::Lanes), visible);
+		}
+#else
+		using namespace simd;
+		Planes4 p;
+		Broadcast(f, p);
+		for (size_t b = 0; b < set.blocks.size(); b++) {
+			const BoxSet::Block& k = set.blocks[b];
+			unsigned outside = 0;
+			for (int h = 0; h < BoxSet::Lanes; h += 4) {
+				f32x4 ex = load(k.ex + h), ey = load(k.ey + h), ez = load(k.ez + h);
+				f32x4 m = splat(std::numeric_limits<float>::max());
+				for (int i = 0; i < 6; i++) {
+					f32x4 r = add(add(mul(p.ax[i], ex), mul(p.ay[i], ey)), mul(p.az[i], ez));
+					m = min(m, add(Dist4(p, i, k.cx + h, k.cy + h, k.cz + h), r));
+				}
+				outside |= unsigned(signbits(m)) << h;
+			}
+			Emit(~outside & ValidLanes(set.count, b), uint32_t(b * BoxSet::Lanes), visible);
+		}
+#endif
+	}
+
+	void Cull(const ViewFrustum& f, const SphereSet& set, std::vector<uint32_t>& visible) {
+		visible.clear();
+		visible.reserve(set.count);
+
+#if defined(SAND_SIMD_AVX)
+		Planes8 p;
+		Broadcast(f, p);
+		for (size_t b = 0; b < set.blocks.size(); b++) {
+			const SphereSet::Block& k = set.blocks[b];
+			__m256 r = _mm256_load_ps(k.r);
+			__m256 m = Dist8(p, 0, k.cx, k.cy, k.cz);
+			for (int i = 1; i < 6; i++) { m = _mm256_min_ps(m, Dist8(p, i, k.cx, k.cy, k.cz)); }
+			unsigned outside = unsigned(_mm256_movemask_ps(_mm256_add_ps(m, r)));
+			Emit(~outside & ValidLanes(set.count, b), uint32_t(b * SphereSet::Lanes), visible);
+		}
+#else
+		using namespace simd;
+		Planes4 p;
+		Broadcast(f, p);
+		for (size_t b = 0; b < set.blocks.size(); b++) {
+			const SphereSet::Block& k = set.blocks[b];
+			unsigned outside = 0;
+			for (int h = 0; h < SphereSet::Lanes; h += 4) {
+				f32x4 m = Dist4(p, 0, k.cx + h, k.cy + h, k.cz + h);
+				for (int i = 1; i < 6; i++) { m = min(m, Dist4(p, i, k.cx + h, k.cy + h, k.cz + h)); }
+				outside |= unsigned(signbits(add(m, load(k.r + h)))) << h;
+			}
+			Emit(~outside & ValidLanes(set.count, b), uint32_t(b * SphereSet::Lanes), visible);
+		}
+#endif
+	}
+
+
+	//
+	//  --- BVH ---
+	//
+
+	void BVH::build(const AABB* boxes, size_t count) {
+		indices.resize(count);
+		std::iota(indices.begin(), indices.end(), 0u);
+		centers.resize(count);
+		for (size_t i = 0; i < count; i++) { centers[i] = boxes[i].center(); }
+
+		nodes.clear();
+		nodes.reserve(2 * count / LeafSize + 1);
+		if (count) { split(boxes, 0, uint32_t(count)); }
+
+		// object data in tree order, so leaves read it sequentially
+		std::vector<vec<3>> c(count);
+		extents.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			c[i] = centers[indices[i]];
+			extents[i] = boxes[indices[i]].extent();
+		}
+		centers = std::move(c);
+	}
+
+	uint32_t BVH::split(const AABB* boxes, uint32_t first, uint32_t count) {
+		uint32_t node = uint32_t(nodes.size());
+		nodes.push_back(Node());
+
+		const GLfloat inf = std::numeric_limits<GLfloat>::infinity();
+		vec<3> lo(inf), hi(-inf), clo(inf), chi(-inf);
+		for (uint32_t i = first; i < first + count; i++) {
+			const AABB& b = boxes[indices[i]];
+			const vec<3>& c = centers[indices[i]];
+			for (int k = 0; k < 3; k++) {
+				lo[k] = std::min(lo[k], b.lo[k]);
+				hi[k] = std::max(hi[k], b.hi[k]);
+				clo[k] = std::min(clo[k], c[k]);
+				chi[k] = std::max(chi[k], c[k]);
+			}
+		}
+
+		Node n;
+		n.center = vec<3>((lo + hi) * 0.5);
+		n.extent = vec<3>((hi - lo) * 0.5);
+		n.first = first;
+		n.count = count;
+		n.right = 0;
+
+		if (count > LeafSize) {
+			int axis = 0;
+			for (int k = 1; k < 3; k++) {
+				if (chi[k] - clo[k] > chi[axis] - clo[axis]) { axis = k; }
+			}
+
+			uint32_t half = count / 2;
+			std::nth_element(indices.begin() + first, indices.begin() + first + half,
+							 indices.begin() + first + count,
+							 [&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+			split(boxes, first, half);
+			n.right = split(boxes, first + half, count - half);
+		}
+		nodes[node] = n;
+		return node;
+	}
+
+	void BVH::cull(const ViewFrustum& f, std::vector<uint32_t>& visible) {
+		SAND_PROFILE_SCOPE("BVH::cull");
+		visible.clear();
+		st = Stats();
+		if (nodes.empty()) { return; }
+
+		GLfloat absNormal[6][3];
+		for (int i = 0; i < 6; i++) {
+			for (int k = 0; k < 3; k++) { absNormal[i][k] = std::fabs(f.planes[i][k]); }
+		}
+
+		// 0: outside, 1: intersecting the planes still in mask, 2: inside all
+		auto classify = [&](const vec<3>& c, const vec<3>& e, unsigned& mask) {
+			for (int i = 0; i < 6; i++) {
+				if (!(mask & (1u << i))) { continue; }
+				GLfloat d = f.distance(i, c);
+				GLfloat r = absNormal[i][0] * e[0] + absNormal[i][1] * e[1] + absNormal[i][2] * e[2];
+				if (d + r < 0) { return 0; }
+				if (d - r >= 0) { mask &= ~(1u << i); }
+			}
+			return mask ? 1 : 2;
+		};
+
+		// pending second children; median splits keep the depth below 64
+		struct Pending { uint32_t node; unsigned mask; };
+		Pending stack[64];
+		int top = 0;
+
+		uint32_t i = 0;
+		unsigned mask = 0x3F;
+		for (;;) {
+			st.nodesVisited++;
+			const Node& n = nodes[i];
+			int side = classify(n.center, n.extent, mask);
+
+			if (side == 2) {
+				visible.insert(visible.end(), indices.begin() + n.first, indices.begin() + n.first + n.count);
+			} else if (side == 1 && n.right == 0) {
+				for (uint32_t k = n.first; k < n.first + n.count; k++) {
+					unsigned m = mask;
+					st.objectsTested++;
+					if (classify(centers[k], extents[k], m)) { visible.push_back(indices[k]); }
+				}
+			} else if (side == 1) {
+				stack[top++] = {n.right, mask};
+				i++;
+				continue;
+			}
+
+			if (top == 0) { break; }
+			top--;
+			i = stack[top].node;
+			mask = stack[top].mask;
+		}
+	}
+
+}  // namespace Sand
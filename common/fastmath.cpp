@@ -0,0 +1,105 @@
+#include "fastmath.h"
+
+
+namespace Sand {
+namespace fastmath {
+
+	static_assert(sizeof(vec<3>) == 3 * sizeof(GLfloat), "[Normalize] : vec<3> is padded");
+
+	// Four vectors a step, their squared lengths gathered into one register
+	// so one rsqrt (or sqrt) serves all four.  The exact tier divides by
+	// the length and sums x^2 + y^2 + z^2 (+ w^2) in dot4's order, so it
+	// matches Sand::normalize bit for bit.
+	template<Accuracy A>
+	static simd::f32x4 Scale(simd::f32x4 len2) {
+		return A == Accuracy::Exact ? simd::sqrt(len2) : rsqrt<A>(len2);
+	}
+
+	template<Accuracy A>
+	static simd::f32x4 Apply(simd::f32x4 v, simd::f32x4 scale) {
+		return A == Accuracy::Exact ? simd::div(v, scale) : simd::mul(v, scale);
+	}
+
+	// 12 floats in three registers: x, y, z gathered by two-register
+	// shuffles, and the four scales spread back over the same layout
+	template<Accuracy A>
+	static void NormalizeBatch(const vec<3>* in, vec<3>* out, size_t count) {
+		using namespace simd;
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			const GLfloat* p = in[i];
+			f32x4 a = load(p), b = load(p + 4), c = load(p + 8);
+			f32x4 x = shuffle<0, 3, 0, 2>(a, shuffle<2, 2, 1, 1>(b, c));     // a0 a3 b2 c1
+			f32x4 y = shuffle<0, 2, 0, 2>(shuffle<1, 1, 0, 0>(a, b), shuffle<3, 3, 2, 2>(b, c));
+			f32x4 z = shuffle<0, 2, 0, 2>(shuffle<2, 2, 1, 1>(a, b), shuffle<0, 0, 3, 3>(c, c));
+			f32x4 d = Scale<A>(add(add(mul(x, x), mul(y, y)), mul(z, z)));
+
+			GLfloat* q = out[i];
+			store(q, Apply<A>(a, swizzle<0, 0, 0, 1>(d)));
+			store(q + 4, Apply<A>(b, swizzle<1, 1, 2, 2>(d)));
+			store(q + 8, Apply<A>(c, swizzle<2, 3, 3, 3>(d)));
+		}
+		for (; i < count; i++) { out[i] = normalize<A>(in[i]); }
+	}
+
+	template<Accuracy A>
+	static void NormalizeBatch(const vec<4>* in, vec<4>* out, size_t count) {
+		using namespace simd;
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			f32x4 v[4];
+			for (int k = 0; k < 4; k++) { v[k] = load(in[i + k]); }
+			f32x4 x = mul(v[0], v[0]), y = mul(v[1], v[1]), z = mul(v[2], v[2]), w = mul(v[3], v[3]);
+			transpose(x, y, z, w);
+			f32x4 d = Scale<A>(add(add(x, y), add(z, w)));
+
+			store(out[i], Apply<A>(v[0], swizzle<0, 0, 0, 0>(d)));
+			store(out[i + 1], Apply<A>(v[1], swizzle<1, 1, 1, 1>(d)));
+			store(out[i + 2], Apply<A>(v[2], swizzle<2, 2, 2, 2>(d)));
+			store(out[i + 3], Apply<A>(v[3], swizzle<3, 3, 3, 3>(d)));
+		}
+		for (; i < count; i++) { out[i] = normalize<A>(in[i]); }
+	}
+
+	template<Accuracy A>
+	static void SinCosBatch(const GLfloat* x, GLfloat* s, GLfloat* c, size_t count) {
+		using namespace simd;
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			f32x4 vs, vc;
+			sincos<A>(load(x + i), vs, vc);
+			store(s + i, vs);
+			store(c + i, vc);
+		}
+		for (; i < count; i++) { sincos<A>(x[i], s[i], c[i]); }
+	}
+
+	// The vec<3> batch is bound by its shuffles, not the divide: the
+	// Newton step made Fast no faster than Exact, and at times slower, so
+	// Fast runs the exact kernel, well inside its error bound.
+	void Normalize(const vec<3>* in, vec<3>* out, size_t count, Accuracy a) {
+		switch (a) {
+			case Accuracy::Exact:
+			case Accuracy::Fast: NormalizeBatch<Accuracy::Exact>(in, out, count); break;
+			case Accuracy::Fastest: NormalizeBatch<Accuracy::Fastest>(in, out, count); break;
+		}
+	}
+
+	void Normalize(const vec<4>* in, vec<4>* out, size_t count, Accuracy a) {
+		switch (a) {
+			case Accuracy::Exact: NormalizeBatch<Accuracy::Exact>(in, out, count); break;
+			case Accuracy::Fast: NormalizeBatch<Accuracy::Fast>(in, out, count); break;
+			case Accuracy::Fastest: NormalizeBatch<Accuracy::Fastest>(in, out, count); break;
+		}
+	}
+
+	void SinCos(const GLfloat* x, GLfloat* s, GLfloat* c, size_t count, Accuracy a) {
+		switch (a) {
+			case Accuracy::Exact: SinCosBatch<Accuracy::Exact>(x, s, c, count); break;
+			case Accuracy::Fast: SinCosBatch<Accuracy::Fast>(x, s, c, count); break;
+			case Accuracy::Fastest: SinCosBatch<Accuracy::Fastest>(x, s, c, count); break;
+		}
+	}
+
+}  // namespace fastmath
+}  // namespace Sand
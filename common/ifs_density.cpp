@@ -0,0 +1,178 @@
+#include "ifs_density.h"
+#include "softraster.h"
+#include "parallel.h"
+#include <chrono>
+#include <cstring>
+
+
+namespace Sand {
+
+	// Points one run() counts before merging, so a thread's uint32_t tile
+	// counts cannot wrap however hot a pixel is
+	static const uint64_t MergeBatch = (uint64_t(1) << 32) - IfsDensity::ChunkSize;
+
+	IfsDensity::IfsDensity(const std::vector<AffineMap>& maps, int width, int height,
+			const vec<2>& lo, const vec<2>& hi, uint64_t seed)
+		: w(width), h(height),
+		  tilesX((width + TileSize - 1) / TileSize),
+		  tilesY((height + TileSize - 1) / TileSize),
+		  lo(lo), scale(width / (hi[0] - lo[0]), height / (hi[1] - lo[1])),
+		  rng(seed), start(seed ^ 0x9E3779B97F4A7C15ull),
+		  hist(size_t(width) * height, 0) {
+		if (maps.empty()) {
+			std::cerr << "[IfsDensity] : no maps" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+
+		double total = 0;
+		for (const AffineMap& map : maps) {
+			const mat<3>& m = map.m;
+			affine.push_back({m.at(0, 0), m.at(0, 1), m.at(0, 2), m.at(1, 0), m.at(1, 1), m.at(1, 2)});
+			total += std::max(map.weight, GLfloat(0.0));
+		}
+		if (total <= 0) {
+			std::cerr << "[IfsDensity] : weights must not all be zero" << std::endl;
+			exit(EXIT_FAILURE);
+		}
+
+		// cumulative weights on the 2^32 scale of a Philox word; the last
+		// map takes whatever rounding leaves over
+		double sum = 0;
+		for (size_t k = 0; k + 1 < maps.size(); k++) {
+			sum += std::max(maps[k].weight, GLfloat(0.0));
+			thresholds.push_back(uint32_t(std::min(sum / total * 4294967296.0, 4294967295.0)));
+		}
+	}
+
+	void IfsDensity::clear() {
+		std::fill(hist.begin(), hist.end(), 0);
+		done = 0;
+	}
+
+	// Iterations [begin, end) of the chunk holding begin, counted into own
+	uint64_t IfsDensity::runChunk(std::vector<Tile>& own, uint64_t begin, uint64_t end) const {
+		const size_t nmaps = affine.size();
+		const GLfloat lx = lo[0], ly = lo[1], sx = scale[0], sy = scale[1];
+		const GLfloat fw = GLfloat(w), fh = GLfloat(h);
+
+		// start anywhere in the window; Warmup steps carry the point
+		// onto the attractor
+		uint64_t c = begin / ChunkSize;
+		Philox::block s = start(c * 16);
+		GLfloat x = lx + Philox::uniform(s[0]) * (fw / sx);
+		GLfloat y = ly + Philox::uniform(s[1]) * (fh / sy);
+
+		auto step = [&](uint32_t r) {
+			size_t k = 0;
+			while (k + 1 < nmaps && r >= thresholds[k]) { k++; }
+			const std::array<GLfloat, 6>& a = affine[k];
+			GLfloat nx = a[0] * x + a[1] * y + a[2];
+			y = a[3] * x + a[4] * y + a[5];
+			x = nx;
+		};
+
+		for (int i = 0; i < Warmup; i += 4) {
+			s = start(c * 16 + 1 + i / 4);
+			for (int j = 0; j < 4; j++) { step(s[j]); }
+		}
+
+		uint64_t plotted = 0;
+		Philox::block r = rng(c * (ChunkSize / 4));
+		for (uint64_t i = c * ChunkSize; i < end; i++) {
+			if ((i & 3) == 0) { r = rng(i >> 2); }
+			step(r[i & 3]);
+			if (i < begin) { continue; }
+
+			GLfloat fx = (x - lx) * sx, fy = (y - ly) * sy;
+			if (!(fx >= 0 && fx < fw && fy >= 0 && fy < fh)) { continue; }     // NaN lands here too
+			int px = int(fx), py = int(fy);
+			Tile& tile = own[size_t(py / TileSize) * tilesX + px / TileSize];
+			if (!tile) { tile.reset(new uint32_t[TileSize * TileSize]()); }
+			tile[(py % TileSize) * TileSize + px % TileSize]++;
+			plotted++;
+		}
+		return plotted;
+	}
+
+	// Each tile is summed by one thread over every thread's copy, then the
+	// copies are zeroed for the next batch
+	void IfsDensity::merge(unsigned threads) {
+		ParallelFor(size_t(tilesX) * tilesY, threads, [&](size_t t, unsigned) {
+			int x0 = int(t % tilesX) * TileSize, y0 = int(t / tilesX) * TileSize;
+			int x1 = std::min(x0 + TileSize, w), y1 = std::min(y0 + TileSize, h);
+			for (std::vector<Tile>& own : tiles) {
+				if (!own[t]) { continue; }
+				const uint32_t* src = own[t].get();
+				for (int y = y0; y < y1; y++) {
+					uint64_t* dst = &hist[size_t(y) * w];
+					const uint32_t* row = src + (y - y0) * TileSize;
+					for (int x = x0; x < x1; x++) { dst[x] += row[x - x0]; }
+				}
+				std::memset(own[t].get(), 0, TileSize * TileSize * sizeof(uint32_t));
+			}
+		});
+	}
+
+	void IfsDensity::run(uint64_t count, unsigned threads) {
+		typedef std::chrono::steady_clock Clock;
+		auto t0 = Clock::now();
+
+		threads = ThreadCount(threads);
+		if (tiles.size() < threads) { tiles.resize(threads); }
+		for (std::vector<Tile>& own : tiles) { own.resize(size_t(tilesX) * tilesY); }
+		std::vector<uint64_t> plotted(threads, 0);
+
+		for (uint64_t left = count; left > 0; ) {
+			uint64_t first = done, last = done + std::min(left, MergeBatch);
+			uint64_t c0 = first / ChunkSize, c1 = (last - 1) / ChunkSize + 1;
+
+			ParallelFor(c1 - c0, threads, [&](size_t i, unsigned thread) {
+				uint64_t c = c0 + i;
+				plotted[thread] += runChunk(tiles[thread], std::max(first, c * ChunkSize),
+											std::min(last, (c + 1) * ChunkSize));
+			});
+
+			auto m0 = Clock::now();
+			merge(threads);
+			st.mergeSeconds += std::chrono::duration<double>(Clock::now() - m0).count();
+
+			left -= last - first;
+			done = last;
+		}
+
+		st.iterations += count;
+		for (uint64_t p : plotted) { st.plotted += p; }
+		st.seconds += std::chrono::duration<double>(Clock::now() - t0).count();
+	}
+
+	uint64_t IfsDensity::maxCount() const {
+		return hist.empty() ? 0 : *std::max_element(hist.begin(), hist.end());
+	}
+
+	std::vector<uint32_t> IfsDensity::toneMap(const vec<4>& background, const vec<4>& color,
+			GLfloat gamma) const {
+		std::vector<uint32_t> out(hist.size(), SoftRaster::pack(background));
+		uint64_t peak = maxCount();
+		if (peak == 0) { return out; }
+
+		const double norm = 1.0 / std::log1p(double(peak));
+		const double invGamma = 1.0 / gamma;
+		for (size_t i = 0; i < hist.size(); i++) {
+			if (hist[i] == 0) { continue; }
+			GLfloat t = GLfloat(std::pow(std::log1p(double(hist[i])) * norm, invGamma));
+			out[i] = SoftRaster::pack(background + (color - background) * t);
+		}
+		return out;
+	}
+
+	bool IfsDensity::writePPM(const std::string& file, const vec<4>& background,
+			const vec<4>& color, GLfloat gamma) const {
+		return WritePPM(file, w, h, toneMap(background, color, gamma));
+	}
+
+	bool IfsDensity::writePNG(const std::string& file, const vec<4>& background,
+			const vec<4>& color, GLfloat gamma) const {
+		return WritePNG(file, w, h, toneMap(background, color, gamma));
+	}
+
+}  // namespace Sand
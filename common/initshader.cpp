@@ -1,45 +1,197 @@
 #include "sand.h"
+#include "profiler.h"
+#include "shader_source.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 
 
 namespace Sand {
 
-	static GLchar* ReadShaderSource(const std::string& shaderFile) {
+	//
+	//  --- Program binary cache ---
+	//
+	//  <dir>/<key>.bin holds a header and the glGetProgramBinary blob.  The
+	//  key hashes both sources with the driver strings, so a driver update
+	//  misses instead of feeding the driver a binary it may not accept.  A
+	//  binary the driver rejects anyway is recompiled and overwritten.
+	//
 
-		std::ifstream fin(shaderFile);
-		if (!fin.is_open()) { return NULL; }
-		fin.seekg(0, fin.end);
-		long length = fin.tellg();
-		fin.seekg(0, fin.beg);
-		
-		GLchar* buf = new GLchar[length+1];
-		fin.read(buf, length);
-		buf[length] = 0;
-		fin.close();
+	struct ProgramBinaryHeader {
+		char magic[8];
+		uint64_t key;
+		uint32_t format, length;
+	};
 
-		return buf;
+	static const char ProgramBinaryMagic[8] = {'S', 'A', 'N', 'D', 'P', 'G', 'M', '1'};
+
+	static ShaderCacheStats cacheStats;
+	static std::string cacheDir = getenv("SAND_SHADER_CACHE") ? getenv("SAND_SHADER_CACHE") : ".shadercache";
+
+	void SetShaderCacheDir(const std::string& dir) { cacheDir = dir; }
+
+	const ShaderCacheStats& GetShaderCacheStats() { return cacheStats; }
+
+	std::ostream& operator << (std::ostream& os, const ShaderCacheStats& s) {
+		return os << "shader cache: " << s.hits << " hits, " << s.misses << " misses ("
+				  << s.rejected << " rejected), " << s.loadSeconds * 1e3 << " ms loading, "
+				  << s.compileSeconds * 1e3 << " ms compiling";
 	}
 
-	// Create a GLSL program object from vertex and fragment shader files
-	GLuint InitShader(const std::string& vShaderFile, const std::string& fShaderFile) {
-		struct Shader {
-			const std::string filename;
-			GLenum type;
-			GLchar *source;
-		} shaders[2] = {
-			{vShaderFile, GL_VERTEX_SHADER, NULL},
-			{fShaderFile, GL_FRAGMENT_SHADER, NULL}};
+	// FNV-1a, including the terminator so adjacent strings cannot run together
+	static uint64_t Hash(const char* str, uint64_t h = 14695981039346656037ull) {
+		do {
+			h = (h ^ uint8_t(*str)) * 1099511628211ull;
+		} while (*str++);
+		return h;
+	}
+
+	static uint64_t ProgramKey(const GLchar* vSource, const GLchar* fSource) {
+		uint64_t h = Hash(fSource, Hash(vSource));
+		const GLenum driver[] = {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION};
+		for (GLenum name : driver) {
+			const GLubyte* str = glGetString(name);
+			h = Hash(str ? (const char*)str : "", h);
+		}
+		return h;
+	}
+
+	// Path of the cache entry, or "" when caching is off or unsupported
+	static std::string CachePath(uint64_t key) {
+		if (cacheDir.empty()) return "";
+
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		if (formats <= 0) return "";
+
+		char name[24];
+		snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+		return cacheDir + "/" + name;
+	}
+
+	// true if program was linked from the cached binary at path
+	static bool LoadProgramBinary(GLuint program, const std::string& path, uint64_t key) {
+		std::ifstream fin(path, std::ios::binary);
+		if (!fin.is_open()) { return false; }
+
+		// the blob must fill the rest of the file exactly, so a truncated
+		// or corrupt length never sizes the buffer
+		fin.seekg(0, std::ios::end);
+		std::streamoff size = fin.tellg();
+		fin.seekg(0, std::ios::beg);
+
+		ProgramBinaryHeader header;
+		if (!fin.read((char*)&header, sizeof(header)) ||
+			memcmp(header.magic, ProgramBinaryMagic, sizeof(header.magic)) != 0 ||
+			header.key != key || std::streamoff(header.length) != size - std::streamoff(sizeof(header))) {
+			cacheStats.rejected++;
+			return false;
+		}
+
+		std::vector<char> binary(header.length);
+		if (!fin.read(binary.data(), header.length)) {
+			cacheStats.rejected++;
+			return false;
+		}
+
+		glProgramBinary(program, header.format, binary.data(), header.length);
+
+		GLint linked;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (!linked) {
+			// an unknown format raises GL_INVALID_ENUM; clear it so the
+			// compile that follows does not look like it failed
+			while (glGetError() != GL_NO_ERROR) {}
+			cacheStats.rejected++;
+		}
+		return linked;
+	}
+
+	// Writes the linked program's binary to path; failures only cost a miss later
+	static void StoreProgramBinary(GLuint program, const std::string& path, uint64_t key) {
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) { return; }
+
+		ProgramBinaryHeader header;
+		memcpy(header.magic, ProgramBinaryMagic, sizeof(header.magic));
+		header.key = key;
+
+		std::vector<char> binary(length);
+		GLenum format;
+		glGetProgramBinary(program, length, NULL, &format, binary.data());
+		header.format = format;
+		header.length = uint32_t(length);
+
+		std::error_code ec;
+		std::filesystem::create_directories(cacheDir, ec);
+
+		// write aside and rename, so a concurrent reader never sees half a file
+		std::string tmp = path + ".tmp";
+		std::ofstream fout(tmp, std::ios::binary);
+		fout.write((const char*)&header, sizeof(header));
+		fout.write(binary.data(), length);
+		fout.close();
+		if (fout) {
+			std::filesystem::rename(tmp, path, ec);
+		} else {
+			std::filesystem::remove(tmp, ec);
+		}
+	}
+
+	void PrintInfoLog(GLuint object) {
+		GLchar log[4096];   // on the stack: longer logs are cut
+		GLsizei length = 0;
+		if (glIsProgram(object)) {
+			glGetProgramInfoLog(object, sizeof(log), &length, log);
+		} else {
+			glGetShaderInfoLog(object, sizeof(log), &length, log);
+		}
+		std::cerr.write(log, length) << std::endl;
+	}
+
+	struct ShaderStage {
+		const std::string name;     // file, for messages
+		GLenum type;
+		const GLchar *source;
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Compiles, links and uses a program from vertex and fragment sources,
+	// through the binary cache if `cached`
+	static GLuint BuildProgram(const ShaderStage (&shaders)[2], bool cached, Clock::time_point start) {
+		uint64_t key = 0;
+		std::string cachePath;
+		if (cached) {
+			key = ProgramKey(shaders[0].source, shaders[1].source);
+			cachePath = CachePath(key);
+		}
 
 		GLuint program = glCreateProgram();
 
-		for (int i = 0; i < 2; ++i) {
-			Shader &s = shaders[i];
-			s.source = ReadShaderSource(s.filename);
-			if (shaders[i].source == NULL) {
-				std::cerr << "Failed to read " << s.filename << std::endl;
-				exit(EXIT_FAILURE);
+		if (!cachePath.empty()) {
+			if (LoadProgramBinary(program, cachePath, key)) {
+				cacheStats.hits++;
+				cacheStats.loadSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+				glUseProgram(program);
+				return program;
 			}
 
+			// start over on a clean program object after a rejected binary
+			glDeleteProgram(program);
+			program = glCreateProgram();
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+		cacheStats.misses++;
+
+		for (int i = 0; i < 2; ++i) {
+			const ShaderStage &s = shaders[i];
 			GLuint shader = glCreateShader(s.type);
 			glShaderSource(shader, 1, (const GLchar **)&s.source, NULL);
 			glCompileShader(shader);
@@ -47,20 +199,12 @@ namespace Sand {
 			GLint compiled;
 			glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
 			if (!compiled) {
-				std::cerr << s.filename << " failed to compile:" << std::endl;
-				GLint logSize;
-				glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logSize);
-				char *logMsg = new char[logSize];
-				glGetShaderInfoLog(shader, logSize, NULL, logMsg);
-				glGetShaderInfoLog(shader, logSize, NULL, logMsg);
-				std::cerr << logMsg << std::endl;
-				delete[] logMsg;
+				std::cerr << s.name << " failed to compile:" << std::endl;
+				PrintInfoLog(shader);
 
 				exit(EXIT_FAILURE);
 			}
 
-			delete[] s.source;
-
 			glAttachShader(program, shader);
 		}
 
@@ -71,20 +215,52 @@ namespace Sand {
 		glGetProgramiv(program, GL_LINK_STATUS, &linked);
 		if (!linked) {
 			std::cerr << "Shader program failed to link" << std::endl;
-			GLint logSize;
-			glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logSize);
-			char *logMsg = new char[logSize];
-			glGetProgramInfoLog(program, logSize, NULL, logMsg);
-			std::cerr << logMsg << std::endl;
-			delete[] logMsg;
+			PrintInfoLog(program);
 
 			exit(EXIT_FAILURE);
 		}
 
+		if (!cachePath.empty()) {
+			StoreProgramBinary(program, cachePath, key);
+		}
+		cacheStats.compileSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+
 		/* use program object */
 		glUseProgram(program);
 
 		return program;
 	}
 
+	// Create a GLSL program object from vertex and fragment shader files
+	GLuint InitShader(const std::string& vShaderFile, const std::string& fShaderFile) {
+		SAND_PROFILE_SCOPE("InitShader");
+		ShaderStage shaders[2] = {
+			{vShaderFile, GL_VERTEX_SHADER, NULL},
+			{fShaderFile, GL_FRAGMENT_SHADER, NULL}};
+
+		auto start = Clock::now();
+
+		for (int i = 0; i < 2; ++i) {
+			ShaderStage &s = shaders[i];
+			const std::string* text = GetShaderSources().get(s.name);
+			if (text == NULL) {
+				exit(EXIT_FAILURE);
+			}
+			s.source = text->c_str();
+		}
+
+		return BuildProgram(shaders, true, start);
+	}
+
+	// ... and from sources compiled in, without the binary cache, so that
+	// nothing reads or writes a file
+	GLuint InitShader(const EmbeddedShader& vShader, const EmbeddedShader& fShader) {
+		SAND_PROFILE_SCOPE("InitShader");
+		const ShaderStage shaders[2] = {
+			{vShader.name, GL_VERTEX_SHADER, vShader.source},
+			{fShader.name, GL_FRAGMENT_SHADER, fShader.source}};
+
+		return BuildProgram(shaders, false, Clock::now());
+	}
+
 }  // namespace Sand
@@ -0,0 +1,370 @@
+#include "mat_batch.h"
+#include "simd.h"
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(SAND_NO_SIMD)
+#   define SAND_DISPATCH_X86
+#   define SAND_KERNEL static inline __attribute__((always_inline))
+#   include <immintrin.h>
+#else
+#   define SAND_KERNEL static inline
+#endif
+
+
+namespace Sand {
+
+	static_assert(sizeof(mat<4>) == 16 * sizeof(GLfloat), "[MulMat4] : mat<4> is padded");
+	static_assert(sizeof(vec<4>) == 4 * sizeof(GLfloat), "[TransformVec4] : vec<4> is padded");
+	static_assert(sizeof(vec<3>) == 3 * sizeof(GLfloat), "[TransformPoints] : vec<3> is padded");
+
+	struct Mat4Kernels {
+		void (*mulShared)(const float* a, const float* b, float* out, size_t count);
+		void (*mulEach)(const float* a, const float* b, float* out, size_t count);
+		void (*transformShared)(const float* m, const float* in, float* out, size_t count);
+		void (*transformEach)(const float* m, const float* in, float* out, size_t count);
+		void (*transformPoints)(const float* m, const float* in, float* out, size_t count);
+	};
+
+	// Column k of row-major m, for products as sums of scaled columns
+	static inline void Columns(const float* m, float* cols) {
+		for (int k = 0; k < 4; k++) {
+			for (int r = 0; r < 4; r++) { cols[4 * k + r] = m[4 * r + k]; }
+		}
+	}
+
+
+	//
+	//  --- Baseline: simd.h ---
+	//
+	//  With SAND_DISPATCH_X86 the bodies are always inlined so the SSE4.1
+	//  entries below compile them again for that target.
+	//
+
+	SAND_KERNEL void MulSharedGeneric(const float* a, const float* b, float* out, size_t count) {
+		for (size_t i = 0; i < count; i++) { simd::mat4_mul(a, b + 16 * i, out + 16 * i); }
+	}
+
+	SAND_KERNEL void MulEachGeneric(const float* a, const float* b, float* out, size_t count) {
+		for (size_t i = 0; i < count; i++) { simd::mat4_mul(a + 16 * i, b + 16 * i, out + 16 * i); }
+	}
+
+	SAND_KERNEL void TransformSharedGeneric(const float* m, const float* in, float* out, size_t count) {
+		using namespace simd;
+		float cols[16];
+		Columns(m, cols);
+		f32x4 c0 = load(cols), c1 = load(cols + 4), c2 = load(cols + 8), c3 = load(cols + 12);
+		for (size_t i = 0; i < count; i++) {
+			f32x4 v = load(in + 4 * i);
+			f32x4 r = mul(c0, swizzle<0, 0, 0, 0>(v));
+			r = add(r, mul(c1, swizzle<1, 1, 1, 1>(v)));
+			r = add(r, mul(c2, swizzle<2, 2, 2, 2>(v)));
+			r = add(r, mul(c3, swizzle<3, 3, 3, 3>(v)));
+			store(out + 4 * i, r);
+		}
+	}
+
+	SAND_KERNEL void TransformEachGeneric(const float* m, const float* in, float* out, size_t count) {
+		for (size_t i = 0; i < count; i++) { simd::mat4_mul_vec(m + 16 * i, in + 4 * i, out + 4 * i); }
+	}
+
+	SAND_KERNEL void TransformPointsGeneric(const float* m, const float* in, float* out, size_t count) {
+		using namespace simd;
+		float cols[16];
+		Columns(m, cols);
+		f32x4 c0 = load(cols), c1 = load(cols + 4), c2 = load(cols + 8), c3 = load(cols + 12);
+		for (size_t i = 0; i < count; i++) {
+			const float* p = in + 3 * i;
+			f32x4 r = add(mul(c0, splat(p[0])), c3);
+			r = add(r, mul(c1, splat(p[1])));
+			r = add(r, mul(c2, splat(p[2])));
+			store(out + 4 * i, r);
+		}
+	}
+
+	static void MulSharedBase(const float* a, const float* b, float* out, size_t count) {
+		MulSharedGeneric(a, b, out, count);
+	}
+	static void MulEachBase(const float* a, const float* b, float* out, size_t count) {
+		MulEachGeneric(a, b, out, count);
+	}
+	static void TransformSharedBase(const float* m, const float* in, float* out, size_t count) {
+		TransformSharedGeneric(m, in, out, count);
+	}
+	static void TransformEachBase(const float* m, const float* in, float* out, size_t count) {
+		TransformEachGeneric(m, in, out, count);
+	}
+	static void TransformPointsBase(const float* m, const float* in, float* out, size_t count) {
+		TransformPointsGeneric(m, in, out, count);
+	}
+
+	static const Mat4Kernels BaselineKernels = {
+		MulSharedBase, MulEachBase, TransformSharedBase, TransformEachBase, TransformPointsBase
+	};
+
+
+#ifdef SAND_DISPATCH_X86
+
+	//
+	//  --- SSE4.1: the baseline, built for it ---
+	//
+
+#define SAND_SSE41 __attribute__((target("sse4.1")))
+
+	SAND_SSE41 static void MulSharedSSE41(const float* a, const float* b, float* out, size_t count) {
+		MulSharedGeneric(a, b, out, count);
+	}
+	SAND_SSE41 static void MulEachSSE41(const float* a, const float* b, float* out, size_t count) {
+		MulEachGeneric(a, b, out, count);
+	}
+	SAND_SSE41 static void TransformSharedSSE41(const float* m, const float* in, float* out, size_t count) {
+		TransformSharedGeneric(m, in, out, count);
+	}
+	SAND_SSE41 static void TransformEachSSE41(const float* m, const float* in, float* out, size_t count) {
+		TransformEachGeneric(m, in, out, count);
+	}
+	SAND_SSE41 static void TransformPointsSSE41(const float* m, const float* in, float* out, size_t count) {
+		TransformPointsGeneric(m, in, out, count);
+	}
+
+	static const Mat4Kernels SSE41Kernels = {
+		MulSharedSSE41, MulEachSSE41, TransformSharedSSE41, TransformEachSSE41, TransformPointsSSE41
+	};
+
+
+	//
+	//  --- AVX2 + FMA: two rows or two vectors per register ---
+	//
+
+#define SAND_AVX2 __attribute__((target("avx2,fma")))
+
+	// (lo, lo, lo, lo, hi, hi, hi, hi)
+	SAND_AVX2 static inline __m256 Splat2(float lo, float hi) {
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(lo)), _mm_set1_ps(hi), 1);
+	}
+
+	SAND_AVX2 static inline __m256 Rows2(const float* row) {
+		return _mm256_broadcast_ps(reinterpret_cast<const __m128*>(row));
+	}
+
+	// Rows 2p and 2p + 1 of a * b: the row of a's coefficients, a[r][k]
+	// splat over its half, times row k of b in both halves
+	SAND_AVX2 static void MulSharedAVX2(const float* a, const float* b, float* out, size_t count) {
+		__m256 s[2][4];
+		for (int p = 0; p < 2; p++) {
+			for (int k = 0; k < 4; k++) { s[p][k] = Splat2(a[8 * p + k], a[8 * p + 4 + k]); }
+		}
+		for (size_t i = 0; i < count; i++) {
+			const float* m = b + 16 * i;
+			__m256 b0 = Rows2(m), b1 = Rows2(m + 4), b2 = Rows2(m + 8), b3 = Rows2(m + 12);
+			for (int p = 0; p < 2; p++) {
+				__m256 r = _mm256_mul_ps(s[p][0], b0);
+				r = _mm256_fmadd_ps(s[p][1], b1, r);
+				r = _mm256_fmadd_ps(s[p][2], b2, r);
+				r = _mm256_fmadd_ps(s[p][3], b3, r);
+				_mm256_storeu_ps(out + 16 * i + 8 * p, r);
+			}
+		}
+	}
+
+	SAND_AVX2 static void MulEachAVX2(const float* a, const float* b, float* out, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			const float* m = b + 16 * i;
+			__m256 b0 = Rows2(m), b1 = Rows2(m + 4), b2 = Rows2(m + 8), b3 = Rows2(m + 12);
+			for (int p = 0; p < 2; p++) {
+				__m256 rows = _mm256_loadu_ps(a + 16 * i + 8 * p);
+				__m256 r = _mm256_mul_ps(_mm256_shuffle_ps(rows, rows, 0x00), b0);
+				r = _mm256_fmadd_ps(_mm256_shuffle_ps(rows, rows, 0x55), b1, r);
+				r = _mm256_fmadd_ps(_mm256_shuffle_ps(rows, rows, 0xAA), b2, r);
+				r = _mm256_fmadd_ps(_mm256_shuffle_ps(rows, rows, 0xFF), b3, r);
+				_mm256_storeu_ps(out + 16 * i + 8 * p, r);
+			}
+		}
+	}
+
+	SAND_AVX2 static void TransformSharedAVX2(const float* m, const float* in, float* out, size_t count) {
+		float cols[16];
+		Columns(m, cols);
+		__m256 c0 = Rows2(cols), c1 = Rows2(cols + 4), c2 = Rows2(cols + 8), c3 = Rows2(cols + 12);
+		size_t i = 0;
+		for (; i + 2 <= count; i += 2) {
+			__m256 v = _mm256_loadu_ps(in + 4 * i);
+			__m256 r = _mm256_mul_ps(c0, _mm256_permute_ps(v, 0x00));
+			r = _mm256_fmadd_ps(c1, _mm256_permute_ps(v, 0x55), r);
+			r = _mm256_fmadd_ps(c2, _mm256_permute_ps(v, 0xAA), r);
+			r = _mm256_fmadd_ps(c3, _mm256_permute_ps(v, 0xFF), r);
+			_mm256_storeu_ps(out + 4 * i, r);
+		}
+		if (i < count) {
+			__m128 v = _mm_loadu_ps(in + 4 * i);
+			__m128 r = _mm_mul_ps(_mm256_castps256_ps128(c0), _mm_permute_ps(v, 0x00));
+			r = _mm_fmadd_ps(_mm256_castps256_ps128(c1), _mm_permute_ps(v, 0x55), r);
+			r = _mm_fmadd_ps(_mm256_castps256_ps128(c2), _mm_permute_ps(v, 0xAA), r);
+			r = _mm_fmadd_ps(_mm256_castps256_ps128(c3), _mm_permute_ps(v, 0xFF), r);
+			_mm_storeu_ps(out + 4 * i, r);
+		}
+	}
+
+	// Row products two rows per register, summed across by two hadds
+	SAND_AVX2 static void TransformEachAVX2(const float* m, const float* in, float* out, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			__m256 v = Rows2(in + 4 * i);
+			__m256 p01 = _mm256_mul_ps(_mm256_loadu_ps(m + 16 * i), v);
+			__m256 p23 = _mm256_mul_ps(_mm256_loadu_ps(m + 16 * i + 8), v);
+			__m256 h = _mm256_hadd_ps(p01, p23);
+			h = _mm256_hadd_ps(h, h);               // (r0 r2 r0 r2 | r1 r3 r1 r3)
+			_mm_storeu_ps(out + 4 * i, _mm_unpacklo_ps(_mm256_castps256_ps128(h), _mm256_extractf128_ps(h, 1)));
+		}
+	}
+
+	SAND_AVX2 static void TransformPointsAVX2(const float* m, const float* in, float* out, size_t count) {
+		float cols[16];
+		Columns(m, cols);
+		__m128 c0 = _mm_loadu_ps(cols), c1 = _mm_loadu_ps(cols + 4);
+		__m128 c2 = _mm_loadu_ps(cols + 8), c3 = _mm_loadu_ps(cols + 12);
+		for (size_t i = 0; i < count; i++) {
+			const float* p = in + 3 * i;
+			__m128 r = _mm_fmadd_ps(c2, _mm_broadcast_ss(p + 2), c3);
+			r = _mm_fmadd_ps(c1, _mm_broadcast_ss(p + 1), r);
+			r = _mm_fmadd_ps(c0, _mm_broadcast_ss(p), r);
+			_mm_storeu_ps(out + 4 * i, r);
+		}
+	}
+
+	static const Mat4Kernels AVX2Kernels = {
+		MulSharedAVX2, MulEachAVX2, TransformSharedAVX2, TransformEachAVX2, TransformPointsAVX2
+	};
+
+
+	//
+	//  --- AVX-512: a matrix or four vectors per register ---
+	//
+
+#define SAND_AVX512 __attribute__((target("avx512f,avx2,fma")))
+
+	SAND_AVX512 static inline __m512 Rows4(const float* row) {
+		return _mm512_broadcast_f32x4(_mm_loadu_ps(row));
+	}
+
+	// a[r][k] over row r's quarter, for k = 0 ... 3
+	SAND_AVX512 static void MulSharedAVX512(const float* a, const float* b, float* out, size_t count) {
+		__m512 am = _mm512_loadu_ps(a);
+		__m512 s[4];
+		for (int k = 0; k < 4; k++) {
+			s[k] = _mm512_permutexvar_ps(_mm512_setr_epi32(k, k, k, k, 4 + k, 4 + k, 4 + k, 4 + k,
+															8 + k, 8 + k, 8 + k, 8 + k, 12 + k, 12 + k, 12 + k, 12 + k), am);
+		}
+		for (size_t i = 0; i < count; i++) {
+			const float* m = b + 16 * i;
+			__m512 b0 = Rows4(m), b1 = Rows4(m + 4), b2 = Rows4(m + 8), b3 = Rows4(m + 12);
+			__m512 r = _mm512_mul_ps(s[0], b0);
+			r = _mm512_fmadd_ps(s[1], b1, r);
+			r = _mm512_fmadd_ps(s[2], b2, r);
+			r = _mm512_fmadd_ps(s[3], b3, r);
+			_mm512_storeu_ps(out + 16 * i, r);
+		}
+	}
+
+	SAND_AVX512 static void MulEachAVX512(const float* a, const float* b, float* out, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			const float* m = b + 16 * i;
+			__m512 b0 = Rows4(m), b1 = Rows4(m + 4), b2 = Rows4(m + 8), b3 = Rows4(m + 12);
+			__m512 am = _mm512_loadu_ps(a + 16 * i);
+			__m512 r = _mm512_mul_ps(_mm512_permute_ps(am, 0x00), b0);
+			r = _mm512_fmadd_ps(_mm512_permute_ps(am, 0x55), b1, r);
+			r = _mm512_fmadd_ps(_mm512_permute_ps(am, 0xAA), b2, r);
+			r = _mm512_fmadd_ps(_mm512_permute_ps(am, 0xFF), b3, r);
+			_mm512_storeu_ps(out + 16 * i, r);
+		}
+	}
+
+	SAND_AVX512 static void TransformSharedAVX512(const float* m, const float* in, float* out, size_t count) {
+		float cols[16];
+		Columns(m, cols);
+		__m512 c0 = Rows4(cols), c1 = Rows4(cols + 4), c2 = Rows4(cols + 8), c3 = Rows4(cols + 12);
+		for (size_t i = 0; i < count; i += 4) {
+			__mmask16 lanes = count - i >= 4 ? __mmask16(0xffff) : __mmask16((1u << (4 * (count - i))) - 1);
+			__m512 v = _mm512_maskz_loadu_ps(lanes, in + 4 * i);
+			__m512 r = _mm512_mul_ps(c0, _mm512_permute_ps(v, 0x00));
+			r = _mm512_fmadd_ps(c1, _mm512_permute_ps(v, 0x55), r);
+			r = _mm512_fmadd_ps(c2, _mm512_permute_ps(v, 0xAA), r);
+			r = _mm512_fmadd_ps(c3, _mm512_permute_ps(v, 0xFF), r);
+			_mm512_mask_storeu_ps(out + 4 * i, lanes, r);
+		}
+	}
+
+	// The whole matrix times v in every quarter, each quarter summed
+	// across, and the four sums gathered
+	SAND_AVX512 static void TransformEachAVX512(const float* m, const float* in, float* out, size_t count) {
+		const __m512i firsts = _mm512_setr_epi32(0, 4, 8, 12, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+		for (size_t i = 0; i < count; i++) {
+			__m512 p = _mm512_mul_ps(_mm512_loadu_ps(m + 16 * i), Rows4(in + 4 * i));
+			p = _mm512_add_ps(p, _mm512_permute_ps(p, _MM_SHUFFLE(2, 3, 0, 1)));
+			p = _mm512_add_ps(p, _mm512_permute_ps(p, _MM_SHUFFLE(1, 0, 3, 2)));
+			_mm_storeu_ps(out + 4 * i, _mm512_castps512_ps128(_mm512_permutexvar_ps(firsts, p)));
+		}
+	}
+
+	// Four points per register: their 12 floats loaded at once and x, y, z
+	// spread over each point's quarter
+	SAND_AVX512 static void TransformPointsAVX512(const float* m, const float* in, float* out, size_t count) {
+		float cols[16];
+		Columns(m, cols);
+		__m512 c0 = Rows4(cols), c1 = Rows4(cols + 4), c2 = Rows4(cols + 8), c3 = Rows4(cols + 12);
+		const __m512i xs = _mm512_setr_epi32(0, 0, 0, 0, 3, 3, 3, 3, 6, 6, 6, 6, 9, 9, 9, 9);
+		const __m512i one = _mm512_set1_epi32(1);
+		const __m512i ys = _mm512_add_epi32(xs, one), zs = _mm512_add_epi32(ys, one);
+		for (size_t i = 0; i < count; i += 4) {
+			size_t n = std::min<size_t>(4, count - i);
+			__m512 p = _mm512_maskz_loadu_ps(__mmask16((1u << (3 * n)) - 1), in + 3 * i);
+			__m512 r = _mm512_fmadd_ps(c2, _mm512_permutexvar_ps(zs, p), c3);
+			r = _mm512_fmadd_ps(c1, _mm512_permutexvar_ps(ys, p), r);
+			r = _mm512_fmadd_ps(c0, _mm512_permutexvar_ps(xs, p), r);
+			_mm512_mask_storeu_ps(out + 4 * i, __mmask16((1u << (4 * n)) - 1), r);
+		}
+	}
+
+	static const Mat4Kernels AVX512Kernels = {
+		MulSharedAVX512, MulEachAVX512, TransformSharedAVX512, TransformEachAVX512, TransformPointsAVX512
+	};
+
+#endif // SAND_DISPATCH_X86
+
+
+	static const Mat4Kernels& Kernels() {
+#ifdef SAND_DISPATCH_X86
+		switch (ActiveIsa()) {
+			case Isa::AVX512: return AVX512Kernels;
+			case Isa::AVX2: return AVX2Kernels;
+			case Isa::SSE41: return SSE41Kernels;
+			case Isa::Baseline: break;
+		}
+#endif
+		return BaselineKernels;
+	}
+
+	void MulMat4(const mat<4>& a, const mat<4>* b, mat<4>* out, size_t count) {
+		if (count == 0) { return; }
+		Kernels().mulShared(a, b[0], out[0], count);
+	}
+
+	void MulMat4(const mat<4>* a, const mat<4>* b, mat<4>* out, size_t count) {
+		if (count == 0) { return; }
+		Kernels().mulEach(a[0], b[0], out[0], count);
+	}
+
+	void TransformVec4(const mat<4>& m, const vec<4>* in, vec<4>* out, size_t count) {
+		if (count == 0) { return; }
+		Kernels().transformShared(m, in[0], out[0], count);
+	}
+
+	void TransformVec4(const mat<4>* m, const vec<4>* in, vec<4>* out, size_t count) {
+		if (count == 0) { return; }
+		Kernels().transformEach(m[0], in[0], out[0], count);
+	}
+
+	void TransformPoints(const mat<4>& m, const vec<3>* in, vec<4>* out, size_t count) {
+		if (count == 0) { return; }
+		Kernels().transformPoints(m, in[0], out[0], count);
+	}
+
+}  // namespace Sand
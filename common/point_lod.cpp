@@ -0,0 +1,296 @@
+#include "point_lod.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <bit>
+#include <chrono>
+#include <limits>
+
+
+namespace Sand {
+
+	static const size_t KeySlice = 1 << 16;     // points per work item while keying
+
+	// Spreads the low 21 bits of v to every third bit
+	static inline uint64_t SpreadBits(uint64_t v) {
+		v &= 0x1fffff;
+		v = (v | v << 32) & 0x1f00000000ffffull;
+		v = (v | v << 16) & 0x1f0000ff0000ffull;
+		v = (v | v << 8) & 0x100f00f00f00f00full;
+		v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+		v = (v | v << 2) & 0x1249249249249249ull;
+		return v;
+	}
+
+	// Priority of point i: the MurmurHash3 finalizer, so the representatives
+	// are a uniform sample that does not depend on the input order in space
+	static inline uint32_t Priority(uint32_t i) {
+		uint32_t h = i ^ 0x9E3779B9u;
+		h ^= h >> 16;
+		h *= 0x85ebca6bu;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h;
+	}
+
+	// Level-L cells of a Morton key
+	static inline uint64_t Cell(uint64_t key, unsigned level) {
+		return key >> (3 * (PointLOD::KeyLevel - level));
+	}
+
+	struct LODItem {
+		uint64_t key;
+		uint32_t priority, index;
+	};
+
+	void PointLOD::build(const VertexArray<3>& in, unsigned threads) {
+		SAND_PROFILE_SCOPE("PointLOD::build");
+		auto start = std::chrono::steady_clock::now();
+		threads = ThreadCount(threads);
+
+		const size_t n = in.size();
+		if (n > size_t(std::numeric_limits<GLint>::max())) {
+			std::cerr << "[PointLOD::build] : " << n << " points, past the GLint range of glMultiDrawArrays"
+					  << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		pts.resize(n);
+		orderOf.resize(n);
+		blocks.clear();
+		finest = BlockLevel;
+		levelCounts.assign(KeyLevel + 1, 0);
+		first.clear();
+		countOf.clear();
+		st = Stats();
+		if (n == 0) {
+			box = AABB();
+			cube = 0;
+			return;
+		}
+
+		auto b = in.bounds();
+		box = AABB(b.first, b.second);
+		cube = std::max(std::max(b.second[0] - b.first[0], b.second[1] - b.first[1]), b.second[2] - b.first[2]);
+		if (!(cube > 0)) { cube = 1; }
+
+		// Morton keys on the finest grid, counted by block per slice
+		const GLfloat scale = GLfloat(1u << KeyLevel) / cube, top = GLfloat((1u << KeyLevel) - 1);
+		const GLfloat* c[3] = {in.component(0), in.component(1), in.component(2)};
+		const size_t cells = size_t(1) << (3 * BlockLevel), slices = (n + KeySlice - 1) / KeySlice;
+
+		std::vector<LODItem> items(n);
+		std::vector<size_t> offsets(slices * cells);
+		ParallelFor(slices, threads, [&](size_t s, unsigned) {
+			size_t* hist = &offsets[s * cells];
+			for (size_t i = s * KeySlice, end = std::min(n, i + KeySlice); i < end; i++) {
+				uint64_t key = 0;
+				for (int k = 0; k < 3; k++) {
+					GLfloat q = std::min(std::max((c[k][i] - box.lo[k]) * scale, 0.0f), top);
+					key |= SpreadBits(uint64_t(q)) << k;
+				}
+				items[i] = LODItem{key, Priority(uint32_t(i)), uint32_t(i)};
+				hist[Cell(key, BlockLevel)]++;
+			}
+		});
+
+		// stable scatter by block: block-major, then slice order
+		std::vector<size_t> blockStart(cells + 1);
+		size_t at = 0;
+		for (size_t cell = 0; cell < cells; cell++) {
+			blockStart[cell] = at;
+			for (size_t s = 0; s < slices; s++) {
+				size_t count = offsets[s * cells + cell];
+				offsets[s * cells + cell] = at;
+				at += count;
+			}
+		}
+		blockStart[cells] = n;
+
+		std::vector<LODItem> sorted(n);
+		ParallelFor(slices, threads, [&](size_t s, unsigned) {
+			size_t* next = &offsets[s * cells];
+			for (size_t i = s * KeySlice, end = std::min(n, i + KeySlice); i < end; i++) {
+				sorted[next[Cell(items[i].key, BlockLevel)]++] = items[i];
+			}
+		});
+		std::vector<LODItem>().swap(items);
+
+		// Morton order within each block, and the number of distinct cells
+		// per level: neighbours in key order first differ at the level of
+		// the highest bit in which their keys differ
+		std::vector<size_t> newCells(cells * (KeyLevel + 1), 0);
+		ParallelFor(cells, threads, [&](size_t cell, unsigned) {
+			LODItem* begin = sorted.data() + blockStart[cell];
+			LODItem* end = sorted.data() + blockStart[cell + 1];
+			if (begin == end) { return; }
+			std::sort(begin, end, [](const LODItem& a, const LODItem& b) {
+				return a.key < b.key || (a.key == b.key && a.index < b.index);
+			});
+			size_t* fresh = &newCells[cell * (KeyLevel + 1)];
+			fresh[BlockLevel]++;
+			for (LODItem* p = begin + 1; p < end; p++) {
+				uint64_t diff = p[-1].key ^ p->key;
+				if (diff != 0) { fresh[KeyLevel - (63 - std::countl_zero(diff)) / 3]++; }
+			}
+		});
+
+		std::vector<size_t> distinct(KeyLevel + 1, 0);
+		for (size_t cell = 0; cell < cells; cell++) {
+			size_t sum = 0;
+			for (unsigned L = BlockLevel; L <= KeyLevel; L++) {
+				sum += newCells[cell * (KeyLevel + 1) + L];
+				distinct[L] += sum;
+			}
+		}
+
+		// the finest level worth keeping: past half the points, drawing all
+		// of them costs at most twice as much
+		finest = KeyLevel;
+		for (unsigned L = BlockLevel; L <= KeyLevel; L++) {
+			if (2 * distinct[L] >= n) {
+				finest = L;
+				break;
+			}
+		}
+
+		// Representatives, finest level first: a cell's representative is the
+		// lowest priority among its children's representatives.  Then each
+		// block is reordered by the coarsest level at which each point is a
+		// representative.
+		const unsigned levels = finest - BlockLevel + 1;
+		std::vector<Block> blockOf(cells);
+		std::vector<std::vector<uint32_t>> candidates(threads);
+		std::vector<std::vector<uint8_t>> levelOf(threads);
+		ParallelFor(cells, threads, [&](size_t cell, unsigned thread) {
+			const size_t b0 = blockStart[cell], count = blockStart[cell + 1] - b0;
+			if (count == 0) { return; }
+			const LODItem* items = sorted.data() + b0;
+
+			std::vector<uint8_t>& level = levelOf[thread];
+			std::vector<uint32_t>& cand = candidates[thread];
+			level.assign(count, uint8_t(finest + 1));
+			cand.clear();
+
+			for (size_t i = 0; i < count; ) {
+				uint64_t key = Cell(items[i].key, finest);
+				size_t best = i;
+				for (i++; i < count && Cell(items[i].key, finest) == key; i++) {
+					if (items[i].priority < items[best].priority) { best = i; }
+				}
+				cand.push_back(uint32_t(best));
+				level[best] = uint8_t(finest);
+			}
+			for (unsigned L = finest; L-- > BlockLevel; ) {
+				size_t kept = 0;
+				for (size_t j = 0; j < cand.size(); ) {
+					uint64_t key = Cell(items[cand[j]].key, L);
+					uint32_t best = cand[j];
+					for (j++; j < cand.size() && Cell(items[cand[j]].key, L) == key; j++) {
+						if (items[cand[j]].priority < items[best].priority) { best = cand[j]; }
+					}
+					cand[kept++] = best;
+					level[best] = uint8_t(L);
+				}
+				cand.resize(kept);
+			}
+
+			// stable counting sort by level into the output
+			Block& block = blockOf[cell];
+			block.first = b0;
+			block.count = count;
+			block.ends.assign(levels + 1, 0);
+			for (size_t i = 0; i < count; i++) { block.ends[level[i] - BlockLevel]++; }
+			uint32_t sum = 0;
+			for (uint32_t& e : block.ends) { sum = (e += sum); }
+
+			uint32_t next[KeyLevel + 2];
+			next[0] = 0;
+			for (unsigned l = 1; l <= levels; l++) { next[l] = block.ends[l - 1]; }
+
+			vec<3> lo(std::numeric_limits<GLfloat>::infinity()), hi(-std::numeric_limits<GLfloat>::infinity());
+			GLfloat* out[3] = {pts.component(0), pts.component(1), pts.component(2)};
+			for (size_t i = 0; i < count; i++) {
+				size_t o = b0 + next[level[i] - BlockLevel]++;
+				uint32_t src = items[i].index;
+				for (int k = 0; k < 3; k++) {
+					GLfloat v = c[k][src];
+					out[k][o] = v;
+					lo[k] = std::min(lo[k], v);
+					hi[k] = std::max(hi[k], v);
+				}
+				orderOf[o] = src;
+			}
+			block.bounds = AABB(lo, hi);
+			block.ends.pop_back();      // the last entry was count
+		});
+
+		for (Block& block : blockOf) {
+			if (block.count == 0) { continue; }
+			for (unsigned l = 0; l < levels; l++) { levelCounts[BlockLevel + l] += block.ends[l]; }
+			blocks.push_back(std::move(block));
+		}
+
+		st.buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	size_t PointLOD::count(unsigned level) const {
+		if (level > finest) { return size(); }
+		return levelCounts[std::max(level, BlockLevel)];
+	}
+
+	void PointLOD::select(const mat<4>& modelView, const mat<4>& projection,
+						  GLfloat viewportHeight, GLfloat pixels) {
+		SAND_PROFILE_SCOPE("PointLOD::select");
+		first.clear();
+		countOf.clear();
+		st.points = st.blocks = st.culled = 0;
+
+		ViewFrustum frustum(projection * modelView);
+
+		// eye-space length of a unit world vector, at most
+		GLfloat viewScale = 0;
+		for (int j = 0; j < 3; j++) {
+			GLfloat len2 = 0;
+			for (int i = 0; i < 3; i++) { len2 += modelView[i][j] * modelView[i][j]; }
+			viewScale = std::max(viewScale, std::sqrt(len2));
+		}
+		// pixels covered by a cell of edge `cube` at w = 1
+		const GLfloat cubePixels = cube * viewScale * std::fabs(projection[1][1]) * viewportHeight * 0.5f / pixels;
+
+		for (const Block& block : blocks) {
+			if (!frustum.intersects(block.bounds)) {
+				st.culled++;
+				continue;
+			}
+
+			// w at the block's point nearest to the eye (eye space looks down -z)
+			vec<3> center = block.bounds.center();
+			vec<4> eye = modelView * vec<4>(center[0], center[1], center[2], 1);
+			GLfloat radius = length(block.bounds.extent()) * viewScale;
+			GLfloat w = projection[3][2] * (eye[2] + radius) + projection[3][3];
+
+			size_t count = block.count;
+			if (w > DivideByZeroTolerance) {
+				GLfloat ratio = cubePixels / w;     // the level-0 cell, in target sizes
+				unsigned level = ratio <= 1 ? 0 : unsigned(std::ceil(std::log2(ratio)));
+				if (level <= finest) { count = block.ends[std::max(level, BlockLevel) - BlockLevel]; }
+			}
+
+			// after a block drawn whole, the range simply grows
+			if (!first.empty() && size_t(first.back()) + size_t(countOf.back()) == block.first) {
+				countOf.back() += GLsizei(count);
+			} else {
+				first.push_back(GLint(block.first));
+				countOf.push_back(GLsizei(count));
+			}
+			st.points += count;
+			st.blocks++;
+		}
+	}
+
+	void PointLOD::draw() const {
+		if (first.empty()) { return; }
+		glMultiDrawArrays(GL_POINTS, first.data(), countOf.data(), GLsizei(first.size()));
+	}
+
+}  // namespace Sand
@@ -0,0 +1,354 @@
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <thread>
+
+
+namespace Sand {
+
+	static const uint32_t GpuTrack = ~uint32_t(0);          // trace tid of GPU events
+	static const uint32_t FrameTrack = ~uint32_t(0) - 1;    // ... and of frames
+
+	Profiler& GetProfiler() {
+		static Profiler profiler;
+		return profiler;
+	}
+
+	Profiler::Profiler() : lastFrameTime(now()) {
+		frames.emplace_back();
+	}
+
+	uint64_t Profiler::now() {
+		static const auto epoch = std::chrono::steady_clock::now();
+		return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - epoch).count());
+	}
+
+
+	//
+	//  --- Rings ---
+	//
+
+	// Hands the thread's ring back when the thread ends
+	struct ThreadRing {
+		ProfileRing* r = NULL;
+		~ThreadRing() { if (r != NULL) { GetProfiler().release(r); } }
+	};
+
+	static thread_local ThreadRing threadRing;
+
+	ProfileRing& Profiler::ring() {
+		if (threadRing.r == NULL) { threadRing.r = GetProfiler().acquire(); }
+		return *threadRing.r;
+	}
+
+	// A drained ring of an ended thread, or a new one
+	ProfileRing* Profiler::acquire() {
+		std::lock_guard<std::mutex> lock(ringsLock);
+		ProfileRing* r;
+		if (!spare.empty()) {
+			r = spare.back();
+			spare.pop_back();
+			r->head.store(0, std::memory_order_relaxed);
+			r->tail = 0;
+			r->depth = 0;
+			r->name.clear();
+			r->retired.store(false, std::memory_order_relaxed);
+		} else {
+			r = new ProfileRing();
+		}
+		r->thread = ++threads;
+		rings.push_back(r);
+		return r;
+	}
+
+	// frame() recycles it once drained
+	void Profiler::release(ProfileRing* r) {
+		r->retired.store(true, std::memory_order_release);
+	}
+
+	void Profiler::setThreadName(const std::string& name) {
+		ProfileRing& r = ring();
+		std::lock_guard<std::mutex> lock(ringsLock);
+		r.name = name;
+		threadNames.emplace_back(r.thread, name);
+	}
+
+	// Appends r's new events to out.  Events the writer lapped before they
+	// were read, or may be overwriting while they are, are counted as lost.
+	void Profiler::drain(ProfileRing& r, std::vector<ProfileEvent>& out) {
+		uint64_t h = r.head.load(std::memory_order_acquire);
+		if (h - r.tail > ProfileRing::Capacity) {
+			lost += h - r.tail - ProfileRing::Capacity;
+			r.tail = h - ProfileRing::Capacity;
+		}
+		size_t at = out.size();
+		for (uint64_t i = r.tail; i < h; i++) { out.push_back(r.events[i % ProfileRing::Capacity]); }
+
+		uint64_t written = r.head.load(std::memory_order_acquire);
+		uint64_t firstValid = written + 1 > ProfileRing::Capacity ? written + 1 - ProfileRing::Capacity : 0;
+		if (firstValid > r.tail) {
+			size_t bad = size_t(std::min(firstValid, h) - r.tail);
+			out.erase(out.begin() + at, out.begin() + at + bad);
+			lost += bad;
+		}
+		r.tail = h;
+
+		for (size_t i = at; i < out.size(); i++) { record(out[i], r.thread); }
+	}
+
+	void Profiler::record(const ProfileEvent& e, uint32_t thread) {
+		if (captured.size() < captureLimit) { captured.push_back(Captured{e, thread}); }
+	}
+
+
+	//
+	//  --- GPU queries ---
+	//
+
+	static size_t ThisThread() {
+		return std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+	}
+
+	bool Profiler::enableGpu(bool on) {
+		if (!on) {
+			gpuThread = 0;
+			return true;
+		}
+
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		bool timer = major * 10 + minor >= 33;
+		if (!timer) {
+			GLint count = 0;
+			glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+			for (GLint i = 0; i < count && !timer; i++) {
+				const GLubyte* ext = glGetStringi(GL_EXTENSIONS, GLuint(i));
+				timer = ext && strcmp((const char*)ext, "GL_ARB_timer_query") == 0;
+			}
+		}
+		gpuThread = timer ? ThisThread() : 0;
+		return timer;
+	}
+
+	GLuint Profiler::beginGpu() {
+		if (gpuThread == 0 || gpuActive || ThisThread() != gpuThread) { return 0; }
+
+		GLuint query;
+		if (!freeQueries.empty()) {
+			query = freeQueries.back();
+			freeQueries.pop_back();
+		} else {
+			glGenQueries(1, &query);
+		}
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		gpuActive = true;
+		return query;
+	}
+
+	void Profiler::endGpu(GLuint query, const char* name, uint64_t begin) {
+		glEndQuery(GL_TIME_ELAPSED);
+		gpuActive = false;
+		pending.push_back(PendingQuery{query, name, begin});
+	}
+
+	// Results finish in order: stop at the first one still in flight.  The
+	// GPU track has no clock of its own here, so each event starts when its
+	// scope started on the CPU or when the previous one ended, if later.
+	// Finished work cannot have taken longer than the time since its scope
+	// started; some drivers return garbage for the first query, so results
+	// past that bound are dropped.
+	void Profiler::resolveGpu(std::vector<ProfileEvent>& out) {
+		if (gpuThread == 0 || ThisThread() != gpuThread) { return; }
+
+		const uint64_t t = now();
+		while (!pending.empty()) {
+			PendingQuery& p = pending.front();
+			GLint available = 0;
+			glGetQueryObjectiv(p.query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) { break; }
+
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(p.query, GL_QUERY_RESULT, &elapsed);
+			freeQueries.push_back(p.query);
+			if (elapsed > t - p.begin) {
+				lost++;
+				pending.pop_front();
+				continue;
+			}
+
+			uint64_t begin = std::max(p.begin, gpuClock);
+			ProfileEvent e = {p.name, begin, begin + elapsed, 0, 1};
+			gpuClock = e.end;
+			out.push_back(e);
+			record(e, GpuTrack);
+			pending.pop_front();
+		}
+	}
+
+
+	//
+	//  --- Frames ---
+	//
+
+	void Profiler::frame() {
+		uint64_t t = now();
+		FrameStats stats;
+		stats.index = frames.back().index + 1;
+		stats.seconds = double(t - lastFrameTime) * 1e-9;
+
+		std::vector<ProfileEvent> events;
+		{
+			std::lock_guard<std::mutex> lock(ringsLock);
+			for (size_t i = 0; i < rings.size(); ) {
+				ProfileRing* r = rings[i];
+				bool ended = r->retired.load(std::memory_order_acquire);
+				drain(*r, events);
+				if (ended) {
+					rings[i] = rings.back();
+					rings.pop_back();
+					spare.push_back(r);
+				} else {
+					i++;
+				}
+			}
+		}
+		resolveGpu(events);
+		record(ProfileEvent{"frame", lastFrameTime, t, 0, 0}, FrameTrack);
+
+		for (const ProfileEvent& e : events) {
+			double s = double(e.end - e.begin) * 1e-9;
+			auto it = std::find_if(stats.scopes.begin(), stats.scopes.end(), [&](const ScopeStats& st) {
+				return st.gpu == bool(e.gpu) && (st.name == e.name || strcmp(st.name, e.name) == 0);
+			});
+			if (it == stats.scopes.end()) {
+				stats.scopes.push_back(ScopeStats{e.name, bool(e.gpu), 1, s, s});
+			} else {
+				it->calls++;
+				it->seconds += s;
+				it->maxSeconds = std::max(it->maxSeconds, s);
+			}
+		}
+
+		if (frames.size() == History) { frames.pop_front(); }
+		frames.push_back(std::move(stats));
+		lastFrameTime = t;
+	}
+
+	void Profiler::report(std::ostream& os) const {
+		struct Row {
+			const char* name;
+			bool gpu;
+			double seconds = 0, worst = 0;
+			size_t calls = 0;
+		};
+		std::vector<Row> rows;
+		double frameSeconds = 0;
+		size_t counted = 0;
+		for (const FrameStats& f : frames) {
+			if (f.index == 0) { continue; }     // the placeholder before the first frame
+			frameSeconds += f.seconds;
+			counted++;
+			for (const ScopeStats& s : f.scopes) {
+				auto it = std::find_if(rows.begin(), rows.end(), [&](const Row& r) {
+					return r.gpu == s.gpu && strcmp(r.name, s.name) == 0;
+				});
+				if (it == rows.end()) {
+					rows.push_back(Row{s.name, s.gpu});
+					it = rows.end() - 1;
+				}
+				it->seconds += s.seconds;
+				it->worst = std::max(it->worst, s.seconds);
+				it->calls += s.calls;
+			}
+		}
+		if (counted == 0) {
+			os << "profile: no frames" << std::endl;
+			return;
+		}
+		std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.seconds > b.seconds; });
+
+		std::ios::fmtflags flags = os.flags();
+		os << "profile over " << counted << " frames: " << std::fixed << std::setprecision(3)
+		   << frameSeconds / counted * 1e3 << " ms/frame";
+		if (lost) { os << ", " << lost << " events lost"; }
+		os << std::endl << "  " << std::left << std::setw(32) << "scope" << std::right
+		   << std::setw(12) << "avg ms" << std::setw(12) << "max ms" << std::setw(12) << "calls" << std::endl;
+		for (const Row& r : rows) {
+			std::string name = r.gpu ? std::string(r.name) + " (GPU)" : r.name;
+			os << "  " << std::left << std::setw(32) << name << std::right
+			   << std::setw(12) << r.seconds / counted * 1e3 << std::setw(12) << r.worst * 1e3
+			   << std::setw(12) << std::setprecision(1) << double(r.calls) / counted
+			   << std::setprecision(3) << std::endl;
+		}
+		os.flags(flags);
+	}
+
+
+	//
+	//  --- Chrome trace ---
+	//
+
+	void Profiler::capture(size_t maxEvents) {
+		captured.clear();
+		captured.reserve(std::min<size_t>(maxEvents, 1 << 16));
+		captureLimit = maxEvents;
+	}
+
+	static void WriteJSONString(FILE* fp, const char* s) {
+		std::fputc('"', fp);
+		for (; *s; s++) {
+			unsigned char c = (unsigned char)*s;
+			if (c == '"' || c == '\\') {
+				std::fprintf(fp, "\\%c", c);
+			} else if (c < 0x20) {
+				std::fprintf(fp, "\\u%04x", c);
+			} else {
+				std::fputc(c, fp);
+			}
+		}
+		std::fputc('"', fp);
+	}
+
+	bool Profiler::writeChromeTrace(const std::string& file) {
+		FILE* fp = std::fopen(file.c_str(), "w");
+		if (fp == NULL) {
+			std::cerr << "Failed to open " << file << std::endl;
+			return false;
+		}
+
+		std::fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+		const char* sep = "\n";
+		auto name = [&](uint32_t tid, const char* label) {
+			std::fprintf(fp, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", sep, tid);
+			WriteJSONString(fp, label);
+			std::fprintf(fp, "}}");
+			sep = ",\n";
+		};
+		name(FrameTrack, "Frames");
+		name(GpuTrack, "GPU");
+		{
+			std::lock_guard<std::mutex> lock(ringsLock);
+			for (const auto& n : threadNames) { name(n.first, n.second.c_str()); }
+		}
+
+		for (const Captured& c : captured) {
+			const ProfileEvent& e = c.event;
+			std::fprintf(fp, "%s{\"ph\":\"X\",\"cat\":\"%s\",\"name\":", sep, e.gpu ? "gpu" : "cpu");
+			WriteJSONString(fp, e.name);
+			std::fprintf(fp, ",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", c.thread,
+						 double(e.begin) * 1e-3, double(e.end - e.begin) * 1e-3);
+		}
+		std::fprintf(fp, "\n]}\n");
+
+		captured.clear();
+		captured.shrink_to_fit();
+		captureLimit = 0;
+		return std::fclose(fp) == 0;
+	}
+
+}  // namespace Sand
@@ -0,0 +1,494 @@
+#include "shader_source.h"
+#include "profiler.h"
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#	include <fstream>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+#ifdef __linux__
+#	include <sys/inotify.h>
+#endif
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#	define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+
+namespace Sand {
+
+	//
+	//  --- File access ---
+	//
+
+	// Read-only view of a whole file, mapped where the platform allows
+	class MappedFile {
+	public:
+		const char* data = NULL;
+		size_t size = 0;
+
+		explicit MappedFile(const std::string& path) {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+			std::ifstream fin(path, std::ios::binary);
+			if (!fin.is_open()) { return; }
+			copy.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+			data = copy.data();
+			size = copy.size();
+#else
+			int fd = open(path.c_str(), O_RDONLY);
+			if (fd < 0) { return; }
+			struct stat st;
+			if (fstat(fd, &st) == 0) {
+				size = size_t(st.st_size);
+				if (size == 0) {
+					data = "";
+				} else {
+					void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+					if (p != MAP_FAILED) { data = (const char*)p; mapped = true; }
+				}
+			}
+			close(fd);
+#endif
+		}
+
+		~MappedFile() {
+#if !defined(_WIN32) || defined(__CYGWIN__)
+			if (mapped) { munmap((void*)data, size); }
+#endif
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator = (const MappedFile&) = delete;
+
+	private:
+		bool mapped = false;
+		std::string copy;
+	};
+
+	static long long ModificationTime(const std::string& path) {
+		std::error_code ec;
+		auto t = std::filesystem::last_write_time(path, ec);
+		return ec ? 0 : (long long)t.time_since_epoch().count();
+	}
+
+	// The quoted name of an `#include "name"` line, or "" for any other line
+	static std::string IncludeName(const char* line, const char* end) {
+		auto skip = [&]() { while (line < end && (*line == ' ' || *line == '\t')) line++; };
+
+		skip();
+		if (line == end || *line++ != '#') { return ""; }
+		skip();
+		if (end - line < 7 || strncmp(line, "include", 7) != 0) { return ""; }
+		line += 7;
+		skip();
+		if (line == end || *line++ != '"') { return ""; }
+		const char* close = (const char*)memchr(line, '"', end - line);
+		return close ? std::string(line, close) : "";
+	}
+
+
+	//
+	//  --- ShaderSources ---
+	//
+
+	ShaderSources::~ShaderSources() {
+#ifdef __linux__
+		if (notify >= 0) { close(notify); }
+#endif
+	}
+
+	std::string ShaderSources::key(const std::string& file) {
+		std::error_code ec;
+		std::filesystem::path path = std::filesystem::absolute(file, ec);
+		return (ec ? std::filesystem::path(file) : path).lexically_normal().string();
+	}
+
+	const std::string* ShaderSources::get(const std::string& file) {
+		std::string name = key(file);
+		Entry& entry = entries[name];   // references survive rehashing
+		if (entry.valid) { return &entry.text; }
+
+		for (const std::string& inc : entry.includes) { includedBy[inc].erase(name); }
+		entry.includes.clear();
+		entry.text.clear();
+
+		loading.insert(name);
+		bool ok = preprocess(name, entry);
+		loading.erase(name);
+
+		// watched even when broken, so that fixing it is noticed
+		watch(name);
+
+		if (!ok) {
+			entry.text.clear();
+			return NULL;
+		}
+		entry.valid = true;
+		return &entry.text;
+	}
+
+	bool ShaderSources::preprocess(const std::string& name, Entry& entry) {
+		entry.mtime = ModificationTime(name);
+
+		MappedFile file(name);
+		if (file.data == NULL) {
+			std::cerr << "Failed to read " << name << std::endl;
+			return false;
+		}
+		entry.text.reserve(file.size);
+
+		std::filesystem::path dir = std::filesystem::path(name).parent_path();
+		const char* p = file.data;
+		const char* end = file.data + file.size;
+
+		for (int line = 1; p < end; line++) {
+			const char* eol = (const char*)memchr(p, '\n', end - p);
+			const char* next = eol ? eol + 1 : end;
+
+			std::string inc = IncludeName(p, eol ? eol : end);
+			if (inc.empty()) {
+				entry.text.append(p, next);
+				p = next;
+				continue;
+			}
+
+			std::string incName = (dir / inc).lexically_normal().string();
+			entry.includes.push_back(incName);
+			includedBy[incName].insert(name);
+
+			if (loading.count(incName)) {
+				std::cerr << name << ":" << line << ": #include \"" << inc << "\" forms a cycle" << std::endl;
+				return false;
+			}
+			const std::string* text = get(incName);
+			if (text == NULL) {
+				std::cerr << "  included from " << name << ":" << line << std::endl;
+				return false;
+			}
+
+			entry.text += *text;
+			if (!text->empty() && text->back() != '\n') { entry.text += '\n'; }
+			entry.text += "#line " + std::to_string(line + 1) + "\n";
+			p = next;
+		}
+		return true;
+	}
+
+	void ShaderSources::watch(const std::string& name) {
+#ifdef __linux__
+		std::string dir = std::filesystem::path(name).parent_path().string();
+		if (watchedDirs.count(dir)) { return; }
+
+		if (notify == -1) {
+			notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+			if (notify < 0) {
+				notify = -2;   // unavailable; poll() compares times instead
+			}
+		}
+		if (notify < 0) { return; }
+
+		// directories rather than files: editors often save by renaming a new file
+		int wd = inotify_add_watch(notify, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (wd >= 0) {
+			watches[wd] = dir;
+			watchedDirs.insert(dir);
+		}
+#else
+		(void)name;
+#endif
+	}
+
+	std::vector<std::string> ShaderSources::invalidate(const std::string& file) {
+		std::vector<std::string> result;
+		std::unordered_set<std::string> seen;
+		std::vector<std::string> stack = {key(file)};
+
+		while (!stack.empty()) {
+			std::string name = stack.back();
+			stack.pop_back();
+			if (!seen.insert(name).second) { continue; }
+
+			result.push_back(name);
+			auto e = entries.find(name);
+			if (e != entries.end()) { e->second.valid = false; }
+
+			auto deps = includedBy.find(name);
+			if (deps != includedBy.end()) {
+				stack.insert(stack.end(), deps->second.begin(), deps->second.end());
+			}
+		}
+		return result;
+	}
+
+	std::vector<std::string> ShaderSources::poll() {
+		std::vector<std::string> changed;
+
+#ifdef __linux__
+		if (notify >= 0) {
+			alignas(inotify_event) char buf[4096];
+			ssize_t len;
+			while ((len = read(notify, buf, sizeof(buf))) > 0) {
+				for (char* p = buf; p < buf + len; ) {
+					const inotify_event* ev = (const inotify_event*)p;
+					p += sizeof(inotify_event) + ev->len;
+					if (ev->len == 0 || !watches.count(ev->wd)) { continue; }
+
+					std::string name = watches[ev->wd] + "/" + ev->name;
+					if (entries.count(name)) { changed.push_back(name); }
+				}
+			}
+		} else
+#endif
+		{
+			for (auto& e : entries) {
+				long long mtime = ModificationTime(e.first);
+				if (mtime != e.second.mtime) {
+					e.second.mtime = mtime;
+					changed.push_back(e.first);
+				}
+			}
+		}
+
+		std::vector<std::string> result;
+		std::unordered_set<std::string> seen;
+		for (const std::string& name : changed) {
+			for (std::string& dep : invalidate(name)) {
+				if (seen.insert(dep).second) { result.push_back(std::move(dep)); }
+			}
+		}
+		return result;
+	}
+
+	ShaderSources& GetShaderSources() {
+		static ShaderSources sources;
+		return sources;
+	}
+
+
+	//
+	//  --- Minification ---
+	//
+
+	static bool WordChar(char c) {
+		return isalnum((unsigned char)c) || c == '_' || c == '.';
+	}
+
+	static bool OperatorChar(char c) {
+		return strchr("+-*/%<>=!&|^~?:", c) != NULL && c != '\0';
+	}
+
+	std::string MinifyGLSL(const std::string& source) {
+		// line continuations joined, then comments replaced by a space each,
+		// the order the GLSL preprocessor applies them in
+		std::string joined;
+		joined.reserve(source.size());
+		for (size_t i = 0; i < source.size(); i++) {
+			if (source[i] == '\\' && i + 1 < source.size() && source[i + 1] == '\n') {
+				i++;
+			} else if (source[i] != '\r') {
+				joined += source[i];
+			}
+		}
+
+		std::string code;
+		code.reserve(joined.size());
+		for (size_t i = 0; i < joined.size(); i++) {
+			if (joined.compare(i, 2, "//") == 0) {
+				i = joined.find('\n', i);
+				if (i == std::string::npos) { break; }
+				code += '\n';
+			} else if (joined.compare(i, 2, "/*") == 0) {
+				size_t end = joined.find("*/", i + 2);
+				i = end == std::string::npos ? joined.size() : end + 1;
+				code += ' ';
+			} else {
+				code += joined[i];
+			}
+		}
+
+		std::string out;
+		out.reserve(code.size());
+		char last = '\n';          // last character written
+		bool space = false;         // whitespace since then
+		size_t p = 0;
+		while (p < code.size()) {
+			size_t eol = code.find('\n', p);
+			if (eol == std::string::npos) { eol = code.size(); }
+			size_t begin = code.find_first_not_of(" \t\f\v", p);
+
+			if (begin < eol && code[begin] == '#') {
+				// a directive: on its own line, whitespace runs cut to one space
+				// (they separate a macro's name from a parenthesized body)
+				size_t end = code.find_last_not_of(" \t\f\v", eol - 1) + 1;
+				std::string directive;
+				bool gap = false;
+				for (size_t i = begin; i < end; i++) {
+					char c = code[i];
+					if (c == ' ' || c == '\t' || c == '\f' || c == '\v') {
+						gap = true;
+						continue;
+					}
+					if (gap && directive != "#") { directive += ' '; }
+					gap = false;
+					directive += c;
+				}
+				if (directive.compare(0, 6, "#line ") != 0) {
+					if (last != '\n') { out += '\n'; }
+					out += directive;
+					out += '\n';
+					last = '\n';
+				}
+				space = false;
+			} else {
+				for (size_t i = p; i < eol; i++) {
+					char c = code[i];
+					if (c == ' ' || c == '\t' || c == '\f' || c == '\v') {
+						space = true;
+						continue;
+					}
+					// a space only where dropping it would join two tokens
+					if (space && ((WordChar(last) && WordChar(c)) || (OperatorChar(last) && OperatorChar(c)))) {
+						out += ' ';
+					}
+					out += c;
+					last = c;
+					space = false;
+				}
+				space = true;
+			}
+			p = eol + 1;
+		}
+		if (last != '\n') { out += '\n'; }
+		return out;
+	}
+
+
+	//
+	//  --- ShaderLibrary ---
+	//
+
+	static bool HasExtension(const char* name) {
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++) {
+			const GLubyte* ext = glGetStringi(GL_EXTENSIONS, i);
+			if (ext && strcmp((const char*)ext, name) == 0) { return true; }
+		}
+		return false;
+	}
+
+	static void PrintShaderLog(GLuint shader, const std::string& filename) {
+		GLint compiled;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+		if (compiled) { return; }
+
+		std::cerr << filename << " failed to compile:" << std::endl;
+		PrintInfoLog(shader);
+	}
+
+	ShaderLibrary::Handle ShaderLibrary::add(const std::string& vShaderFile,
+											 const std::string& fShaderFile) {
+		if (programs.empty()) {
+			parallelCompile = HasExtension("GL_KHR_parallel_shader_compile") ||
+							  HasExtension("GL_ARB_parallel_shader_compile");
+		}
+
+		Program p;
+		p.files[0] = ShaderSources::key(vShaderFile);
+		p.files[1] = ShaderSources::key(fShaderFile);
+		p.program = InitShader(vShaderFile, fShaderFile);
+		programs.push_back(p);
+		return Handle(programs.size() - 1);
+	}
+
+	// Starts compiling and linking p from its current sources
+	void ShaderLibrary::rebuild(Program& p) {
+		const GLenum types[2] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+		const std::string* sources[2];
+		for (int i = 0; i < 2; i++) {
+			sources[i] = GetShaderSources().get(p.files[i]);
+			if (sources[i] == NULL) { return; }   // reported; keep the old program
+		}
+
+		p.pending = glCreateProgram();
+		for (int i = 0; i < 2; i++) {
+			const GLchar* text = sources[i]->c_str();
+			p.shaders[i] = glCreateShader(types[i]);
+			glShaderSource(p.shaders[i], 1, &text, NULL);
+			glCompileShader(p.shaders[i]);
+			glAttachShader(p.pending, p.shaders[i]);
+		}
+		// no status queries here: they would wait for the compile
+		glLinkProgram(p.pending);
+		p.started = updates;
+	}
+
+	// Swaps in p.pending once linked; false while it is still compiling or
+	// when it failed
+	bool ShaderLibrary::finish(Program& p) {
+		GLint status;
+		if (parallelCompile) {
+			glGetProgramiv(p.pending, GL_COMPLETION_STATUS_KHR, &status);
+			if (!status) { return false; }
+		}
+
+		glGetProgramiv(p.pending, GL_LINK_STATUS, &status);
+		if (status) {
+			glDeleteProgram(p.program);
+			p.program = p.pending;
+		} else {
+			for (int i = 0; i < 2; i++) { PrintShaderLog(p.shaders[i], p.files[i]); }
+
+			std::cerr << "Shader program failed to link" << std::endl;
+			PrintInfoLog(p.pending);
+
+			glDeleteProgram(p.pending);
+		}
+
+		for (GLuint& shader : p.shaders) {
+			glDeleteShader(shader);
+			shader = 0;
+		}
+		p.pending = 0;
+
+		// the rebuild is stamped with this update, so it is finished next time
+		if (p.stale) {
+			p.stale = false;
+			rebuild(p);
+		}
+		return status;
+	}
+
+	unsigned ShaderLibrary::update() {
+		SAND_PROFILE_SCOPE("ShaderLibrary::update");
+		updates++;
+		std::vector<std::string> changed = GetShaderSources().poll();
+		if (!changed.empty()) {
+			std::unordered_set<std::string> files(changed.begin(), changed.end());
+			for (Program& p : programs) {
+				if (!files.count(p.files[0]) && !files.count(p.files[1])) { continue; }
+				if (p.pending) {
+					p.stale = true;
+				} else {
+					rebuild(p);
+				}
+			}
+		}
+
+		// a link started in this call is left for the next: without the
+		// parallel compile extension, its status query would wait for it
+		unsigned swapped = 0;
+		for (Program& p : programs) {
+			if (p.pending && p.started != updates && finish(p)) { swapped++; }
+		}
+		return swapped;
+	}
+
+}  // namespace Sand
@@ -0,0 +1,310 @@
+#include "softraster.h"
+#include "parallel.h"
+#include <array>
+#include <chrono>
+#include <cstdio>
+
+
+namespace Sand {
+
+	static const size_t VertexBlock = 1 << 16;  // vertices per binning work item
+
+	SoftRaster::SoftRaster(int width, int height, unsigned threads)
+		: w(width), h(height),
+		  tilesX((width + TileSize - 1) / TileSize),
+		  tilesY((height + TileSize - 1) / TileSize),
+		  threads(ThreadCount(threads)),
+		  fragColor(pack(vec<4>(1.0, 1.0, 1.0, 1.0))),
+		  fb(size_t(width) * height, 0) {
+		pointBins.resize(this->threads);
+		triBins.resize(this->threads);
+		for (unsigned t = 0; t < this->threads; t++) {
+			pointBins[t].resize(size_t(tilesX) * tilesY);
+			triBins[t].resize(size_t(tilesX) * tilesY);
+		}
+	}
+
+	uint32_t SoftRaster::pack(const vec<4>& color) {
+		uint32_t res = 0;
+		for (int i = 0; i < 4; i++) {
+			GLfloat c = std::min(std::max(color[i], GLfloat(0.0)), GLfloat(1.0));
+			res |= uint32_t(c * 255.0f + 0.5f) << (8 * i);
+		}
+		return res;
+	}
+
+	void SoftRaster::clear(const vec<4>& color) {
+		std::fill(fb.begin(), fb.end(), pack(color));
+	}
+
+	// vertex i of a tightly packed stream as a clip-space position
+	static inline vec<4> fetch(const GLfloat* positions, int size, size_t i) {
+		vec<4> p(0.0, 0.0, 0.0, 1.0);
+		for (int k = 0; k < size; k++) p[k] = positions[i * size + k];
+		return p;
+	}
+
+	void SoftRaster::drawArrays(GLenum mode, const GLfloat* positions, int size,
+								size_t first, size_t count) {
+		if (size < 1 || size > 4 || count == 0) return;
+		auto start = std::chrono::steady_clock::now();
+
+		positions += first * size;
+		switch (mode) {
+			case GL_POINTS:
+				drawPoints(positions, size, count);
+				st.points += count;
+				break;
+			case GL_TRIANGLES:
+				drawTriangles(positions, size, count - count % 3);
+				st.triangles += count / 3;
+				break;
+			default:
+				std::cerr << "SoftRaster: unsupported primitive mode " << mode << std::endl;
+				return;
+		}
+
+		auto stop = std::chrono::steady_clock::now();
+		st.seconds += std::chrono::duration<double>(stop - start).count();
+	}
+
+
+	//
+	//  --- Points ---
+	//
+
+	void SoftRaster::drawPoints(const GLfloat* positions, int size, size_t count) {
+		const size_t blocks = (count + VertexBlock - 1) / VertexBlock;
+
+		// pass 1: clip, viewport and bin pixel indices per tile
+		ParallelFor(blocks, threads, [&](size_t b, unsigned t) {
+			auto& bins = pointBins[t];
+			size_t end = std::min(count, (b + 1) * VertexBlock);
+			for (size_t i = b * VertexBlock; i < end; i++) {
+				vec<4> p = fetch(positions, size, i);
+				GLfloat cw = p[3];
+				if (!(cw > 0) || std::fabs(p[0]) > cw || std::fabs(p[1]) > cw || std::fabs(p[2]) > cw)
+					continue;
+				int x = std::min(int((p[0] / cw + 1) * 0.5f * w), w - 1);
+				int y = std::min(int((p[1] / cw + 1) * 0.5f * h), h - 1);
+				bins[(y / TileSize) * tilesX + x / TileSize].push_back(uint32_t(y * w + x));
+			}
+		});
+
+		// pass 2: every tile drains its bins from all threads
+		const uint32_t color = fragColor;
+		ParallelFor(size_t(tilesX) * tilesY, threads, [&](size_t tile, unsigned) {
+			for (auto& bins : pointBins) {
+				for (uint32_t idx : bins[tile]) fb[idx] = color;
+				bins[tile].clear();
+			}
+		});
+	}
+
+
+	//
+	//  --- Triangles ---
+	//
+
+	// positive when c is left of a -> b (y up)
+	static inline GLfloat edge(const vec<3>& a, const vec<3>& b, GLfloat x, GLfloat y) {
+		return (b[0] - a[0]) * (y - a[1]) - (b[1] - a[1]) * (x - a[0]);
+	}
+
+	// top-left rule for a counter-clockwise triangle in y-up window space
+	static inline bool topLeft(const vec<3>& a, const vec<3>& b) {
+		return b[1] < a[1] || (b[1] == a[1] && b[0] < a[0]);
+	}
+
+	void SoftRaster::drawTriangles(const GLfloat* positions, int size, size_t count) {
+		const size_t tris = count / 3;
+		const size_t blocks = (tris + VertexBlock - 1) / VertexBlock;
+
+		// pass 1: vertices to window space, triangles binned by bounding box
+		window.resize(count);
+		ParallelFor(blocks, threads, [&](size_t b, unsigned t) {
+			auto& bins = triBins[t];
+			size_t end = std::min(tris, (b + 1) * VertexBlock);
+			for (size_t i = b * VertexBlock; i < end; i++) {
+				GLfloat minx = GLfloat(w), miny = GLfloat(h), maxx = 0, maxy = 0;
+				bool behind = false;
+				for (int k = 0; k < 3; k++) {
+					vec<4> p = fetch(positions, size, 3 * i + k);
+					behind |= !(p[3] > 0);
+					GLfloat iw = GLfloat(1.0) / p[3];
+					vec<3>& v = window[3 * i + k];
+					v = vec<3>((p[0] * iw + 1) * 0.5f * w, (p[1] * iw + 1) * 0.5f * h, iw);
+					minx = std::min(minx, v[0]); maxx = std::max(maxx, v[0]);
+					miny = std::min(miny, v[1]); maxy = std::max(maxy, v[1]);
+				}
+				if (behind || maxx < 0 || maxy < 0 || minx >= w || miny >= h) continue;
+
+				// clamped to the viewport before the casts: near w = 0 the
+				// bounds overflow an int
+				minx = std::max(minx, GLfloat(0)); maxx = std::min(maxx, GLfloat(w - 1));
+				miny = std::max(miny, GLfloat(0)); maxy = std::min(maxy, GLfloat(h - 1));
+				int tx0 = int(minx) / TileSize, tx1 = int(maxx) / TileSize;
+				int ty0 = int(miny) / TileSize, ty1 = int(maxy) / TileSize;
+				for (int ty = ty0; ty <= ty1; ty++)
+					for (int tx = tx0; tx <= tx1; tx++)
+						bins[ty * tilesX + tx].push_back(uint32_t(i));
+			}
+		});
+
+		// pass 2: rasterize each tile
+		ParallelFor(size_t(tilesX) * tilesY, threads, [&](size_t tile, unsigned) {
+			int x0 = int(tile % tilesX) * TileSize, y0 = int(tile / tilesX) * TileSize;
+			int x1 = std::min(x0 + TileSize, w), y1 = std::min(y0 + TileSize, h);
+			for (auto& bins : triBins) {
+				for (uint32_t i : bins[tile])
+					rasterTriangle(window[3 * i], window[3 * i + 1], window[3 * i + 2], x0, y0, x1, y1);
+				bins[tile].clear();
+			}
+		});
+	}
+
+	// Fills the pixels of triangle abc whose centers fall inside, within
+	// [x0, x1) x [y0, y1)
+	void SoftRaster::rasterTriangle(const vec<3>& a, const vec<3>& b0, const vec<3>& c0,
+									int x0, int y0, int x1, int y1) {
+		GLfloat area = edge(a, b0, c0[0], c0[1]);
+		if (area == 0) return;
+		const vec<3>& b = area > 0 ? b0 : c0;  // make it counter-clockwise
+		const vec<3>& c = area > 0 ? c0 : b0;
+
+		// clamped to the tile in float, then cast
+		x0 = int(std::max(GLfloat(x0), std::floor(std::min({a[0], b[0], c[0]}))));
+		x1 = int(std::min(GLfloat(x1), std::ceil(std::max({a[0], b[0], c[0]}))));
+		y0 = int(std::max(GLfloat(y0), std::floor(std::min({a[1], b[1], c[1]}))));
+		y1 = int(std::min(GLfloat(y1), std::ceil(std::max({a[1], b[1], c[1]}))));
+
+		const bool tl0 = topLeft(b, c), tl1 = topLeft(c, a), tl2 = topLeft(a, b);
+		const uint32_t color = fragColor;
+
+		for (int y = y0; y < y1; y++) {
+			GLfloat py = y + 0.5f;
+			uint32_t* row = &fb[size_t(y) * w];
+			for (int x = x0; x < x1; x++) {
+				GLfloat px = x + 0.5f;
+				GLfloat e0 = edge(b, c, px, py), e1 = edge(c, a, px, py), e2 = edge(a, b, px, py);
+				if ((e0 > 0 || (e0 == 0 && tl0)) &&
+					(e1 > 0 || (e1 == 0 && tl1)) &&
+					(e2 > 0 || (e2 == 0 && tl2)))
+					row[x] = color;
+			}
+		}
+	}
+
+
+	//
+	//  --- Image output ---
+	//
+
+	bool WritePPM(const std::string& file, int w, int h, const std::vector<uint32_t>& pixels) {
+		FILE* fp = std::fopen(file.c_str(), "wb");
+		if (fp == NULL) {
+			std::cerr << "Failed to open " << file << std::endl;
+			return false;
+		}
+		std::fprintf(fp, "P6\n%d %d\n255\n", w, h);
+
+		std::vector<unsigned char> row(size_t(w) * 3);
+		for (int y = h - 1; y >= 0; y--) {
+			for (int x = 0; x < w; x++) {
+				uint32_t p = pixels[size_t(y) * w + x];
+				row[3 * x] = p & 0xff;
+				row[3 * x + 1] = (p >> 8) & 0xff;
+				row[3 * x + 2] = (p >> 16) & 0xff;
+			}
+			std::fwrite(row.data(), 1, row.size(), fp);
+		}
+		return std::fclose(fp) == 0;
+	}
+
+	static constexpr std::array<uint32_t, 256> crc32Table() {
+		std::array<uint32_t, 256> table = {};
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+		return table;
+	}
+
+	static uint32_t crc32(const unsigned char* data, size_t len, uint32_t crc = 0) {
+		// built by the compiler, so threads writing PNGs share no lazy state
+		static constexpr std::array<uint32_t, 256> table = crc32Table();
+		crc = ~crc;
+		for (size_t i = 0; i < len; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	static void put32(std::vector<unsigned char>& out, uint32_t v) {
+		for (int s = 24; s >= 0; s -= 8) out.push_back((v >> s) & 0xff);
+	}
+
+	static void chunk(FILE* fp, const char* type, const std::vector<unsigned char>& data) {
+		std::vector<unsigned char> buf;
+		put32(buf, uint32_t(data.size()));
+		buf.insert(buf.end(), type, type + 4);
+		buf.insert(buf.end(), data.begin(), data.end());
+		put32(buf, crc32(buf.data() + 4, buf.size() - 4));
+		std::fwrite(buf.data(), 1, buf.size(), fp);
+	}
+
+	// 8-bit RGB PNG with stored (uncompressed) deflate blocks: no zlib needed
+	bool WritePNG(const std::string& file, int w, int h, const std::vector<uint32_t>& pixels) {
+		FILE* fp = std::fopen(file.c_str(), "wb");
+		if (fp == NULL) {
+			std::cerr << "Failed to open " << file << std::endl;
+			return false;
+		}
+		static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+		std::fwrite(signature, 1, 8, fp);
+
+		std::vector<unsigned char> ihdr;
+		put32(ihdr, uint32_t(w));
+		put32(ihdr, uint32_t(h));
+		ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});  // 8 bit, RGB
+		chunk(fp, "IHDR", ihdr);
+
+		// filter byte 0 + RGB per scanline, top row first
+		std::vector<unsigned char> raw;
+		raw.reserve(size_t(h) * (3 * w + 1));
+		for (int y = h - 1; y >= 0; y--) {
+			raw.push_back(0);
+			for (int x = 0; x < w; x++) {
+				uint32_t p = pixels[size_t(y) * w + x];
+				raw.push_back(p & 0xff);
+				raw.push_back((p >> 8) & 0xff);
+				raw.push_back((p >> 16) & 0xff);
+			}
+		}
+
+		std::vector<unsigned char> z = {0x78, 0x01};
+		uint32_t s1 = 1, s2 = 0;  // adler32
+		for (size_t pos = 0; pos < raw.size() || pos == 0; ) {
+			size_t len = std::min<size_t>(65535, raw.size() - pos);
+			z.push_back(pos + len == raw.size() ? 1 : 0);
+			z.push_back(len & 0xff); z.push_back(len >> 8);
+			z.push_back(~len & 0xff); z.push_back((~len >> 8) & 0xff);
+			for (size_t i = pos; i < pos + len; i++) {
+				z.push_back(raw[i]);
+				s1 = (s1 + raw[i]) % 65521;
+				s2 = (s2 + s1) % 65521;
+			}
+			pos += len;
+			if (len == 0) break;
+		}
+		put32(z, (s2 << 16) | s1);
+		chunk(fp, "IDAT", z);
+		chunk(fp, "IEND", {});
+
+		return std::fclose(fp) == 0;
+	}
+
+	bool SoftRaster::writePPM(const std::string& file) const { return WritePPM(file, w, h, fb); }
+
+	bool SoftRaster::writePNG(const std::string& file) const { return WritePNG(file, w, h, fb); }
+
+}  // namespace Sand
@@ -0,0 +1,189 @@
+#include "transform_graph.h"
+#include "parallel.h"
+#include "profiler.h"
+#include <chrono>
+
+
+namespace Sand {
+
+	static const size_t LevelBlock = 4096;  // nodes per work item within a depth
+
+	TransformGraph::TransformGraph(unsigned threads)
+		: threads(ThreadCount(threads)), levels(1, 0) {}
+
+	TransformGraph::Node TransformGraph::add(Node parent, const mat<4>& local) {
+		if (parent != None && parent >= size()) {
+			std::cerr << "TransformGraph::add: no node " << parent << std::endl;
+			return None;
+		}
+
+		Node n = Node(size());
+		uint32_t d = parent == None ? 0 : depthOf[parent] + 1;
+		parentOf.push_back(parent);
+		depthOf.push_back(d);
+		slotOf.push_back(uint32_t(nodes.size()));
+
+		nodes.push_back(n);
+		parents.push_back(parent == None ? None : slotOf[parent]);
+		locals.push_back(local);
+		worlds.push_back(local);
+		dirty.push_back(0);
+
+		// still sorted if n lands in the deepest depth or starts a new one
+		if (sorted) {
+			if (d + 2 == levels.size()) {
+				levels.back() = nodes.size();
+			} else if (d + 1 == levels.size()) {
+				levels.push_back(nodes.size());
+			} else {
+				sorted = false;
+			}
+		}
+		markDirty(n);
+		return n;
+	}
+
+	bool TransformGraph::setParent(Node n, Node parent) {
+		if (n >= size() || (parent != None && parent >= size())) {
+			std::cerr << "TransformGraph::setParent: no node "
+					  << (n >= size() ? n : parent) << std::endl;
+			return false;
+		}
+		if (parentOf[n] == parent) { return true; }
+		for (Node m = parent; m != None; m = parentOf[m]) {
+			if (m == n) { return false; }
+		}
+
+		parentOf[n] = parent;
+		sorted = false;
+		markDirty(n);
+		return true;
+	}
+
+	void TransformGraph::setLocal(Node n, const mat<4>& local) {
+		locals[slotOf[n]] = local;
+		markDirty(n);
+	}
+
+	void TransformGraph::markDirty(Node n) {
+		dirty[slotOf[n]] = 1;
+		dirtyLo = std::min(dirtyLo, depthOf[n]);
+		dirtyHi = std::max(dirtyHi, depthOf[n]);
+	}
+
+	// Recomputes depths and re-sorts the slot arrays by depth (stable in
+	// handle order)
+	void TransformGraph::sort() {
+		const size_t count = size();
+
+		// setParent can leave parents after their children, so walk up to
+		// the nearest node with a known depth
+		std::fill(depthOf.begin(), depthOf.end(), None);
+		std::vector<Node> chain;
+		uint32_t maxDepth = 0;
+		for (Node n = 0; n < count; n++) {
+			Node m = n;
+			for (; m != None && depthOf[m] == None; m = parentOf[m]) { chain.push_back(m); }
+			uint32_t d = m == None ? 0 : depthOf[m] + 1;
+			for (auto c = chain.rbegin(); c != chain.rend(); ++c) { depthOf[*c] = d++; }
+			chain.clear();
+			maxDepth = std::max(maxDepth, depthOf[n]);
+		}
+
+		levels.assign(maxDepth + 2, 0);
+		for (Node n = 0; n < count; n++) { levels[depthOf[n] + 1]++; }
+		std::partial_sum(levels.begin(), levels.end(), levels.begin());
+
+		std::vector<size_t> next(levels.begin(), levels.end() - 1);
+		std::vector<uint32_t> newSlot(count);
+		for (Node n = 0; n < count; n++) { newSlot[n] = uint32_t(next[depthOf[n]]++); }
+
+		std::vector<Node> newNodes(count);
+		std::vector<uint32_t> newParents(count);
+		std::vector<mat<4>> newLocals(count), newWorlds(count);
+		std::vector<uint8_t> newDirty(count);
+		dirtyLo = None;
+		dirtyHi = 0;
+		for (Node n = 0; n < count; n++) {
+			uint32_t s = newSlot[n], old = slotOf[n];
+			newNodes[s] = n;
+			newParents[s] = parentOf[n] == None ? None : newSlot[parentOf[n]];
+			newLocals[s] = locals[old];
+			newWorlds[s] = worlds[old];
+			newDirty[s] = dirty[old];
+			if (dirty[old]) {
+				dirtyLo = std::min(dirtyLo, depthOf[n]);
+				dirtyHi = std::max(dirtyHi, depthOf[n]);
+			}
+		}
+
+		slotOf = std::move(newSlot);
+		nodes = std::move(newNodes);
+		parents = std::move(newParents);
+		locals = std::move(newLocals);
+		worlds = std::move(newWorlds);
+		dirty = std::move(newDirty);
+		sorted = true;
+	}
+
+	// One depth's slots: recompute the flagged nodes and the children of
+	// recomputed parents, flagging them in turn for the next depth
+	size_t TransformGraph::updateRange(size_t begin, size_t end) {
+		size_t count = 0;
+		for (size_t s = begin; s < end; s++) {
+			uint32_t p = parents[s];
+			if (p == None) {
+				if (!dirty[s]) { continue; }
+				worlds[s] = locals[s];
+			} else {
+				if (!dirty[s] && !dirty[p]) { continue; }
+				worlds[s] = worlds[p] * locals[s];
+				dirty[s] = 1;
+			}
+			count++;
+		}
+		return count;
+	}
+
+	size_t TransformGraph::update() {
+		SAND_PROFILE_SCOPE("TransformGraph::update");
+		auto start = std::chrono::steady_clock::now();
+		if (!sorted) { sort(); }
+
+		st.recomputed = 0;
+		st.levels = 0;
+		if (dirtyLo != None) {
+			size_t d = dirtyLo;
+			for (; d + 1 < levels.size(); d++) {
+				size_t begin = levels[d], end = levels[d + 1];
+				size_t count = 0;
+				if (end - begin <= LevelBlock) {
+					count = updateRange(begin, end);
+				} else {
+					size_t blocks = (end - begin + LevelBlock - 1) / LevelBlock;
+					std::vector<size_t> counts(blocks, 0);
+					ParallelFor(blocks, threads, [&](size_t b, unsigned) {
+						size_t first = begin + b * LevelBlock;
+						counts[b] = updateRange(first, std::min(first + LevelBlock, end));
+					});
+					count = std::accumulate(counts.begin(), counts.end(), size_t(0));
+				}
+				st.recomputed += count;
+				st.levels++;
+
+				// nothing changed here and nothing flagged below: done
+				if (count == 0 && d >= dirtyHi) { break; }
+			}
+
+			size_t last = std::min(d + 1, levels.size() - 1);
+			std::fill(dirty.begin() + levels[dirtyLo], dirty.begin() + levels[last], 0);
+			dirtyLo = None;
+			dirtyHi = 0;
+		}
+
+		st.totalRecomputed += st.recomputed;
+		st.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return st.recomputed;
+	}
+
+}  // namespace Sand
@@ -0,0 +1,682 @@
+#include "vertex_file.h"
+#include "profiler.h"
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <unistd.h>
+#endif
+
+
+namespace Sand {
+
+	//
+	//  --- On-disk layout ---
+	//
+
+	struct FileHeader {
+		char magic[8];
+		uint32_t version, headerBytes;
+		uint64_t vertexCount, indexCount;
+		uint32_t attributeCount, chunkCount;
+		uint32_t alignment, primitive;
+		uint64_t tableOffset;       // 0 until the writer closes
+		uint64_t fileBytes;
+	};
+
+	struct FileAttribute {
+		char name[24];
+		uint32_t format, components;
+	};
+
+	// followed by one block offset per attribute
+	struct FileChunk {
+		uint64_t firstVertex;
+		uint32_t vertexCount, indexCount;
+		uint64_t indexOffset;
+		float lo[3], hi[3];
+	};
+
+	static_assert(sizeof(FileHeader) == 64 && sizeof(FileAttribute) == 32 && sizeof(FileChunk) == 48,
+				  "[VertexFile] : on-disk structs are padded");
+	static_assert(std::endian::native == std::endian::little, "[VertexFile] : files are little-endian");
+
+	static const char VertexFileMagic[8] = {'S', 'A', 'N', 'D', 'V', 'T', 'X', '\0'};
+	static const uint32_t MaxAttributes = 16;
+
+	static size_t ChunkEntryBytes(size_t attributes) {
+		return sizeof(FileChunk) + attributes * sizeof(uint64_t);
+	}
+
+	// [offset, offset + bytes) lies within [0, limit)
+	static bool Within(uint64_t offset, uint64_t bytes, uint64_t limit) {
+		return offset <= limit && bytes <= limit - offset;
+	}
+
+	// true if every index of a chunk names one of its vertices; the block
+	// may sit anywhere in a corrupt file, so it is read without alignment
+	static bool IndicesInRange(const char* block, uint32_t indexCount, uint32_t vertexCount) {
+		uint32_t top = 0;
+		for (uint32_t i = 0; i < indexCount; i++) {
+			uint32_t index;
+			memcpy(&index, block + i * sizeof(uint32_t), sizeof(index));
+			top = std::max(top, index);
+		}
+		return indexCount == 0 || top < vertexCount;
+	}
+
+	// Header, attributes and chunk table, common to both readers
+	struct FileLayout {
+		GLenum mode;
+		uint64_t vertices, indices;
+		std::vector<VertexAttribute> attribs;
+		struct Chunk {
+			VertexChunk info;
+			uint64_t indexOffset;
+			std::vector<uint64_t> offsets;
+		};
+		std::vector<Chunk> chunks;
+	};
+
+	typedef std::function<bool(uint64_t offset, void* out, size_t bytes)> FileReader;
+
+	static bool ReadLayout(const std::string& path, uint64_t fileBytes, const FileReader& read,
+						   FileLayout& layout) {
+		auto bad = [&](const char* why) {
+			std::cerr << path << ": " << why << std::endl;
+			return false;
+		};
+
+		FileHeader h;
+		if (fileBytes < sizeof(h) || !read(0, &h, sizeof(h)) ||
+			memcmp(h.magic, VertexFileMagic, sizeof(h.magic)) != 0) {
+			return bad("not a vertex file");
+		}
+		if (h.version != VertexFileVersion) { return bad("unsupported vertex file version"); }
+		if (h.tableOffset == 0) { return bad("incomplete vertex file (the writer did not finish)"); }
+		if (h.fileBytes != fileBytes) { return bad("truncated vertex file"); }
+		if (h.headerBytes != sizeof(h) || h.attributeCount == 0 || h.attributeCount > MaxAttributes) {
+			return bad("corrupt vertex file header");
+		}
+
+		const uint64_t dataEnd = h.tableOffset;
+		const size_t entryBytes = ChunkEntryBytes(h.attributeCount);
+		if (!Within(sizeof(h), uint64_t(h.attributeCount) * sizeof(FileAttribute), dataEnd) ||
+			!Within(h.tableOffset, uint64_t(h.chunkCount) * entryBytes, fileBytes)) {
+			return bad("corrupt vertex file header");
+		}
+
+		layout.mode = h.primitive;
+		layout.vertices = h.vertexCount;
+		layout.indices = h.indexCount;
+		layout.attribs.resize(h.attributeCount);
+		for (uint32_t a = 0; a < h.attributeCount; a++) {
+			FileAttribute fa;
+			if (!read(sizeof(h) + a * sizeof(fa), &fa, sizeof(fa))) { return bad("read error"); }
+			if (fa.format > uint32_t(VertexFormat::Unorm10_10_10_2) || fa.components < 1 || fa.components > 4) {
+				return bad("corrupt vertex attribute");
+			}
+			fa.name[sizeof(fa.name) - 1] = '\0';
+			layout.attribs[a] = VertexAttribute(fa.name, VertexFormat(fa.format), int(fa.components));
+		}
+
+		std::vector<char> table(h.chunkCount * entryBytes);
+		if (!read(h.tableOffset, table.data(), table.size())) { return bad("read error"); }
+
+		layout.chunks.resize(h.chunkCount);
+		uint64_t nextVertex = 0, indexTotal = 0;
+		for (uint32_t c = 0; c < h.chunkCount; c++) {
+			const char* entry = table.data() + c * entryBytes;
+			FileChunk fc;
+			memcpy(&fc, entry, sizeof(fc));
+
+			FileLayout::Chunk& chunk = layout.chunks[c];
+			chunk.info.firstVertex = fc.firstVertex;
+			chunk.info.vertexCount = fc.vertexCount;
+			chunk.info.indexCount = fc.indexCount;
+			chunk.info.bounds = AABB(vec<3>(fc.lo[0], fc.lo[1], fc.lo[2]), vec<3>(fc.hi[0], fc.hi[1], fc.hi[2]));
+			chunk.indexOffset = fc.indexOffset;
+			chunk.offsets.resize(h.attributeCount);
+			memcpy(chunk.offsets.data(), entry + sizeof(fc), h.attributeCount * sizeof(uint64_t));
+
+			if (fc.firstVertex != nextVertex) { return bad("corrupt chunk table"); }
+			for (uint32_t a = 0; a < h.attributeCount; a++) {
+				if (!Within(chunk.offsets[a], uint64_t(fc.vertexCount) * layout.attribs[a].stride(), dataEnd)) {
+					return bad("corrupt chunk table");
+				}
+			}
+			if (!Within(fc.indexOffset, uint64_t(fc.indexCount) * sizeof(uint32_t), dataEnd)) {
+				return bad("corrupt chunk table");
+			}
+			nextVertex += fc.vertexCount;
+			indexTotal += fc.indexCount;
+		}
+		if (nextVertex != h.vertexCount || indexTotal != h.indexCount) { return bad("corrupt chunk table"); }
+		return true;
+	}
+
+
+	//
+	//  --- File access ---
+	//
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+	static intptr_t OpenFile(const std::string& path, uint64_t& bytes) {
+		HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+							   FILE_ATTRIBUTE_NORMAL, NULL);
+		if (f == INVALID_HANDLE_VALUE) { return -1; }
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(f, &size)) {
+			CloseHandle(f);
+			return -1;
+		}
+		bytes = uint64_t(size.QuadPart);
+		return intptr_t(f);
+	}
+
+	static void CloseFile(intptr_t fd) { CloseHandle(HANDLE(fd)); }
+
+	static bool ReadAt(intptr_t fd, uint64_t offset, void* out, size_t bytes) {
+		while (bytes > 0) {
+			OVERLAPPED at = {};
+			at.Offset = DWORD(offset);
+			at.OffsetHigh = DWORD(offset >> 32);
+			DWORD n = 0, want = DWORD(std::min<size_t>(bytes, 1u << 30));
+			if (!ReadFile(HANDLE(fd), out, want, &n, &at) || n == 0) { return false; }
+			out = (char*)out + n;
+			offset += n;
+			bytes -= n;
+		}
+		return true;
+	}
+
+	static size_t MapGranularity() {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwAllocationGranularity;
+	}
+
+	// A view of [offset, offset + bytes) of the file behind mapping
+	static const char* MapView(void* mapping, uint64_t offset, size_t bytes) {
+		return (const char*)MapViewOfFile(HANDLE(mapping), FILE_MAP_READ,
+										  DWORD(offset >> 32), DWORD(offset), bytes);
+	}
+
+	static void UnmapView(const char* view, size_t) { UnmapViewOfFile(view); }
+
+	// no read-ahead hints (PrefetchVirtualMemory needs Windows 8); the first touch reads
+	static void WillNeed(intptr_t, uint64_t, uint64_t) {}
+#else
+	static intptr_t OpenFile(const std::string& path, uint64_t& bytes) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) { return -1; }
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			::close(fd);
+			return -1;
+		}
+		bytes = uint64_t(st.st_size);
+		return fd;
+	}
+
+	static void CloseFile(intptr_t fd) { ::close(int(fd)); }
+
+	static bool ReadAt(intptr_t fd, uint64_t offset, void* out, size_t bytes) {
+		while (bytes > 0) {
+			ssize_t n = pread(int(fd), out, bytes, off_t(offset));
+			if (n <= 0) { return false; }
+			out = (char*)out + n;
+			offset += uint64_t(n);
+			bytes -= size_t(n);
+		}
+		return true;
+	}
+
+	static size_t MapGranularity() { return size_t(sysconf(_SC_PAGESIZE)); }
+
+	static const char* MapView(intptr_t fd, uint64_t offset, size_t bytes) {
+		void* p = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, int(fd), off_t(offset));
+		return p == MAP_FAILED ? NULL : (const char*)p;
+	}
+
+	static void UnmapView(const char* view, size_t bytes) { munmap((void*)view, bytes); }
+
+	// Starts reading [offset, offset + bytes) of the file in the background
+	static void WillNeed(intptr_t fd, uint64_t offset, uint64_t bytes) {
+#	ifdef POSIX_FADV_WILLNEED
+		posix_fadvise(int(fd), off_t(offset), off_t(bytes), POSIX_FADV_WILLNEED);
+#	endif
+	}
+#endif
+
+
+	//
+	//  --- VertexFile ---
+	//
+
+	bool VertexFile::open(const std::string& path) {
+		SAND_PROFILE_SCOPE("VertexFile::open");
+		close();
+
+		uint64_t fileBytes = 0;
+		intptr_t fd = OpenFile(path, fileBytes);
+		if (fd == -1) {
+			std::cerr << "Failed to open " << path << std::endl;
+			return false;
+		}
+		if (fileBytes > uint64_t(SIZE_MAX)) {
+			std::cerr << path << ": too large to map; use VertexFileStream" << std::endl;
+			CloseFile(fd);
+			return false;
+		}
+
+		if (fileBytes < sizeof(FileHeader)) {
+			std::cerr << path << ": not a vertex file" << std::endl;
+			CloseFile(fd);
+			return false;
+		}
+
+		const char* p = NULL;
+		{
+#if defined(_WIN32) && !defined(__CYGWIN__)
+			mapping = CreateFileMappingA(HANDLE(fd), NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping != NULL) { p = MapView(mapping, 0, size_t(fileBytes)); }
+#else
+			p = MapView(fd, 0, size_t(fileBytes));
+#endif
+		}
+		CloseFile(fd);   // the mapping keeps the file open
+		if (p == NULL) {
+			std::cerr << path << ": cannot map" << std::endl;
+			close();
+			return false;
+		}
+		base = p;
+		bytes = size_t(fileBytes);
+
+		FileLayout layout;
+		auto read = [&](uint64_t offset, void* out, size_t n) {
+			if (!Within(offset, n, bytes)) { return false; }
+			memcpy(out, base + offset, n);
+			return true;
+		};
+		if (!ReadLayout(path, fileBytes, read, layout)) {
+			close();
+			return false;
+		}
+
+		mode = layout.mode;
+		vertexTotal = layout.vertices;
+		indexTotal = layout.indices;
+		attribs = std::move(layout.attribs);
+		chunks.resize(layout.chunks.size());
+		for (size_t c = 0; c < chunks.size(); c++) {
+			chunks[c].info = layout.chunks[c].info;
+			chunks[c].indexOffset = layout.chunks[c].indexOffset;
+			chunks[c].offsets = std::move(layout.chunks[c].offsets);
+		}
+		return true;
+	}
+
+	void VertexFile::close() {
+		if (base != NULL) { UnmapView(base, bytes); }
+#if defined(_WIN32) && !defined(__CYGWIN__)
+		if (mapping != NULL) { CloseHandle(HANDLE(mapping)); }
+		mapping = NULL;
+#endif
+		base = NULL;
+		bytes = 0;
+		vertexTotal = indexTotal = 0;
+		attribs.clear();
+		chunks.clear();
+	}
+
+	int VertexFile::find(const std::string& name) const {
+		for (size_t a = 0; a < attribs.size(); a++) {
+			if (attribs[a].name == name) { return int(a); }
+		}
+		return -1;
+	}
+
+	FileSpan VertexFile::vertices(size_t a, size_t c) const {
+		const Entry& e = chunks[c];
+		return FileSpan{base + e.offsets[a], e.info.vertexCount * attribs[a].stride()};
+	}
+
+	FileSpan VertexFile::indices(size_t c) const {
+		const Entry& e = chunks[c];
+		if (!IndicesInRange(base + e.indexOffset, e.info.indexCount, e.info.vertexCount)) {
+			std::cerr << "VertexFile: index out of range in chunk " << c << std::endl;
+			return FileSpan();
+		}
+		return FileSpan{base + e.indexOffset, e.info.indexCount * sizeof(uint32_t)};
+	}
+
+	void VertexFile::upload(size_t a, GLenum target, GLenum usage) const {
+		if (chunks.size() == 1) {
+			FileSpan s = vertices(a, 0);
+			glBufferData(target, GLsizeiptr(s.bytes), s.data, usage);
+			return;
+		}
+
+		glBufferData(target, GLsizeiptr(vertexCount() * attribs[a].stride()), NULL, usage);
+		GLintptr offset = 0;
+		for (size_t c = 0; c < chunks.size(); c++) {
+			FileSpan s = vertices(a, c);
+			glBufferSubData(target, offset, GLsizeiptr(s.bytes), s.data);
+			offset += GLintptr(s.bytes);
+		}
+	}
+
+	void VertexFile::prefetch(size_t c) const {
+#if !defined(_WIN32) || defined(__CYGWIN__)
+		const Entry& e = chunks[c];
+		uint64_t lo = e.indexOffset, hi = e.indexOffset + e.info.indexCount * sizeof(uint32_t);
+		for (size_t a = 0; a < attribs.size(); a++) {
+			lo = std::min(lo, e.offsets[a]);
+			hi = std::max(hi, e.offsets[a] + e.info.vertexCount * attribs[a].stride());
+		}
+		lo -= lo % MapGranularity();
+		madvise((void*)(base + lo), size_t(hi - lo), MADV_WILLNEED);
+#else
+		(void)c;
+#endif
+	}
+
+
+	//
+	//  --- VertexFileStream ---
+	//
+
+	bool VertexFileStream::open(const std::string& path) {
+		close();
+
+		uint64_t fileBytes = 0;
+		fd = OpenFile(path, fileBytes);
+		if (fd == -1) {
+			std::cerr << "Failed to open " << path << std::endl;
+			return false;
+		}
+
+		FileLayout layout;
+		auto read = [&](uint64_t offset, void* out, size_t n) {
+			return Within(offset, n, fileBytes) && ReadAt(fd, offset, out, n);
+		};
+		if (!ReadLayout(path, fileBytes, read, layout)) {
+			close();
+			return false;
+		}
+#if defined(_WIN32) && !defined(__CYGWIN__)
+		mapping = CreateFileMappingA(HANDLE(fd), NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) {
+			std::cerr << path << ": cannot map" << std::endl;
+			close();
+			return false;
+		}
+#endif
+
+		mode = layout.mode;
+		vertexTotal = layout.vertices;
+		attribs = std::move(layout.attribs);
+		chunks.resize(layout.chunks.size());
+		for (size_t c = 0; c < chunks.size(); c++) {
+			Entry& e = chunks[c];
+			e.info = layout.chunks[c].info;
+			e.indexOffset = layout.chunks[c].indexOffset;
+			e.offsets = std::move(layout.chunks[c].offsets);
+			e.begin = e.indexOffset;
+			e.end = e.indexOffset + e.info.indexCount * sizeof(uint32_t);
+			for (size_t a = 0; a < attribs.size(); a++) {
+				e.begin = std::min(e.begin, e.offsets[a]);
+				e.end = std::max(e.end, e.offsets[a] + e.info.vertexCount * attribs[a].stride());
+			}
+		}
+		chunkIndex = size_t(-1);
+		if (!chunks.empty()) { WillNeed(fd, chunks[0].begin, chunks[0].end - chunks[0].begin); }
+		return true;
+	}
+
+	void VertexFileStream::unmap() {
+		if (view != NULL) { UnmapView(view, viewBytes); }
+		view = NULL;
+		viewBytes = 0;
+	}
+
+	void VertexFileStream::close() {
+		unmap();
+#if defined(_WIN32) && !defined(__CYGWIN__)
+		if (mapping != NULL) { CloseHandle(HANDLE(mapping)); }
+		mapping = NULL;
+#endif
+		if (fd != -1) { CloseFile(fd); }
+		fd = -1;
+		attribs.clear();
+		chunks.clear();
+		chunkIndex = size_t(-1);
+	}
+
+	bool VertexFileStream::next() {
+		unmap();
+		if (fd == -1 || chunkIndex + 1 >= chunks.size()) {
+			chunkIndex = chunks.size();
+			return false;
+		}
+		const Entry& e = chunks[++chunkIndex];
+
+		// views start on a mapping granularity boundary
+		viewOffset = e.begin - e.begin % MapGranularity();
+		viewBytes = size_t(e.end - viewOffset);
+		if (viewBytes > 0) {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+			view = MapView(mapping, viewOffset, viewBytes);
+#else
+			view = MapView(fd, viewOffset, viewBytes);
+#endif
+			if (view == NULL) {
+				std::cerr << "VertexFileStream: cannot map chunk " << chunkIndex << std::endl;
+				viewBytes = 0;
+				chunkIndex = chunks.size();
+				return false;
+			}
+		}
+
+		if (chunkIndex + 1 < chunks.size()) {
+			const Entry& n = chunks[chunkIndex + 1];
+			WillNeed(fd, n.begin, n.end - n.begin);
+		}
+		return true;
+	}
+
+	FileSpan VertexFileStream::vertices(size_t a) const {
+		const Entry& e = chunks[chunkIndex];
+		return FileSpan{view + (e.offsets[a] - viewOffset), e.info.vertexCount * attribs[a].stride()};
+	}
+
+	FileSpan VertexFileStream::indices() const {
+		const Entry& e = chunks[chunkIndex];
+		const char* block = view + (e.indexOffset - viewOffset);
+		if (!IndicesInRange(block, e.info.indexCount, e.info.vertexCount)) {
+			std::cerr << "VertexFileStream: index out of range in chunk " << chunkIndex << std::endl;
+			return FileSpan();
+		}
+		return FileSpan{block, e.info.indexCount * sizeof(uint32_t)};
+	}
+
+
+	//
+	//  --- VertexFileWriter ---
+	//
+
+	VertexFileWriter::VertexFileWriter(const std::string& path, const std::vector<VertexAttribute>& attributes,
+									   GLenum primitive, size_t alignment)
+		: path(path), tmpPath(path + ".tmp"), attribs(attributes), mode(primitive), alignment(alignment) {
+		if (attribs.empty() || attribs.size() > MaxAttributes) {
+			fail("needs 1 to 16 attributes");
+			return;
+		}
+		for (const VertexAttribute& a : attribs) {
+			if (a.components < 1 || a.components > 4 || a.name.size() >= sizeof(FileAttribute::name)) {
+				fail("attributes need 1 to 4 components and names under 24 characters");
+				return;
+			}
+		}
+		if (alignment < 16 || (alignment & (alignment - 1)) != 0) {
+			fail("alignment must be a power of two, at least 16");
+			return;
+		}
+
+		out.open(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) {
+			std::cerr << "Failed to open " << tmpPath << std::endl;
+			failed = true;
+			return;
+		}
+
+		// the header is rewritten by close(); until then tableOffset is 0
+		FileHeader h = {};
+		out.write((const char*)&h, sizeof(h));
+		for (const VertexAttribute& a : attribs) {
+			FileAttribute fa = {};
+			memcpy(fa.name, a.name.data(), a.name.size());
+			fa.format = uint32_t(a.format);
+			fa.components = uint32_t(a.components);
+			out.write((const char*)&fa, sizeof(fa));
+		}
+		if (!out) { fail("write error"); }
+	}
+
+	bool VertexFileWriter::fail(const char* what) {
+		if (!failed) { std::cerr << "VertexFileWriter " << path << ": " << what << std::endl; }
+		failed = true;
+		return false;
+	}
+
+	// Zeros up to the next multiple of alignment
+	bool VertexFileWriter::pad() {
+		static const char zeros[256] = {};
+		uint64_t at = uint64_t(out.tellp());
+		for (uint64_t n = (alignment - at % alignment) % alignment; n > 0; ) {
+			size_t k = size_t(std::min<uint64_t>(n, sizeof(zeros)));
+			out.write(zeros, k);
+			n -= k;
+		}
+		return bool(out);
+	}
+
+	bool VertexFileWriter::write(size_t count, const GLfloat* const* data,
+								 const uint32_t* idx, size_t indexCount, size_t chunkVertices) {
+		if (failed || closed) { return false; }
+
+		if (idx != NULL && indexCount > 0) {
+			if (count > UINT32_MAX || indexCount > UINT32_MAX) { return fail("chunk too large"); }
+			if (!IndicesInRange((const char*)idx, uint32_t(indexCount), uint32_t(count))) {
+				return fail("index out of range");
+			}
+			return chunk(0, count, data, idx, indexCount);
+		}
+
+		chunkVertices = std::max<size_t>(1, std::min<size_t>(chunkVertices, UINT32_MAX));
+		for (size_t first = 0; first < count; first += chunkVertices) {
+			if (!chunk(first, std::min(chunkVertices, count - first), data, NULL, 0)) { return false; }
+		}
+		return true;
+	}
+
+	bool VertexFileWriter::chunk(size_t first, size_t count, const GLfloat* const* data,
+								 const uint32_t* idx, size_t indexCount) {
+		FileChunk fc = {};
+		fc.firstVertex = vertices;
+		fc.vertexCount = uint32_t(count);
+		fc.indexCount = uint32_t(indexCount);
+		std::vector<uint64_t> offsets(attribs.size());
+
+		// bounds of the first attribute, on the floats
+		const int n0 = attribs[0].components;
+		for (int k = 0; k < 3; k++) {
+			fc.lo[k] = count && k < n0 ? data[0][first * n0 + k] : 0.0f;
+			fc.hi[k] = fc.lo[k];
+		}
+		for (size_t i = 0; i < count && n0 > 0; i++) {
+			const GLfloat* p = data[0] + (first + i) * n0;
+			for (int k = 0; k < std::min(n0, 3); k++) {
+				fc.lo[k] = std::min(fc.lo[k], p[k]);
+				fc.hi[k] = std::max(fc.hi[k], p[k]);
+			}
+		}
+
+		for (size_t a = 0; a < attribs.size(); a++) {
+			const VertexAttribute& attr = attribs[a];
+			if (!pad()) { return fail("write error"); }
+			offsets[a] = uint64_t(out.tellp());
+			const GLfloat* in = data[a] + first * attr.components;
+			if (attr.format == VertexFormat::Float) {
+				out.write((const char*)in, std::streamsize(count * attr.stride()));
+			} else {
+				packed.resize(count * attr.stride());
+				PackVertices(attr.format, attr.components, in, packed.data(), count);
+				out.write((const char*)packed.data(), std::streamsize(packed.size()));
+			}
+		}
+		if (!pad()) { return fail("write error"); }
+		fc.indexOffset = uint64_t(out.tellp());
+		if (indexCount > 0) { out.write((const char*)idx, std::streamsize(indexCount * sizeof(uint32_t))); }
+		if (!out) { return fail("write error"); }
+
+		size_t at = table.size();
+		table.resize(at + ChunkEntryBytes(attribs.size()));
+		memcpy(table.data() + at, &fc, sizeof(fc));
+		memcpy(table.data() + at + sizeof(fc), offsets.data(), offsets.size() * sizeof(uint64_t));
+
+		chunkCount++;
+		vertices += count;
+		indices += indexCount;
+		return true;
+	}
+
+	bool VertexFileWriter::close() {
+		if (closed) { return !failed; }
+		closed = true;
+
+		std::error_code ec;
+		if (!failed) {
+			// the table on an 8-byte boundary
+			static const char zeros[8] = {};
+			out.write(zeros, std::streamsize((8 - uint64_t(out.tellp()) % 8) % 8));
+
+			FileHeader h = {};
+			memcpy(h.magic, VertexFileMagic, sizeof(h.magic));
+			h.version = VertexFileVersion;
+			h.headerBytes = sizeof(h);
+			h.vertexCount = vertices;
+			h.indexCount = indices;
+			h.attributeCount = uint32_t(attribs.size());
+			h.chunkCount = chunkCount;
+			h.alignment = uint32_t(alignment);
+			h.primitive = mode;
+			h.tableOffset = uint64_t(out.tellp());
+			out.write(table.data(), std::streamsize(table.size()));
+			h.fileBytes = uint64_t(out.tellp());
+
+			out.seekp(0);
+			out.write((const char*)&h, sizeof(h));
+			out.close();
+			if (!out) { fail("write error"); }
+		}
+		if (out.is_open()) { out.close(); }
+
+		if (!failed) {
+			std::filesystem::rename(tmpPath, path, ec);
+			if (ec) { fail("cannot move the file into place"); }
+		}
+		if (failed) { std::filesystem::remove(tmpPath, ec); }
+		return !failed;
+	}
+
+}  // namespace Sand
@@ -0,0 +1,336 @@
+#include "vertex_format.h"
+#include "simd.h"
+#include <cstring>
+
+#if defined(SAND_SIMD_SSE) && defined(__F16C__)
+#	include <immintrin.h>
+#endif
+
+
+namespace Sand {
+
+	//
+	//  --- Scalar conversions ---
+	//
+	//  The SSE paths compute exactly these, lane by lane, so packed data does
+	//  not depend on how the library was built.
+	//
+
+	static inline uint32_t Bits(float f) { uint32_t u; memcpy(&u, &f, sizeof(u)); return u; }
+	static inline float Float(uint32_t u) { float f; memcpy(&f, &u, sizeof(f)); return f; }
+
+	static inline uint16_t FloatToHalf(float f) {
+		uint32_t x = Bits(f);
+		uint32_t sign = x & 0x80000000u;
+		x ^= sign;
+
+		uint32_t h;
+		if (x >= (127u + 16) << 23) {
+			// rounds past 65504, infinity, or NaN (kept quiet)
+			h = x > 0x7F800000u ? 0x7E00 : 0x7C00;
+		} else if (x < (127u - 14) << 23) {
+			// subnormal half: adding 0.5 makes the FPU round the mantissa
+			const float magic = Float(((127u - 15) + (23 - 10) + 1) << 23);
+			h = Bits(Float(x) + magic) - Bits(magic);
+		} else {
+			// rebias the exponent; 0xFFF plus the lowest kept bit rounds to even
+			h = (x + 0xFFF + ((x >> 13) & 1) - ((127u - 15) << 23)) >> 13;
+		}
+		return uint16_t(h | sign >> 16);
+	}
+
+	static inline float HalfToFloat(uint16_t h) {
+		const float magic = Float((254u - 15) << 23);
+		uint32_t em = h & 0x7FFFu;
+		uint32_t bits = Bits(Float(em << 13) * magic);
+		if (em > 0x7BFF) { bits |= 255u << 23; }   // infinity or NaN
+		return Float(bits | uint32_t(h & 0x8000u) << 16);
+	}
+
+	// min/max with the SSE operand order: NaN clamps to lo
+	static inline float Clamp(float x, float lo, float hi) {
+		x = x > lo ? x : lo;
+		return x < hi ? x : hi;
+	}
+
+	static inline int32_t Quantize(float x, float lo, float hi, float scale) {
+		return int32_t(std::nearbyint(Clamp(x, lo, hi) * scale));
+	}
+
+	static const float Snorm16Scale = 32767.0f, Unorm16Scale = 65535.0f;
+	static const float Snorm10Scale = 511.0f, Unorm10Scale = 1023.0f;
+
+
+	//
+	//  --- Element-wise kernels ---
+	//
+
+	void PackHalf(const GLfloat* in, uint16_t* out, size_t count) {
+		size_t i = 0;
+#if defined(SAND_SIMD_SSE) && defined(__F16C__)
+		for (; i + 4 <= count; i += 4) {
+			__m128i h = _mm_cvtps_ph(_mm_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+			_mm_storel_epi64((__m128i*)(out + i), h);
+		}
+#elif defined(SAND_SIMD_SSE)
+		const __m128i f16max = _mm_set1_epi32((127 + 16) << 23);
+		const __m128i minNormal = _mm_set1_epi32((127 - 14) << 23);
+		const __m128i subnormMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+		const __m128i normalBias = _mm_set1_epi32(0xFFF - ((127 - 15) << 23));
+		const __m128i infinity = _mm_set1_epi32(0x7C00), nanBit = _mm_set1_epi32(0x200);
+
+		for (; i + 8 <= count; i += 8) {
+			__m128i res[2];
+			for (int k = 0; k < 2; k++) {
+				__m128 f = _mm_loadu_ps(in + i + 4 * k);
+				__m128 sign = _mm_and_ps(f, _mm_set1_ps(-0.0f));
+				__m128 absf = _mm_xor_ps(f, sign);
+				__m128i x = _mm_castps_si128(absf);
+
+				__m128i special = _mm_or_si128(infinity,
+					_mm_and_si128(_mm_castps_si128(_mm_cmpunord_ps(absf, absf)), nanBit));
+				__m128i subnormal = _mm_sub_epi32(
+					_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(subnormMagic))), subnormMagic);
+				__m128i odd = _mm_srai_epi32(_mm_slli_epi32(x, 31 - 13), 31);   // -1 when bit 13 is set
+				__m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(x, normalBias), odd), 13);
+
+				__m128i isSub = _mm_cmpgt_epi32(minNormal, x);
+				__m128i isRegular = _mm_cmpgt_epi32(f16max, x);
+				__m128i h = _mm_or_si128(_mm_and_si128(isSub, subnormal), _mm_andnot_si128(isSub, normal));
+				h = _mm_or_si128(_mm_and_si128(isRegular, h), _mm_andnot_si128(isRegular, special));
+
+				// the sign lands in bit 15 and above, so the signed pack keeps 16 bits
+				res[k] = _mm_or_si128(h, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+			}
+			_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(res[0], res[1]));
+		}
+#endif
+		for (; i < count; i++) { out[i] = FloatToHalf(in[i]); }
+	}
+
+	void UnpackHalf(const uint16_t* in, GLfloat* out, size_t count) {
+		size_t i = 0;
+#if defined(SAND_SIMD_SSE) && defined(__F16C__)
+		for (; i + 4 <= count; i += 4) {
+			_mm_storeu_ps(out + i, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(in + i))));
+		}
+#elif defined(SAND_SIMD_SSE)
+		const __m128i noSign = _mm_set1_epi32(0x7FFF), wasInfNan = _mm_set1_epi32(0x7BFF);
+		const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23));
+		const __m128 infNanExp = _mm_castsi128_ps(_mm_set1_epi32(255 << 23));
+		const __m128i zero = _mm_setzero_si128();
+
+		for (; i + 8 <= count; i += 8) {
+			__m128i h8 = _mm_loadu_si128((const __m128i*)(in + i));
+			__m128i halves[2] = {_mm_unpacklo_epi16(h8, zero), _mm_unpackhi_epi16(h8, zero)};
+			for (int k = 0; k < 2; k++) {
+				__m128i em = _mm_and_si128(halves[k], noSign);
+				__m128i sign = _mm_slli_epi32(_mm_xor_si128(halves[k], em), 16);
+				__m128 f = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(em, 13)), magic);
+				__m128 special = _mm_and_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(em, wasInfNan)), infNanExp);
+				_mm_storeu_ps(out + i + 4 * k, _mm_or_ps(f, _mm_or_ps(special, _mm_castsi128_ps(sign))));
+			}
+		}
+#endif
+		for (; i < count; i++) { out[i] = HalfToFloat(in[i]); }
+	}
+
+	void PackSnorm16(const GLfloat* in, int16_t* out, size_t count) {
+		size_t i = 0;
+#if defined(SAND_SIMD_SSE)
+		const __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f), scale = _mm_set1_ps(Snorm16Scale);
+		for (; i + 8 <= count; i += 8) {
+			__m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi), scale));
+			__m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), lo), hi), scale));
+			_mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(a, b));
+		}
+#endif
+		for (; i < count; i++) { out[i] = int16_t(Quantize(in[i], -1.0f, 1.0f, Snorm16Scale)); }
+	}
+
+	void UnpackSnorm16(const int16_t* in, GLfloat* out, size_t count) {
+		const float inv = 1.0f / Snorm16Scale;
+		size_t i = 0;
+#if defined(SAND_SIMD_SSE)
+		const __m128 scale = _mm_set1_ps(inv), lo = _mm_set1_ps(-1.0f);
+		for (; i + 8 <= count; i += 8) {
+			__m128i s = _mm_loadu_si128((const __m128i*)(in + i));
+			__m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);   // sign-extended
+			__m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+			_mm_storeu_ps(out + i, _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(a), scale), lo));
+			_mm_storeu_ps(out + i + 4, _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(b), scale), lo));
+		}
+#endif
+		for (; i < count; i++) { out[i] = std::max(float(in[i]) * inv, -1.0f); }
+	}
+
+	void PackUnorm16(const GLfloat* in, uint16_t* out, size_t count) {
+		size_t i = 0;
+#if defined(SAND_SIMD_SSE)
+		const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(1.0f), scale = _mm_set1_ps(Unorm16Scale);
+		const __m128i bias = _mm_set1_epi32(32768);
+		for (; i + 8 <= count; i += 8) {
+			// SSE2 only packs signed: shift to [-32768, 32767] and flip the top bit back
+			__m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi), scale));
+			__m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), lo), hi), scale));
+			__m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias));
+			_mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(packed, _mm_set1_epi16(-32768)));
+		}
+#endif
+		for (; i < count; i++) { out[i] = uint16_t(Quantize(in[i], 0.0f, 1.0f, Unorm16Scale)); }
+	}
+
+	void UnpackUnorm16(const uint16_t* in, GLfloat* out, size_t count) {
+		const float inv = 1.0f / Unorm16Scale;
+		size_t i = 0;
+#if defined(SAND_SIMD_SSE)
+		const __m128 scale = _mm_set1_ps(inv);
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 8 <= count; i += 8) {
+			__m128i s = _mm_loadu_si128((const __m128i*)(in + i));
+			_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(s, zero)), scale));
+			_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(s, zero)), scale));
+		}
+#endif
+		for (; i < count; i++) { out[i] = float(in[i]) * inv; }
+	}
+
+
+	//
+	//  --- 10_10_10_2 ---
+	//
+	//  x in bits 0-9, y 10-19, z 20-29, w 30-31 (the _REV layouts).  Four
+	//  vertices are gathered into one register per component.
+	//
+
+	struct Format1010102 {
+		float lo, scale, wScale;
+		bool snorm;
+	};
+
+	static const Format1010102 Snorm1010102 = {-1.0f, Snorm10Scale, 1.0f, true};
+	static const Format1010102 Unorm1010102 = {0.0f, Unorm10Scale, 3.0f, false};
+
+	// vertex i, n components, as (x, y, z, w) with missing xyz 0 and w 1
+	static inline void Gather(const GLfloat* in, int n, size_t i, float v[4]) {
+		v[0] = v[1] = v[2] = 0.0f;
+		v[3] = 1.0f;
+		for (int k = 0; k < n; k++) { v[k] = in[i * n + k]; }
+	}
+
+	static inline uint32_t Pack1010102(const float v[4], const Format1010102& f) {
+		uint32_t res = 0;
+		for (int k = 0; k < 4; k++) {
+			float scale = k < 3 ? f.scale : f.wScale;
+			uint32_t q = uint32_t(Quantize(v[k], f.lo, 1.0f, scale));
+			res |= (k < 3 ? q & 0x3FFu : q & 3u) << (10 * k);
+		}
+		return res;
+	}
+
+	static inline void Unpack1010102(uint32_t p, const Format1010102& f, float v[4]) {
+		for (int k = 0; k < 4; k++) {
+			float scale = k < 3 ? f.scale : f.wScale;
+			int bits = k < 3 ? 10 : 2;
+			float c;
+			if (f.snorm) {
+				c = float(int32_t(p << (32 - bits - 10 * k)) >> (32 - bits));
+				v[k] = std::max(c * (1.0f / scale), -1.0f);
+			} else {
+				c = float((p >> (10 * k)) & ((1u << bits) - 1));
+				v[k] = c * (1.0f / scale);
+			}
+		}
+	}
+
+	static void Pack1010102(const Format1010102& f, int n, const GLfloat* in, uint32_t* out, size_t count) {
+		size_t i = 0;
+#if defined(SAND_SIMD_SSE)
+		const __m128 lo = _mm_set1_ps(f.lo), hi = _mm_set1_ps(1.0f);
+		const __m128 scale[4] = {_mm_set1_ps(f.scale), _mm_set1_ps(f.scale), _mm_set1_ps(f.scale),
+								 _mm_set1_ps(f.wScale)};
+		const __m128i mask[4] = {_mm_set1_epi32(0x3FF), _mm_set1_epi32(0x3FF), _mm_set1_epi32(0x3FF),
+								 _mm_set1_epi32(3)};
+		for (; i + 4 <= count; i += 4) {
+			alignas(16) float v[4][4];
+			for (int j = 0; j < 4; j++) { Gather(in, n, i + j, v[j]); }
+			__m128 c[4] = {_mm_load_ps(v[0]), _mm_load_ps(v[1]), _mm_load_ps(v[2]), _mm_load_ps(v[3])};
+			_MM_TRANSPOSE4_PS(c[0], c[1], c[2], c[3]);
+
+			__m128i res = _mm_setzero_si128();
+			for (int k = 0; k < 4; k++) {
+				__m128i q = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(c[k], lo), hi), scale[k]));
+				q = _mm_and_si128(q, mask[k]);
+				switch (k) {   // shift counts must be immediates
+					case 1: q = _mm_slli_epi32(q, 10); break;
+					case 2: q = _mm_slli_epi32(q, 20); break;
+					case 3: q = _mm_slli_epi32(q, 30); break;
+				}
+				res = _mm_or_si128(res, q);
+			}
+			_mm_storeu_si128((__m128i*)(out + i), res);
+		}
+#endif
+		for (; i < count; i++) {
+			float v[4];
+			Gather(in, n, i, v);
+			out[i] = Pack1010102(v, f);
+		}
+	}
+
+	static void Unpack1010102(const Format1010102& f, int n, const uint32_t* in, GLfloat* out, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			float v[4];
+			Unpack1010102(in[i], f, v);
+			for (int k = 0; k < n; k++) { out[i * n + k] = v[k]; }
+		}
+	}
+
+
+	//
+	//  --- Vertices ---
+	//
+
+	void PackVertices(VertexFormat f, int n, const GLfloat* in, void* out, size_t count) {
+		size_t values = count * size_t(n);
+		switch (f) {
+			case VertexFormat::Float: memcpy(out, in, values * sizeof(GLfloat)); break;
+			case VertexFormat::Half: PackHalf(in, (uint16_t*)out, values); break;
+			case VertexFormat::Snorm16: PackSnorm16(in, (int16_t*)out, values); break;
+			case VertexFormat::Unorm16: PackUnorm16(in, (uint16_t*)out, values); break;
+			case VertexFormat::Snorm10_10_10_2: Pack1010102(Snorm1010102, n, in, (uint32_t*)out, count); break;
+			case VertexFormat::Unorm10_10_10_2: Pack1010102(Unorm1010102, n, in, (uint32_t*)out, count); break;
+		}
+	}
+
+	void UnpackVertices(VertexFormat f, int n, const void* in, GLfloat* out, size_t count) {
+		size_t values = count * size_t(n);
+		switch (f) {
+			case VertexFormat::Float: memcpy(out, in, values * sizeof(GLfloat)); break;
+			case VertexFormat::Half: UnpackHalf((const uint16_t*)in, out, values); break;
+			case VertexFormat::Snorm16: UnpackSnorm16((const int16_t*)in, out, values); break;
+			case VertexFormat::Unorm16: UnpackUnorm16((const uint16_t*)in, out, values); break;
+			case VertexFormat::Snorm10_10_10_2: Unpack1010102(Snorm1010102, n, (const uint32_t*)in, out, count); break;
+			case VertexFormat::Unorm10_10_10_2: Unpack1010102(Unorm1010102, n, (const uint32_t*)in, out, count); break;
+		}
+	}
+
+	VertexAttribType AttribType(VertexFormat f, int n) {
+		switch (f) {
+			case VertexFormat::Float: break;
+			case VertexFormat::Half: return VertexAttribType{n, GL_HALF_FLOAT, GL_FALSE};
+			case VertexFormat::Snorm16: return VertexAttribType{n, GL_SHORT, GL_TRUE};
+			case VertexFormat::Unorm16: return VertexAttribType{n, GL_UNSIGNED_SHORT, GL_TRUE};
+			// always four components; the shader sees the ones it declares
+			case VertexFormat::Snorm10_10_10_2: return VertexAttribType{4, GL_INT_2_10_10_10_REV, GL_TRUE};
+			case VertexFormat::Unorm10_10_10_2: return VertexAttribType{4, GL_UNSIGNED_INT_2_10_10_10_REV, GL_TRUE};
+		}
+		return VertexAttribType{n, GL_FLOAT, GL_FALSE};
+	}
+
+	void VertexAttribPointer(GLuint index, int n, VertexFormat f, GLsizei stride, const GLvoid* offset) {
+		VertexAttribType t = AttribType(f, n);
+		glVertexAttribPointer(index, t.size, t.type, t.normalized, stride, offset);
+	}
+
+}  // namespace Sand
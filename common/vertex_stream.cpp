@@ -0,0 +1,152 @@
+#include "vertex_stream.h"
+#include "parallel.h"
+#include "profiler.h"
+
+
+namespace Sand {
+
+	VertexStream::VertexStream(int components, VertexFormat format, size_t chunkVertices,
+							   unsigned threads, size_t queueDepth)
+		: n(components), fmt(format), chunkSize(chunkVertices), stride(VertexBytes(format, components)),
+		  threadCount(ThreadCount(threads)), depth(std::max<size_t>(queueDepth, 1)) {}
+
+	void VertexStream::start(Producer produce, uint64_t chunks) {
+		stop();
+		next = 0;
+		stopping = false;
+		waits = 0;
+		total = chunks;
+		appended = 0;
+		count = 0;
+		m = Metrics();
+		appendCalls = 0;
+		latencySum = queuedSum = 0;
+
+		if (buf == 0) { glGenBuffers(1, &buf); }
+		glBindBuffer(GL_ARRAY_BUFFER, buf);
+		glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(chunks * chunkSize * stride), NULL, GL_STATIC_DRAW);
+
+		workers.clear();
+		unsigned threads = unsigned(std::min<uint64_t>(threadCount, std::max<uint64_t>(chunks, 1)));
+		for (unsigned t = 0; t < threads; t++) {
+			workers.emplace_back(new Worker(depth));
+			Worker& w = *workers.back();
+			for (Chunk& c : w.chunks) {
+				c.data.resize(chunkSize * stride);
+				w.empty.push(&c);
+			}
+		}
+		// the producer is shared: each thread copies it
+		for (auto& w : workers) {
+			Worker* worker = w.get();
+			worker->thread = std::thread([this, worker, produce]() { this->produce(*worker, produce); });
+		}
+	}
+
+	void VertexStream::produce(Worker& w, const Producer& f) {
+		SAND_PROFILE_THREAD("vertex stream");
+		std::vector<GLfloat> scratch(chunkSize * size_t(n));
+		for (;;) {
+			Chunk* c = NULL;
+			while (!w.empty.pop(c)) {
+				if (stopping.load(std::memory_order_relaxed)) { return; }
+				waits.fetch_add(1, std::memory_order_relaxed);
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+
+			uint64_t index = next.fetch_add(1);
+			if (index >= total || stopping.load(std::memory_order_relaxed)) { return; }
+
+			size_t produced;
+			{
+				SAND_PROFILE_SCOPE("VertexStream::produce");
+				produced = std::min(f(index, scratch.data()), chunkSize);
+				PackVertices(fmt, n, scratch.data(), c->data.data(), produced);
+			}
+			c->count = produced;
+			c->pushed = Clock::now();
+			w.full.push(c);     // never full: the worker only owns depth chunks
+		}
+	}
+
+	void VertexStream::stop() {
+		stopping = true;
+		for (auto& w : workers) {
+			if (w->thread.joinable()) { w->thread.join(); }
+		}
+	}
+
+	size_t VertexStream::append(double budget) {
+		SAND_PROFILE_SCOPE("VertexStream::append");
+		const Clock::time_point begin = Clock::now();
+		const Clock::time_point end = begin + std::chrono::duration_cast<Clock::duration>(
+			std::chrono::duration<double>(budget));
+
+		size_t queued = 0;
+		for (auto& w : workers) { queued += w->full.size(); }
+
+		glBindBuffer(GL_ARRAY_BUFFER, buf);
+		size_t added = 0;
+		bool any = true, late = false;
+		while (any && !late) {
+			any = false;
+			for (size_t k = 0; k < workers.size() && !late; k++) {
+				Worker& w = *workers[(rotate + k) % workers.size()];
+				Chunk* c;
+				if (!w.full.pop(c)) { continue; }
+				any = true;
+
+				glBufferSubData(GL_ARRAY_BUFFER, GLintptr(count * stride), GLsizeiptr(c->count * stride),
+								c->data.data());
+				Clock::time_point t = Clock::now();
+				double latency = std::chrono::duration<double>(t - c->pushed).count();
+				m.latency = latency;
+				m.maxLatency = std::max(m.maxLatency, latency);
+				latencySum += latency;
+
+				count += c->count;
+				added += c->count;
+				appended++;
+				m.chunks++;
+				m.vertices += c->count;
+				w.empty.push(c);
+				late = t >= end;
+			}
+			rotate++;
+		}
+
+		m.appendSeconds = std::chrono::duration<double>(Clock::now() - begin).count();
+		if (late) {
+			size_t left = 0;
+			for (auto& w : workers) { left += w->full.size(); }
+			if (left) { m.overBudget++; }
+		}
+		appendCalls++;
+		queuedSum += double(queued);
+		m.queued = queued;
+		m.maxQueued = std::max(m.maxQueued, queued);
+		return added;
+	}
+
+	const VertexStream::Metrics& VertexStream::metrics() const {
+		m.meanQueued = appendCalls ? queuedSum / double(appendCalls) : 0;
+		m.meanLatency = m.chunks ? latencySum / double(m.chunks) : 0;
+		m.producerWaits = waits.load(std::memory_order_relaxed);
+		return m;
+	}
+
+	std::ostream& operator << (std::ostream& os, const VertexStream::Metrics& m) {
+		return os << m.vertices << " vertices in " << m.chunks << " chunks; queued " << m.queued
+				  << " (mean " << m.meanQueued << ", max " << m.maxQueued << "); latency "
+				  << m.latency * 1e3 << " ms (mean " << m.meanLatency * 1e3 << ", max "
+				  << m.maxLatency * 1e3 << "); " << m.overBudget << " appends over budget, "
+				  << m.producerWaits << " producer waits";
+	}
+
+	std::ostream& operator << (std::ostream& os, const FixedTimestep::Stats& s) {
+		return os << s.frames << " frames, " << s.steps << " steps; frame " << s.frameSeconds * 1e3
+				  << " ms (mean " << s.meanFrameSeconds * 1e3 << ", max " << s.maxFrameSeconds * 1e3
+				  << "); " << s.droppedSeconds << " s dropped";
+	}
+
+}  // namespace Sand
@@ -1,51 +1,231 @@
 #include "sand.h"
+#include "chaos.h"
+#include "command_buffer.h"
+#include "embedded_shaders.h"
+#include "profiler.h"
+#include "spatial_index.h"
+#include "vertex_stream.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+
+//
+//  example21 [stream [points]]: with "stream", worker threads compute the
+//  gasket (16M points by default) while it is drawn at a fixed 60 Hz,
+//  each frame adding what the workers finished within its upload budget.
+//
+//  Hovering shows the nearest point in the title bar; a click prints the
+//  five nearest and the count within PickPixels.  The points are indexed
+//  by a k-d tree (a background thread builds it while streaming).
+//
 
 const int num_points = 5000;
 
+// recorded once, replayed every frame
+CommandBuffer commands;
+
+bool streaming = false;
+size_t stream_points = size_t(1) << 24;
+VertexStream stream(2, VertexFormat::Snorm16, ChaosGame<2>::chunk);
+FixedTimestep pacing(1.0 / 60);
+
+// what vshader21.glsl applies to the points (nothing), and its inverse
+// for taking mouse positions back to point coordinates
+const mat<4> view_projection;
+mat<4> inverse_view_projection;
+
+const GLfloat PickPixels = 8;
+VertexArray<2> cpu_points;      // the drawn points, for readouts
+KdTree<2> picker;
+std::atomic<bool> picker_ready(false);
+std::atomic<bool> indexer_cancel(false);    // set by Esc, so exit need not wait
+std::thread indexer;
+uint32_t hovered = KdTree<2>::None;
+
 
 void init() {
-    std::array<vec<2>, num_points> points;
-    std::array<vec<2>, 3> vertices = {
+    SAND_PROFILE_SCOPE("init");
+    constexpr std::array<vec<2>, 3> vertices = {
         vec<2>(-1, -1), vec<2>(0, 1), vec<2>(1, -1)
     };
     
-    points[0] = vec<2>(0.25, 0.5);
-    
-    for(int i = 1; i < num_points; ++i) { 
-        int j = rand() % 3;
-        points[i] = (points[i-1] + vertices[j]) / 2.0;
-    }
+    // outlives init() for the stream's workers
+    static ChaosGame<2> game({vertices.begin(), vertices.end()}, 0.5);
+    game.set_start(vec<2>(0.25, 0.5));
     
 
     GLuint vao;
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
     
+    // the triangle spans [-1, 1]: snorm16 halves the buffer
     GLuint buffer;
-    glGenBuffers(1, &buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, buffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(points), points.data(), GL_STATIC_DRAW);
-    
-    GLuint program = InitShader("vshader21.glsl", "fshader21.glsl");
-    glUseProgram(program);
+    if (streaming) {
+        constexpr size_t chunk = ChaosGame<2>::chunk;
+        stream.start([](uint64_t c, GLfloat* out) {
+            thread_local VertexArray<2> part(chunk);
+            game.generate({part.component(0), part.component(1)}, c * chunk, chunk, 1);
+            part.interleave(out);
+            return chunk;
+        }, (stream_points + chunk - 1) / chunk);
+        buffer = stream.buffer();
+
+        // the same points on the CPU, generated again rather than kept
+        // back from the stream
+        size_t total = (stream_points + chunk - 1) / chunk * chunk;
+        indexer = std::thread([total] {
+            // in pieces, so a cancel is seen between them
+            const size_t piece = size_t(1) << 20;
+            cpu_points.resize(total);
+            for (size_t first = 0; first < total; first += piece) {
+                if (indexer_cancel) { return; }
+                game.generate({cpu_points.component(0) + first, cpu_points.component(1) + first},
+                              first, std::min(piece, total - first));
+            }
+            picker.build(cpu_points, 0, &indexer_cancel);
+            if (indexer_cancel) { return; }
+            std::cout << "indexed " << total << " points in " << picker.buildSeconds() * 1e3
+                      << " ms" << std::endl;
+            picker_ready = true;
+        });
+    } else {
+        cpu_points.resize(num_points);
+        game.generate(cpu_points);
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        cpu_points.upload(GL_ARRAY_BUFFER, GL_STATIC_DRAW, VertexFormat::Snorm16);
+        picker.build(cpu_points);
+        picker_ready = true;
+    }
+    inverse_view_projection = inverse(view_projection);
     
+    // compiled in by make, so the working directory does not matter
+    GLuint program = InitShader(shaders::vshader21_glsl, shaders::fshader21_glsl);
     GLuint loc = glGetAttribLocation(program, "vPosition");
-    glEnableVertexAttribArray(loc);
-    glVertexAttribPointer(loc, 2, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+
+    commands.useProgram(program);
+    commands.bindVertexArray(vao);
+    commands.bindBuffer(GL_ARRAY_BUFFER, buffer);
+    commands.enableVertexAttribArray(loc);
+    commands.vertexAttribPointer(loc, 2, VertexFormat::Snorm16);
+    if (streaming) {
+        // the draw changes every frame; the setup goes out now
+        commands.submit();
+    } else {
+        commands.drawArrays(GL_POINTS, 0, num_points);
+    }
     
     glClearColor(1.0, 1.0, 1.0, 1.0); // white background
+
+    if constexpr (Profiling) {
+        GetProfiler().enableGpu();
+        GetProfiler().capture();
+    }
 }
 
 
+bool ticking = false;   // a frame is scheduled
+
+void tick(int) {
+    ticking = false;
+    glutPostRedisplay();
+}
+
 void display() {
-    glClear(GL_COLOR_BUFFER_BIT);
-    glDrawArrays(GL_POINTS, 0, num_points);
+    {
+        SAND_PROFILE_SCOPE("display");
+        if (streaming) {
+            pacing.advance();                   // nothing to simulate yet: the steps set the pace
+            stream.append(pacing.step() / 4);   // a quarter of the frame for uploads
+            commands.clear();
+            commands.drawArrays(GL_POINTS, 0, GLsizei(stream.size()));
+        }
+        SAND_PROFILE_GPU_SCOPE("draw");
+        glClear(GL_COLOR_BUFFER_BIT);
+        commands.submit();     // the attribute setup only goes out once
+    }
     glFlush();
+    SAND_PROFILE_FRAME();
+
+    if (streaming && !stream.done() && !ticking) {
+        ticking = true;
+        glutTimerFunc(unsigned(pacing.untilNext() * 1e3), tick, 0);
+    }
+}
+
+// Window pixel (x, y), y down as GLUT gives it, in point coordinates
+vec<2> unproject(GLfloat x, GLfloat y) {
+    GLfloat w = GLfloat(glutGet(GLUT_WINDOW_WIDTH)), h = GLfloat(glutGet(GLUT_WINDOW_HEIGHT));
+    vec<3> p = Unproject(vec<3>(x + 0.5f, h - y - 0.5f, 0.5f), inverse_view_projection,
+                         vec<4>(0.0, 0.0, w, h));
+    return vec<2>(p[0], p[1]);
+}
+
+// PickPixels at (x, y) in point units
+GLfloat pickRadius(int x, int y) {
+    return length(unproject(GLfloat(x + PickPixels), GLfloat(y)) - unproject(GLfloat(x), GLfloat(y)));
+}
+
+void hover(int x, int y) {
+    if (!picker_ready) return;
+    uint32_t i = picker.nearest(unproject(GLfloat(x), GLfloat(y)), pickRadius(x, y));
+    if (i == hovered) return;
+    hovered = i;
+
+    std::string title = "Sierpinski Gasket";
+    if (i != KdTree<2>::None) {
+        vec<2> p = cpu_points[i];
+        title += " - point " + std::to_string(i) + " (" + std::to_string(p[0]) + ", "
+               + std::to_string(p[1]) + ")";
+    }
+    glutSetWindowTitle(title.c_str());
+}
+
+void mouse(int button, int state, int x, int y) {
+    if (button != GLUT_LEFT_BUTTON || state != GLUT_DOWN) return;
+    if (!picker_ready) {
+        std::cout << "still indexing" << std::endl;
+        return;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    vec<2> q = unproject(GLfloat(x), GLfloat(y));
+    GLfloat r = pickRadius(x, y);
+    std::vector<uint32_t> near, within;
+
+    auto t0 = Clock::now();
+    picker.nearest(q, 5, near);
+    auto t1 = Clock::now();
+    picker.radius(q, r, within);
+    auto t2 = Clock::now();
+
+    std::cout << "(" << q[0] << ", " << q[1] << "): " << within.size() << " points within "
+              << PickPixels << " px (" << std::chrono::duration<double>(t2 - t1).count() * 1e6
+              << " us), nearest (" << std::chrono::duration<double>(t1 - t0).count() * 1e6
+              << " us):" << std::endl;
+    for (uint32_t i : near) {
+        vec<2> p = cpu_points[i];
+        std::cout << "    " << i << " (" << p[0] << ", " << p[1] << ") at "
+                  << length(p - q) << std::endl;
+    }
 }
 
 void keyboard(unsigned char key, int x, int y) {
     switch(key) {
         case 033:
+            indexer_cancel = true;
+            if (indexer.joinable()) indexer.join();
+            std::cout << commands.stats() << std::endl;
+            if (streaming) {
+                stream.stop();      // before exit() destroys the game
+                std::cout << stream.metrics() << std::endl << pacing.stats() << std::endl;
+            }
+            if constexpr (Profiling) {
+                GetProfiler().report(std::cout);
+                GetProfiler().writeChromeTrace("example21.trace.json");
+            }
             exit(EXIT_SUCCESS);
             break;
     }
@@ -54,6 +234,10 @@ void keyboard(unsigned char key, int x, int y) {
 
 int main(int argc, char** argv) {
     glutInit(&argc, argv);
+    if (argc > 1 && strcmp(argv[1], "stream") == 0) {
+        streaming = true;
+        if (argc > 2) stream_points = std::strtoull(argv[2], NULL, 10);
+    }
     glutInitDisplayMode(GLUT_RGBA);
     glutInitWindowSize(512, 512);
     
@@ -67,6 +251,8 @@ int main(int argc, char** argv) {
     init();
     glutDisplayFunc(display);
     glutKeyboardFunc(keyboard);
+    glutMouseFunc(mouse);
+    glutPassiveMotionFunc(hover);
 
     glutMainLoop();
     return 0;
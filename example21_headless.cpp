@@ -0,0 +1,100 @@
+#include "sand.h"
+#include "chaos.h"
+#include "softraster.h"
+#include "ifs_density.h"
+#include <cstdlib>
+
+//
+//  example21 without a window: the same Sierpinski gasket drawn by the
+//  software rasterizer into sierpinski_points.{ppm,png}, plus the filled
+//  gasket as recursively subdivided triangles in sierpinski_triangles.*,
+//  and the chaos game run for `iterations` more steps as a log-density
+//  histogram in sierpinski_density.*.  Output is identical for any thread
+//  count, so the images double as regression references.
+//
+//  usage: example21_headless [points] [threads] [iterations]
+//
+
+const int width = 512, height = 512;
+
+
+// Recursive subdivision of abc into 3^depth triangles
+void divide(const vec<2>& a, const vec<2>& b, const vec<2>& c, int depth,
+            std::vector<GLfloat>& out) {
+    if (depth == 0) {
+        for (const vec<2>* p : {&a, &b, &c}) {
+            out.push_back((*p)[0]);
+            out.push_back((*p)[1]);
+        }
+        return;
+    }
+    vec<2> ab = (a + b) / 2, bc = (b + c) / 2, ca = (c + a) / 2;
+    divide(a, ab, ca, depth - 1, out);
+    divide(ab, b, bc, depth - 1, out);
+    divide(ca, bc, c, depth - 1, out);
+}
+
+void report(const char* what, size_t count, const SoftRaster::Stats& st) {
+    std::cout << what << ": " << count << " in " << st.seconds * 1e3 << " ms, "
+              << count / st.seconds * 1e-6 << " M/s" << std::endl;
+}
+
+
+int main(int argc, char** argv) {
+    size_t num_points = argc > 1 ? std::strtoull(argv[1], NULL, 10) : 5000;
+    unsigned threads = argc > 2 ? unsigned(std::atoi(argv[2])) : 0;
+    uint64_t iterations = argc > 3 ? std::strtoull(argv[3], NULL, 10) : uint64_t(1) << 24;
+
+    constexpr std::array<vec<2>, 3> vertices = {
+        vec<2>(-1, -1), vec<2>(0, 1), vec<2>(1, -1)
+    };
+
+    VertexArray<2> points(num_points);
+    ChaosGame<2> game({vertices.begin(), vertices.end()}, 0.5);
+    game.set_start(vec<2>(0.25, 0.5));
+    game.generate(points, threads);
+
+    std::vector<GLfloat> packed(points.size() * 2);
+    points.interleave(packed.data());
+
+    SoftRaster raster(width, height, threads);
+    raster.clear(vec<4>(1.0, 1.0, 1.0, 1.0));   // white background
+    raster.setColor(vec<4>(1.0, 0.0, 0.0, 1.0)); // red, as fshader21.glsl
+    raster.drawArrays(GL_POINTS, packed.data(), 2, 0, num_points);
+    report("points", num_points, raster.stats());
+
+    if (!raster.writePPM("sierpinski_points.ppm") || !raster.writePNG("sierpinski_points.png"))
+        exit(EXIT_FAILURE);
+
+    std::vector<GLfloat> tris;
+    divide(vertices[0], vertices[1], vertices[2], 6, tris);
+
+    raster.resetStats();
+    raster.clear(vec<4>(1.0, 1.0, 1.0, 1.0));
+    raster.drawArrays(GL_TRIANGLES, tris.data(), 2, 0, tris.size() / 2);
+    report("triangles", raster.stats().triangles, raster.stats());
+
+    if (!raster.writePPM("sierpinski_triangles.ppm") || !raster.writePNG("sierpinski_triangles.png"))
+        exit(EXIT_FAILURE);
+
+    // the chaos-game step toward vertex v is the map p -> (p + v) / 2
+    std::vector<AffineMap> maps;
+    for (const vec<2>& v : vertices)
+        maps.push_back({mat<3>(0.5, 0.0, v[0] / 2,
+                               0.0, 0.5, v[1] / 2,
+                               0.0, 0.0, 1.0)});
+
+    IfsDensity density(maps, width, height);
+    density.run(iterations, threads);
+    const IfsDensity::Stats& st = density.stats();
+    std::cout << "density: " << st.iterations << " iterations in " << st.seconds * 1e3 << " ms ("
+              << st.mergeSeconds * 1e3 << " ms merging), " << st.iterations / st.seconds * 1e-6
+              << " M/s" << std::endl;
+
+    const vec<4> white(1.0, 1.0, 1.0, 1.0), red(1.0, 0.0, 0.0, 1.0);
+    if (!density.writePPM("sierpinski_density.ppm", white, red, 2.2)
+            || !density.writePNG("sierpinski_density.png", white, red, 2.2))
+        exit(EXIT_FAILURE);
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef __ALLOC_TRACKER_H__
+#define __ALLOC_TRACKER_H__
+
+#include <cstddef>
+
+namespace Sand {
+
+//
+//  Heap allocation accounting.
+//
+//  Built with -DSAND_TRACK_ALLOCATIONS, common/alloc_tracker.cpp replaces
+//  the global operator new and delete (every form) with versions that
+//  count calls and bytes per thread.  Otherwise nothing is hooked and
+//  every count reads zero.
+//
+//  AllocationScope measures a region of the calling thread: a frame, a
+//  draw, or one call that must not allocate.
+//
+//      {
+//          AllocationScope frame("frame");
+//          ...
+//          if (frame.counts().allocations) ...
+//      }
+//
+//      SAND_NO_ALLOCATIONS("LookAt");   // exits if the rest of the block
+//      mat<4> m = LookAt(eye, at, up);  // allocates, in tracking builds
+//
+
+#ifdef SAND_TRACK_ALLOCATIONS
+constexpr bool TrackingAllocations = true;
+#else
+constexpr bool TrackingAllocations = false;
+#endif
+
+struct AllocationCounts {
+    size_t allocations = 0, frees = 0;
+    size_t bytes = 0;       // requested by the allocations
+};
+
+// Totals for the calling thread since it started
+AllocationCounts ThreadAllocations();
+
+class AllocationScope {
+public:
+    // fatal: report and exit at the end of the scope if anything allocated
+    explicit AllocationScope(const char* name, bool fatal = false)
+        : name(name), fatal(fatal), start(ThreadAllocations()) {}
+    ~AllocationScope();
+
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator = (const AllocationScope&) = delete;
+
+    // Since construction
+    AllocationCounts counts() const;
+
+private:
+    const char* name;
+    bool fatal;
+    AllocationCounts start;
+};
+
+} // namespace Sand
+
+#define SAND_ALLOCATION_CAT2(a, b) a##b
+#define SAND_ALLOCATION_CAT(a, b) SAND_ALLOCATION_CAT2(a, b)
+
+#ifdef SAND_TRACK_ALLOCATIONS
+#   define SAND_NO_ALLOCATIONS(name) \
+        Sand::AllocationScope SAND_ALLOCATION_CAT(sandNoAlloc, __LINE__)(name, true)
+#else
+#   define SAND_NO_ALLOCATIONS(name) ((void)0)
+#endif
+
+#endif // __ALLOC_TRACKER_H__
@@ -0,0 +1,117 @@
+#ifndef __CHAOS_H__
+#define __CHAOS_H__
+
+#include "sand.h"
+#include "philox.h"
+#include "vertex_array.h"
+#include "parallel.h"
+#include <cmath>
+
+namespace Sand {
+
+//
+//  Chaos-game point generator (the Sierpinski gasket of example21 and any
+//  other vertex set).
+//
+//  Point 0 is the start point.  Point i moves `ratio` of the way from point
+//  i-1 toward vertex Philox::below(rng.word(i), vertices.size()), so every
+//  choice is a pure function of (seed, i).
+//
+//  The sequence is cut into fixed chunks that worker threads claim from a
+//  shared counter.  A chunk does not wait for its predecessor: it replays
+//  the few steps before its first point starting from the start point.
+//  Each step contracts the error by (1 - ratio), and `warmup` is picked so
+//  the replayed history is exact to far below float precision.  Chunk
+//  boundaries never depend on the thread count, so the output is
+//  bit-identical whether it is produced by one thread or sixty-four.
+//
+//  Output goes to caller memory, one stream per component (the layout of
+//  VertexArray<D>), so hundreds of millions of points never touch the stack.
+//
+
+template<int D>
+class ChaosGame {
+    std::vector<vec<D>> vertices;
+    vec<D> start;
+    GLfloat ratio;
+    Philox rng;
+    size_t warmup;
+
+    void run(const std::array<GLfloat*, D>& out, size_t first,
+             size_t begin, size_t end) const;
+
+public:
+    static constexpr size_t chunk = size_t(1) << 16;
+
+    ChaosGame(const std::vector<vec<D>>& vertices, GLfloat ratio = GLfloat(0.5),
+              uint64_t seed = 0)
+        : vertices(vertices), start(vertices.empty() ? vec<D>() : vertices[0]),
+          ratio(ratio), rng(seed) {
+        // contract the replayed history below 2^-48
+        GLfloat c = std::fabs(GLfloat(1.0) - ratio);
+        warmup = c <= GLfloat(0.0) ? 1
+            : c >= GLfloat(1.0) ? chunk
+            : std::min(chunk, size_t(std::ceil(-48.0 / std::log2(c))));
+    }
+
+    void set_start(const vec<D>& p) { start = p; }
+
+    // Points [first, first + count) into out[k][0 .. count)
+    void generate(const std::array<GLfloat*, D>& out, size_t first, size_t count,
+                  unsigned threads = 0) const;
+
+    // Fills points[0 .. size())
+    void generate(VertexArray<D>& points, unsigned threads = 0) const {
+        std::array<GLfloat*, D> out;
+        for (int k = 0; k < D; k++) out[k] = points.component(k);
+        generate(out, 0, points.size(), threads);
+    }
+};
+
+
+// Points [begin, end) of one chunk, written at out[k][i - first]
+template<int D>
+void ChaosGame<D>::run(const std::array<GLfloat*, D>& out, size_t first,
+                       size_t begin, size_t end) const {
+    const uint32_t nv = uint32_t(vertices.size());
+    const GLfloat t = ratio;
+
+    GLfloat p[D];
+    for (int k = 0; k < D; k++) p[k] = start[k];
+
+    if (begin == 0) {
+        for (int k = 0; k < D; k++) out[k][0] = p[k];
+        begin = 1;
+    }
+
+    // replay from the same place whichever range asked for this chunk
+    size_t base = begin - begin % chunk;
+    size_t i = base > warmup ? base - warmup : 1;
+
+    Philox::block r = rng(i >> 2);
+    for (; i < end; i++) {
+        if ((i & 3) == 0) r = rng(i >> 2);
+        const vec<D>& v = vertices[Philox::below(r[i & 3], nv)];
+        for (int k = 0; k < D; k++) p[k] += (v[k] - p[k]) * t;
+        if (i >= begin)
+            for (int k = 0; k < D; k++) out[k][i - first] = p[k];
+    }
+}
+
+template<int D>
+void ChaosGame<D>::generate(const std::array<GLfloat*, D>& out, size_t first,
+                            size_t count, unsigned threads) const {
+    if (count == 0 || vertices.empty()) return;
+
+    const size_t last = first + count;
+    const size_t c0 = first / chunk, c1 = (last - 1) / chunk + 1;
+
+    ParallelFor(c1 - c0, threads, [&](size_t i, unsigned) {
+        size_t c = c0 + i;
+        run(out, first, std::max(first, c * chunk), std::min(last, (c + 1) * chunk));
+    });
+}
+
+} // namespace Sand
+
+#endif // __CHAOS_H__
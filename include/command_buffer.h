@@ -0,0 +1,281 @@
+#ifndef __COMMAND_BUFFER_H__
+#define __COMMAND_BUFFER_H__
+
+#include "sand.h"
+#include "vertex_format.h"
+#include <cstdint>
+#include <string>
+
+namespace Sand {
+
+//
+//  Recorded GL commands.
+//
+//  A CommandBuffer takes the calls an app would make directly, under the
+//  same names, and replays them later with the redundant ones left out:
+//
+//      CommandBuffer cb;
+//      cb.useProgram(program);
+//      cb.bindVertexArray(vao);
+//      cb.uniform(mvLoc, modelView);
+//      cb.drawArrays(GL_TRIANGLES, 0, n);
+//      ...
+//      cb.sort();          // optional: group draws by program, VAO, texture
+//      cb.submit();
+//
+//  Binding calls (program, VAO, textures) and uniforms are not stored as
+//  they come: they update the state the buffer tracks, and each draw is
+//  stored with the state it needs, in a 48-byte record in a linear buffer.
+//  Texture bindings and uniform values are kept once per distinct set and
+//  shared by the draws that use them.  Because every draw carries its own
+//  state, sort() may reorder draws; it keeps the recorded order across
+//  setup commands (buffer bindings, vertex attribute setup) and barrier().
+//
+//  submit() tracks what GL holds and issues only the calls that change
+//  it.  Bindings are assumed unknown at the start of every submit(), so
+//  other code may bind between frames; what lives in objects (uniforms of
+//  programs, attribute setup of VAOs) is remembered across submits until
+//  invalidate().  State recorded after the last draw that needs it is
+//  dropped.
+//
+//  A sorted draw runs with the uniforms set before it in the buffer; one
+//  that relies on a value set outside the buffer may see a value that a
+//  draw recorded after it set.  Set every uniform a draw reads in the
+//  buffer, or do not sort().
+//
+//  Replay goes through a GLDispatch, GL by default; RecordingGL logs the
+//  calls instead (or as well), to check what a buffer sends.
+//
+
+enum class UniformType : uint8_t { Int, Float, Vec2, Vec3, Vec4, Mat3, Mat4 };
+
+// The GL entry points a CommandBuffer replays through
+class GLDispatch {
+public:
+    virtual ~GLDispatch() = default;
+
+    virtual void useProgram(GLuint program) = 0;
+    virtual void bindVertexArray(GLuint vao) = 0;
+    virtual void activeTexture(GLenum unit) = 0;
+    virtual void bindTexture(GLenum target, GLuint texture) = 0;
+    virtual void bindBuffer(GLenum target, GLuint buffer) = 0;
+    virtual void enableVertexAttribArray(GLuint index) = 0;
+    virtual void disableVertexAttribArray(GLuint index) = 0;
+    virtual void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+                                     GLsizei stride, const GLvoid* offset) = 0;
+    // one glUniform*v call for a value of type t; matrices are row-major
+    // (transpose = GL_TRUE), as mat<N> stores them
+    virtual void uniform(GLint location, UniformType t, const void* value) = 0;
+    virtual void drawArrays(GLenum mode, GLint first, GLsizei count) = 0;
+    virtual void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* offset) = 0;
+};
+
+// Calls GL
+GLDispatch& GetGL();
+
+// Logs every call as text, "glUseProgram(3)", and passes it on to
+// forward if there is one
+class RecordingGL : public GLDispatch {
+public:
+    explicit RecordingGL(GLDispatch* forward = NULL) : forward(forward) {}
+
+    std::vector<std::string> calls;
+
+    // Calls of one entry point, "glBindVertexArray"
+    size_t count(const std::string& name) const;
+    void clear() { calls.clear(); }
+
+    void useProgram(GLuint program) override;
+    void bindVertexArray(GLuint vao) override;
+    void activeTexture(GLenum unit) override;
+    void bindTexture(GLenum target, GLuint texture) override;
+    void bindBuffer(GLenum target, GLuint buffer) override;
+    void enableVertexAttribArray(GLuint index) override;
+    void disableVertexAttribArray(GLuint index) override;
+    void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+                             GLsizei stride, const GLvoid* offset) override;
+    void uniform(GLint location, UniformType t, const void* value) override;
+    void drawArrays(GLenum mode, GLint first, GLsizei count) override;
+    void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* offset) override;
+
+private:
+    GLDispatch* forward;
+};
+
+
+class CommandBuffer {
+public:
+    static constexpr unsigned TextureUnits = 16;
+
+    struct Stats {
+        size_t recorded = 0;    // calls made on the buffer, draws included
+        size_t draws = 0;
+        size_t issued = 0;      // GL calls made by the last submit()
+        size_t elided() const { return recorded > issued ? recorded - issued : 0; }
+    };
+
+    CommandBuffer() = default;
+
+    // Empties the buffer, keeping its memory.  The recorded bindings and
+    // uniforms carry over, as they would in GL.
+    void clear();
+
+    //
+    //  --- state ---
+    //
+
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    // unit: 0 for GL_TEXTURE0; one texture per unit is tracked, so binding
+    // another target on a unit replaces the first
+    void bindTexture(unsigned unit, GLenum target, GLuint texture);
+
+    // Uniforms of the current program
+    void uniform(GLint location, GLint v);
+    void uniform(GLint location, GLfloat v);
+    // a double literal (0.5) goes to the float uniform, as GLfloat(v)
+    void uniform(GLint location, GLdouble v);
+    void uniform(GLint location, const vec<2>& v);
+    void uniform(GLint location, const vec<3>& v);
+    void uniform(GLint location, const vec<4>& v);
+    void uniform(GLint location, const mat<3>& m);
+    void uniform(GLint location, const mat<4>& m);
+
+    //
+    //  --- setup: replayed in place ---
+    //
+
+    void bindBuffer(GLenum target, GLuint buffer);
+    void enableVertexAttribArray(GLuint index);
+    void disableVertexAttribArray(GLuint index);
+    void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized,
+                             GLsizei stride = 0, const GLvoid* offset = BUFFER_OFFSET(0));
+    // ... for n components stored as f, as Sand::VertexAttribPointer
+    void vertexAttribPointer(GLuint index, int n, VertexFormat f, GLsizei stride = 0,
+                             const GLvoid* offset = BUFFER_OFFSET(0)) {
+        VertexAttribType t = AttribType(f, n);
+        vertexAttribPointer(index, t.size, t.type, t.normalized, stride, offset);
+    }
+
+    // Draws are not moved across a barrier
+    void barrier();
+
+    //
+    //  --- draws ---
+    //
+
+    void drawArrays(GLenum mode, GLint first, GLsizei count);
+    void drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* offset = BUFFER_OFFSET(0));
+
+    // Orders the draws between setup commands by program, VAO, textures
+    // and uniforms, keeping the recorded order among equals
+    void sort();
+
+    // Replays the buffer; it stays recorded, for the next frame
+    void submit(GLDispatch& gl = GetGL());
+
+    // Forgets what GL is known to hold, after GL calls made around the
+    // buffer that change uniforms or VAOs
+    void invalidate();
+
+    const Stats& stats() const { return st; }
+    size_t bytes() const { return words.size() * sizeof(uint32_t); }
+
+private:
+    static constexpr uint32_t None = ~uint32_t(0);
+
+    struct UniformValue {
+        GLint location;
+        UniformType type;
+        uint32_t data[16];      // the GLint or GLfloats, as bits
+    };
+
+    struct TextureBinding {
+        GLenum target = 0;      // 0: none recorded (replay: unknown)
+        GLuint texture = 0;
+        bool operator == (const TextureBinding& b) const { return target == b.target && texture == b.texture; }
+        bool operator != (const TextureBinding& b) const { return !(*this == b); }
+    };
+    typedef std::array<TextureBinding, TextureUnits> TextureSet;
+
+    struct UniformSet {
+        uint32_t first, count;  // in uniformPool
+    };
+
+    struct ProgramState {
+        GLuint program;
+        std::vector<UniformValue> values;   // sorted by location
+        uint32_t set;                       // the UniformSet of values, None if changed since
+    };
+
+    struct AttribState {
+        GLuint index;
+        int enabled = -1;                   // -1: unknown
+        bool pointerKnown = false;
+        GLuint buffer = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        GLboolean normalized = GL_FALSE;
+        GLsizei stride = 0;
+        const GLvoid* offset = NULL;
+    };
+
+    struct VaoState {
+        GLuint vao;
+        GLuint elementBuffer = None;
+        std::vector<AttribState> attribs;
+    };
+
+    struct SortItem {
+        uint32_t program, vao;
+        uint64_t textures;                  // hash of the texture set
+        uint32_t uniforms;
+        size_t at;
+    };
+
+    // the linear buffer: commands of a header word and their arguments
+    std::vector<uint32_t> words;
+    std::vector<size_t> order;              // word offsets of the commands, in replay order
+    std::vector<TextureSet> textureSets;
+    std::vector<uint64_t> textureHashes;
+    std::vector<UniformSet> uniformSets;
+    std::vector<UniformValue> uniformPool;
+    std::vector<SortItem> sortItems;        // scratch
+
+    // recording: the state the calls so far leave
+    GLuint program = 0, vao = 0, arrayBuffer = 0;
+    TextureSet textures;
+    uint32_t textureSet = None;             // index of textures, None if changed since
+    std::vector<ProgramState> programs;
+
+    // replay: what GL holds
+    uint32_t glProgram = None, glVao = None, glUnit = None;
+    TextureSet glTextures;
+    std::vector<std::pair<GLenum, GLuint>> glBuffers;   // bindings outside VAOs
+    std::vector<ProgramState> glPrograms;
+    std::vector<VaoState> glVaos;
+
+    Stats st;
+
+    template<typename Cmd> void append(const Cmd& c);
+    template<typename Cmd> Cmd read(size_t at) const;
+    void setUniform(GLint location, UniformType t, const void* value);
+    void draw(GLenum mode, GLint first, GLsizei count, GLenum indexType, const GLvoid* offset);
+
+    static ProgramState& programState(std::vector<ProgramState>& list, GLuint program);
+    VaoState& vaoState(GLuint vao);
+    static AttribState& attribState(VaoState& v, GLuint index);
+    void bindVao(GLDispatch& gl, GLuint vao);
+    void bindBufferNow(GLDispatch& gl, GLenum target, GLuint buffer);
+    void replayDraw(GLDispatch& gl, size_t at);
+    void replaySetup(GLDispatch& gl, size_t at);
+};
+
+// Values (GLints or GLfloats) in a uniform of type t
+size_t UniformSize(UniformType t);     // floats (or ints) in a value
+
+std::ostream& operator << (std::ostream& os, const CommandBuffer::Stats& s);
+
+} // namespace Sand
+
+#endif // __COMMAND_BUFFER_H__
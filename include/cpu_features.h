@@ -0,0 +1,45 @@
+#ifndef __CPU_FEATURES_H__
+#define __CPU_FEATURES_H__
+
+#include <string>
+
+namespace Sand {
+
+//
+//  Instruction sets for run-time dispatch.
+//
+//  The build targets the baseline (simd.h: SSE2 on x86-64, NEON on ARM);
+//  kernels that gain from wider registers or FMA carry extra versions
+//  compiled for one instruction set each, and pick one per call from
+//  ActiveIsa().  That is the best level the CPU (and the OS, for the AVX
+//  register state) supports, lowered by $SAND_ISA (baseline, sse4.1,
+//  avx2, avx512) or ForceIsa(), so every path can be run and compared on
+//  one machine.
+//
+//  Levels are cumulative: AVX2 here means AVX2 and FMA, AVX512 means
+//  AVX-512F on top of them.  Builds for other CPUs or compilers only have
+//  the baseline.
+//
+
+enum class Isa { Baseline, SSE41, AVX2, AVX512 };
+
+// What this CPU supports
+Isa DetectIsa();
+
+// What dispatched kernels use
+Isa ActiveIsa();
+
+// Makes kernels use isa; false (and no change) if the CPU lacks it
+bool ForceIsa(Isa isa);
+
+// Back to DetectIsa(), ignoring $SAND_ISA
+void ResetIsa();
+
+const char* IsaName(Isa isa);
+
+// "baseline", "sse4.1", "avx2", "avx512"; false if name is none of them
+bool ParseIsa(const std::string& name, Isa& isa);
+
+} // namespace Sand
+
+#endif // __CPU_FEATURES_H__
@@ -0,0 +1,93 @@
+#ifndef __CTMATH_H__
+#define __CTMATH_H__
+
+//
+//  sqrt, sin, cos and tan usable in constant expressions.
+//
+//  At run time these forward to <cmath> exactly as the library always has;
+//  during constant evaluation they use range reduction plus a Taylor
+//  series (and Newton's method for sqrt) in double precision, so rotation
+//  and projection matrices can be baked into .rodata.
+//
+
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+namespace Sand {
+namespace ct {
+
+namespace detail {
+
+constexpr double pi = 3.14159265358979323846;
+
+// x - 2*pi*k into [-pi, pi]
+constexpr double reduce(double x) {
+    double k = x / (2.0 * pi);
+    long long n = static_cast<long long>(k >= 0.0 ? k + 0.5 : k - 0.5);
+    return x - static_cast<double>(n) * (2.0 * pi);
+}
+
+constexpr double sin_series(double x) {
+    double term = x, sum = x;
+    for (int i = 1; i < 16; i++) {
+        term *= -x * x / ((2.0 * i) * (2.0 * i + 1.0));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double cos_series(double x) {
+    double term = 1.0, sum = 1.0;
+    for (int i = 1; i < 16; i++) {
+        term *= -x * x / ((2.0 * i - 1.0) * (2.0 * i));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double sqrt_newton(double x) {
+    if (!(x >= 0.0)) return std::numeric_limits<double>::quiet_NaN();
+    if (x == 0.0 || x == std::numeric_limits<double>::infinity()) return x;
+    // start above the root; the iteration then decreases monotonically
+    double r = x > 1.0 ? x : 1.0;
+    for (;;) {
+        double next = 0.5 * (r + x / r);
+        if (next >= r) return r;
+        r = next;
+    }
+}
+
+} // namespace detail
+
+
+constexpr GLfloat sqrt(const GLfloat x) {
+    if (std::is_constant_evaluated())
+        return static_cast<GLfloat>(detail::sqrt_newton(x));
+    return std::sqrt(x);
+}
+
+constexpr GLfloat sin(const GLfloat x) {
+    if (std::is_constant_evaluated())
+        return static_cast<GLfloat>(detail::sin_series(detail::reduce(x)));
+    return std::sin(static_cast<double>(x));
+}
+
+constexpr GLfloat cos(const GLfloat x) {
+    if (std::is_constant_evaluated())
+        return static_cast<GLfloat>(detail::cos_series(detail::reduce(x)));
+    return std::cos(static_cast<double>(x));
+}
+
+constexpr GLfloat tan(const GLfloat x) {
+    if (std::is_constant_evaluated()) {
+        double r = detail::reduce(x);
+        return static_cast<GLfloat>(detail::sin_series(r) / detail::cos_series(r));
+    }
+    return std::tan(static_cast<double>(x));
+}
+
+} // namespace ct
+} // namespace Sand
+
+#endif // __CTMATH_H__
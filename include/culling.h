@@ -0,0 +1,158 @@
+#ifndef __CULLING_H__
+#define __CULLING_H__
+
+#include "sand.h"
+#include <cstdint>
+
+namespace Sand {
+
+//
+//  View-frustum culling.
+//
+//  ViewFrustum extracts the six clip planes from a view-projection matrix
+//  (Perspective(...) * LookAt(...), or Frustum/Ortho), normalized so that
+//  plane . (p, 1) is the signed distance of p, positive inside.
+//
+//  BoxSet and SphereSet keep object bounds in blocks of 8, one array per
+//  coordinate, and Cull() tests them 4 (SSE, NEON) or 8 (AVX) at a time,
+//  filling a list with the indices of the objects that may be visible, in
+//  increasing order, that can be walked straight into draw calls.  Tests
+//  are conservative: a box near a frustum corner may pass although it is
+//  outside.
+//
+//  For static geometry, BVH builds a bounding volume hierarchy over the
+//  boxes once; cull() then skips whole subtrees outside the frustum, emits
+//  whole subtrees inside it without further tests, and only tests
+//  individual objects under nodes that straddle a plane.
+//
+
+struct AABB {
+    vec<3> lo, hi;
+
+    AABB() = default;
+    constexpr AABB(const vec<3>& lo, const vec<3>& hi) : lo(lo), hi(hi) {}
+
+    vec<3> center() const { return vec<3>((lo + hi) * 0.5); }
+    vec<3> extent() const { return vec<3>((hi - lo) * 0.5); }
+};
+
+struct Sphere {
+    vec<3> center;
+    GLfloat radius = 0;
+
+    Sphere() = default;
+    constexpr Sphere(const vec<3>& center, GLfloat radius) : center(center), radius(radius) {}
+};
+
+
+class ViewFrustum {
+public:
+    enum { Left, Right, Bottom, Top, Near, Far };
+
+    vec<4> planes[6];
+
+    explicit ViewFrustum(const mat<4>& viewProjection);
+
+    GLfloat distance(int plane, const vec<3>& p) const {
+        const vec<4>& q = planes[plane];
+        return q[0] * p[0] + q[1] * p[1] + q[2] * p[2] + q[3];
+    }
+
+    bool contains(const vec<3>& p) const;
+    bool intersects(const AABB& box) const;
+    bool intersects(const Sphere& sphere) const;
+};
+
+
+// Bounds for Cull(), in blocks of Lanes objects
+class BoxSet {
+public:
+    static constexpr int Lanes = 8;
+
+    BoxSet() = default;
+    BoxSet(const AABB* boxes, size_t count) { assign(boxes, count); }
+
+    void assign(const AABB* boxes, size_t count);
+    void set(size_t i, const AABB& box);
+    size_t size() const { return count; }
+
+private:
+    friend void Cull(const ViewFrustum&, const BoxSet&, std::vector<uint32_t>&);
+
+    struct alignas(32) Block {
+        GLfloat cx[Lanes], cy[Lanes], cz[Lanes];   // centers
+        GLfloat ex[Lanes], ey[Lanes], ez[Lanes];   // half extents
+    };
+
+    std::vector<Block> blocks;
+    size_t count = 0;
+};
+
+class SphereSet {
+public:
+    static constexpr int Lanes = 8;
+
+    SphereSet() = default;
+    SphereSet(const Sphere* spheres, size_t count) { assign(spheres, count); }
+
+    void assign(const Sphere* spheres, size_t count);
+    void set(size_t i, const Sphere& sphere);
+    size_t size() const { return count; }
+
+private:
+    friend void Cull(const ViewFrustum&, const SphereSet&, std::vector<uint32_t>&);
+
+    struct alignas(32) Block {
+        GLfloat cx[Lanes], cy[Lanes], cz[Lanes], r[Lanes];
+    };
+
+    std::vector<Block> blocks;
+    size_t count = 0;
+};
+
+// Replaces visible with the indices of the objects that intersect f
+void Cull(const ViewFrustum& f, const BoxSet& boxes, std::vector<uint32_t>& visible);
+void Cull(const ViewFrustum& f, const SphereSet& spheres, std::vector<uint32_t>& visible);
+
+
+class BVH {
+public:
+    struct Stats {
+        size_t nodesVisited = 0;    // by the last cull()
+        size_t objectsTested = 0;   // individually, under straddling nodes
+    };
+
+    static constexpr unsigned LeafSize = 8;
+
+    BVH() = default;
+    BVH(const AABB* boxes, size_t count) { build(boxes, count); }
+
+    // Median splits along the longest axis of the box centers
+    void build(const AABB* boxes, size_t count);
+
+    // Replaces visible with the indices of the boxes that intersect f, in
+    // tree order
+    void cull(const ViewFrustum& f, std::vector<uint32_t>& visible);
+
+    size_t size() const { return indices.size(); }
+    size_t nodeCount() const { return nodes.size(); }
+    const Stats& stats() const { return st; }
+
+private:
+    struct Node {
+        vec<3> center, extent;
+        uint32_t first, count;  // objects below, as a range of indices
+        uint32_t right;         // second child (the first is next); 0 for leaves
+    };
+
+    std::vector<Node> nodes;            // depth-first
+    std::vector<uint32_t> indices;      // object indices in tree order
+    std::vector<vec<3>> centers, extents;   // per object, in tree order
+    Stats st;
+
+    uint32_t split(const AABB* boxes, uint32_t first, uint32_t count);
+};
+
+} // namespace Sand
+
+#endif // __CULLING_H__
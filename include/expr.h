@@ -0,0 +1,345 @@
+#ifndef __EXPR_H__
+#define __EXPR_H__
+
+//
+//  Expression templates behind vec<N> and mat<N> arithmetic.
+//
+//  +, -, unary -, component-wise *, and scalar * and / do not compute
+//  anything; they return small node objects.  The whole chain is evaluated
+//  in one pass when it is assigned to (or used to construct) a vec or mat,
+//  so `(a + b) / 2.0` costs one loop and no temporaries.  For N == 4 the pass
+//  runs on simd::f32x4 registers.
+//
+//  Lvalue operands are held by reference and rvalues by value, so keeping an
+//  expression in an `auto` is safe as long as its lvalue operands outlive it.
+//  mat * mat and mat * vec are not element-wise and stay eager.
+//
+//  Everything is constexpr; the simd path is only taken at run time.
+//
+
+#include "simd.h"
+#include <array>
+#include <type_traits>
+#include <utility>
+
+namespace Sand {
+
+template<int N> struct vec;
+template<int N> class mat;
+
+namespace expr {
+
+struct vec_tag {};
+struct mat_tag {};
+
+// CRTP bases.  A vec expression provides
+//      constexpr GLfloat operator[](int i) const;
+//      simd::f32x4 packet() const;            (N == 4 only)
+// and a mat expression provides
+//      constexpr GLfloat at(int i, int j) const;
+//      simd::f32x4 row(int i) const;          (N == 4 only)
+
+template<int N, typename E>
+struct vec_expr : vec_tag {
+    static constexpr int dim = N;
+    constexpr const E& self() const { return static_cast<const E&>(*this); }
+};
+
+template<int N, typename E>
+struct mat_expr : mat_tag {
+    static constexpr int dim = N;
+    constexpr const E& self() const { return static_cast<const E&>(*this); }
+};
+
+template<typename T>
+constexpr bool is_vec_v = std::is_base_of_v<vec_tag, std::decay_t<T>>;
+
+template<typename T>
+constexpr bool is_mat_v = std::is_base_of_v<mat_tag, std::decay_t<T>>;
+
+template<typename T> struct is_leaf : std::false_type {};
+template<int N> struct is_leaf<vec<N>> : std::true_type {};
+template<int N> struct is_leaf<mat<N>> : std::true_type {};
+
+template<typename T>
+constexpr bool is_leaf_v = is_leaf<std::decay_t<T>>::value;
+
+template<typename T>
+constexpr int dim_v = std::decay_t<T>::dim;
+
+template<typename T>
+using stored_t = std::conditional_t<std::is_lvalue_reference_v<T>,
+    const std::decay_t<T>&, std::decay_t<T>>;
+
+
+//
+//  Operations
+//
+
+struct add {
+    static constexpr GLfloat apply(GLfloat a, GLfloat b) { return a + b; }
+    static simd::f32x4 apply(simd::f32x4 a, simd::f32x4 b) { return simd::add(a, b); }
+};
+
+struct sub {
+    static constexpr GLfloat apply(GLfloat a, GLfloat b) { return a - b; }
+    static simd::f32x4 apply(simd::f32x4 a, simd::f32x4 b) { return simd::sub(a, b); }
+};
+
+struct mul {
+    static constexpr GLfloat apply(GLfloat a, GLfloat b) { return a * b; }
+    static simd::f32x4 apply(simd::f32x4 a, simd::f32x4 b) { return simd::mul(a, b); }
+};
+
+struct neg {
+    static constexpr GLfloat apply(GLfloat a) { return -a; }
+    static simd::f32x4 apply(simd::f32x4 a) { return simd::neg(a); }
+};
+
+
+//
+//  vec nodes
+//
+
+template<int N, typename Op, typename L, typename R>
+struct vbinary : vec_expr<N, vbinary<N, Op, L, R>> {
+    L l;
+    R r;
+
+    template<typename A, typename B>
+    constexpr vbinary(A&& a, B&& b) : l(std::forward<A>(a)), r(std::forward<B>(b)) {}
+
+    constexpr GLfloat operator[](int i) const { return Op::apply(l[i], r[i]); }
+    simd::f32x4 packet() const { return Op::apply(l.packet(), r.packet()); }
+};
+
+template<int N, typename Op, typename E>
+struct vunary : vec_expr<N, vunary<N, Op, E>> {
+    E e;
+
+    template<typename A>
+    constexpr explicit vunary(A&& a) : e(std::forward<A>(a)) {}
+
+    constexpr GLfloat operator[](int i) const { return Op::apply(e[i]); }
+    simd::f32x4 packet() const { return Op::apply(e.packet()); }
+};
+
+template<int N>
+struct vscalar : vec_expr<N, vscalar<N>> {
+    GLfloat s;
+
+    constexpr explicit vscalar(GLfloat s) : s(s) {}
+
+    constexpr GLfloat operator[](int) const { return s; }
+    simd::f32x4 packet() const { return simd::splat(s); }
+};
+
+
+//
+//  mat nodes
+//
+
+template<int N, typename Op, typename L, typename R>
+struct mbinary : mat_expr<N, mbinary<N, Op, L, R>> {
+    L l;
+    R r;
+
+    template<typename A, typename B>
+    constexpr mbinary(A&& a, B&& b) : l(std::forward<A>(a)), r(std::forward<B>(b)) {}
+
+    constexpr GLfloat at(int i, int j) const { return Op::apply(l.at(i, j), r.at(i, j)); }
+    simd::f32x4 row(int i) const { return Op::apply(l.row(i), r.row(i)); }
+};
+
+template<int N, typename Op, typename E>
+struct munary : mat_expr<N, munary<N, Op, E>> {
+    E e;
+
+    template<typename A>
+    constexpr explicit munary(A&& a) : e(std::forward<A>(a)) {}
+
+    constexpr GLfloat at(int i, int j) const { return Op::apply(e.at(i, j)); }
+    simd::f32x4 row(int i) const { return Op::apply(e.row(i)); }
+};
+
+template<int N>
+struct mscalar : mat_expr<N, mscalar<N>> {
+    GLfloat s;
+
+    constexpr explicit mscalar(GLfloat s) : s(s) {}
+
+    constexpr GLfloat at(int, int) const { return s; }
+    simd::f32x4 row(int) const { return simd::splat(s); }
+};
+
+
+//
+//  Evaluation: dst = e, or dst = dst Op e
+//
+
+// Lanes are gathered into a local before the store so the compiler need
+// not assume dst aliases an operand and reload after every lane.
+
+template<int N, typename E>
+constexpr void assign(vec<N>& dst, const E& e) {
+    if constexpr (N == 4) {
+        if (!std::is_constant_evaluated()) {
+            simd::store(dst, e.packet());
+            return;
+        }
+    }
+    std::array<GLfloat, N> res;
+    for (int i = 0; i < N; i++) res[i] = e[i];
+    dst.v = res;
+}
+
+template<typename Op, int N, typename E>
+constexpr void update(vec<N>& dst, const E& e) {
+    if constexpr (N == 4) {
+        if (!std::is_constant_evaluated()) {
+            simd::store(dst, Op::apply(dst.packet(), e.packet()));
+            return;
+        }
+    }
+    std::array<GLfloat, N> res;
+    for (int i = 0; i < N; i++) res[i] = Op::apply(dst[i], e[i]);
+    dst.v = res;
+}
+
+template<int N, typename E>
+constexpr void assign(mat<N>& dst, const E& e) {
+    if constexpr (N == 4) {
+        if (!std::is_constant_evaluated()) {
+            for (int i = 0; i < N; i++) simd::store(dst[i], e.row(i));
+            return;
+        }
+    }
+    for (int i = 0; i < N; i++) {
+        std::array<GLfloat, N> res;
+        for (int j = 0; j < N; j++) res[j] = e.at(i, j);
+        dst[i].v = res;
+    }
+}
+
+// Leaves by reference, pending expressions materialized
+template<typename T>
+constexpr decltype(auto) evaluate(const T& t) {
+    if constexpr (is_leaf_v<T>)
+        return (t);
+    else if constexpr (is_vec_v<T>)
+        return vec<dim_v<T>>(t);
+    else
+        return mat<dim_v<T>>(t);
+}
+
+template<typename Op, int N, typename E>
+constexpr void update(mat<N>& dst, const E& e) {
+    if constexpr (N == 4) {
+        if (!std::is_constant_evaluated()) {
+            for (int i = 0; i < N; i++)
+                simd::store(dst[i], Op::apply(dst[i].packet(), e.row(i)));
+            return;
+        }
+    }
+    for (int i = 0; i < N; i++) {
+        std::array<GLfloat, N> res;
+        for (int j = 0; j < N; j++) res[j] = Op::apply(dst[i][j], e.at(i, j));
+        dst[i].v = res;
+    }
+}
+
+} // namespace expr
+
+
+//----------------------------------------------------------------------------
+//
+//  Operators
+//
+
+#define SAND_VEC_BINARY(OP, Op) \
+template<typename L, typename R, \
+    std::enable_if_t<expr::is_vec_v<L> && expr::is_vec_v<R>, bool> = true> \
+constexpr auto operator OP (L&& l, R&& r) { \
+    static_assert(expr::dim_v<L> == expr::dim_v<R>, "[vec] : Dimensions must match"); \
+    return expr::vbinary<expr::dim_v<L>, Op, expr::stored_t<L>, expr::stored_t<R>>( \
+        std::forward<L>(l), std::forward<R>(r)); \
+}
+
+SAND_VEC_BINARY(+, expr::add)
+SAND_VEC_BINARY(-, expr::sub)
+SAND_VEC_BINARY(*, expr::mul)
+#undef SAND_VEC_BINARY
+
+template<typename E, std::enable_if_t<expr::is_vec_v<E>, bool> = true>
+constexpr auto operator - (E&& e) {
+    return expr::vunary<expr::dim_v<E>, expr::neg, expr::stored_t<E>>(std::forward<E>(e));
+}
+
+template<typename E, std::enable_if_t<expr::is_vec_v<E>, bool> = true>
+constexpr auto operator * (E&& e, const GLfloat s) {
+    constexpr int N = expr::dim_v<E>;
+    return expr::vbinary<N, expr::mul, expr::stored_t<E>, expr::vscalar<N>>(
+        std::forward<E>(e), expr::vscalar<N>(s));
+}
+
+template<typename E, std::enable_if_t<expr::is_vec_v<E>, bool> = true>
+constexpr auto operator * (const GLfloat s, E&& e) {
+    return std::forward<E>(e) * s;
+}
+
+// Scales by the reciprocal like the scalar code always has, but the
+// reciprocal is folded into the node instead of a second temporary.
+template<typename E, std::enable_if_t<expr::is_vec_v<E>, bool> = true>
+constexpr auto operator / (E&& e, const GLfloat s) {
+    return std::forward<E>(e) * (GLfloat(1.0) / s);
+}
+
+
+#define SAND_MAT_BINARY(OP, Op) \
+template<typename L, typename R, \
+    std::enable_if_t<expr::is_mat_v<L> && expr::is_mat_v<R>, bool> = true> \
+constexpr auto operator OP (L&& l, R&& r) { \
+    static_assert(expr::dim_v<L> == expr::dim_v<R>, "[mat] : Dimensions must match"); \
+    return expr::mbinary<expr::dim_v<L>, Op, expr::stored_t<L>, expr::stored_t<R>>( \
+        std::forward<L>(l), std::forward<R>(r)); \
+}
+
+SAND_MAT_BINARY(+, expr::add)
+SAND_MAT_BINARY(-, expr::sub)
+#undef SAND_MAT_BINARY
+
+template<typename E, std::enable_if_t<expr::is_mat_v<E>, bool> = true>
+constexpr auto operator - (E&& e) {
+    return expr::munary<expr::dim_v<E>, expr::neg, expr::stored_t<E>>(std::forward<E>(e));
+}
+
+template<typename E, std::enable_if_t<expr::is_mat_v<E>, bool> = true>
+constexpr auto operator * (E&& e, const GLfloat s) {
+    constexpr int N = expr::dim_v<E>;
+    return expr::mbinary<N, expr::mul, expr::stored_t<E>, expr::mscalar<N>>(
+        std::forward<E>(e), expr::mscalar<N>(s));
+}
+
+template<typename E, std::enable_if_t<expr::is_mat_v<E>, bool> = true>
+constexpr auto operator * (const GLfloat s, E&& e) {
+    return std::forward<E>(e) * s;
+}
+
+template<typename E, std::enable_if_t<expr::is_mat_v<E>, bool> = true>
+constexpr auto operator / (E&& e, const GLfloat s) {
+    return std::forward<E>(e) * (GLfloat(1.0) / s);
+}
+
+// Products are not element-wise: evaluate pending operands, then use the
+// eager mat<N> members.  Leaf * leaf goes straight to the members.
+template<typename L, typename R,
+    std::enable_if_t<expr::is_mat_v<L> && (expr::is_mat_v<R> || expr::is_vec_v<R>)
+        && !(expr::is_leaf_v<L> && expr::is_leaf_v<R>), bool> = true>
+constexpr auto operator * (L&& l, R&& r) {
+    static_assert(expr::dim_v<L> == expr::dim_v<R>, "[mat] : Dimensions must match");
+    return expr::evaluate(l) * expr::evaluate(r);
+}
+
+} // namespace Sand
+
+#endif // __EXPR_H__
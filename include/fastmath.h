@@ -0,0 +1,184 @@
+#ifndef __FASTMATH_H__
+#define __FASTMATH_H__
+
+#include "sand.h"
+#include "simd.h"
+
+namespace Sand {
+namespace fastmath {
+
+//
+//  Approximate rsqrt, reciprocal and sincos, four lanes at a time.
+//
+//  Each comes in three accuracy tiers, picked per call site with a
+//  template argument or for the whole build with
+//  -DSAND_FASTMATH_ACCURACY=Exact|Fast|Fastest (default Exact):
+//
+//      Exact     1 / sqrt, a divide, <cmath> sin and cos: what vec.h does
+//      Fast      the hardware estimate plus one Newton step; sincos by
+//                Cody-Waite reduction to [-pi/4, pi/4] and degree 7 / 8
+//                polynomials
+//      Fastest   the hardware estimate alone; degree 5 / 4 polynomials
+//
+//  The worst errors bench/fastmath_accuracy measures against libm (in
+//  double) are bounded by the tables below, in ulp of the float result;
+//  for sin and cos in ulp of max(|result|, SinCosFloor), as the error of
+//  the reduction is absolute.  Fast and Fastest sincos hold them for
+//  |x| <= 8192 and degrade beyond; rsqrt and rcp for normal inputs and
+//  results.  At zero and infinity Fast rsqrt and rcp give NaN where the
+//  other tiers give infinity or zero.
+//
+
+enum class Accuracy { Exact, Fast, Fastest };
+
+#ifndef SAND_FASTMATH_ACCURACY
+#   define SAND_FASTMATH_ACCURACY Exact
+#endif
+
+constexpr Accuracy DefaultAccuracy = Accuracy::SAND_FASTMATH_ACCURACY;
+
+// Bounds on the measured error, indexed by Accuracy.  Fastest rsqrt and
+// rcp are the hardware's documented relative 1.5 * 2^-12.
+constexpr double RsqrtMaxUlp[] = {1.5, 4, 6144};
+constexpr double RcpMaxUlp[] = {0.5, 3, 6144};
+constexpr double SinCosMaxUlp[] = {1, 2, 256};
+constexpr double SinCosFloor = 0x1p-13;
+constexpr double NormalizeMaxUlp[] = {3, 5, 6150};     // per component, in ulp of 0.5 ... 1
+
+namespace detail {
+
+// to the nearest integer, for |x| < 2^22
+inline simd::f32x4 round(simd::f32x4 x) {
+    const simd::f32x4 magic = simd::splat(12582912.0f);    // 1.5 * 2^23
+    return simd::sub(simd::add(x, magic), magic);
+}
+
+// 1 for odd k, 0 for even, for integral k
+inline simd::f32x4 parity(simd::f32x4 k) {
+    using namespace simd;
+    return abs(sub(k, mul(splat(2.0f), round(mul(k, splat(0.5f))))));
+}
+
+} // namespace detail
+
+
+template<Accuracy A = DefaultAccuracy>
+inline simd::f32x4 rsqrt(simd::f32x4 x) {
+    using namespace simd;
+    if constexpr (A == Accuracy::Exact) {
+        return div(splat(1.0f), sqrt(x));
+    } else if constexpr (A == Accuracy::Fast) {
+        // y (3 - x y^2) / 2
+        f32x4 y = rsqrt_est(x);
+        return mul(mul(splat(0.5f), y), sub(splat(3.0f), mul(x, mul(y, y))));
+    } else {
+        return rsqrt_est(x);
+    }
+}
+
+template<Accuracy A = DefaultAccuracy>
+inline simd::f32x4 rcp(simd::f32x4 x) {
+    using namespace simd;
+    if constexpr (A == Accuracy::Exact) {
+        return div(splat(1.0f), x);
+    } else if constexpr (A == Accuracy::Fast) {
+        // y + y (1 - x y)
+        f32x4 y = rcp_est(x);
+        return add(y, mul(y, sub(splat(1.0f), mul(x, y))));
+    } else {
+        return rcp_est(x);
+    }
+}
+
+template<Accuracy A = DefaultAccuracy>
+inline void sincos(simd::f32x4 x, simd::f32x4& s, simd::f32x4& c) {
+    using namespace simd;
+    if constexpr (A == Accuracy::Exact) {
+        float v[4], sv[4], cv[4];
+        store(v, x);
+        for (int i = 0; i < 4; i++) {
+            sv[i] = float(std::sin(double(v[i])));
+            cv[i] = float(std::cos(double(v[i])));
+        }
+        s = load(sv);
+        c = load(cv);
+    } else {
+        // x = k pi/2 + r, with pi/2 in three parts so the first two
+        // products are exact for |k| < 2^13
+        f32x4 k = detail::round(mul(x, splat(0.636619772f)));
+        f32x4 r = sub(x, mul(k, splat(1.5703125f)));
+        r = sub(r, mul(k, splat(4.837512969970703125e-4f)));
+        r = sub(r, mul(k, splat(7.54978995489188216e-8f)));
+        f32x4 r2 = mul(r, r);
+
+        f32x4 sr, cr;
+        if constexpr (A == Accuracy::Fast) {
+            f32x4 ps = add(mul(r2, splat(-1.9515295891e-4f)), splat(8.3321608736e-3f));
+            ps = add(mul(r2, ps), splat(-1.6666654611e-1f));
+            sr = add(r, mul(mul(r, r2), ps));
+            f32x4 pc = add(mul(r2, splat(2.443315711809948e-5f)), splat(-1.388731625493765e-3f));
+            pc = add(mul(r2, pc), splat(4.166664568298827e-2f));
+            cr = add(sub(splat(1.0f), mul(splat(0.5f), r2)), mul(mul(r2, r2), pc));
+        } else {
+            sr = add(r, mul(mul(r, r2), add(mul(r2, splat(8.16328193e-3f)), splat(-0.166633904f))));
+            cr = add(splat(1.0f), mul(r2, add(mul(r2, splat(0.0404584523f)), splat(-0.499760557f))));
+        }
+
+        // k = 2j + o: sin(r + k pi/2) = (-1)^j (o ? cos r : sin r), and
+        // cos(r + k pi/2) = (-1)^j (o ? -sin r : cos r).  The blends
+        // multiply by exactly 0 or 1.
+        f32x4 o = detail::parity(k);
+        f32x4 e = sub(splat(1.0f), o);
+        f32x4 j = mul(sub(k, o), splat(0.5f));
+        f32x4 sign = sub(splat(1.0f), mul(splat(2.0f), detail::parity(j)));
+        s = mul(sign, add(mul(e, sr), mul(o, cr)));
+        c = mul(sign, sub(mul(e, cr), mul(o, sr)));
+    }
+}
+
+template<Accuracy A = DefaultAccuracy>
+inline GLfloat rsqrt(GLfloat x) { return simd::first(rsqrt<A>(simd::splat(x))); }
+
+template<Accuracy A = DefaultAccuracy>
+inline GLfloat rcp(GLfloat x) { return simd::first(rcp<A>(simd::splat(x))); }
+
+template<Accuracy A = DefaultAccuracy>
+inline void sincos(GLfloat x, GLfloat& s, GLfloat& c) {
+    simd::f32x4 vs, vc;
+    sincos<A>(simd::splat(x), vs, vc);
+    s = simd::first(vs);
+    c = simd::first(vc);
+}
+
+// v / length(v) through rsqrt; a zero vector gives non-finite values, as
+// with Sand::normalize
+template<Accuracy A = DefaultAccuracy, int N>
+inline vec<N> normalize(const vec<N>& v) {
+    static_assert(N == 3 || N == 4, "fastmath::normalize takes vec<3> or vec<4>");
+    simd::f32x4 x = v.packet();
+    simd::f32x4 len2 = simd::dot4(x, x);
+    if constexpr (A == Accuracy::Exact)
+        x = simd::div(x, simd::sqrt(len2));
+    else
+        x = simd::mul(x, rsqrt<A>(len2));
+    vec<N> res;
+    if constexpr (N == 3) simd::store3(res, x); else simd::store(res, x);
+    return res;
+}
+
+
+//
+//  Batches: four items per step, the rest one at a time.  out may be in.
+//
+
+// out[i] = normalize(in[i]); for vec<3>, Fast gives the Exact results
+void Normalize(const vec<3>* in, vec<3>* out, size_t count, Accuracy a = DefaultAccuracy);
+void Normalize(const vec<4>* in, vec<4>* out, size_t count, Accuracy a = DefaultAccuracy);
+
+// s[i] = sin(x[i]), c[i] = cos(x[i])
+void SinCos(const GLfloat* x, GLfloat* s, GLfloat* c, size_t count, Accuracy a = DefaultAccuracy);
+
+} // namespace fastmath
+} // namespace Sand
+
+#endif // __FASTMATH_H__
@@ -0,0 +1,111 @@
+#ifndef __IFS_DENSITY_H__
+#define __IFS_DENSITY_H__
+
+#include "sand.h"
+#include "philox.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace Sand {
+
+//
+//  Density histogram of an iterated function system.
+//
+//  The chaos game of example21 plots every point at one color, so after a
+//  few thousand points the image saturates and shows nothing of how often
+//  each pixel is hit.  IfsDensity counts the hits instead and maps the
+//  counts to color on a log scale, so billions of points keep adding
+//  detail (the fractal-flame renderers' histogram, without the flames).
+//
+//  The maps are 2D affine transforms in homogeneous form, rows (a b tx),
+//  (c d ty), (0 0 1).  Iteration i applies the map picked by
+//  rng.word(i) in proportion to the weights.  As in ChaosGame the
+//  sequence is cut into fixed chunks, but here each chunk starts from its
+//  own random point and drops the first Warmup steps, so no chunk needs
+//  another's history; the maps must contract on average for that to
+//  settle onto the attractor.
+//
+//  Each thread counts into private 64x64 tiles, allocated on first touch.
+//  After the chunks are done, each tile is merged by one thread, which
+//  adds every thread's copy of it into the totals: no locks, no atomics.
+//  The counts are integers summed over fixed chunks, so they are the
+//  same for any thread count.
+//
+
+struct AffineMap {
+    mat<3> m;
+    GLfloat weight = 1;     // relative probability
+};
+
+class IfsDensity {
+public:
+    struct Stats {
+        uint64_t iterations = 0;    // points computed, warm-up steps excluded
+        uint64_t plotted = 0;       // of those, the ones inside the window
+        double seconds = 0;         // time in run(), merging included
+        double mergeSeconds = 0;
+    };
+
+    static const int TileSize = 64;
+    static constexpr uint64_t ChunkSize = uint64_t(1) << 16;
+    static const int Warmup = 32;
+
+    // Counts the points falling in [lo, hi] on a width x height grid
+    IfsDensity(const std::vector<AffineMap>& maps, int width, int height,
+               const vec<2>& lo = vec<2>(-1, -1), const vec<2>& hi = vec<2>(1, 1),
+               uint64_t seed = 0);
+
+    // Iterations [done, done + count) of the sequence, on `threads`
+    // threads (0 = all cores); repeated calls continue where the last
+    // stopped
+    void run(uint64_t count, unsigned threads = 0);
+
+    // Zeroes the counts and restarts the sequence
+    void clear();
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+    // Per pixel, bottom row first like SoftRaster::pixels()
+    const std::vector<uint64_t>& counts() const { return hist; }
+    uint64_t count(int x, int y) const { return hist[size_t(y) * w + x]; }
+    uint64_t maxCount() const;
+
+    // Pixels for WritePPM / WritePNG: background where nothing landed,
+    // elsewhere blended toward `color` by
+    //
+    //     (log(1 + count) / log(1 + maxCount())) ^ (1 / gamma)
+    //
+    std::vector<uint32_t> toneMap(const vec<4>& background, const vec<4>& color,
+                                  GLfloat gamma = 1) const;
+
+    bool writePPM(const std::string& file, const vec<4>& background, const vec<4>& color,
+                  GLfloat gamma = 1) const;
+    bool writePNG(const std::string& file, const vec<4>& background, const vec<4>& color,
+                  GLfloat gamma = 1) const;
+
+    const Stats& stats() const { return st; }
+    void resetStats() { st = Stats(); }
+
+private:
+    typedef std::unique_ptr<uint32_t[]> Tile;
+
+    // maps unpacked: x' = a x + b y + tx, y' = c x + d y + ty
+    std::vector<std::array<GLfloat, 6>> affine;
+    std::vector<uint32_t> thresholds;   // map k is picked when r < thresholds[k]
+    int w, h, tilesX, tilesY;
+    vec<2> lo, scale;                   // point -> pixel: (p - lo) * scale
+    Philox rng, start;                  // map choices; chunk start points
+    uint64_t done = 0;
+    std::vector<uint64_t> hist;
+    std::vector<std::vector<Tile>> tiles;   // tiles[thread][tile]
+    Stats st;
+
+    uint64_t runChunk(std::vector<Tile>& own, uint64_t begin, uint64_t end) const;
+    void merge(unsigned threads);
+};
+
+} // namespace Sand
+
+#endif // __IFS_DENSITY_H__
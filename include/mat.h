@@ -8,20 +8,20 @@ namespace Sand {
     
 
 template<int N>
-class mat {
+class mat : public expr::mat_expr<N, mat<N>> {
 
     std::array<vec<N>, N> m;
 
 private:
     // vector generator init for float
     template<int curm, int curv, typename T>
-    void vec_generate(std::array<T, N> &v) {
+    constexpr void vec_generate(std::array<T, N> &v) {
         m[curm] = vec<N>(v);
     }
     
     // vector generator recursion for float
     template<int curm, int curv, typename... T, typename U>
-    void vec_generate(std::array<U, N> &v, U first, T... rest) {
+    constexpr void vec_generate(std::array<U, N> &v, U first, T... rest) {
         if constexpr (curv == N) {
             m[curm] = vec<N>(v);
             vec_generate<curm+1, 0>(v, first, rest...);
@@ -34,7 +34,7 @@ private:
 
 
     template<typename... T>
-    void mat_float(T... vals) {
+    constexpr void mat_float(T... vals) {
         static_assert(N * N == sizeof...(vals),
              "The number of parameters should be N square.");
         auto v = std::array<GLfloat, N>();
@@ -43,7 +43,7 @@ private:
 
     // N vectors
     template<typename... T> // requires is_same_v<T, vec<N>> c++20 // for vector
-    void mat_vec(T&&... vals) {
+    constexpr void mat_vec(T&&... vals) {
         static_assert(N == sizeof...(vals), 
             "The number of parameters should be N");
         m = std::array<vec<N>, N>{vals...};
@@ -58,7 +58,7 @@ public:
     //  --- Constructors and Destructors ---
     //
 
-    mat(const GLfloat d = GLfloat(1.0))  { // Diagonal
+    constexpr mat(const GLfloat d = GLfloat(1.0))  { // Diagonal
         for(int i = 0; i < N; i++)
             m[i][i] = d;
     }
@@ -66,54 +66,50 @@ public:
     template<typename... Fs, 
         std::enable_if_t<std::conjunction_v<std::is_arithmetic<Fs>...> && (sizeof...(Fs) > 1), bool> = true
     >
-    mat(const Fs&... vals) {
+    constexpr mat(const Fs&... vals) {
         mat_float(static_cast<GLfloat>(vals)...);
     }
     
     template<typename... Vs,
         std::enable_if_t<std::conjunction_v<std::is_same<vec<N>, Vs>...>, bool> = true
     >
-    mat(const Vs&... vals) {
+    constexpr mat(const Vs&... vals) {
         mat_vec(vals...);
     }
     
 
-    mat(const mat<N>& m) : m(m.m) {}
-    mat(const std::array<vec<N>, N>& _m) : m(_m) {}
+    constexpr mat(const mat<N>& m) : m(m.m) {}
+    constexpr mat(const std::array<vec<N>, N>& _m) : m(_m) {}
 
-    vec<N>& operator [] (int i) { return m[i]; }
-    const vec<N>& operator [] (int i) const { return m[i]; }
-
-    mat operator-() const {
-        std::array<vec<N>, N> res;
-        std::transform(m.begin(), m.end(), res.begin(),
-            [](vec<N> v) -> vec<N> { return -v; });
-        return mat(res);
+    // Evaluates a pending expression (see expr.h) in one pass
+    template<typename E>
+    constexpr mat(const expr::mat_expr<N, E>& e) {
+        expr::assign(*this, e.self());
     }
 
-    mat operator + (const mat& _m) const {
-        std::array<vec<N>, N> res;
-        std::transform(m.begin(), m.end(), _m.m.begin(), res.begin(), std::plus<>{}); 
-        return mat(res);
+    template<typename E>
+    constexpr mat& operator = (const expr::mat_expr<N, E>& e) {
+        expr::assign(*this, e.self());
+        return *this;
     }
 
-    mat operator - (const mat& _m) const {
-        std::array<vec<N>, N> res;
-        std::transform(m.begin(), m.end(), _m.m.begin(), res.begin(), std::minus<>{});
-        return mat(res);
-    }
+    constexpr vec<N>& operator [] (int i) { return m[i]; }
+    constexpr const vec<N>& operator [] (int i) const { return m[i]; }
 
-    mat operator * (const GLfloat s) const {
-        std::array<vec<N>, N> res;
-        std::transform(m.begin(), m.end(), res.begin(),
-                [s](vec<N> v) -> vec<N> { return s * v; });
-        return mat(res);
-    }
+    // expression leaf
+    constexpr GLfloat at(int i, int j) const { return m[i][j]; }
+    simd::f32x4 row(int i) const { return m[i].packet(); }
 
-    friend mat operator * (const GLfloat s, const mat m)
-    { return m * s; }
+    // 4x4 products run in registers at run time (see simd.h)
 
-    mat operator * (const mat& _m) const {
+    constexpr mat operator * (const mat& _m) const {
+        if constexpr (N == 4) {
+            if (!std::is_constant_evaluated()) {
+                mat res;
+                simd::mat4_mul(*this, _m, res);
+                return res;
+            }
+        }
         std::array<vec<N>, N> res;
         for (int i = 0; i < N; i++)
             for(int j = 0; j < N; j++)
@@ -122,36 +118,38 @@ public:
         return mat(res);
     }
 
-    vec<N> operator * (const vec<N>& v) const {
+    constexpr vec<N> operator * (const vec<N>& v) const {
+        if constexpr (N == 4) {
+            if (!std::is_constant_evaluated()) {
+                vec<N> res;
+                simd::mat4_mul_vec(*this, v, res);
+                return res;
+            }
+        }
         std::array<GLfloat, N> res;
-        std::transform(m.m.begin(), m.m.end(), res.begin(),
-                [v](vec<N> _v) -> GLfloat { return dot(v, _v); });
-        return vec(res);
-    }
-
-    mat operator / (const GLfloat s) const {
-        GLfloat r  = GLfloat(1.0) / s;
-        return *this * r;
+        std::transform(m.begin(), m.end(), res.begin(),
+                [&v](const vec<N>& _v) -> GLfloat { return dot(v, _v); });
+        return vec<N>(res);
     }
 
-
-    mat& operator += (const mat& _m) {
-        std::transform(m.begin(), m.end(), _m.m.begin(), std::plus<>{});
+    template<typename E>
+    constexpr mat& operator += (const expr::mat_expr<N, E>& e) {
+        expr::update<expr::add>(*this, e.self());
         return *this;
     }
 
-    mat& operator -= (const mat& _m) {
-        std::transform(m.begin(), m.end(), _m.m.begin(), std::minus<>{});
+    template<typename E>
+    constexpr mat& operator -= (const expr::mat_expr<N, E>& e) {
+        expr::update<expr::sub>(*this, e.self());
         return *this;
     }
 
-    mat& operator *= (const GLfloat s) {
-        std::transform(m.begin(), m.end(), m.begin(),
-                [s](vec<N> v) -> vec<N> { return s * v; });
+    constexpr mat& operator *= (const GLfloat s) {
+        expr::update<expr::mul>(*this, expr::mscalar<N>(s));
         return *this;
     }
 
-    mat& operator /= (const GLfloat s) {
+    constexpr mat& operator /= (const GLfloat s) {
         GLfloat r = GLfloat(1.0) / s;
         return *this *= r;
     }
@@ -170,11 +168,11 @@ public:
     
     // Conversion operators
 
-    operator const GLfloat* () const {
+    constexpr operator const GLfloat* () const {
         return static_cast<const GLfloat*>(m[0]);
     }
 
-    operator GLfloat* () {
+    constexpr operator GLfloat* () {
         return static_cast<GLfloat*>(m[0]);
     }
 };
@@ -183,17 +181,166 @@ public:
 // Non-class matrix methods
 
 template<int N>
-inline mat<N> matrixCompMult(const mat<N>& A, const mat<N>& B) {
-    std::array<vec<N>, N> res;
-    std::transform(A.begin(), A.end(), B.begin(), res.begin(), std::multiplies<>{});
-    return mat(res);
+constexpr mat<N> matrixCompMult(const mat<N>& A, const mat<N>& B) {
+    return expr::mbinary<N, expr::mul, const mat<N>&, const mat<N>&>(A, B);
 }
 
 template<int N>
-inline mat<N> transpose(const mat<N>& A) {
+constexpr mat<N> transpose(const mat<N>& A) {
     std::array<vec<N>, N> res;
     for(int i=0;i<N;i++) for(int j=0;j<N;j++) res[j][i] = A[i][j];
-    return mat(res);
+    return mat<N>(res);
+}
+
+
+//----------------------------------------------------------------------------
+//
+//  Determinants and inverses
+//
+//  inverse() is exact for any invertible matrix: closed forms for 2x2 and
+//  3x3, the simd.h cofactor kernel for 4x4 at run time, Gauss-Jordan with
+//  partial pivoting otherwise.  Transforms known to be affine (bottom row
+//  0 0 0 1) or rigid (rotation and translation only) have cheaper inverses
+//  below.  As in GLSL, singular input gives non-finite results.
+//
+
+namespace detail {
+
+// Determinant by LU decomposition with partial pivoting
+template<int N>
+constexpr GLfloat luDeterminant(mat<N> a) {
+    GLfloat det = 1;
+    for (int k = 0; k < N; k++) {
+        int p = k;
+        for (int i = k + 1; i < N; i++)
+            if ((a[i][k] < 0 ? -a[i][k] : a[i][k]) > (a[p][k] < 0 ? -a[p][k] : a[p][k])) p = i;
+        if (a[p][k] == 0) return 0;
+        if (p != k) {
+            std::swap(a[p], a[k]);
+            det = -det;
+        }
+        det *= a[k][k];
+        GLfloat r = 1 / a[k][k];
+        for (int i = k + 1; i < N; i++) {
+            GLfloat f = a[i][k] * r;
+            for (int j = k + 1; j < N; j++) a[i][j] -= f * a[k][j];
+        }
+    }
+    return det;
+}
+
+// Inverse by Gauss-Jordan elimination with partial pivoting
+template<int N>
+constexpr mat<N> gaussJordan(mat<N> a) {
+    mat<N> inv;
+    for (int k = 0; k < N; k++) {
+        int p = k;
+        for (int i = k + 1; i < N; i++)
+            if ((a[i][k] < 0 ? -a[i][k] : a[i][k]) > (a[p][k] < 0 ? -a[p][k] : a[p][k])) p = i;
+        std::swap(a[p], a[k]);
+        std::swap(inv[p], inv[k]);
+
+        GLfloat r = 1 / a[k][k];
+        a[k] *= r;
+        inv[k] *= r;
+        for (int i = 0; i < N; i++) {
+            if (i == k) continue;
+            GLfloat f = a[i][k];
+            a[i] -= a[k] * f;
+            inv[i] -= inv[k] * f;
+        }
+    }
+    return inv;
+}
+
+// Transposed inverse of the upper-left 3x3 block: its rows are the cross
+// products of the block's rows, over one determinant
+template<int N>
+constexpr mat<3> cofactors3(const mat<N>& c) {
+    vec<3> a0(c[0][0], c[0][1], c[0][2]);
+    vec<3> a1(c[1][0], c[1][1], c[1][2]);
+    vec<3> a2(c[2][0], c[2][1], c[2][2]);
+    vec<3> c0 = cross(a1, a2);
+    GLfloat r = 1 / dot(a0, c0);
+    return mat<3>(vec<3>(c0 * r), vec<3>(cross(a2, a0) * r), vec<3>(cross(a0, a1) * r));
+}
+
+} // namespace detail
+
+
+template<int N>
+constexpr GLfloat determinant(const mat<N>& c) {
+    if constexpr (N == 1) {
+        return c[0][0];
+    } else if constexpr (N == 2) {
+        return c[0][0]*c[1][1] - c[0][1]*c[1][0];
+    } else if constexpr (N == 3) {
+        return dot(vec<3>(c[0]), cross(vec<3>(c[1]), vec<3>(c[2])));
+    } else if constexpr (N == 4) {
+        // 2x2 minors of the top and bottom row pairs
+        GLfloat a0 = c[0][0]*c[1][1] - c[0][1]*c[1][0], b0 = c[2][0]*c[3][1] - c[2][1]*c[3][0];
+        GLfloat a1 = c[0][0]*c[1][2] - c[0][2]*c[1][0], b1 = c[2][0]*c[3][2] - c[2][2]*c[3][0];
+        GLfloat a2 = c[0][0]*c[1][3] - c[0][3]*c[1][0], b2 = c[2][0]*c[3][3] - c[2][3]*c[3][0];
+        GLfloat a3 = c[0][1]*c[1][2] - c[0][2]*c[1][1], b3 = c[2][1]*c[3][2] - c[2][2]*c[3][1];
+        GLfloat a4 = c[0][1]*c[1][3] - c[0][3]*c[1][1], b4 = c[2][1]*c[3][3] - c[2][3]*c[3][1];
+        GLfloat a5 = c[0][2]*c[1][3] - c[0][3]*c[1][2], b5 = c[2][2]*c[3][3] - c[2][3]*c[3][2];
+        return a0*b5 - a1*b4 + a2*b3 + a3*b2 - a4*b1 + a5*b0;
+    } else {
+        return detail::luDeterminant(c);
+    }
+}
+
+template<int N>
+constexpr mat<N> inverse(const mat<N>& c) {
+    if constexpr (N == 1) {
+        return mat<N>(1 / c[0][0]);
+    } else if constexpr (N == 2) {
+        GLfloat r = 1 / determinant(c);
+        return mat<2>(c[1][1]*r, -c[0][1]*r, -c[1][0]*r, c[0][0]*r);
+    } else if constexpr (N == 3) {
+        return transpose(detail::cofactors3(c));
+    } else {
+        if constexpr (N == 4) {
+            if (!std::is_constant_evaluated()) {
+                mat<4> res;
+                simd::mat4_inverse(c, res);
+                return res;
+            }
+        }
+        return detail::gaussJordan(c);
+    }
+}
+
+// Inverse of [A t; 0 1]: [A^-1  -A^-1 t; 0 1]
+constexpr mat<4> inverseAffine(const mat<4>& c) {
+    if (!std::is_constant_evaluated()) {
+        mat<4> res;
+        simd::mat4_inverse_affine(c, res);
+        return res;
+    }
+    mat<3> d = detail::cofactors3(c);   // transpose(A^-1)
+    mat<4> res;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) res[i][j] = d[j][i];
+        res[i][3] = -(d[0][i]*c[0][3] + d[1][i]*c[1][3] + d[2][i]*c[2][3]);
+    }
+    return res;
+}
+
+// Inverse of [R t; 0 1] with R a rotation: [R^T  -R^T t; 0 1]
+constexpr mat<4> inverseRigid(const mat<4>& c) {
+    if (!std::is_constant_evaluated()) {
+        mat<4> res;
+        simd::mat4_inverse_rigid(c, res);
+        return res;
+    }
+    vec<3> t(c[0][3], c[1][3], c[2][3]);
+    mat<4> res;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) res[i][j] = c[j][i];
+        res[i][3] = -(c[0][i]*t[0] + c[1][i]*t[1] + c[2][i]*t[2]);
+    }
+    return res;
 }
 
 
@@ -202,50 +349,50 @@ inline mat<N> transpose(const mat<N>& A) {
 #define Error(str) std::cerr << "[" __FILE__ ":" << __LINE__ << "] " \
     << str << std::endl
 
-inline mat<4> RotateX(const GLfloat theta) {
+constexpr mat<4> RotateX(const GLfloat theta) {
     GLfloat angle = DegreesToRadians * theta;
     mat<4> c;
-    c[2][2] = c[1][1] = cos(angle);
-    c[2][1] = sin(angle);
+    c[2][2] = c[1][1] = ct::cos(angle);
+    c[2][1] = ct::sin(angle);
     c[1][2] = -c[2][1];
     return c;
 }
 
-inline mat<4> RotateY(const GLfloat theta) {
+constexpr mat<4> RotateY(const GLfloat theta) {
     GLfloat angle = DegreesToRadians * theta;
 
     mat<4> c;
-    c[2][2] = c[0][0] = cos(angle);
-    c[0][2] = sin(angle);
+    c[2][2] = c[0][0] = ct::cos(angle);
+    c[0][2] = ct::sin(angle);
     c[2][0] = -c[0][2];
     return c;
 }
 
-inline mat<4> RotateZ(const GLfloat theta) {
+constexpr mat<4> RotateZ(const GLfloat theta) {
     GLfloat angle = DegreesToRadians * theta;
     mat<4> c;
-    c[0][0] = c[1][1] = cos(angle);
-    c[1][0] = sin(angle);
+    c[0][0] = c[1][1] = ct::cos(angle);
+    c[1][0] = ct::sin(angle);
     c[0][1] = -c[1][0];
     return c;
 }
 
-inline mat<4> Translate(const GLfloat x, const GLfloat y, const GLfloat z) {
+constexpr mat<4> Translate(const GLfloat x, const GLfloat y, const GLfloat z) {
     mat<4> c;
     c[0][3] = x; c[1][3] = y; c[2][3] = z;
     return c;
 }
 
-inline mat<4> Translate(const vec<3>& v) {
+constexpr mat<4> Translate(const vec<3>& v) {
     return Translate(v[0], v[1], v[2]);
 }
 
-inline mat<4> Translate(const vec<4>& v) {
+constexpr mat<4> Translate(const vec<4>& v) {
     return Translate(v[0], v[1], v[2]);
 }
 
 
-inline mat<4> Scale(const GLfloat x, const GLfloat y, const GLfloat z) {
+constexpr mat<4> Scale(const GLfloat x, const GLfloat y, const GLfloat z) {
     mat<4> c;
     c[0][0] = x;
     c[1][1] = y;
@@ -253,7 +400,7 @@ inline mat<4> Scale(const GLfloat x, const GLfloat y, const GLfloat z) {
     return c;
 }
 
-inline mat<4> Scale(const vec<3>& v) {
+constexpr mat<4> Scale(const vec<3>& v) {
     return Scale(v[0], v[1], v[2]);
 }
 
@@ -262,7 +409,7 @@ inline mat<4> Scale(const vec<3>& v) {
 
 
 
-inline mat<4> Ortho( const GLfloat left, const GLfloat right,
+constexpr mat<4> Ortho( const GLfloat left, const GLfloat right,
            const GLfloat bottom, const GLfloat top,
            const GLfloat zNear, const GLfloat zFar ) {
     mat<4> c;
@@ -276,12 +423,12 @@ inline mat<4> Ortho( const GLfloat left, const GLfloat right,
     return c;
 }
 
-inline mat<4> Ortho2D( const GLfloat left, const GLfloat right,
+constexpr mat<4> Ortho2D( const GLfloat left, const GLfloat right,
              const GLfloat bottom, const GLfloat top ) {
     return Ortho( left, right, bottom, top, -1.0, 1.0 );
 }
 
-inline mat<4> Frustum( const GLfloat left, const GLfloat right,
+constexpr mat<4> Frustum( const GLfloat left, const GLfloat right,
              const GLfloat bottom, const GLfloat top,
              const GLfloat zNear, const GLfloat zFar ) {
     mat<4> c;
@@ -296,9 +443,9 @@ inline mat<4> Frustum( const GLfloat left, const GLfloat right,
     return c;
 }
 
-inline mat<4> Perspective( const GLfloat fovy, const GLfloat aspect,
+constexpr mat<4> Perspective( const GLfloat fovy, const GLfloat aspect,
                  const GLfloat zNear, const GLfloat zFar) {
-    GLfloat top   = tan(fovy*DegreesToRadians/2) * zNear;
+    GLfloat top   = ct::tan(fovy*DegreesToRadians/2) * zNear;
     GLfloat right = top * aspect;
     
     mat<4> c;
@@ -316,7 +463,7 @@ inline mat<4> Perspective( const GLfloat fovy, const GLfloat aspect,
 //  Viewing transformation matrix generation
 //
 
-inline mat<4> LookAt( const vec<4>& eye, const vec<4>& at, const vec<4>& up ) {
+constexpr mat<4> LookAt( const vec<4>& eye, const vec<4>& at, const vec<4>& up ) {
     vec<4> n = normalize(eye - at);
     vec<4> u = vec<4>(normalize(cross(up,n)), GLfloat(0.0));
     vec<4> v = vec<4>(normalize(cross(n,u)), GLfloat(0.0));
@@ -325,28 +472,30 @@ inline mat<4> LookAt( const vec<4>& eye, const vec<4>& at, const vec<4>& up ) {
     return c * Translate( -eye );
 }
 
+//----------------------------------------------------------------------------
+//
+//  Window coordinates back to object space, as gluUnProject: window is
+//  (x, y, depth) with y up from the bottom of viewport (x, y, width,
+//  height) and depth in [0, 1]; inverseViewProjection is
+//  inverse(projection * modelView)
+//
+
+constexpr vec<3> Unproject( const vec<3>& window, const mat<4>& inverseViewProjection,
+                            const vec<4>& viewport ) {
+    vec<4> ndc(2 * (window[0] - viewport[0]) / viewport[2] - 1,
+               2 * (window[1] - viewport[1]) / viewport[3] - 1,
+               2 * window[2] - 1, GLfloat(1.0));
+    vec<4> p = inverseViewProjection * ndc;
+    return vec<3>(p[0] / p[3], p[1] / p[3], p[2] / p[3]);
+}
+
 //----------------------------------------------------------------------------
 //
 // Generates a Normal Matrix
 //
-inline mat<3> Normal( const mat<4>& c) {
-    mat<3> d;
-    GLfloat det;
-    
-    det = c[0][0]*c[1][1]*c[2][2]+c[0][1]*c[1][2]*c[2][1]+c[0][2]*c[1][0]*c[2][1]
-    -c[2][0]*c[1][1]*c[0][2]-c[1][0]*c[0][1]*c[2][2]-c[0][0]*c[1][2]*c[2][1];
-    
-    d[0][0] = (c[1][1]*c[2][2]-c[1][2]*c[2][1])/det;
-    d[0][1] = -(c[1][0]*c[2][2]-c[1][2]*c[2][0])/det;
-    d[0][2] =  (c[1][0]*c[2][1]-c[1][1]*c[2][0])/det;
-    d[1][0] = -(c[0][1]*c[2][2]-c[0][2]*c[2][1])/det;
-    d[1][1] = (c[0][0]*c[2][2]-c[0][2]*c[2][0])/det;
-    d[1][2] = -(c[0][0]*c[2][1]-c[0][1]*c[2][0])/det;
-    d[2][0] =  (c[0][1]*c[1][2]-c[0][2]*c[1][1])/det;
-    d[2][1] = -(c[0][0]*c[1][2]-c[0][2]*c[1][0])/det;
-    d[2][2] = (c[0][0]*c[1][1]-c[1][0]*c[0][1])/det;
-    
-    return d;
+constexpr mat<3> Normal( const mat<4>& c) {
+    // transpose(inverse(upper 3x3)), which is the cofactor matrix over det
+    return detail::cofactors3(c);
 }
 
 } // namespace Sand
@@ -0,0 +1,43 @@
+#ifndef __MAT_BATCH_H__
+#define __MAT_BATCH_H__
+
+#include "sand.h"
+#include "cpu_features.h"
+
+namespace Sand {
+
+//
+//  Batched mat<4> products.
+//
+//  mat<4>::operator * handles one product in a few registers; these run
+//  whole arrays through one loop, with the shared operand held in
+//  registers, in the widest version ActiveIsa() allows:
+//
+//      baseline    simd.h, one 4-wide row at a time
+//      sse4.1      the same, built for SSE4.1
+//      avx2        two rows (or two vectors) per register, with FMA
+//      avx512      a whole matrix (or four vectors) per register, with FMA
+//
+//  FMA rounds once where the baseline rounds twice, so results may differ
+//  from mat<4>::operator * in the last bit.  out may be the same array as
+//  an input of the same type (in place); other overlaps are not allowed.
+//
+
+// out[i] = a * b[i], as proj * view * model[i]
+void MulMat4(const mat<4>& a, const mat<4>* b, mat<4>* out, size_t count);
+
+// out[i] = a[i] * b[i]
+void MulMat4(const mat<4>* a, const mat<4>* b, mat<4>* out, size_t count);
+
+// out[i] = m * in[i]
+void TransformVec4(const mat<4>& m, const vec<4>* in, vec<4>* out, size_t count);
+
+// out[i] = m[i] * in[i]
+void TransformVec4(const mat<4>* m, const vec<4>* in, vec<4>* out, size_t count);
+
+// out[i] = m * vec<4>(in[i], 1), as clip coordinates of positions
+void TransformPoints(const mat<4>& m, const vec<3>* in, vec<4>* out, size_t count);
+
+} // namespace Sand
+
+#endif // __MAT_BATCH_H__
@@ -0,0 +1,88 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace Sand {
+
+// Worker count for a request of `threads` (0 = one per hardware thread)
+inline unsigned ThreadCount(unsigned threads = 0) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    return std::max(1u, threads);
+}
+
+// The step of a 1, 2, 4, ... thread-count sweep that ends on max itself:
+// the last doubling is cut short to max, and max steps past the end
+inline unsigned NextThreadCount(unsigned threads, unsigned max) {
+    return threads < max && threads * 2 > max ? max : threads * 2;
+}
+
+//
+//  Runs f(item, thread) for every item in [0, count) on up to `threads`
+//  threads (0 = all cores).  Items are claimed one at a time from a shared
+//  counter, so uneven items balance themselves; `thread` is a dense index
+//  in [0, threads) for per-thread scratch.  The calling thread takes part.
+//
+
+template<typename F>
+void ParallelFor(size_t count, unsigned threads, F&& f) {
+    if (count == 0) return;
+    threads = unsigned(std::min<size_t>(ThreadCount(threads), count));
+
+    std::atomic<size_t> next(0);
+    auto worker = [&](unsigned thread) {
+        for (size_t i; (i = next.fetch_add(1)) < count; )
+            f(i, thread);
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) pool.emplace_back(worker, t);
+    worker(0);
+    for (auto& th : pool) th.join();
+}
+
+//
+//  Sorts v: one std::sort per block, then rounds of pairwise merges, the
+//  pairs of each round in parallel.  Not stable; the result only depends
+//  on the thread count when equal elements can be told apart.
+//
+
+template<typename T, typename Less = std::less<T>>
+void ParallelSort(std::vector<T>& v, unsigned threads = 0, Less less = Less()) {
+    const size_t MinBlock = size_t(1) << 14;
+    size_t blocks = std::min<size_t>(ThreadCount(threads), (v.size() + MinBlock - 1) / MinBlock);
+    if (blocks <= 1) {
+        std::sort(v.begin(), v.end(), less);
+        return;
+    }
+
+    // run b is [bound[b], bound[b + 1])
+    std::vector<size_t> bound(blocks + 1);
+    for (size_t b = 0; b <= blocks; b++) bound[b] = v.size() * b / blocks;
+    ParallelFor(blocks, threads, [&](size_t b, unsigned) {
+        std::sort(v.begin() + bound[b], v.begin() + bound[b + 1], less);
+    });
+
+    std::vector<T> tmp(v.size());
+    std::vector<T>* src = &v;
+    std::vector<T>* dst = &tmp;
+    for (size_t width = 1; width < blocks; width *= 2) {
+        ParallelFor((blocks + 2 * width - 1) / (2 * width), threads, [&](size_t pair, unsigned) {
+            size_t b0 = pair * 2 * width;
+            size_t lo = bound[b0], mid = bound[std::min(b0 + width, blocks)];
+            size_t hi = bound[std::min(b0 + 2 * width, blocks)];
+            std::merge(src->begin() + lo, src->begin() + mid, src->begin() + mid, src->begin() + hi,
+                       dst->begin() + lo, less);
+        });
+        std::swap(src, dst);
+    }
+    if (src != &v) v.swap(tmp);
+}
+
+} // namespace Sand
+
+#endif // __PARALLEL_H__
@@ -0,0 +1,61 @@
+#ifndef __PHILOX_H__
+#define __PHILOX_H__
+
+#include <array>
+#include <cstdint>
+
+namespace Sand {
+
+//
+//  Philox4x32-10 counter-based generator (Salmon et al., "Parallel Random
+//  Numbers: As Easy as 1, 2, 3", SC 2011).
+//
+//  Output block n is a pure function of (seed, n), so any thread can jump
+//  to any position of the stream in constant time and the values never
+//  depend on how the work was split.
+//
+
+class Philox {
+    uint32_t k0, k1;
+
+    static constexpr uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+    static constexpr uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+
+public:
+    typedef std::array<uint32_t, 4> block;
+
+    constexpr explicit Philox(uint64_t seed = 0)
+        : k0(uint32_t(seed)), k1(uint32_t(seed >> 32)) {}
+
+    // The four 32-bit words of block n
+    constexpr block operator () (uint64_t n) const {
+        block c = {uint32_t(n), uint32_t(n >> 32), 0, 0};
+        uint32_t a = k0, b = k1;
+        for (int round = 0; round < 10; round++) {
+            uint64_t p0 = uint64_t(M0) * c[0];
+            uint64_t p1 = uint64_t(M1) * c[2];
+            c = {uint32_t(p1 >> 32) ^ c[1] ^ a, uint32_t(p1),
+                 uint32_t(p0 >> 32) ^ c[3] ^ b, uint32_t(p0)};
+            a += W0;
+            b += W1;
+        }
+        return c;
+    }
+
+    // Word i of the stream (block i / 4)
+    constexpr uint32_t word(uint64_t i) const { return (*this)(i >> 2)[i & 3]; }
+
+    // r mapped onto [0, n) by a multiply instead of a modulo
+    static constexpr uint32_t below(uint32_t r, uint32_t n) {
+        return uint32_t((uint64_t(r) * n) >> 32);
+    }
+
+    // r mapped onto [0, 1)
+    static constexpr float uniform(uint32_t r) {
+        return float(r >> 8) * (1.0f / 16777216.0f);
+    }
+};
+
+} // namespace Sand
+
+#endif // __PHILOX_H__
@@ -0,0 +1,109 @@
+#ifndef __POINT_LOD_H__
+#define __POINT_LOD_H__
+
+#include "sand.h"
+#include "culling.h"
+#include "vertex_array.h"
+#include <cstdint>
+
+namespace Sand {
+
+//
+//  Level of detail for large point sets.
+//
+//  build() puts the bounding cube of the points under grids of 2^L cells
+//  per axis, L = BlockLevel ... maxLevel(), and keeps one representative
+//  point per occupied cell at every level.  Representatives are picked by
+//  a fixed pseudo-random priority per point (the lowest wins), so the
+//  representative of a cell is also the representative of one of its
+//  eight children: every level contains the level above it.  Points are
+//  then reordered so that each level is a prefix of its block, where the
+//  blocks are the cells of level BlockLevel (up to 512), each stored
+//  contiguously in Morton order.  Drawing level L of a block is drawing
+//  the first count(block, L) of its points.
+//
+//  select() picks a level for every block that survives frustum culling,
+//  the coarsest whose cells project to at most `pixels` pixels at the
+//  block's nearest point, and draw() submits them all in one
+//  glMultiDrawArrays.  The number of points drawn then follows the screen
+//  area the cloud covers rather than the size of the data set.
+//
+//  Building sorts in parallel over blocks; the priority only depends on a
+//  point's index, so the result does not depend on the thread count.
+//
+
+class PointLOD {
+public:
+    static constexpr unsigned BlockLevel = 3;
+    static constexpr unsigned KeyLevel = 21;     // finest grid: 3 * 21 bits of Morton key
+
+    struct Stats {
+        size_t points = 0;          // selected by the last select()
+        size_t blocks = 0;          // drawn
+        size_t culled = 0;          // blocks outside the frustum
+        double buildSeconds = 0;
+    };
+
+    PointLOD() = default;
+    explicit PointLOD(const VertexArray<3>& points, unsigned threads = 0) { build(points, threads); }
+
+    // At most 2^31 - 1 points, the most a GLint first can address
+    void build(const VertexArray<3>& points, unsigned threads = 0);
+    void build(const vec<3>* points, size_t count, unsigned threads = 0) {
+        build(VertexArray<3>(points, count), threads);
+    }
+
+    // The points in draw order, and the input index of each, for reordering
+    // other attributes the same way
+    const VertexArray<3>& points() const { return pts; }
+    const std::vector<uint32_t>& order() const { return orderOf; }
+
+    size_t size() const { return pts.size(); }
+    size_t blockCount() const { return blocks.size(); }
+    unsigned maxLevel() const { return finest; }
+    const AABB& bounds() const { return box; }
+
+    // Points of the whole set at level L (all of them past maxLevel())
+    size_t count(unsigned level) const;
+
+    // Edge of a level-L cell
+    GLfloat cellSize(unsigned level) const { return cube / GLfloat(1u << level); }
+
+    // Chooses the blocks and levels to draw for a camera: modelView maps
+    // the points to eye space, projection is Perspective/Frustum/Ortho and
+    // viewportHeight is in pixels
+    void select(const mat<4>& modelView, const mat<4>& projection,
+                GLfloat viewportHeight, GLfloat pixels = 1);
+
+    // The selection as glMultiDrawArrays ranges
+    const std::vector<GLint>& firsts() const { return first; }
+    const std::vector<GLsizei>& counts() const { return countOf; }
+
+    // points().upload() into the bound GL_ARRAY_BUFFER first
+    void draw() const;
+
+    const Stats& stats() const { return st; }
+
+private:
+    struct Block {
+        size_t first = 0, count = 0;
+        AABB bounds;                    // of its points
+        std::vector<uint32_t> ends;     // level BlockLevel + i ends at first + ends[i]
+    };
+
+    VertexArray<3> pts;
+    std::vector<uint32_t> orderOf;
+    std::vector<Block> blocks;
+    std::vector<size_t> levelCounts;    // per level, over all blocks
+    AABB box;
+    GLfloat cube = 0;
+    unsigned finest = BlockLevel;
+
+    std::vector<GLint> first;
+    std::vector<GLsizei> countOf;
+    Stats st;
+};
+
+} // namespace Sand
+
+#endif // __POINT_LOD_H__
@@ -0,0 +1,242 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include "sand.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace Sand {
+
+//
+//  Frame profiler.
+//
+//  Built with -DSAND_PROFILE (for the whole build, common/ included), the
+//  macros below time the enclosing block:
+//
+//      void display() {
+//          SAND_PROFILE_SCOPE("display");
+//          {
+//              SAND_PROFILE_GPU_SCOPE("draw");     // CPU and GL_TIME_ELAPSED
+//              glDrawArrays(GL_POINTS, 0, num_points);
+//          }
+//          glFlush();
+//          SAND_PROFILE_FRAME();
+//      }
+//
+//  Otherwise they expand to nothing and the profiler costs nothing.
+//
+//  A scope records one event (name, begin, end) into a ring buffer owned
+//  by its thread: no locks and no allocation on the way.  Once per frame,
+//  SAND_PROFILE_FRAME() drains every ring on the calling thread, sums the
+//  events by name into FrameStats, and keeps them for the last History
+//  frames; report() prints averages over them.  Between capture() and
+//  writeChromeTrace() the events are also kept, and written as a Chrome
+//  trace (chrome://tracing, ui.perfetto.dev).
+//
+//  GPU scopes need enableGpu() with a current context that has timer
+//  queries (GL 3.3 or ARB_timer_query).  GL_TIME_ELAPSED queries do not
+//  nest, so a GPU scope inside another only times the CPU.  Results are
+//  read without waiting, and land in the frame in which they arrive,
+//  usually a frame or two late.  Scope names must outlive the profiler
+//  (string literals).
+//
+
+#ifdef SAND_PROFILE
+constexpr bool Profiling = true;
+#else
+constexpr bool Profiling = false;
+#endif
+
+struct ProfileEvent {
+    const char* name;
+    uint64_t begin, end;    // ns on the profiler's clock
+    uint32_t depth;         // nesting on its thread
+    uint32_t gpu;           // 1 for GL_TIME_ELAPSED results
+};
+
+// Thread-local event ring, written by its thread, drained by frame()
+struct ProfileRing {
+    static constexpr size_t Capacity = 4096;
+
+    ProfileEvent events[Capacity];
+    std::atomic<uint64_t> head{0};      // events written
+    uint64_t tail = 0;                  // events drained
+    uint32_t depth = 0;
+    uint32_t thread = 0;
+    std::string name;
+    std::atomic<bool> retired{false};   // its thread ended
+
+    void push(const ProfileEvent& e) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        events[h % Capacity] = e;
+        head.store(h + 1, std::memory_order_release);
+    }
+};
+
+class Profiler {
+public:
+    static constexpr size_t History = 120;  // frames kept
+
+    struct ScopeStats {
+        const char* name;
+        bool gpu;
+        uint32_t calls;
+        double seconds, maxSeconds;   // total, and the longest call
+    };
+
+    struct FrameStats {
+        uint64_t index = 0;
+        double seconds = 0;     // since the previous frame()
+        std::vector<ScopeStats> scopes;
+    };
+
+    Profiler();
+    Profiler(const Profiler&) = delete;
+    Profiler& operator = (const Profiler&) = delete;
+
+    // Nanoseconds since the profiler started
+    static uint64_t now();
+
+    // The calling thread's ring (registered on first use)
+    static ProfileRing& ring();
+
+    // Names the calling thread in traces
+    void setThreadName(const std::string& name);
+
+    // Turns GPU scopes on or off for the calling thread's GL context; false
+    // if the context has no timer queries
+    bool enableGpu(bool on = true);
+    bool gpuEnabled() const { return gpuThread != 0; }
+
+    // Ends a frame: drains all rings and resolved GPU queries
+    void frame();
+
+    const FrameStats& lastFrame() const { return frames.back(); }
+    const std::deque<FrameStats>& history() const { return frames; }
+    size_t dropped() const { return lost; }     // events overwritten before a frame()
+
+    // Per scope, over history(): ms per frame (average and worst), calls
+    void report(std::ostream& os) const;
+
+    // Keeps up to maxEvents events for writeChromeTrace()
+    void capture(size_t maxEvents = 1 << 20);
+    bool capturing() const { return captureLimit != 0; }
+
+    // Writes the captured events as Chrome trace JSON and ends the capture
+    bool writeChromeTrace(const std::string& file);
+
+    //
+    //  --- used by GpuProfileScope ---
+    //
+
+    GLuint beginGpu();
+    void endGpu(GLuint query, const char* name, uint64_t begin);
+
+private:
+    struct Captured {
+        ProfileEvent event;
+        uint32_t thread;
+    };
+
+    struct PendingQuery {
+        GLuint query;
+        const char* name;
+        uint64_t begin;     // CPU time of the scope's start
+    };
+
+    std::mutex ringsLock;
+    std::vector<ProfileRing*> rings, spare;
+    uint32_t threads = 0;
+
+    std::deque<FrameStats> frames;
+    uint64_t lastFrameTime = 0;
+    size_t lost = 0;
+
+    size_t captureLimit = 0;
+    std::vector<Captured> captured;
+    std::vector<std::pair<uint32_t, std::string>> threadNames;
+
+    size_t gpuThread = 0;           // hash of the GL thread's id, 0 when off
+    bool gpuActive = false;         // a GL_TIME_ELAPSED query is open
+    uint64_t gpuClock = 0;          // end of the last GPU event placed
+    std::vector<GLuint> freeQueries;
+    std::deque<PendingQuery> pending;
+
+    ProfileRing* acquire();
+    void release(ProfileRing* r);
+    void drain(ProfileRing& r, std::vector<ProfileEvent>& out);
+    void resolveGpu(std::vector<ProfileEvent>& out);
+    void record(const ProfileEvent& e, uint32_t thread);
+
+    friend struct ThreadRing;
+};
+
+// The process-wide profiler the macros report to
+Profiler& GetProfiler();
+
+
+// Times the enclosing block on the calling thread
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name)
+        : r(Profiler::ring()), name(name), begin(Profiler::now()) { r.depth++; }
+
+    ~ProfileScope() {
+        uint64_t end = Profiler::now();
+        r.depth--;
+        r.push(ProfileEvent{name, begin, end, r.depth, 0});
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator = (const ProfileScope&) = delete;
+
+    uint64_t start() const { return begin; }
+
+private:
+    ProfileRing& r;
+    const char* name;
+    uint64_t begin;
+};
+
+// ... and the GL commands issued in it
+class GpuProfileScope {
+public:
+    explicit GpuProfileScope(const char* name)
+        : cpu(name), name(name), query(GetProfiler().beginGpu()) {}
+
+    ~GpuProfileScope() {
+        if (query != 0) { GetProfiler().endGpu(query, name, cpu.start()); }
+    }
+
+    GpuProfileScope(const GpuProfileScope&) = delete;
+    GpuProfileScope& operator = (const GpuProfileScope&) = delete;
+
+private:
+    ProfileScope cpu;
+    const char* name;
+    GLuint query;
+};
+
+} // namespace Sand
+
+#define SAND_PROFILE_CAT2(a, b) a##b
+#define SAND_PROFILE_CAT(a, b) SAND_PROFILE_CAT2(a, b)
+
+#ifdef SAND_PROFILE
+#   define SAND_PROFILE_SCOPE(name) \
+        Sand::ProfileScope SAND_PROFILE_CAT(sandProfile, __LINE__)(name)
+#   define SAND_PROFILE_GPU_SCOPE(name) \
+        Sand::GpuProfileScope SAND_PROFILE_CAT(sandProfile, __LINE__)(name)
+#   define SAND_PROFILE_FRAME() Sand::GetProfiler().frame()
+#   define SAND_PROFILE_THREAD(name) Sand::GetProfiler().setThreadName(name)
+#else
+#   define SAND_PROFILE_SCOPE(name) ((void)0)
+#   define SAND_PROFILE_GPU_SCOPE(name) ((void)0)
+#   define SAND_PROFILE_FRAME() ((void)0)
+#   define SAND_PROFILE_THREAD(name) ((void)0)
+#endif
+
+#endif // __PROFILER_H__
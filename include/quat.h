@@ -0,0 +1,314 @@
+#ifndef __QUAT_H__
+#define __QUAT_H__
+
+#include "sand.h"
+
+namespace Sand {
+
+//
+//  Rotation quaternions and unit dual quaternions.
+//
+//  quat is (x, y, z, w) with w the scalar part, laid out like vec<4> so
+//  the run-time paths work on one simd.h register.  a * b rotates by b,
+//  then by a, the same order as the mat<4> product of their matrices, and
+//  the matrices match RotateX/Y/Z: mat<4>(AxisAngle(30, vec<3>(1, 0, 0)))
+//  equals RotateX(30) to rounding.
+//
+//  dualquat is a rigid transform (rotation, then translation) as
+//  real + e dual.  Composing two costs 48 multiplies against 64 for the
+//  mat<4> product, and blending them (nlerp) does not shear the way
+//  blending matrices does.
+//
+//  Animation code can keep these until upload and expand whole arrays at
+//  once with QuatToMat4 / DualQuatToMat4, four per register pass.
+//
+
+struct alignas(16) quat {
+    GLfloat x, y, z, w;
+
+    constexpr quat() : x(0), y(0), z(0), w(1) {}
+    constexpr quat(GLfloat x, GLfloat y, GLfloat z, GLfloat w) : x(x), y(y), z(z), w(w) {}
+    constexpr quat(const vec<3>& v, GLfloat w) : x(v[0]), y(v[1]), z(v[2]), w(w) {}
+
+    // From the rotation part of an orthonormal matrix (Shepperd's method)
+    template<int N, std::enable_if_t<N == 3 || N == 4, bool> = true>
+    explicit constexpr quat(const mat<N>& m) : x(0), y(0), z(0), w(1) {
+        GLfloat tr = m[0][0] + m[1][1] + m[2][2];
+        if (tr > 0) {
+            GLfloat s = ct::sqrt(tr + 1) * 2;
+            *this = quat((m[2][1] - m[1][2]) / s, (m[0][2] - m[2][0]) / s,
+                         (m[1][0] - m[0][1]) / s, s / 4);
+        } else if (m[0][0] > m[1][1] && m[0][0] > m[2][2]) {
+            GLfloat s = ct::sqrt(1 + m[0][0] - m[1][1] - m[2][2]) * 2;
+            *this = quat(s / 4, (m[0][1] + m[1][0]) / s,
+                         (m[0][2] + m[2][0]) / s, (m[2][1] - m[1][2]) / s);
+        } else if (m[1][1] > m[2][2]) {
+            GLfloat s = ct::sqrt(1 + m[1][1] - m[0][0] - m[2][2]) * 2;
+            *this = quat((m[0][1] + m[1][0]) / s, s / 4,
+                         (m[1][2] + m[2][1]) / s, (m[0][2] - m[2][0]) / s);
+        } else {
+            GLfloat s = ct::sqrt(1 + m[2][2] - m[0][0] - m[1][1]) * 2;
+            *this = quat((m[0][2] + m[2][0]) / s, (m[1][2] + m[2][1]) / s,
+                         s / 4, (m[1][0] - m[0][1]) / s);
+        }
+    }
+
+    constexpr vec<3> xyz() const { return vec<3>(x, y, z); }
+
+    simd::f32x4 packet() const { return simd::load(&x); }
+
+    static quat unpack(simd::f32x4 p) {
+        quat q;
+        simd::store(&q.x, p);
+        return q;
+    }
+
+    // Hamilton product
+    constexpr quat operator * (const quat& b) const {
+        if (!std::is_constant_evaluated()) {
+            // xyz: w b.xyz + b.w xyz + xyz x b.xyz,  w: w b.w - xyz . b.xyz
+            simd::f32x4 p = packet(), q = b.packet();
+            simd::f32x4 r = simd::add(simd::mul(simd::swizzle<3, 3, 3, 3>(p), q),
+                                      simd::mul(p, simd::swizzle<3, 3, 3, 3>(q)));
+            r = simd::add(r, simd::cross3(p, q));
+            const float wOnly[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+            r = simd::sub(r, simd::mul(simd::dot4(p, q), simd::load(wOnly)));
+            return unpack(r);
+        }
+        return quat(w*b.x + x*b.w + y*b.z - z*b.y,
+                    w*b.y - x*b.z + y*b.w + z*b.x,
+                    w*b.z + x*b.y - y*b.x + z*b.w,
+                    w*b.w - x*b.x - y*b.y - z*b.z);
+    }
+
+    constexpr quat operator + (const quat& b) const { return quat(x + b.x, y + b.y, z + b.z, w + b.w); }
+    constexpr quat operator - (const quat& b) const { return quat(x - b.x, y - b.y, z - b.z, w - b.w); }
+    constexpr quat operator - () const { return quat(-x, -y, -z, -w); }
+    constexpr quat operator * (const GLfloat s) const { return quat(x * s, y * s, z * s, w * s); }
+    friend constexpr quat operator * (const GLfloat s, const quat& q) { return q * s; }
+
+    constexpr quat& operator *= (const quat& b) { return *this = *this * b; }
+
+    constexpr bool operator == (const quat& b) const {
+        return x == b.x && y == b.y && z == b.z && w == b.w;
+    }
+    constexpr bool operator != (const quat& b) const { return !(*this == b); }
+
+    // Rotation matrices; the quaternion must be unit length
+    explicit constexpr operator mat<3>() const {
+        GLfloat x2 = x + x, y2 = y + y, z2 = z + z;
+        GLfloat xx = x * x2, yy = y * y2, zz = z * z2;
+        GLfloat xy = x * y2, xz = x * z2, yz = y * z2;
+        GLfloat wx = w * x2, wy = w * y2, wz = w * z2;
+        return mat<3>(1 - (yy + zz), xy - wz, xz + wy,
+                      xy + wz, 1 - (xx + zz), yz - wx,
+                      xz - wy, yz + wx, 1 - (xx + yy));
+    }
+
+    explicit constexpr operator mat<4>() const {
+        mat<3> r = mat<3>(*this);
+        return mat<4>(r[0][0], r[0][1], r[0][2], 0.0,
+                      r[1][0], r[1][1], r[1][2], 0.0,
+                      r[2][0], r[2][1], r[2][2], 0.0,
+                      0.0, 0.0, 0.0, 1.0);
+    }
+
+    friend std::ostream& operator << (std::ostream& os, const quat& q) {
+        return os << "(" << q.x << ", " << q.y << ", " << q.z << ", " << q.w << ")";
+    }
+};
+
+
+// Rotation by theta degrees about axis, like Rotate{X,Y,Z}
+constexpr quat AxisAngle(const GLfloat theta, const vec<3>& axis) {
+    GLfloat half = DegreesToRadians * theta / 2;
+    return quat(normalize(axis) * ct::sin(half), ct::cos(half));
+}
+
+constexpr GLfloat dot(const quat& a, const quat& b) {
+    return a.x*b.x + a.y*b.y + a.z*b.z + a.w*b.w;
+}
+
+constexpr GLfloat length(const quat& q) { return ct::sqrt(dot(q, q)); }
+
+constexpr quat normalize(const quat& q) { return q * (1 / length(q)); }
+
+constexpr quat conjugate(const quat& q) { return quat(-q.x, -q.y, -q.z, q.w); }
+
+constexpr quat inverse(const quat& q) { return conjugate(q) * (1 / dot(q, q)); }
+
+// v rotated by the unit quaternion q: v + w t + xyz x t, t = 2 xyz x v
+constexpr vec<3> rotate(const quat& q, const vec<3>& v) {
+    if (!std::is_constant_evaluated()) {
+        simd::f32x4 p = q.packet(), a = v.packet();
+        simd::f32x4 t = simd::cross3(p, a);
+        t = simd::add(t, t);
+        simd::f32x4 r = simd::add(a, simd::add(simd::mul(simd::swizzle<3, 3, 3, 3>(p), t),
+                                               simd::cross3(p, t)));
+        vec<3> res;
+        simd::store3(&res[0], r);
+        return res;
+    }
+    vec<3> u = q.xyz();
+    vec<3> t = cross(u, v) * 2;
+    return v + t * q.w + cross(u, t);
+}
+
+// Normalized linear interpolation along the shorter arc
+constexpr quat nlerp(const quat& a, const quat& b, const GLfloat t) {
+    quat c = dot(a, b) < 0 ? -b : b;
+    return normalize(a * (1 - t) + c * t);
+}
+
+// Constant-speed interpolation along the shorter arc
+inline quat slerp(const quat& a, const quat& b, const GLfloat t) {
+    GLfloat d = dot(a, b);
+    quat c = d < 0 ? -b : b;
+    d = std::fabs(d);
+    if (d > GLfloat(0.9995))   // sin(theta) ~ 0: nlerp is as accurate
+        return nlerp(a, c, t);
+
+    GLfloat theta = std::acos(d);
+    GLfloat r = 1 / std::sin(theta);
+    return a * (std::sin((1 - t) * theta) * r) + c * (std::sin(t * theta) * r);
+}
+
+
+//----------------------------------------------------------------------------
+//
+//  Dual quaternions
+//
+
+struct dualquat {
+    quat real, dual;
+
+    constexpr dualquat() : real(), dual(0, 0, 0, 0) {}
+    constexpr dualquat(const quat& real, const quat& dual) : real(real), dual(dual) {}
+
+    // Rotation by r, then translation by t
+    constexpr dualquat(const quat& r, const vec<3>& t) : real(r), dual(quat(t, 0) * r * GLfloat(0.5)) {}
+
+    // From a rigid [R t; 0 1]
+    explicit constexpr dualquat(const mat<4>& m)
+        : dualquat(quat(m), vec<3>(m[0][3], m[1][3], m[2][3])) {}
+
+    constexpr vec<3> translation() const { return (dual * conjugate(real) * 2).xyz(); }
+
+    // a * b applies b, then a
+    constexpr dualquat operator * (const dualquat& b) const {
+        return dualquat(real * b.real, real * b.dual + dual * b.real);
+    }
+
+    constexpr dualquat operator + (const dualquat& b) const { return dualquat(real + b.real, dual + b.dual); }
+    constexpr dualquat operator - () const { return dualquat(-real, -dual); }
+    constexpr dualquat operator * (const GLfloat s) const { return dualquat(real * s, dual * s); }
+
+    explicit constexpr operator mat<4>() const {
+        mat<4> m = mat<4>(real);
+        vec<3> t = translation();
+        m[0][3] = t[0]; m[1][3] = t[1]; m[2][3] = t[2];
+        return m;
+    }
+
+    friend std::ostream& operator << (std::ostream& os, const dualquat& d) {
+        return os << d.real << " + e" << d.dual;
+    }
+};
+
+constexpr dualquat conjugate(const dualquat& d) { return dualquat(conjugate(d.real), conjugate(d.dual)); }
+
+// The inverse of a unit dual quaternion is its conjugate
+constexpr dualquat inverse(const dualquat& d) { return conjugate(d); }
+
+constexpr dualquat normalize(const dualquat& d) { return d * (1 / length(d.real)); }
+
+constexpr vec<3> transform(const dualquat& d, const vec<3>& p) {
+    return rotate(d.real, p) + d.translation();
+}
+
+// Dual-quaternion linear blending along the shorter arc
+constexpr dualquat nlerp(const dualquat& a, const dualquat& b, const GLfloat t) {
+    dualquat c = dot(a.real, b.real) < 0 ? -b : b;
+    return normalize(a * (1 - t) + c * t);
+}
+
+
+//----------------------------------------------------------------------------
+//
+//  Batched conversions
+//
+
+namespace detail {
+
+// Rows 0-2 of four rigid transforms from their quaternion components,
+// one transform per lane, and translations tx, ty, tz
+inline void rigid4(simd::f32x4 x, simd::f32x4 y, simd::f32x4 z, simd::f32x4 w,
+                   simd::f32x4 tx, simd::f32x4 ty, simd::f32x4 tz, mat<4>* out) {
+    using namespace simd;
+    f32x4 x2 = add(x, x), y2 = add(y, y), z2 = add(z, z);
+    f32x4 xx = mul(x, x2), yy = mul(y, y2), zz = mul(z, z2);
+    f32x4 xy = mul(x, y2), xz = mul(x, z2), yz = mul(y, z2);
+    f32x4 wx = mul(w, x2), wy = mul(w, y2), wz = mul(w, z2);
+    f32x4 one = splat(1.0f);
+
+    f32x4 rows[3][4] = {
+        {sub(one, add(yy, zz)), sub(xy, wz), add(xz, wy), tx},
+        {add(xy, wz), sub(one, add(xx, zz)), sub(yz, wx), ty},
+        {sub(xz, wy), add(yz, wx), sub(one, add(xx, yy)), tz}};
+
+    static const float w1[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    for (int r = 0; r < 3; r++) {
+        transpose(rows[r][0], rows[r][1], rows[r][2], rows[r][3]);
+        for (int k = 0; k < 4; k++) store(&out[k][r][0], rows[r][k]);
+    }
+    for (int k = 0; k < 4; k++) store(&out[k][3][0], load(w1));
+}
+
+} // namespace detail
+
+// out[i] = mat<4>(q[i])
+inline void QuatToMat4(const quat* q, mat<4>* out, size_t count) {
+    size_t i = 0, whole = count - count % 4;
+    simd::f32x4 zero = simd::splat(0.0f);
+    for (; i < whole; i += 4) {
+        simd::f32x4 x = q[i].packet(), y = q[i + 1].packet(), z = q[i + 2].packet(), w = q[i + 3].packet();
+        simd::transpose(x, y, z, w);
+        detail::rigid4(x, y, z, w, zero, zero, zero, out + i);
+    }
+    for (; i < count; i++) out[i] = mat<4>(q[i]);
+}
+
+// out[i] = mat<4>(d[i])
+inline void DualQuatToMat4(const dualquat* d, mat<4>* out, size_t count) {
+    using namespace simd;
+    size_t i = 0, whole = count - count % 4;
+    for (; i < whole; i += 4) {
+        f32x4 x = d[i].real.packet(), y = d[i + 1].real.packet();
+        f32x4 z = d[i + 2].real.packet(), w = d[i + 3].real.packet();
+        f32x4 dx = d[i].dual.packet(), dy = d[i + 1].dual.packet();
+        f32x4 dz = d[i + 2].dual.packet(), dw = d[i + 3].dual.packet();
+        transpose(x, y, z, w);
+        transpose(dx, dy, dz, dw);
+
+        // t = 2 (dual * conjugate(real)).xyz = 2 (w d - dw r + r x d)
+        f32x4 tx = add(sub(mul(w, dx), mul(dw, x)), sub(mul(y, dz), mul(z, dy)));
+        f32x4 ty = add(sub(mul(w, dy), mul(dw, y)), sub(mul(z, dx), mul(x, dz)));
+        f32x4 tz = add(sub(mul(w, dz), mul(dw, z)), sub(mul(x, dy), mul(y, dx)));
+        detail::rigid4(x, y, z, w, add(tx, tx), add(ty, ty), add(tz, tz), out + i);
+    }
+    for (; i < count; i++) out[i] = mat<4>(d[i]);
+}
+
+// out[i] = quat(m[i])
+inline void Mat4ToQuat(const mat<4>* m, quat* out, size_t count) {
+    for (size_t i = 0; i < count; i++) out[i] = quat(m[i]);
+}
+
+// out[i] = dualquat(m[i])
+inline void Mat4ToDualQuat(const mat<4>* m, dualquat* out, size_t count) {
+    for (size_t i = 0; i < count; i++) out[i] = dualquat(m[i]);
+}
+
+} // namespace Sand
+
+#endif // __QUAT_H__
@@ -28,10 +28,37 @@
 namespace Sand {
     GLuint InitShader(const std::string& vertexShaderFile,
                 const std::string& fragmentShaderFile);
+
+    // A shader compiled into the binary: `make` writes every *.glsl to
+    // embedded_shaders.h as Sand::shaders::<file>_glsl.  InitShader on
+    // these touches no files, the program binary cache included.
+    struct EmbeddedShader {
+        const char* name;       // the file it came from, for messages
+        const char* source;     // includes expanded
+    };
+
+    GLuint InitShader(const EmbeddedShader& vertexShader,
+                const EmbeddedShader& fragmentShader);
+
+    // Prints the info log of a shader or program object to std::cerr
+    void PrintInfoLog(GLuint object);
+
+    // InitShader keeps linked program binaries in an on-disk cache keyed by
+    // the shader sources and the GL vendor, renderer and version.  The
+    // directory defaults to $SAND_SHADER_CACHE, else ".shadercache"; an
+    // empty name turns the cache off.
+    struct ShaderCacheStats {
+        unsigned hits = 0, misses = 0, rejected = 0;  // rejected: stale binaries
+        double loadSeconds = 0, compileSeconds = 0;   // time in each path
+    };
+
+    void SetShaderCacheDir(const std::string& dir);
+    const ShaderCacheStats& GetShaderCacheStats();
+    std::ostream& operator << (std::ostream& os, const ShaderCacheStats& s);
     
-    const GLfloat DivideByZeroTolerance = GLfloat(1.0e-07);
+    constexpr GLfloat DivideByZeroTolerance = GLfloat(1.0e-07);
     
-    const GLfloat DegreesToRadians = M_PI / 180.0;
+    constexpr GLfloat DegreesToRadians = M_PI / 180.0;
 } // namespace Sand
 
 
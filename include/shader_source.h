@@ -0,0 +1,131 @@
+#ifndef __SHADER_SOURCE_H__
+#define __SHADER_SOURCE_H__
+
+#include "sand.h"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Sand {
+
+//
+//  Shader source manager.
+//
+//  Files are memory-mapped and preprocessed once: every line of the form
+//
+//      #include "common/lighting.glsl"
+//
+//  is replaced by the named file (relative to the including file),
+//  followed by a #line directive that restores the includer's numbering.
+//  The expanded text of every file is memoized, and the include edges form
+//  a dependency graph, so a change to one file invalidates exactly that
+//  file and the files that include it, directly or not.
+//
+//  Changes are picked up by poll(): through inotify on the directories of
+//  every loaded file on Linux (editors that save by rename are covered), or
+//  by comparing modification times elsewhere.  Not thread-safe; use it from
+//  the GL thread.
+//
+
+class ShaderSources {
+public:
+    ShaderSources() = default;
+    ShaderSources(const ShaderSources&) = delete;
+    ShaderSources& operator = (const ShaderSources&) = delete;
+    ~ShaderSources();
+
+    // The expanded text of file, or NULL (after a message) when it or one
+    // of its includes cannot be read or the includes form a cycle.  The
+    // pointer stays valid until file is invalidated.
+    const std::string* get(const std::string& file);
+
+    // Forgets file and everything that includes it; returns their names
+    std::vector<std::string> invalidate(const std::string& file);
+
+    // Files changed on disk since the last call, with their includers,
+    // already invalidated
+    std::vector<std::string> poll();
+
+    // Absolute, normalized name used as the key for file
+    static std::string key(const std::string& file);
+
+private:
+    struct Entry {
+        std::string text;
+        std::vector<std::string> includes;  // direct includes, as keys
+        bool valid = false;
+        long long mtime = 0;
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_map<std::string, std::unordered_set<std::string>> includedBy;
+    std::unordered_set<std::string> loading;  // include cycle detection
+
+    int notify = -1;
+    std::unordered_map<int, std::string> watches;  // watch descriptor -> directory
+    std::unordered_set<std::string> watchedDirs;
+
+    bool preprocess(const std::string& name, Entry& entry);
+    void watch(const std::string& name);
+};
+
+// The process-wide manager InitShader reads through
+ShaderSources& GetShaderSources();
+
+// source without comments, #line directives or whitespace the compiler
+// does not need: directives keep a line each, all other code shares
+// lines.  Compile errors then point at the minified lines.
+std::string MinifyGLSL(const std::string& source);
+
+
+//
+//  Programs that follow their sources.  Call update() once per frame: it
+//  polls for changes, starts recompiling the programs whose sources (or
+//  includes) changed, and swaps in those that finished linking.  Where
+//  GL_KHR_parallel_shader_compile is available, the compile proceeds in the
+//  driver's threads and a program is only swapped once it completes, so the
+//  frame never waits on it.  A rebuild that fails prints its log and keeps
+//  the previous program.
+//
+//  Program names change on reload: look them up with operator[] each frame,
+//  and re-query uniform and attribute locations after update() returns
+//  nonzero.
+//
+
+class ShaderLibrary {
+public:
+    typedef unsigned Handle;
+
+    ShaderLibrary() = default;
+    ShaderLibrary(const ShaderLibrary&) = delete;
+    ShaderLibrary& operator = (const ShaderLibrary&) = delete;
+
+    // Builds a program with InitShader (fatal on error, like InitShader)
+    Handle add(const std::string& vShaderFile, const std::string& fShaderFile);
+
+    GLuint operator [] (Handle h) const { return programs[h].program; }
+
+    // Returns the number of programs swapped in this call
+    unsigned update();
+
+private:
+    struct Program {
+        std::string files[2];   // vertex, fragment as keys
+        GLuint program = 0;
+        GLuint pending = 0;     // relinking, not yet swapped in
+        GLuint shaders[2] = {0, 0};
+        bool stale = false;     // changed while pending
+        uint64_t started = 0;   // update() that last called rebuild
+    };
+
+    std::vector<Program> programs;
+    bool parallelCompile = false;
+    uint64_t updates = 0;
+
+    void rebuild(Program& p);
+    bool finish(Program& p);
+};
+
+} // namespace Sand
+
+#endif // __SHADER_SOURCE_H__
@@ -0,0 +1,413 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+//
+//  Thin 4-wide float register layer used by the vec<3>, vec<4> and mat<4>
+//  fast paths and the bulk kernels.  Picks SSE (with an AVX path for 4x4 products) on x86,
+//  NEON on ARM, and a plain array otherwise.  Define SAND_NO_SIMD to force
+//  the scalar fallback.
+//
+
+#include <cmath>
+#include <cstring>
+
+#if !defined(SAND_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#   define SAND_SIMD_SSE
+#   include <emmintrin.h>
+#   if defined(__AVX__)
+#       define SAND_SIMD_AVX
+#       include <immintrin.h>
+#   endif
+#elif !defined(SAND_NO_SIMD) && defined(__ARM_NEON)
+#   define SAND_SIMD_NEON
+#   include <arm_neon.h>
+#else
+#   define SAND_SIMD_SCALAR
+#endif
+
+namespace Sand {
+namespace simd {
+
+#if defined(SAND_SIMD_SSE)
+
+typedef __m128 f32x4;
+
+inline f32x4 load(const float* p) { return _mm_loadu_ps(p); }
+inline void store(float* p, f32x4 a) { _mm_storeu_ps(p, a); }
+
+// xyz, w = 0.  The 64-bit halves go through memcpy: GCC's _mm_load_sd and
+// _mm_storel_pi access floats through double / __m64 lvalues, which lets
+// the optimizer reorder them against plain float stores to the same vec.
+inline f32x4 load3(const float* p) {
+    double xy;
+    std::memcpy(&xy, p, sizeof(xy));
+    return _mm_movelh_ps(_mm_castpd_ps(_mm_set_sd(xy)), _mm_load_ss(p + 2));
+}
+
+inline void store3(float* p, f32x4 a) {
+    double xy = _mm_cvtsd_f64(_mm_castps_pd(a));
+    std::memcpy(p, &xy, sizeof(xy));
+    _mm_store_ss(p + 2, _mm_movehl_ps(a, a));
+}
+
+inline f32x4 splat(float s) { return _mm_set1_ps(s); }
+inline f32x4 add(f32x4 a, f32x4 b) { return _mm_add_ps(a, b); }
+inline f32x4 sub(f32x4 a, f32x4 b) { return _mm_sub_ps(a, b); }
+inline f32x4 mul(f32x4 a, f32x4 b) { return _mm_mul_ps(a, b); }
+inline f32x4 div(f32x4 a, f32x4 b) { return _mm_div_ps(a, b); }
+inline f32x4 neg(f32x4 a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+inline f32x4 sqrt(f32x4 a) { return _mm_sqrt_ps(a); }
+
+// 1 / sqrt(a) and 1 / a to within a relative 1.5 * 2^-12 on every backend,
+// for fastmath.h to refine
+inline f32x4 rsqrt_est(f32x4 a) { return _mm_rsqrt_ps(a); }
+inline f32x4 rcp_est(f32x4 a) { return _mm_rcp_ps(a); }
+
+inline f32x4 min(f32x4 a, f32x4 b) { return _mm_min_ps(a, b); }
+inline f32x4 max(f32x4 a, f32x4 b) { return _mm_max_ps(a, b); }
+inline f32x4 abs(f32x4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+
+// bit i set when lane i has its sign bit set
+inline int signbits(f32x4 a) { return _mm_movemask_ps(a); }
+
+// horizontal sum broadcast to every lane
+inline f32x4 hsum(f32x4 a) {
+    __m128 s = _mm_add_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+inline float first(f32x4 a) { return _mm_cvtss_f32(a); }
+
+// (y, z, x, w)
+inline f32x4 yzx(f32x4 a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+
+// (a[i0], a[i1], a[i2], a[i3])
+template<int i0, int i1, int i2, int i3>
+inline f32x4 swizzle(f32x4 a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(i3, i2, i1, i0)); }
+
+// (a[i0], a[i1], b[j0], b[j1])
+template<int i0, int i1, int j0, int j1>
+inline f32x4 shuffle(f32x4 a, f32x4 b) { return _mm_shuffle_ps(a, b, _MM_SHUFFLE(j1, j0, i1, i0)); }
+
+inline void transpose(f32x4& a, f32x4& b, f32x4& c, f32x4& d) {
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+}
+
+// (a0 b0 a1 b1), (a2 b2 a3 b3)
+inline void zip(f32x4 a, f32x4 b, f32x4& lo, f32x4& hi) {
+    lo = _mm_unpacklo_ps(a, b);
+    hi = _mm_unpackhi_ps(a, b);
+}
+
+#elif defined(SAND_SIMD_NEON)
+
+typedef float32x4_t f32x4;
+
+inline f32x4 load(const float* p) { return vld1q_f32(p); }
+inline void store(float* p, f32x4 a) { vst1q_f32(p, a); }
+
+inline f32x4 load3(const float* p) {
+    return vcombine_f32(vld1_f32(p), vset_lane_f32(p[2], vdup_n_f32(0.0f), 0));
+}
+
+inline void store3(float* p, f32x4 a) {
+    vst1_f32(p, vget_low_f32(a));
+    p[2] = vgetq_lane_f32(a, 2);
+}
+
+inline f32x4 splat(float s) { return vdupq_n_f32(s); }
+inline f32x4 add(f32x4 a, f32x4 b) { return vaddq_f32(a, b); }
+inline f32x4 sub(f32x4 a, f32x4 b) { return vsubq_f32(a, b); }
+inline f32x4 mul(f32x4 a, f32x4 b) { return vmulq_f32(a, b); }
+inline f32x4 neg(f32x4 a) { return vnegq_f32(a); }
+inline f32x4 min(f32x4 a, f32x4 b) { return vminq_f32(a, b); }
+inline f32x4 max(f32x4 a, f32x4 b) { return vmaxq_f32(a, b); }
+inline f32x4 abs(f32x4 a) { return vabsq_f32(a); }
+
+inline int signbits(f32x4 a) {
+    uint32_t s[4];
+    vst1q_u32(s, vshrq_n_u32(vreinterpretq_u32_f32(a), 31));
+    return int(s[0] | s[1] << 1 | s[2] << 2 | s[3] << 3);
+}
+
+// the estimates alone are good to 8 bits: one Newton step each
+inline f32x4 rsqrt_est(f32x4 a) {
+    f32x4 e = vrsqrteq_f32(a);
+    return vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a, e), e));
+}
+
+inline f32x4 rcp_est(f32x4 a) {
+    f32x4 e = vrecpeq_f32(a);
+    return vmulq_f32(e, vrecpsq_f32(a, e));
+}
+
+#if defined(__aarch64__)
+inline f32x4 div(f32x4 a, f32x4 b) { return vdivq_f32(a, b); }
+inline f32x4 sqrt(f32x4 a) { return vsqrtq_f32(a); }
+#else
+inline f32x4 div(f32x4 a, f32x4 b) {
+    float x[4], y[4];
+    vst1q_f32(x, a); vst1q_f32(y, b);
+    for (int i = 0; i < 4; i++) x[i] /= y[i];
+    return vld1q_f32(x);
+}
+inline f32x4 sqrt(f32x4 a) {
+    float x[4];
+    vst1q_f32(x, a);
+    for (int i = 0; i < 4; i++) x[i] = std::sqrt(x[i]);
+    return vld1q_f32(x);
+}
+#endif
+
+inline f32x4 hsum(f32x4 a) {
+    float32x2_t s = vadd_f32(vget_low_f32(a), vget_high_f32(a));
+    return vdupq_lane_f32(vpadd_f32(s, s), 0);
+}
+
+inline float first(f32x4 a) { return vgetq_lane_f32(a, 0); }
+
+inline f32x4 yzx(f32x4 a) {
+    f32x4 t = vextq_f32(a, a, 1);                 // y z w x
+    t = vsetq_lane_f32(vgetq_lane_f32(a, 0), t, 2);
+    return vsetq_lane_f32(vgetq_lane_f32(a, 3), t, 3);
+}
+
+template<int i0, int i1, int i2, int i3>
+inline f32x4 swizzle(f32x4 a) {
+    f32x4 r = vdupq_n_f32(vgetq_lane_f32(a, i0));
+    r = vsetq_lane_f32(vgetq_lane_f32(a, i1), r, 1);
+    r = vsetq_lane_f32(vgetq_lane_f32(a, i2), r, 2);
+    return vsetq_lane_f32(vgetq_lane_f32(a, i3), r, 3);
+}
+
+template<int i0, int i1, int j0, int j1>
+inline f32x4 shuffle(f32x4 a, f32x4 b) {
+    f32x4 r = vdupq_n_f32(vgetq_lane_f32(a, i0));
+    r = vsetq_lane_f32(vgetq_lane_f32(a, i1), r, 1);
+    r = vsetq_lane_f32(vgetq_lane_f32(b, j0), r, 2);
+    return vsetq_lane_f32(vgetq_lane_f32(b, j1), r, 3);
+}
+
+inline void transpose(f32x4& a, f32x4& b, f32x4& c, f32x4& d) {
+    float32x4x2_t ab = vtrnq_f32(a, b);
+    float32x4x2_t cd = vtrnq_f32(c, d);
+    a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+
+inline void zip(f32x4 a, f32x4 b, f32x4& lo, f32x4& hi) {
+    float32x4x2_t z = vzipq_f32(a, b);
+    lo = z.val[0];
+    hi = z.val[1];
+}
+
+#else // SAND_SIMD_SCALAR
+
+struct f32x4 { float x[4]; };
+
+inline f32x4 load(const float* p) { return {{p[0], p[1], p[2], p[3]}}; }
+inline void store(float* p, f32x4 a) { for (int i = 0; i < 4; i++) p[i] = a.x[i]; }
+inline f32x4 load3(const float* p) { return {{p[0], p[1], p[2], 0.0f}}; }
+inline void store3(float* p, f32x4 a) { for (int i = 0; i < 3; i++) p[i] = a.x[i]; }
+
+inline f32x4 splat(float s) { return {{s, s, s, s}}; }
+
+#define SAND_SIMD_LANEWISE(name, expr) \
+    inline f32x4 name(f32x4 a, f32x4 b) { \
+        f32x4 r; for (int i = 0; i < 4; i++) r.x[i] = expr; return r; }
+SAND_SIMD_LANEWISE(add, a.x[i] + b.x[i])
+SAND_SIMD_LANEWISE(sub, a.x[i] - b.x[i])
+SAND_SIMD_LANEWISE(mul, a.x[i] * b.x[i])
+SAND_SIMD_LANEWISE(div, a.x[i] / b.x[i])
+SAND_SIMD_LANEWISE(min, b.x[i] < a.x[i] ? b.x[i] : a.x[i])
+SAND_SIMD_LANEWISE(max, a.x[i] < b.x[i] ? b.x[i] : a.x[i])
+#undef SAND_SIMD_LANEWISE
+
+inline f32x4 neg(f32x4 a) { return {{-a.x[0], -a.x[1], -a.x[2], -a.x[3]}}; }
+
+inline f32x4 abs(f32x4 a) {
+    for (int i = 0; i < 4; i++) a.x[i] = std::fabs(a.x[i]);
+    return a;
+}
+
+inline int signbits(f32x4 a) {
+    int bits = 0;
+    for (int i = 0; i < 4; i++) bits |= int(std::signbit(a.x[i])) << i;
+    return bits;
+}
+
+inline f32x4 sqrt(f32x4 a) {
+    for (int i = 0; i < 4; i++) a.x[i] = std::sqrt(a.x[i]);
+    return a;
+}
+
+inline f32x4 rsqrt_est(f32x4 a) {
+    for (int i = 0; i < 4; i++) a.x[i] = 1.0f / std::sqrt(a.x[i]);
+    return a;
+}
+
+inline f32x4 rcp_est(f32x4 a) {
+    for (int i = 0; i < 4; i++) a.x[i] = 1.0f / a.x[i];
+    return a;
+}
+
+inline f32x4 hsum(f32x4 a) { return splat((a.x[0] + a.x[1]) + (a.x[2] + a.x[3])); }
+inline float first(f32x4 a) { return a.x[0]; }
+inline f32x4 yzx(f32x4 a) { return {{a.x[1], a.x[2], a.x[0], a.x[3]}}; }
+
+template<int i0, int i1, int i2, int i3>
+inline f32x4 swizzle(f32x4 a) { return {{a.x[i0], a.x[i1], a.x[i2], a.x[i3]}}; }
+
+template<int i0, int i1, int j0, int j1>
+inline f32x4 shuffle(f32x4 a, f32x4 b) { return {{a.x[i0], a.x[i1], b.x[j0], b.x[j1]}}; }
+
+inline void transpose(f32x4& a, f32x4& b, f32x4& c, f32x4& d) {
+    f32x4 r[4] = {a, b, c, d};
+    a = {{r[0].x[0], r[1].x[0], r[2].x[0], r[3].x[0]}};
+    b = {{r[0].x[1], r[1].x[1], r[2].x[1], r[3].x[1]}};
+    c = {{r[0].x[2], r[1].x[2], r[2].x[2], r[3].x[2]}};
+    d = {{r[0].x[3], r[1].x[3], r[2].x[3], r[3].x[3]}};
+}
+
+inline void zip(f32x4 a, f32x4 b, f32x4& lo, f32x4& hi) {
+    lo = {{a.x[0], b.x[0], a.x[1], b.x[1]}};
+    hi = {{a.x[2], b.x[2], a.x[3], b.x[3]}};
+}
+
+#endif
+
+
+//
+//  Composite operations shared by every backend
+//
+
+inline f32x4 dot4(f32x4 a, f32x4 b) { return hsum(mul(a, b)); }
+
+// a x b for the xyz lanes, w = 0
+inline f32x4 cross3(f32x4 a, f32x4 b) {
+    f32x4 c = sub(mul(a, yzx(b)), mul(yzx(a), b));
+    return yzx(c);
+}
+
+// Row-major 4x4 products: out = a * b, out = a * v.
+inline void mat4_mul(const float* a, const float* b, float* out) {
+#if defined(SAND_SIMD_AVX)
+    __m256 b0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b));
+    __m256 b1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 4));
+    __m256 b2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 8));
+    __m256 b3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(b + 12));
+    for (int i = 0; i < 16; i += 8) {
+        __m256 rows = _mm256_loadu_ps(a + i);     // two rows of a
+        __m256 r = _mm256_mul_ps(_mm256_shuffle_ps(rows, rows, 0x00), b0);
+        r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_shuffle_ps(rows, rows, 0x55), b1));
+        r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_shuffle_ps(rows, rows, 0xAA), b2));
+        r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_shuffle_ps(rows, rows, 0xFF), b3));
+        _mm256_storeu_ps(out + i, r);
+    }
+#else
+    f32x4 b0 = load(b), b1 = load(b + 4), b2 = load(b + 8), b3 = load(b + 12);
+    for (int i = 0; i < 16; i += 4) {
+        f32x4 r = mul(splat(a[i]), b0);
+        r = add(r, mul(splat(a[i + 1]), b1));
+        r = add(r, mul(splat(a[i + 2]), b2));
+        r = add(r, mul(splat(a[i + 3]), b3));
+        store(out + i, r);
+    }
+#endif
+}
+
+inline void mat4_mul_vec(const float* a, const float* v, float* out) {
+    f32x4 x = load(v);
+    f32x4 r0 = mul(load(a), x);
+    f32x4 r1 = mul(load(a + 4), x);
+    f32x4 r2 = mul(load(a + 8), x);
+    f32x4 r3 = mul(load(a + 12), x);
+    transpose(r0, r1, r2, r3);
+    store(out, add(add(r0, r1), add(r2, r3)));
+}
+
+// Row-major 4x4 inverse by cofactors; returns the determinant.  The
+// adjugate's columns are three products of swizzled rows each, built from
+// the 2x2 minors of rows 0-1 (a) and rows 2-3 (b), and the whole result is
+// scaled by one reciprocal.  A singular matrix gives non-finite values.
+inline float mat4_inverse(const float* m, float* out) {
+    f32x4 r0 = load(m), r1 = load(m + 4), r2 = load(m + 8), r3 = load(m + 12);
+
+    // lanes (1 0 0 0), (2 2 1 1), (3 3 3 2) of every row
+    f32x4 x0 = swizzle<1, 0, 0, 0>(r0), y0 = swizzle<2, 2, 1, 1>(r0), z0 = swizzle<3, 3, 3, 2>(r0);
+    f32x4 x1 = swizzle<1, 0, 0, 0>(r1), y1 = swizzle<2, 2, 1, 1>(r1), z1 = swizzle<3, 3, 3, 2>(r1);
+    f32x4 x2 = swizzle<1, 0, 0, 0>(r2), y2 = swizzle<2, 2, 1, 1>(r2), z2 = swizzle<3, 3, 3, 2>(r2);
+    f32x4 x3 = swizzle<1, 0, 0, 0>(r3), y3 = swizzle<2, 2, 1, 1>(r3), z3 = swizzle<3, 3, 3, 2>(r3);
+
+    // minors over column pairs (23 23 13 12), (13 03 03 02), (12 02 01 01)
+    f32x4 a1 = sub(mul(y0, z1), mul(z0, y1));
+    f32x4 a2 = sub(mul(x0, z1), mul(z0, x1));
+    f32x4 a3 = sub(mul(x0, y1), mul(y0, x1));
+    f32x4 b1 = sub(mul(y2, z3), mul(z2, y3));
+    f32x4 b2 = sub(mul(x2, z3), mul(z2, x3));
+    f32x4 b3 = sub(mul(x2, y3), mul(y2, x3));
+
+    static const float alternate[4] = {1.0f, -1.0f, 1.0f, -1.0f};
+    f32x4 sign = load(alternate);
+
+    // adjugate columns
+    f32x4 c0 = mul(sign, add(sub(mul(x1, b1), mul(y1, b2)), mul(z1, b3)));
+    f32x4 c1 = mul(neg(sign), add(sub(mul(x0, b1), mul(y0, b2)), mul(z0, b3)));
+    f32x4 c2 = mul(sign, add(sub(mul(x3, a1), mul(y3, a2)), mul(z3, a3)));
+    f32x4 c3 = mul(neg(sign), add(sub(mul(x2, a1), mul(y2, a2)), mul(z2, a3)));
+
+    f32x4 det = dot4(r0, c0);
+    f32x4 r = div(splat(1.0f), det);
+
+    transpose(c0, c1, c2, c3);
+    store(out, mul(c0, r));
+    store(out + 4, mul(c1, r));
+    store(out + 8, mul(c2, r));
+    store(out + 12, mul(c3, r));
+    return first(det);
+}
+
+// Row-major inverse of an affine [A t; 0 1]: the rows of A's cofactor
+// matrix are cross products of its rows, and -A^-1 t falls out of the
+// same products before the final transpose.
+inline void mat4_inverse_affine(const float* m, float* out) {
+    f32x4 r0 = load(m), r1 = load(m + 4), r2 = load(m + 8);
+
+    f32x4 c0 = cross3(r1, r2), c1 = cross3(r2, r0), c2 = cross3(r0, r1);
+    f32x4 r = div(splat(1.0f), dot4(r0, c0));
+
+    f32x4 u = add(add(mul(c0, swizzle<3, 3, 3, 3>(r0)), mul(c1, swizzle<3, 3, 3, 3>(r1))),
+                  mul(c2, swizzle<3, 3, 3, 3>(r2)));
+    u = neg(u);
+
+    transpose(c0, c1, c2, u);
+    store(out, mul(c0, r));
+    store(out + 4, mul(c1, r));
+    store(out + 8, mul(c2, r));
+    static const float w[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    store(out + 12, load(w));
+}
+
+// Row-major inverse of a rigid [R t; 0 1]: R^T, and -R^T t as the sum of
+// R's rows weighted by t, transposed together.
+inline void mat4_inverse_rigid(const float* m, float* out) {
+    f32x4 r0 = load(m), r1 = load(m + 4), r2 = load(m + 8);
+
+    f32x4 u = add(add(mul(r0, swizzle<3, 3, 3, 3>(r0)), mul(r1, swizzle<3, 3, 3, 3>(r1))),
+                  mul(r2, swizzle<3, 3, 3, 3>(r2)));
+    u = neg(u);
+
+    transpose(r0, r1, r2, u);
+    store(out, r0);
+    store(out + 4, r1);
+    store(out + 8, r2);
+    static const float w[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    store(out + 12, load(w));
+}
+
+} // namespace simd
+} // namespace Sand
+
+#endif // __SIMD_H__
@@ -0,0 +1,89 @@
+#ifndef __SOFTRASTER_H__
+#define __SOFTRASTER_H__
+
+#include "sand.h"
+#include <cstdint>
+#include <string>
+
+namespace Sand {
+
+//
+//  Headless CPU stand-in for the tiny GL pipeline the examples use:
+//  a pass-through vertex shader (gl_Position = vPosition), GL_POINTS
+//  (1 pixel) or GL_TRIANGLES, and one flat fragment color as in
+//  fshader21.glsl.
+//
+//  Each draw runs in two parallel passes.  First, vertex ranges are
+//  transformed to window space and binned into 64x64 pixel tiles, with
+//  separate bins per thread.  Then each thread owns whole tiles and
+//  rasterizes their bins.  No two threads write the same pixel, and since
+//  one draw has one color the image does not depend on the thread count.
+//
+//  Triangles use the top-left fill rule at pixel centers.  Triangles with
+//  a vertex behind the eye (w <= 0) are dropped rather than clipped.
+//
+
+class SoftRaster {
+public:
+    struct Stats {
+        size_t points = 0, triangles = 0;   // primitives submitted
+        double seconds = 0;                 // time spent in draws
+    };
+
+    static const int TileSize = 64;
+
+    SoftRaster(int width, int height, unsigned threads = 0);
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+    // glClearColor + glClear(GL_COLOR_BUFFER_BIT)
+    void clear(const vec<4>& color);
+
+    // the flat fragment color for following draws
+    void setColor(const vec<4>& color) { fragColor = pack(color); }
+
+    // glDrawArrays over tightly packed positions with `size` (1..4)
+    // floats per vertex; missing components default to (0, 0, 0, 1)
+    void drawArrays(GLenum mode, const GLfloat* positions, int size,
+                    size_t first, size_t count);
+
+    // R | G << 8 | B << 16 | A << 24, bottom row first like glReadPixels
+    const std::vector<uint32_t>& pixels() const { return fb; }
+    uint32_t pixel(int x, int y) const { return fb[size_t(y) * w + x]; }
+
+    bool writePPM(const std::string& file) const;
+    bool writePNG(const std::string& file) const;
+
+    const Stats& stats() const { return st; }
+    void resetStats() { st = Stats(); }
+
+    static uint32_t pack(const vec<4>& color);
+
+private:
+    int w, h, tilesX, tilesY;
+    unsigned threads;
+    uint32_t fragColor;
+    std::vector<uint32_t> fb;
+    Stats st;
+
+    // bins[thread][tile] -> primitive data
+    std::vector<std::vector<std::vector<uint32_t>>> pointBins;
+    std::vector<std::vector<std::vector<uint32_t>>> triBins;
+    std::vector<vec<3>> window;  // x, y window coords and 1/w per vertex
+
+    void drawPoints(const GLfloat* positions, int size, size_t count);
+    void drawTriangles(const GLfloat* positions, int size, size_t count);
+    void rasterTriangle(const vec<3>& a, const vec<3>& b, const vec<3>& c,
+                        int x0, int y0, int x1, int y1);
+};
+
+// RGB images of width x height pixels laid out as SoftRaster::pixels():
+// R | G << 8 | B << 16 per word, bottom row first.  PNG is written
+// uncompressed, so neither needs zlib.
+bool WritePPM(const std::string& file, int width, int height, const std::vector<uint32_t>& pixels);
+bool WritePNG(const std::string& file, int width, int height, const std::vector<uint32_t>& pixels);
+
+} // namespace Sand
+
+#endif // __SOFTRASTER_H__
@@ -0,0 +1,575 @@
+#ifndef __SPATIAL_INDEX_H__
+#define __SPATIAL_INDEX_H__
+
+#include "sand.h"
+#include "parallel.h"
+#include "vertex_array.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+namespace Sand {
+
+//
+//  Point indexes for picking and hover queries on large point sets.
+//
+//  PointGrid<D> buckets the points into a uniform grid of about PerCell
+//  points per cell; KdTree<D> splits them at the median of the widest
+//  axis down to leaves of at most LeafSize.  Both answer the same
+//  queries with the points' input indices:
+//
+//      nearest(q)              the closest point, or None
+//      nearest(q, k, out)      the k closest, nearest first
+//      radius(q, r, out)       every point within r of q
+//      rect(lo, hi, out)       every point in the box [lo, hi]
+//
+//  nearest() can be limited to maxDist.  Ties in distance go to the lower
+//  index, so both agree with a brute-force search exactly; radius and
+//  rect return their points in no particular order.  The grid is the
+//  faster of the two while the density is even; a query far from the data
+//  or into a sparse region may visit many empty cells, where the tree's
+//  cost stays logarithmic.
+//
+//  Both copy the points into their own storage in query order, and build
+//  in parallel: the grid sorts by cell with ParallelSort, the tree splits
+//  every node of a level at once.  The result does not depend on the
+//  thread count.
+//
+
+namespace detail {
+
+template<int D>
+struct IndexedPoint {
+    vec<D> p;
+    uint32_t id;
+};
+
+template<int D>
+inline GLfloat distance2(const vec<D>& a, const vec<D>& b) {
+    GLfloat d2 = 0;
+    for (int k = 0; k < D; k++) d2 += (a[k] - b[k]) * (a[k] - b[k]);
+    return d2;
+}
+
+template<int D>
+inline bool inside(const vec<D>& p, const vec<D>& lo, const vec<D>& hi) {
+    for (int k = 0; k < D; k++)
+        if (!(lo[k] <= p[k] && p[k] <= hi[k])) return false;
+    return true;
+}
+
+// The k smallest (distance^2, index) pairs seen, as a max-heap
+class KBest {
+    std::vector<std::pair<GLfloat, uint32_t>> heap;
+    size_t k;
+    GLfloat limit;
+
+public:
+    KBest(size_t k, GLfloat maxDist) : k(k), limit(maxDist * maxDist) { heap.reserve(k); }
+
+    // distance^2 a point must not exceed to get in
+    GLfloat bound() const { return heap.size() < k ? limit : heap.front().first; }
+
+    void add(GLfloat d2, uint32_t id) {
+        std::pair<GLfloat, uint32_t> e(d2, id);
+        if (d2 > limit) return;
+        if (heap.size() < k) {
+            heap.push_back(e);
+            std::push_heap(heap.begin(), heap.end());
+        } else if (e < heap.front()) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = e;
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+
+    void result(std::vector<uint32_t>& out) {
+        std::sort_heap(heap.begin(), heap.end());
+        out.clear();
+        for (const auto& e : heap) out.push_back(e.second);
+    }
+};
+
+// points[i] paired with i, and their bounding box
+template<int D>
+void CollectPoints(const vec<D>* points, size_t count, unsigned threads,
+                   std::vector<IndexedPoint<D>>& out, vec<D>& lo, vec<D>& hi) {
+    const size_t Block = size_t(1) << 16;
+    const size_t blocks = (count + Block - 1) / Block;
+    std::vector<std::pair<vec<D>, vec<D>>> boxes(blocks);
+
+    out.resize(count);
+    ParallelFor(blocks, threads, [&](size_t b, unsigned) {
+        vec<D> bl, bh;
+        for (int k = 0; k < D; k++) {
+            bl[k] = std::numeric_limits<GLfloat>::infinity();
+            bh[k] = -std::numeric_limits<GLfloat>::infinity();
+        }
+        for (size_t i = b * Block; i < std::min(count, (b + 1) * Block); i++) {
+            out[i] = {points[i], uint32_t(i)};
+            for (int k = 0; k < D; k++) {
+                bl[k] = std::min(bl[k], points[i][k]);
+                bh[k] = std::max(bh[k], points[i][k]);
+            }
+        }
+        boxes[b] = {bl, bh};
+    });
+
+    for (int k = 0; k < D; k++) {
+        lo[k] = count ? boxes[0].first[k] : 0;
+        hi[k] = count ? boxes[0].second[k] : 0;
+    }
+    for (const auto& box : boxes)
+        for (int k = 0; k < D; k++) {
+            lo[k] = std::min(lo[k], box.first[k]);
+            hi[k] = std::max(hi[k], box.second[k]);
+        }
+}
+
+template<int D>
+std::vector<vec<D>> Gather(const VertexArray<D>& points) {
+    std::vector<vec<D>> res(points.size());
+    for (size_t i = 0; i < points.size(); i++) res[i] = points[i];
+    return res;
+}
+
+} // namespace detail
+
+
+template<int D>
+class PointGrid {
+    static_assert(D == 2 || D == 3, "[PointGrid] : D should be 2 or 3");
+
+public:
+    static constexpr uint32_t None = ~uint32_t(0);
+    static constexpr GLfloat PerCell = 2;
+
+    PointGrid() = default;
+    PointGrid(const vec<D>* points, size_t count, unsigned threads = 0) { build(points, count, threads); }
+    explicit PointGrid(const VertexArray<D>& points, unsigned threads = 0) { build(points, threads); }
+
+    void build(const vec<D>* points, size_t count, unsigned threads = 0);
+    void build(const VertexArray<D>& points, unsigned threads = 0) {
+        std::vector<vec<D>> p = detail::Gather(points);
+        build(p.data(), p.size(), threads);
+    }
+
+    size_t size() const { return pts.size(); }
+    size_t cellCount() const { return cellStart.empty() ? 0 : cellStart.size() - 1; }
+    double buildSeconds() const { return seconds; }
+
+    uint32_t nearest(const vec<D>& q, GLfloat maxDist = std::numeric_limits<GLfloat>::infinity()) const {
+        detail::KBest best(1, maxDist);
+        search(q, best);
+        std::vector<uint32_t> out;
+        best.result(out);
+        return out.empty() ? None : out[0];
+    }
+
+    void nearest(const vec<D>& q, size_t k, std::vector<uint32_t>& out,
+                 GLfloat maxDist = std::numeric_limits<GLfloat>::infinity()) const {
+        detail::KBest best(k, maxDist);
+        if (k > 0) search(q, best);
+        best.result(out);
+    }
+
+    void radius(const vec<D>& q, GLfloat r, std::vector<uint32_t>& out) const {
+        out.clear();
+        const GLfloat r2 = r * r;
+        int c0[D], c1[D];
+        for (int k = 0; k < D; k++) {
+            c0[k] = cellOf(q[k] - r, k);
+            c1[k] = cellOf(q[k] + r, k);
+        }
+        forBox(c0, c1, [&](size_t cell) {
+            for (uint32_t i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+                if (detail::distance2(pts[i].p, q) <= r2) out.push_back(pts[i].id);
+        });
+    }
+
+    void rect(const vec<D>& lo, const vec<D>& hi, std::vector<uint32_t>& out) const {
+        out.clear();
+        int c0[D], c1[D];
+        for (int k = 0; k < D; k++) {
+            c0[k] = cellOf(lo[k], k);
+            c1[k] = cellOf(hi[k], k);
+        }
+        forBox(c0, c1, [&](size_t cell) {
+            for (uint32_t i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+                if (detail::inside(pts[i].p, lo, hi)) out.push_back(pts[i].id);
+        });
+    }
+
+private:
+    std::vector<detail::IndexedPoint<D>> pts;   // by cell
+    std::vector<uint32_t> cellStart;            // cell c is pts[cellStart[c] .. cellStart[c + 1])
+    vec<D> lo, edge, inv;                       // grid origin, cell edge and its inverse
+    int dims[D] = {};
+    double seconds = 0;
+
+    int cellOf(GLfloat x, int k) const {
+        GLfloat c = (x - lo[k]) * inv[k];
+        return !(c >= 0) ? 0 : c >= GLfloat(dims[k]) ? dims[k] - 1 : int(c);   // NaN -> 0
+    }
+
+    size_t linear(const int* c) const {
+        size_t cell = size_t(c[D - 1]);
+        for (int k = D - 2; k >= 0; k--) cell = cell * dims[k] + c[k];
+        return cell;
+    }
+
+    template<typename F>
+    void forBox(const int* c0, const int* c1, F&& f) const {
+        if (pts.empty()) return;
+        int c[D];
+        if constexpr (D == 3) {
+            for (c[2] = c0[2]; c[2] <= c1[2]; c[2]++)
+                for (c[1] = c0[1]; c[1] <= c1[1]; c[1]++)
+                    for (c[0] = c0[0]; c[0] <= c1[0]; c[0]++) f(linear(c));
+        } else {
+            for (c[1] = c0[1]; c[1] <= c1[1]; c[1]++)
+                for (c[0] = c0[0]; c[0] <= c1[0]; c[0]++) f(linear(c));
+        }
+    }
+
+    // Cells at Chebyshev distance r from center: whole rows where a higher
+    // axis is on the shell, else the row's two ends
+    template<typename F>
+    void forShell(const int* center, int r, F&& f) const {
+        int c[D];
+        auto row = [&](bool edge) {
+            if (edge) {
+                for (c[0] = std::max(center[0] - r, 0); c[0] <= std::min(center[0] + r, dims[0] - 1); c[0]++)
+                    f(linear(c));
+            } else {
+                if ((c[0] = center[0] - r) >= 0) f(linear(c));
+                if ((c[0] = center[0] + r) < dims[0]) f(linear(c));
+            }
+        };
+        auto span = [&](int k, int& from, int& to) {
+            from = std::max(center[k] - r, 0);
+            to = std::min(center[k] + r, dims[k] - 1);
+        };
+        int y0, y1;
+        span(1, y0, y1);
+        if constexpr (D == 3) {
+            int z0, z1;
+            span(2, z0, z1);
+            for (c[2] = z0; c[2] <= z1; c[2]++)
+                for (c[1] = y0; c[1] <= y1; c[1]++)
+                    row(std::abs(c[2] - center[2]) == r || std::abs(c[1] - center[1]) == r);
+        } else {
+            for (c[1] = y0; c[1] <= y1; c[1]++) row(std::abs(c[1] - center[1]) == r);
+        }
+    }
+
+    // Rings of cells outward from q's cell until no unvisited cell can
+    // hold a point closer than the k-th best
+    void search(const vec<D>& q, detail::KBest& best) const {
+        if (pts.empty()) return;
+        int center[D], last = 0;
+        GLfloat out[D], outside2 = 0;       // q's offsets to the grid box
+        for (int k = 0; k < D; k++) {
+            center[k] = cellOf(q[k], k);
+            last = std::max(last, std::max(center[k], dims[k] - 1 - center[k]));
+            GLfloat hi = lo[k] + dims[k] * edge[k];
+            out[k] = std::max(std::max(lo[k] - q[k], q[k] - hi), GLfloat(0.0)) * GLfloat(0.99999);
+            outside2 += out[k] * out[k];
+        }
+        for (int r = 0; r <= last; r++) {
+            forShell(center, r, [&](size_t cell) {
+                for (uint32_t i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+                    best.add(detail::distance2(pts[i].p, q), pts[i].id);
+            });
+
+            // unvisited points lie beyond one of the faces of the visited
+            // box (a face at the edge of the grid has nothing beyond it),
+            // and inside the grid on the other axes
+            GLfloat gap2 = std::numeric_limits<GLfloat>::infinity();
+            for (int k = 0; k < D; k++) {
+                GLfloat side = std::numeric_limits<GLfloat>::infinity();
+                if (center[k] - r > 0)
+                    side = q[k] - (lo[k] + (center[k] - r) * edge[k]);
+                if (center[k] + r + 1 < dims[k])
+                    side = std::min(side, lo[k] + (center[k] + r + 1) * edge[k] - q[k]);
+                if (side == std::numeric_limits<GLfloat>::infinity()) continue;
+                // a hair inside, for points binned across a face by rounding
+                side = std::max(side * GLfloat(0.99999) - GLfloat(1e-30), GLfloat(0.0));
+                gap2 = std::min(gap2, side * side + outside2 - out[k] * out[k]);
+            }
+            if (best.bound() < gap2) return;
+        }
+    }
+};
+
+
+template<int D>
+void PointGrid<D>::build(const vec<D>* points, size_t count, unsigned threads) {
+    typedef std::chrono::steady_clock Clock;
+    auto start = Clock::now();
+    if (count >= size_t(None)) {
+        std::cerr << "[PointGrid] : more than 2^32 - 1 points" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<detail::IndexedPoint<D>> in;
+    vec<D> hi;
+    detail::CollectPoints(points, count, threads, in, lo, hi);
+
+    // cells of equal edge, about PerCell points each if the points filled
+    // the box.  An axis narrower than the edge gets one cell and the edge
+    // is worked out again over the others, so nearly flat data does not
+    // get a cell count that grows with 1 / thickness; rounding the counts
+    // down keeps their product within count / PerCell.
+    double extent[D];
+    bool flat[D];
+    for (int k = 0; k < D; k++) {
+        extent[k] = double(hi[k]) - lo[k];
+        flat[k] = !(extent[k] > 0);
+    }
+    double target = 1;
+    for (bool again = true; again; ) {
+        double volume = 1;
+        int spread = 0;
+        for (int k = 0; k < D; k++)
+            if (!flat[k]) { volume *= extent[k]; spread++; }
+        target = spread ? std::pow(volume * PerCell / std::max<size_t>(count, 1), 1.0 / spread) : 1;
+        again = false;
+        for (int k = 0; k < D; k++)
+            if (!flat[k] && extent[k] < target) flat[k] = again = true;
+    }
+    size_t cells = 1;
+    for (int k = 0; k < D; k++) {
+        double n = flat[k] ? 1 : std::floor(extent[k] / target);
+        dims[k] = int(std::min(std::max(n, 1.0), double(1 << 20)));
+        edge[k] = extent[k] > 0 ? GLfloat(extent[k] / dims[k]) : GLfloat(1.0);
+        inv[k] = GLfloat(1.0) / edge[k];
+        cells *= size_t(dims[k]);
+    }
+    // the keys hold the cell above the point's 32-bit index
+    if (cells > size_t(None)) {
+        std::cerr << "[PointGrid] : " << cells << " cells do not fit the 32-bit keys" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // (cell, index) keys, sorted
+    std::vector<uint64_t> keys(count);
+    ParallelFor((count + 65535) / 65536, threads, [&](size_t b, unsigned) {
+        for (size_t i = b * 65536; i < std::min(count, (b + 1) * 65536); i++) {
+            int c[D];
+            for (int k = 0; k < D; k++) c[k] = cellOf(in[i].p[k], k);
+            keys[i] = uint64_t(linear(c)) << 32 | i;
+        }
+    });
+    ParallelSort(keys, threads);
+
+    pts.resize(count);
+    cellStart.assign(cells + 1, uint32_t(count));
+
+    // position i starts every cell after the previous point's, up to its own
+    ParallelFor((count + 65535) / 65536, threads, [&](size_t b, unsigned) {
+        for (size_t i = b * 65536; i < std::min(count, (b + 1) * 65536); i++) {
+            pts[i] = in[uint32_t(keys[i])];
+            size_t cell = size_t(keys[i] >> 32);
+            size_t prev = i ? size_t(keys[i - 1] >> 32) + 1 : 0;
+            for (size_t c = prev; c <= cell; c++) cellStart[c] = uint32_t(i);
+        }
+    });
+
+    seconds = std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+template<int D>
+class KdTree {
+    static_assert(D == 2 || D == 3, "[KdTree] : D should be 2 or 3");
+
+public:
+    static constexpr uint32_t None = ~uint32_t(0);
+    static constexpr size_t LeafSize = 8;
+
+    KdTree() = default;
+    KdTree(const vec<D>* points, size_t count, unsigned threads = 0) { build(points, count, threads); }
+    explicit KdTree(const VertexArray<D>& points, unsigned threads = 0) { build(points, threads); }
+
+    // Once *cancel is set, from another thread, build() stops at the next
+    // node and leaves the tree empty
+    void build(const vec<D>* points, size_t count, unsigned threads = 0,
+               const std::atomic<bool>* cancel = nullptr);
+    void build(const VertexArray<D>& points, unsigned threads = 0,
+               const std::atomic<bool>* cancel = nullptr) {
+        std::vector<vec<D>> p = detail::Gather(points);
+        build(p.data(), p.size(), threads, cancel);
+    }
+
+    size_t size() const { return pts.size(); }
+    int depth() const { return levels; }
+    double buildSeconds() const { return seconds; }
+
+    uint32_t nearest(const vec<D>& q, GLfloat maxDist = std::numeric_limits<GLfloat>::infinity()) const {
+        detail::KBest best(1, maxDist);
+        search(q, best);
+        std::vector<uint32_t> out;
+        best.result(out);
+        return out.empty() ? None : out[0];
+    }
+
+    void nearest(const vec<D>& q, size_t k, std::vector<uint32_t>& out,
+                 GLfloat maxDist = std::numeric_limits<GLfloat>::infinity()) const {
+        detail::KBest best(k, maxDist);
+        if (k > 0) search(q, best);
+        best.result(out);
+    }
+
+    void radius(const vec<D>& q, GLfloat r, std::vector<uint32_t>& out) const {
+        out.clear();
+        radius(0, 0, pts.size(), 0, q, r * r, out);
+    }
+
+    void rect(const vec<D>& lo, const vec<D>& hi, std::vector<uint32_t>& out) const {
+        out.clear();
+        rect(0, 0, pts.size(), 0, lo, hi, out);
+    }
+
+private:
+    // Node n of level l has children 2n + 1 and 2n + 2 and splits its
+    // points [first, first + count) into halves of count / 2 and the rest;
+    // everything left of the split is <= splits[n] on axes[n], everything
+    // right of it >=.  Level `levels` is the leaves.
+    std::vector<detail::IndexedPoint<D>> pts;
+    std::vector<GLfloat> splits;
+    std::vector<uint8_t> axes;
+    vec<D> box[2];                      // bounds of all the points
+    int levels = 0;
+    double seconds = 0;
+
+    // off[k] is how far q lies outside the node's cell on axis k and d2
+    // the sum of their squares: the least distance^2 to any of its points
+    // (Arya and Mount's incremental distance)
+    void search(size_t n, size_t first, size_t count, int level, const vec<D>& q,
+                GLfloat d2, GLfloat* off, detail::KBest& best) const {
+        if (level == levels) {
+            for (size_t i = first; i < first + count; i++)
+                best.add(detail::distance2(pts[i].p, q), pts[i].id);
+            return;
+        }
+        size_t half = count / 2;
+        int axis = axes[n];
+        GLfloat d = q[axis] - splits[n];
+        size_t nearNode = d < 0 ? 2 * n + 1 : 2 * n + 2, farNode = d < 0 ? 2 * n + 2 : 2 * n + 1;
+        size_t nearFirst = d < 0 ? first : first + half, farFirst = d < 0 ? first + half : first;
+        size_t nearCount = d < 0 ? half : count - half, farCount = d < 0 ? count - half : half;
+
+        search(nearNode, nearFirst, nearCount, level + 1, q, d2, off, best);
+
+        GLfloat old = off[axis];
+        GLfloat farD2 = d2 - old * old + d * d;
+        if (farD2 <= best.bound()) {
+            off[axis] = d;
+            search(farNode, farFirst, farCount, level + 1, q, farD2, off, best);
+            off[axis] = old;
+        }
+    }
+
+    // starting from q's offsets to the bounding box of all the points
+    void search(const vec<D>& q, detail::KBest& best) const {
+        GLfloat off[D], d2 = 0;
+        for (int k = 0; k < D; k++) {
+            off[k] = std::max(std::max(box[0][k] - q[k], q[k] - box[1][k]), GLfloat(0.0));
+            d2 += off[k] * off[k];
+        }
+        search(0, 0, pts.size(), 0, q, d2, off, best);
+    }
+
+    void radius(size_t n, size_t first, size_t count, int level,
+                const vec<D>& q, GLfloat r2, std::vector<uint32_t>& out) const {
+        if (level == levels) {
+            for (size_t i = first; i < first + count; i++)
+                if (detail::distance2(pts[i].p, q) <= r2) out.push_back(pts[i].id);
+            return;
+        }
+        size_t half = count / 2;
+        GLfloat d = q[axes[n]] - splits[n];
+        if (d <= 0 || d * d <= r2) radius(2 * n + 1, first, half, level + 1, q, r2, out);
+        if (d >= 0 || d * d <= r2) radius(2 * n + 2, first + half, count - half, level + 1, q, r2, out);
+    }
+
+    void rect(size_t n, size_t first, size_t count, int level,
+              const vec<D>& lo, const vec<D>& hi, std::vector<uint32_t>& out) const {
+        if (level == levels) {
+            for (size_t i = first; i < first + count; i++)
+                if (detail::inside(pts[i].p, lo, hi)) out.push_back(pts[i].id);
+            return;
+        }
+        size_t half = count / 2;
+        if (lo[axes[n]] <= splits[n]) rect(2 * n + 1, first, half, level + 1, lo, hi, out);
+        if (hi[axes[n]] >= splits[n]) rect(2 * n + 2, first + half, count - half, level + 1, lo, hi, out);
+    }
+};
+
+
+template<int D>
+void KdTree<D>::build(const vec<D>* points, size_t count, unsigned threads,
+                      const std::atomic<bool>* cancel) {
+    typedef std::chrono::steady_clock Clock;
+    auto start = Clock::now();
+    if (count >= size_t(None)) {
+        std::cerr << "[KdTree] : more than 2^32 - 1 points" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    detail::CollectPoints(points, count, threads, pts, box[0], box[1]);
+
+    // the smallest level count whose largest leaf holds LeafSize points
+    levels = 0;
+    while ((count + (size_t(1) << levels) - 1) >> levels > LeafSize) levels++;
+    splits.assign((size_t(1) << levels) - 1, 0);
+    axes.assign(splits.size(), 0);
+
+    // one level at a time, every node of it in parallel: a node's range
+    // follows from its path, its axis is the widest of its points' box
+    for (int level = 0; level < levels; level++) {
+        size_t nodes = size_t(1) << level;
+        ParallelFor(nodes, threads, [&](size_t j, unsigned) {
+            if (cancel && *cancel) { return; }
+            size_t first = 0, n = count;
+            for (int l = level - 1; l >= 0; l--) {
+                if (j >> l & 1) { first += n / 2; n -= n / 2; } else { n /= 2; }
+            }
+            if (n == 0) return;
+
+            vec<D> bl = pts[first].p, bh = bl;
+            for (size_t i = first; i < first + n; i++)
+                for (int k = 0; k < D; k++) {
+                    bl[k] = std::min(bl[k], pts[i].p[k]);
+                    bh[k] = std::max(bh[k], pts[i].p[k]);
+                }
+            int axis = 0;
+            for (int k = 1; k < D; k++)
+                if (bh[k] - bl[k] > bh[axis] - bl[axis]) axis = k;
+
+            auto begin = pts.begin() + first, mid = begin + n / 2;
+            std::nth_element(begin, mid, begin + n,
+                [axis](const detail::IndexedPoint<D>& a, const detail::IndexedPoint<D>& b) {
+                    return a.p[axis] < b.p[axis];
+                });
+            size_t node = nodes - 1 + j;
+            splits[node] = mid->p[axis];
+            axes[node] = uint8_t(axis);
+        });
+        if (cancel && *cancel) {
+            pts.clear();
+            splits.clear();
+            axes.clear();
+            levels = 0;
+            break;
+        }
+    }
+
+    seconds = std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace Sand
+
+#endif // __SPATIAL_INDEX_H__
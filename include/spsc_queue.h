@@ -0,0 +1,89 @@
+#ifndef __SPSC_QUEUE_H__
+#define __SPSC_QUEUE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Sand {
+
+//
+//  Bounded lock-free queue for one producer thread and one consumer
+//  thread.
+//
+//  A ring of a power-of-two number of slots with a write counter owned by
+//  the producer and a read counter owned by the consumer, each on its own
+//  cache line.  Each side keeps a copy of the other's counter and reloads
+//  it only when the ring looks full (or empty), so while the ring has
+//  room neither side touches the other's line.  No locks and no
+//  allocation after construction; push and pop never wait.
+//
+
+template<typename T>
+class SpscQueue {
+public:
+    // Room for at least `capacity` items
+    explicit SpscQueue(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n *= 2;
+        slots.resize(n);
+        mask = n - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator = (const SpscQueue&) = delete;
+
+    size_t capacity() const { return mask + 1; }
+
+    // Producer: false if the ring is full
+    bool push(const T& item) {
+        const uint64_t w = write.value.load(std::memory_order_relaxed);
+        if (w - readCache == capacity()) {
+            readCache = read.value.load(std::memory_order_acquire);
+            if (w - readCache == capacity()) return false;
+        }
+        slots[w & mask] = item;
+        write.value.store(w + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: false if the ring is empty
+    bool pop(T& item) {
+        const uint64_t r = read.value.load(std::memory_order_relaxed);
+        if (r == writeCache) {
+            writeCache = write.value.load(std::memory_order_acquire);
+            if (r == writeCache) return false;
+        }
+        item = slots[r & mask];
+        read.value.store(r + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Items queued; exact on either side's thread when the other is idle,
+    // a snapshot otherwise
+    size_t size() const {
+        uint64_t r = read.value.load(std::memory_order_acquire);
+        uint64_t w = write.value.load(std::memory_order_acquire);
+        return w >= r ? size_t(w - r) : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    struct alignas(64) Counter {
+        std::atomic<uint64_t> value{0};
+    };
+
+    std::vector<T> slots;
+    size_t mask;
+
+    Counter write;                  // items pushed
+    alignas(64) uint64_t readCache = 0;     // producer's copy of read
+    Counter read;                   // items popped
+    alignas(64) uint64_t writeCache = 0;    // consumer's copy of write
+};
+
+} // namespace Sand
+
+#endif // __SPSC_QUEUE_H__
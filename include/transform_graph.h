@@ -0,0 +1,96 @@
+#ifndef __TRANSFORM_GRAPH_H__
+#define __TRANSFORM_GRAPH_H__
+
+#include "sand.h"
+#include <cstdint>
+
+namespace Sand {
+
+//
+//  Transform hierarchy: every node has a local mat<4> (built with
+//  Translate, Scale, RotateX/Y/Z, ...) and a world matrix
+//
+//      world = world(parent) * local
+//
+//  Nodes are stored as separate arrays (locals, worlds, parents, flags)
+//  sorted by depth, so parents always precede their children and each
+//  depth is one contiguous range.  update() walks the depths in order and
+//  splits every large depth across threads; nodes of one depth never
+//  depend on each other.
+//
+//  setLocal() only flags the node.  update() recomputes flagged nodes and
+//  the subtrees below them, starting at the shallowest flagged depth, and
+//  leaves everything else untouched, so a frame that moves a handful of
+//  nodes costs a handful of products plus a scan of the deeper levels.
+//
+//  Node handles stay valid for the life of the graph.  Adding nodes in
+//  breadth-first order (parents' depth complete before children) keeps the
+//  arrays sorted; anything else, and setParent(), triggers one re-sort on
+//  the next update().
+//
+
+class TransformGraph {
+public:
+    typedef uint32_t Node;
+    static constexpr Node None = ~Node(0);
+
+    struct Stats {
+        size_t recomputed = 0;      // world matrices computed by the last update()
+        size_t levels = 0;          // depths visited by the last update()
+        double seconds = 0;         // time in the last update()
+        size_t totalRecomputed = 0; // over all updates
+    };
+
+    explicit TransformGraph(unsigned threads = 0);
+
+    // A new node under parent (None for a root); its world matrix is valid
+    // after the next update()
+    Node add(Node parent = None, const mat<4>& local = mat<4>());
+
+    // Moves n (and its subtree) under parent; false if that would make a
+    // cycle
+    bool setParent(Node n, Node parent);
+
+    void setLocal(Node n, const mat<4>& local);
+
+    const mat<4>& local(Node n) const { return locals[slotOf[n]]; }
+    const mat<4>& world(Node n) const { return worlds[slotOf[n]]; }
+    Node parent(Node n) const { return parentOf[n]; }
+    uint32_t depth(Node n) const { return depthOf[n]; }
+
+    size_t size() const { return parentOf.size(); }
+
+    // Recomputes the world matrices of changed nodes and their subtrees;
+    // returns how many were recomputed
+    size_t update();
+
+    const Stats& stats() const { return st; }
+
+private:
+    unsigned threads;
+    Stats st;
+
+    // by handle
+    std::vector<Node> parentOf;
+    std::vector<uint32_t> depthOf;
+    std::vector<uint32_t> slotOf;
+
+    // by slot, sorted by depth
+    std::vector<Node> nodes;
+    std::vector<uint32_t> parents;     // slot of the parent, None for roots
+    std::vector<mat<4>> locals, worlds;
+    std::vector<uint8_t> dirty;        // set by setLocal, and during update
+                                       // for nodes whose world changed
+    std::vector<size_t> levels;        // depth d is [levels[d], levels[d + 1])
+
+    uint32_t dirtyLo = None, dirtyHi = 0;   // depths of flagged nodes
+    bool sorted = true;
+
+    void markDirty(Node n);
+    void sort();
+    size_t updateRange(size_t begin, size_t end);
+};
+
+} // namespace Sand
+
+#endif // __TRANSFORM_GRAPH_H__
@@ -2,6 +2,9 @@
 #define __VEC_H__
 
 #include "sand.h"
+#include "simd.h"
+#include "ctmath.h"
+#include "expr.h"
 
 namespace Sand {
 
@@ -13,99 +16,82 @@ std::ostream& operator << (std::ostream& os, const std::array<T, N> v) {
 }
 
 template <int N>
-struct vec {
-    std::array<GLfloat, N> v;
+struct vec : expr::vec_expr<N, vec<N>> {
+    alignas(N == 4 ? 16 : alignof(GLfloat)) std::array<GLfloat, N> v;
 
-    vec(GLfloat s = GLfloat(0.0)) {
+    constexpr vec(GLfloat s = GLfloat(0.0)) {
         v.fill(s);
     }
 
     template<typename... T, 
         std::enable_if_t<(sizeof...(T) > 1), bool> = true
     >
-    vec(T... vals) {
+    constexpr vec(T... vals) {
         static_assert(N == sizeof...(vals), "[vec] : Parameter size should be N");
         v = {static_cast<GLfloat>(vals)...};
     }
     
 
-    vec(const vec& v) : v(v.v) {}
-    vec(const std::array<GLfloat, N>& _v) : v(_v) {}
+    constexpr vec(const vec& v) : v(v.v) {}
+    constexpr vec(const std::array<GLfloat, N>& _v) : v(_v) {}
     
     template<int I, typename... T>
-    vec(const vec<I>& _v, T... vals) {
+    constexpr vec(const vec<I>& _v, T... vals) {
         static_assert(N == I + sizeof...(vals), "[vec]: Total parameter size should be N");
-        auto rest = std::vector<GLfloat>{static_cast<GLfloat>(vals)...};
         std::copy(_v.v.begin(), _v.v.end(), v.begin());
-        std::copy(rest.begin(), rest.end(), v.begin() + I);
+        int i = I;
+        ((v[i++] = static_cast<GLfloat>(vals)), ...);
     }
 
 
-    GLfloat &operator[](int i) { return v[i]; } // lvalue
-    const GLfloat operator[](int i) const { return v[i]; } // rvalue
-
-    vec operator-() const {
-        std::array<GLfloat,N> res;
-        std::transform(v.begin(), v.end(), res.begin(), 
-            [](GLfloat x) -> GLfloat { return -x; });
-        return vec(res);
-    }
-    
-    vec operator+ (const vec& _v) const { 
-        std::array<GLfloat, N> res;
-        std::transform(v.begin(), v.end(), _v.v.begin(), res.begin(), std::plus<>{});
-        return vec(res);
-    }
-    
-    vec operator- (const vec& _v) const {
-        std::array<GLfloat, N> res;
-        std::transform(v.begin(), v.end(), _v.v.begin(), res.begin(), std::minus<>{});
-        return vec(res);
-    }
-    
-    vec operator * (const GLfloat s) const { 
-        std::array<GLfloat, N> res;
-        std::transform(v.begin(), v.end(), res.begin(), 
-            [s](GLfloat x) -> GLfloat { return s * x; });
-        return vec(res);
+    // Evaluates a pending expression (see expr.h) in one pass
+    template<typename E>
+    constexpr vec(const expr::vec_expr<N, E>& e) {
+        expr::assign(*this, e.self());
     }
 
-    vec operator * (const vec& _v) const { 
-        std::array<GLfloat, N> res;
-        std::transform(v.begin(), v.end(), _v.v.begin(), res.begin(), std::multiplies<>{});
-        return vec(res);
+    template<typename E>
+    constexpr vec& operator = (const expr::vec_expr<N, E>& e) {
+        expr::assign(*this, e.self());
+        return *this;
     }
-    
-    friend vec operator * (const GLfloat s, const vec& v)
-    { return v * s; }
-    
-    vec operator / (const GLfloat s) const {
-        GLfloat r = 1.0 / s;
-        return *this * r;
+
+
+    constexpr GLfloat &operator[](int i) { return v[i]; } // lvalue
+    constexpr const GLfloat operator[](int i) const { return v[i]; } // rvalue
+
+    // expression leaf; vec<3> is padded with w = 0
+    simd::f32x4 packet() const {
+        if constexpr (N == 3)
+            return simd::load3(v.data());
+        else
+            return simd::load(v.data());
     }
-    
-    vec& operator += (const vec& _v) {
-        std::transform(v.begin(), v.end(), _v.v.begin(), v.begin(), std::plus<>{});
+
+    template<typename E>
+    constexpr vec& operator += (const expr::vec_expr<N, E>& e) {
+        expr::update<expr::add>(*this, e.self());
         return *this;
     }
     
-    vec& operator -= (const vec& _v) {
-        std::transform(v.begin(), v.end(), _v.v.begin(), v.begin(), std::minus<>{});
+    template<typename E>
+    constexpr vec& operator -= (const expr::vec_expr<N, E>& e) {
+        expr::update<expr::sub>(*this, e.self());
         return *this;
     }
     
-    vec& operator *= (const vec& _v) {
-        std::transform(v.begin(), v.end(), _v.v.begin(), v.begin(), std::multiplies<>{});
+    template<typename E>
+    constexpr vec& operator *= (const expr::vec_expr<N, E>& e) {
+        expr::update<expr::mul>(*this, e.self());
         return *this;
     }
     
-    vec& operator *= (const GLfloat s) {
-        std::transform(v.begin(), v.end(), v.begin(),
-                [s](GLfloat x) -> GLfloat {return s * x;});
+    constexpr vec& operator *= (const GLfloat s) {
+        expr::update<expr::mul>(*this, expr::vscalar<N>(s));
         return *this;
     }
     
-    vec& operator /= (const GLfloat s) {
+    constexpr vec& operator /= (const GLfloat s) {
         GLfloat r = 1.0 / s;
         *this *= r;
         return *this;
@@ -124,34 +110,62 @@ struct vec {
     
 
     // Conversion
-    operator const GLfloat* () const {
+    constexpr operator const GLfloat* () const {
         return static_cast<const GLfloat*>(v.data());
     }
     
-    operator GLfloat* () {
+    constexpr operator GLfloat* () {
         return static_cast<GLfloat*>(v.data());
     }
     
 };
 
+//  vec<3> and vec<4> reductions run in one simd.h register at run time.
+//  vec<3> stays tightly packed in memory so arrays of it can still be
+//  uploaded with glBufferData; it is padded to four lanes on load instead.
+
 template <int N>
-inline GLfloat dot (const vec<N>& u, const vec<N>& v) {
-    return std::inner_product(u.v.begin(), u.v.end(), v.v.begin(), 0);
+constexpr GLfloat dot (const vec<N>& u, const vec<N>& v) {
+    if constexpr (N == 3 || N == 4) {
+        if (!std::is_constant_evaluated())
+            return simd::first(simd::dot4(u.packet(), v.packet()));
+    }
+    return std::inner_product(u.v.begin(), u.v.end(), v.v.begin(), GLfloat(0.0));
 }
 
 template <int N>
-inline GLfloat length (const vec<N>& v) {
-    return std::sqrt(dot(v, v));
+constexpr GLfloat length (const vec<N>& v) {
+    if constexpr (N == 3 || N == 4) {
+        if (!std::is_constant_evaluated()) {
+            simd::f32x4 x = v.packet();
+            return simd::first(simd::sqrt(simd::dot4(x, x)));
+        }
+    }
+    return ct::sqrt(dot(v, v));
 }
 
 template <int N>
-inline vec<N> normalize (const vec<N>& v) {
+constexpr vec<N> normalize (const vec<N>& v) {
+    if constexpr (N == 3 || N == 4) {
+        if (!std::is_constant_evaluated()) {
+            simd::f32x4 x = v.packet();
+            x = simd::div(x, simd::sqrt(simd::dot4(x, x)));
+            vec<N> res;
+            if constexpr (N == 3) simd::store3(res, x); else simd::store(res, x);
+            return res;
+        }
+    }
     return v / length(v);
 }
 
 template <int N>
-inline vec<3> cross(const vec<N>&u, const vec<N>&v) {
+constexpr vec<3> cross(const vec<N>&u, const vec<N>&v) {
     static_assert(2 < N && N < 5);
+    if (!std::is_constant_evaluated()) {
+        vec<3> res;
+        simd::store3(res, simd::cross3(u.packet(), v.packet()));
+        return res;
+    }
     return vec<3>(
         u[1] * v[2] - u[2] * v[1],
         u[2] * v[0] - u[0] * v[2],
@@ -159,6 +173,28 @@ inline vec<3> cross(const vec<N>&u, const vec<N>&v) {
     );
 }
 
+// Overloads taking pending expressions, e.g. normalize(eye - at)
+
+template <int N, typename L, typename R>
+constexpr GLfloat dot (const expr::vec_expr<N, L>& u, const expr::vec_expr<N, R>& v) {
+    return dot(vec<N>(u), vec<N>(v));
+}
+
+template <int N, typename E>
+constexpr GLfloat length (const expr::vec_expr<N, E>& v) {
+    return length(vec<N>(v));
+}
+
+template <int N, typename E>
+constexpr vec<N> normalize (const expr::vec_expr<N, E>& v) {
+    return normalize(vec<N>(v));
+}
+
+template <int N, typename L, typename R>
+constexpr vec<3> cross (const expr::vec_expr<N, L>& u, const expr::vec_expr<N, R>& v) {
+    return cross(vec<N>(u), vec<N>(v));
+}
+
 
 } // namespace Sand
 
@@ -0,0 +1,342 @@
+#ifndef __VERTEX_ARRAY_H__
+#define __VERTEX_ARRAY_H__
+
+#include "sand.h"
+#include "vertex_format.h"
+#include <limits>
+#include <utility>
+
+namespace Sand {
+
+//
+//  Structure-of-arrays vertex storage.
+//
+//  Component k of every point lives in its own contiguous stream, so the
+//  bulk kernels below work on four points per simd.h register instead of
+//  one point at a time.  interleave() and upload() produce the tight
+//  x0 y0 x1 y1 ... layout that
+//
+//      glVertexAttribPointer(loc, N, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0))
+//
+//  expects, or a packed VertexFormat for VertexAttribPointer().
+//
+
+template<int N>
+class VertexArray {
+    static_assert(1 <= N && N <= 4, "[VertexArray] : N should be 1 to 4");
+
+    std::array<std::vector<GLfloat>, N> c;
+
+    // Applies an M x M matrix to every point.  With N < M the points are
+    // homogeneous: missing components are 0, the last one is 1, and the
+    // result is divided by w when the bottom row is not (0, ..., 0, 1).
+    template<int M>
+    void apply(const mat<M>& m);
+
+public:
+    VertexArray(size_t count = 0) { resize(count); }
+    VertexArray(const vec<N>* points, size_t count) { assign(points, count); }
+
+    size_t size() const { return c[0].size(); }
+    bool empty() const { return c[0].empty(); }
+
+    void resize(size_t count) { for (auto& s : c) s.resize(count); }
+    void reserve(size_t count) { for (auto& s : c) s.reserve(count); }
+    void clear() { for (auto& s : c) s.clear(); }
+
+    void assign(const vec<N>* points, size_t count);
+
+    void push_back(const vec<N>& p) {
+        for (int k = 0; k < N; k++) c[k].push_back(p[k]);
+    }
+
+    vec<N> operator [] (size_t i) const {
+        vec<N> p;
+        for (int k = 0; k < N; k++) p[k] = c[k][i];
+        return p;
+    }
+
+    void set(size_t i, const vec<N>& p) {
+        for (int k = 0; k < N; k++) c[k][i] = p[k];
+    }
+
+    GLfloat* component(int k) { return c[k].data(); }
+    const GLfloat* component(int k) const { return c[k].data(); }
+
+    //
+    //  --- Bulk kernels ---
+    //
+
+    // Full 4x4 transform; points with N < 4 are taken as (p, 0.., 1)
+    void transform(const mat<4>& m) { apply(m); }
+
+    // 2D affine (N == 2) or linear 3x3 (N == 3)
+    void transform(const mat<3>& m) {
+        static_assert(N == 2 || N == 3, "[VertexArray] : mat<3> needs N = 2 or 3");
+        apply(m);
+    }
+
+    void add(const vec<N>& d);
+    void scale(const GLfloat s);
+    void scale(const vec<N>& s);
+    void normalize();
+
+    // Component-wise min and max; (+inf, -inf) when empty
+    std::pair<vec<N>, vec<N>> bounds() const;
+
+    //
+    //  --- Upload ---
+    //
+
+    // Writes size() * N tightly packed floats to out
+    void interleave(GLfloat* out) const { interleave(0, size(), out); }
+
+    // ... for points [first, first + count)
+    void interleave(size_t first, size_t count, GLfloat* out) const;
+
+    // glBufferData on the buffer bound to target, interleaving straight
+    // into the mapped storage
+    void upload(GLenum target, GLenum usage) const;
+
+    // ... packed as format, a block of points at a time through the stack
+    void upload(GLenum target, GLenum usage, VertexFormat format) const;
+};
+
+
+template<int N>
+void VertexArray<N>::assign(const vec<N>* points, size_t count) {
+    resize(count);
+    size_t i = 0;
+    if constexpr (N == 4) {
+        for (; i + 4 <= count; i += 4) {
+            simd::f32x4 x = points[i].packet(), y = points[i + 1].packet();
+            simd::f32x4 z = points[i + 2].packet(), w = points[i + 3].packet();
+            simd::transpose(x, y, z, w);
+            simd::store(&c[0][i], x); simd::store(&c[1][i], y);
+            simd::store(&c[2][i], z); simd::store(&c[3][i], w);
+        }
+    }
+    for (; i < count; i++)
+        for (int k = 0; k < N; k++) c[k][i] = points[i][k];
+}
+
+
+template<int N>
+template<int M>
+void VertexArray<N>::apply(const mat<M>& m) {
+    static_assert(N <= M, "[VertexArray] : matrix is too small for the points");
+
+    constexpr bool homogeneous = N < M;
+    constexpr int rows = homogeneous ? N + 1 : N;   // last one is w
+
+    bool project = false;
+    if constexpr (homogeneous) {
+        for (int k = 0; k < M - 1; k++) project |= m[M - 1][k] != GLfloat(0.0);
+        project |= m[M - 1][M - 1] != GLfloat(1.0);
+    }
+
+    // output row r reads matrix row r, or M - 1 for w
+    GLfloat a[rows][N + 1];
+    for (int r = 0; r < rows; r++) {
+        int mr = r < N ? r : M - 1;
+        for (int k = 0; k < N; k++) a[r][k] = m[mr][k];
+        a[r][N] = homogeneous ? m[mr][M - 1] : GLfloat(0.0);
+    }
+
+    simd::f32x4 va[rows][N + 1];
+    for (int r = 0; r < rows; r++)
+        for (int k = 0; k <= N; k++) va[r][k] = simd::splat(a[r][k]);
+
+    const size_t n = size();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        simd::f32x4 x[N], o[rows];
+        for (int k = 0; k < N; k++) x[k] = simd::load(&c[k][i]);
+        for (int r = 0; r < rows; r++) {
+            if (r == N && !project) break;
+            simd::f32x4 acc = va[r][N];
+            for (int k = 0; k < N; k++) acc = simd::add(acc, simd::mul(va[r][k], x[k]));
+            o[r] = acc;
+        }
+        if (project)
+            for (int r = 0; r < N; r++) o[r] = simd::div(o[r], o[N]);
+        for (int r = 0; r < N; r++) simd::store(&c[r][i], o[r]);
+    }
+    for (; i < n; i++) {
+        GLfloat x[N], o[rows];
+        for (int k = 0; k < N; k++) x[k] = c[k][i];
+        for (int r = 0; r < rows; r++) {
+            GLfloat acc = a[r][N];
+            for (int k = 0; k < N; k++) acc += a[r][k] * x[k];
+            o[r] = acc;
+        }
+        for (int r = 0; r < N; r++) c[r][i] = project ? o[r] / o[N] : o[r];
+    }
+}
+
+
+template<int N>
+void VertexArray<N>::add(const vec<N>& d) {
+    const size_t n = size();
+    for (int k = 0; k < N; k++) {
+        GLfloat* p = c[k].data();
+        simd::f32x4 dk = simd::splat(d[k]);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) simd::store(p + i, simd::add(simd::load(p + i), dk));
+        for (; i < n; i++) p[i] += d[k];
+    }
+}
+
+template<int N>
+void VertexArray<N>::scale(const GLfloat s) {
+    scale(vec<N>(s));
+}
+
+template<int N>
+void VertexArray<N>::scale(const vec<N>& s) {
+    const size_t n = size();
+    for (int k = 0; k < N; k++) {
+        GLfloat* p = c[k].data();
+        simd::f32x4 sk = simd::splat(s[k]);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) simd::store(p + i, simd::mul(simd::load(p + i), sk));
+        for (; i < n; i++) p[i] *= s[k];
+    }
+}
+
+template<int N>
+void VertexArray<N>::normalize() {
+    const size_t n = size();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        simd::f32x4 x[N];
+        simd::f32x4 len2 = simd::splat(0.0f);
+        for (int k = 0; k < N; k++) {
+            x[k] = simd::load(&c[k][i]);
+            len2 = simd::add(len2, simd::mul(x[k], x[k]));
+        }
+        simd::f32x4 len = simd::sqrt(len2);
+        for (int k = 0; k < N; k++) simd::store(&c[k][i], simd::div(x[k], len));
+    }
+    for (; i < n; i++) {
+        GLfloat len2 = 0;
+        for (int k = 0; k < N; k++) len2 += c[k][i] * c[k][i];
+        GLfloat len = std::sqrt(len2);
+        for (int k = 0; k < N; k++) c[k][i] /= len;
+    }
+}
+
+template<int N>
+std::pair<vec<N>, vec<N>> VertexArray<N>::bounds() const {
+    vec<N> lo(std::numeric_limits<GLfloat>::infinity());
+    vec<N> hi(-std::numeric_limits<GLfloat>::infinity());
+    const size_t n = size();
+    for (int k = 0; k < N; k++) {
+        const GLfloat* p = c[k].data();
+        size_t i = 0;
+        if (n >= 4) {
+            simd::f32x4 mn = simd::load(p), mx = mn;
+            for (i = 4; i + 4 <= n; i += 4) {
+                simd::f32x4 x = simd::load(p + i);
+                mn = simd::min(mn, x);
+                mx = simd::max(mx, x);
+            }
+            GLfloat l[4], h[4];
+            simd::store(l, mn);
+            simd::store(h, mx);
+            for (int j = 0; j < 4; j++) {
+                lo[k] = std::min(lo[k], l[j]);
+                hi[k] = std::max(hi[k], h[j]);
+            }
+        }
+        for (; i < n; i++) {
+            lo[k] = std::min(lo[k], p[i]);
+            hi[k] = std::max(hi[k], p[i]);
+        }
+    }
+    return std::make_pair(lo, hi);
+}
+
+
+template<int N>
+void VertexArray<N>::interleave(size_t first, size_t count, GLfloat* out) const {
+    const size_t n = first + count;
+    size_t i = first;
+    if constexpr (N == 4) {
+        for (; i + 4 <= n; i += 4, out += 16) {
+            simd::f32x4 x = simd::load(&c[0][i]), y = simd::load(&c[1][i]);
+            simd::f32x4 z = simd::load(&c[2][i]), w = simd::load(&c[3][i]);
+            simd::transpose(x, y, z, w);
+            simd::store(out, x); simd::store(out + 4, y);
+            simd::store(out + 8, z); simd::store(out + 12, w);
+        }
+    } else if constexpr (N == 2) {
+        for (; i + 4 <= n; i += 4, out += 8) {
+            simd::f32x4 lo, hi;
+            simd::zip(simd::load(&c[0][i]), simd::load(&c[1][i]), lo, hi);
+            simd::store(out, lo);
+            simd::store(out + 4, hi);
+        }
+    }
+    for (; i < n; i++, out += N)
+        for (int k = 0; k < N; k++) out[k] = c[k][i];
+}
+
+template<int N>
+void VertexArray<N>::upload(GLenum target, GLenum usage) const {
+    GLsizeiptr bytes = GLsizeiptr(size() * N * sizeof(GLfloat));
+    glBufferData(target, bytes, NULL, usage);
+    if (bytes == 0) return;
+
+    void* dst = glMapBufferRange(target, 0, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (dst != NULL) {
+        interleave(static_cast<GLfloat*>(dst));
+        if (glUnmapBuffer(target) == GL_TRUE) return;
+    }
+
+    // mapping failed or the store was lost: go through client memory
+    std::vector<GLfloat> tmp(size() * N);
+    interleave(tmp.data());
+    glBufferSubData(target, 0, bytes, tmp.data());
+}
+
+template<int N>
+void VertexArray<N>::upload(GLenum target, GLenum usage, VertexFormat format) const {
+    if (format == VertexFormat::Float) {
+        upload(target, usage);
+        return;
+    }
+
+    const size_t n = size(), stride = VertexBytes(format, N);
+    GLsizeiptr bytes = GLsizeiptr(n * stride);
+    glBufferData(target, bytes, NULL, usage);
+    if (bytes == 0) return;
+
+    const size_t block = 1024;
+    alignas(16) GLfloat tmp[block * N];
+    alignas(16) unsigned char packed[block * 8];   // up to four halves per point
+
+    char* dst = static_cast<char*>(glMapBufferRange(target, 0, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    if (dst != NULL) {
+        for (size_t i = 0; i < n; i += block) {
+            size_t count = std::min(block, n - i);
+            interleave(i, count, tmp);
+            PackVertices(format, N, tmp, dst + i * stride, count);
+        }
+        if (glUnmapBuffer(target) == GL_TRUE) return;
+    }
+
+    // mapping failed or the store was lost: pack block by block
+    for (size_t i = 0; i < n; i += block) {
+        size_t count = std::min(block, n - i);
+        interleave(i, count, tmp);
+        PackVertices(format, N, tmp, packed, count);
+        glBufferSubData(target, GLintptr(i * stride), GLsizeiptr(count * stride), packed);
+    }
+}
+
+} // namespace Sand
+
+#endif // __VERTEX_ARRAY_H__
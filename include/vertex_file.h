@@ -0,0 +1,262 @@
+#ifndef __VERTEX_FILE_H__
+#define __VERTEX_FILE_H__
+
+#include "sand.h"
+#include "culling.h"
+#include "vertex_array.h"
+#include "vertex_format.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+namespace Sand {
+
+//
+//  Binary vertex files.
+//
+//  A file holds one or more vertex attributes (positions, normals, colors,
+//  ... each stored in a VertexFormat) and optional 32-bit indices, cut
+//  into chunks of consecutive vertices:
+//
+//      header          magic "SANDVTX\0", version, counts, table offset
+//      attributes      one descriptor per attribute
+//      chunk data      for each chunk, each attribute's vertices and then
+//                      the chunk's indices, every block starting on an
+//                      alignment boundary (4096 by default)
+//      chunk table     per chunk: first vertex, counts, bounds of the
+//                      positions, and the offset of every block
+//
+//  Blocks are stored exactly as GL reads them: tightly packed vertices of
+//  one attribute, and indices relative to the chunk's first vertex, so
+//  every chunk can be drawn on its own.  Reading needs no parsing: the
+//  blocks of a mapped file are handed to glBufferData as they are.  The
+//  one pass over data is indices(), which checks its block against the
+//  chunk's vertex count before handing it out.
+//
+//  The table sits at the end so the writer can stream chunks of unknown
+//  number; the header points to it once close() succeeds, and a file whose
+//  writer did not finish is rejected.  Integers are little-endian.
+//
+//  VertexFile maps the whole file (the OS pages it in on demand, so files
+//  larger than RAM work on 64-bit systems).  VertexFileStream maps one
+//  chunk at a time and asks the OS to read ahead the next, for a single
+//  pass with bounded address space.
+//
+
+constexpr uint32_t VertexFileVersion = 1;
+
+struct VertexAttribute {
+    std::string name;           // up to 23 characters
+    VertexFormat format = VertexFormat::Float;
+    int components = 3;
+
+    VertexAttribute() = default;
+    VertexAttribute(const std::string& name, VertexFormat format, int components)
+        : name(name), format(format), components(components) {}
+
+    size_t stride() const { return VertexBytes(format, components); }
+};
+
+// A read-only block of a mapped file
+struct FileSpan {
+    const void* data = NULL;
+    size_t bytes = 0;
+};
+
+struct VertexChunk {
+    uint64_t firstVertex = 0;
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    AABB bounds;                // of the first attribute's xyz, before packing
+};
+
+
+class VertexFile {
+public:
+    VertexFile() = default;
+    explicit VertexFile(const std::string& path) { open(path); }
+    VertexFile(const VertexFile&) = delete;
+    VertexFile& operator = (const VertexFile&) = delete;
+    ~VertexFile() { close(); }
+
+    // false (after a message) if path cannot be mapped or is not a
+    // complete vertex file
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return base != NULL; }
+
+    GLenum primitive() const { return mode; }
+    uint64_t vertexCount() const { return vertexTotal; }
+    uint64_t indexCount() const { return indexTotal; }
+
+    size_t attributeCount() const { return attribs.size(); }
+    const VertexAttribute& attribute(size_t a) const { return attribs[a]; }
+    int find(const std::string& name) const;    // -1 if absent
+
+    size_t chunkCount() const { return chunks.size(); }
+    const VertexChunk& chunk(size_t c) const { return chunks[c].info; }
+
+    // Attribute a of chunk c, and chunk c's indices; the indices are
+    // empty (after a message) if one is not below the chunk's vertexCount
+    FileSpan vertices(size_t a, size_t c) const;
+    FileSpan indices(size_t c) const;
+
+    // glBufferData on the buffer bound to target with attribute a of every
+    // chunk, one glBufferSubData per chunk straight from the mapping
+    void upload(size_t a, GLenum target, GLenum usage) const;
+
+    // VertexAttribPointer with attribute a's components and format
+    void attribPointer(GLuint index, size_t a, GLsizei stride = 0,
+                       const GLvoid* offset = BUFFER_OFFSET(0)) const {
+        VertexAttribPointer(index, attribs[a].components, attribs[a].format, stride, offset);
+    }
+
+    // Hints that chunk c will be read soon (the OS reads it ahead)
+    void prefetch(size_t c) const;
+
+private:
+    struct Entry {
+        VertexChunk info;
+        uint64_t indexOffset;
+        std::vector<uint64_t> offsets;  // per attribute
+    };
+
+    const char* base = NULL;
+    size_t bytes = 0;
+#if defined(_WIN32) && !defined(__CYGWIN__)
+    void* mapping = NULL;
+#endif
+
+    GLenum mode = GL_POINTS;
+    uint64_t vertexTotal = 0, indexTotal = 0;
+    std::vector<VertexAttribute> attribs;
+    std::vector<Entry> chunks;
+};
+
+
+// Reads a vertex file front to back, one chunk mapped at a time
+class VertexFileStream {
+public:
+    VertexFileStream() = default;
+    explicit VertexFileStream(const std::string& path) { open(path); }
+    VertexFileStream(const VertexFileStream&) = delete;
+    VertexFileStream& operator = (const VertexFileStream&) = delete;
+    ~VertexFileStream() { close(); }
+
+    // Reads the header and chunk table only
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return fd != -1; }
+
+    GLenum primitive() const { return mode; }
+    uint64_t vertexCount() const { return vertexTotal; }
+    size_t attributeCount() const { return attribs.size(); }
+    const VertexAttribute& attribute(size_t a) const { return attribs[a]; }
+    size_t chunkCount() const { return chunks.size(); }
+
+    // Maps the next chunk, releasing the previous one; false at the end
+    // (or on a read error, after a message).  The spans stay valid until
+    // the next call; indices() is empty, as VertexFile's, for a chunk
+    // whose indices run past its vertices.
+    bool next();
+
+    size_t current() const { return chunkIndex; }
+    const VertexChunk& chunk() const { return chunks[chunkIndex].info; }
+    FileSpan vertices(size_t a) const;
+    FileSpan indices() const;
+
+private:
+    struct Entry {
+        VertexChunk info;
+        uint64_t begin, end;            // byte range of the chunk's blocks
+        uint64_t indexOffset;
+        std::vector<uint64_t> offsets;
+    };
+
+    intptr_t fd = -1;                   // file descriptor or HANDLE
+#if defined(_WIN32) && !defined(__CYGWIN__)
+    void* mapping = NULL;
+#endif
+    const char* view = NULL;            // mapping of the current chunk
+    size_t viewBytes = 0;
+    uint64_t viewOffset = 0;            // file offset of view
+
+    GLenum mode = GL_POINTS;
+    uint64_t vertexTotal = 0;
+    std::vector<VertexAttribute> attribs;
+    std::vector<Entry> chunks;
+    size_t chunkIndex = size_t(-1);
+
+    void unmap();
+};
+
+
+// Writes a vertex file chunk by chunk.  The file appears under its name
+// only when close() succeeds; until then it is written aside.
+class VertexFileWriter {
+public:
+    static constexpr size_t DefaultChunk = 1 << 20;     // vertices
+
+    VertexFileWriter(const std::string& path, const std::vector<VertexAttribute>& attributes,
+                     GLenum primitive = GL_POINTS, size_t alignment = 4096);
+    VertexFileWriter(const VertexFileWriter&) = delete;
+    VertexFileWriter& operator = (const VertexFileWriter&) = delete;
+    ~VertexFileWriter() { close(); }
+
+    bool ok() const { return !failed; }
+
+    // Appends count vertices; data[a] holds attribute a as count * its
+    // components floats, packed here to its format.  Without indices the
+    // vertices are cut into chunks of at most chunkVertices; with indices
+    // (relative to the first of these vertices, each below count) they
+    // form one chunk.
+    bool write(size_t count, const GLfloat* const* data,
+               const uint32_t* indices = NULL, size_t indexCount = 0,
+               size_t chunkVertices = DefaultChunk);
+
+    // A point cloud with a single attribute
+    template<int N>
+    bool write(const VertexArray<N>& points, size_t chunkVertices = DefaultChunk);
+
+    // Writes the chunk table and header and moves the file into place
+    bool close();
+
+private:
+    std::string path, tmpPath;
+    std::ofstream out;
+    std::vector<VertexAttribute> attribs;
+    GLenum mode;
+    size_t alignment;
+    bool failed = false, closed = false;
+
+    std::vector<char> table;            // chunk entries, written by close()
+    uint32_t chunkCount = 0;
+    uint64_t vertices = 0, indices = 0;
+    std::vector<unsigned char> packed;  // scratch
+
+    bool fail(const char* what);
+    bool pad();
+    bool chunk(size_t first, size_t count, const GLfloat* const* data,
+               const uint32_t* idx, size_t indexCount);
+};
+
+template<int N>
+bool VertexFileWriter::write(const VertexArray<N>& points, size_t chunkVertices) {
+    if (attribs.size() != 1 || attribs[0].components != N)
+        return fail("write(VertexArray): the file needs one attribute of N components");
+
+    // interleave a chunk at a time, so the floats never exist whole
+    std::vector<GLfloat> tmp;
+    for (size_t i = 0; i < points.size(); i += chunkVertices) {
+        size_t count = std::min(chunkVertices, points.size() - i);
+        tmp.resize(count * N);
+        points.interleave(i, count, tmp.data());
+        const GLfloat* data[1] = {tmp.data()};
+        if (!write(count, data, NULL, 0, chunkVertices)) return false;
+    }
+    return true;
+}
+
+} // namespace Sand
+
+#endif // __VERTEX_FILE_H__
@@ -0,0 +1,90 @@
+#ifndef __VERTEX_FORMAT_H__
+#define __VERTEX_FORMAT_H__
+
+#include "sand.h"
+#include <cstdint>
+
+namespace Sand {
+
+//
+//  Packed vertex formats.
+//
+//  Positions that live in a known range do not need 32-bit floats: a
+//  point cloud in [-1, 1] keeps 1/32767 resolution as snorm16 at half the
+//  bytes, and unit normals fit 10_10_10_2 at a third.  The converters take
+//  tightly packed floats (x0 y0 x1 y1 ..., the layout of a vec<N> array
+//  and of VertexArray::interleave()) and work four values per SSE
+//  register, with bit-exact scalar versions for tails and other targets.
+//  Pair the packed buffer with VertexAttribPointer() below, which passes
+//  the matching GL type and normalization.
+//
+//  Rounding is to nearest even.  Normalized formats clamp to their range
+//  and decode as GL does (snorm: max(c / (2^(b-1) - 1), -1)); half floats
+//  overflow to infinity past 65504 and keep NaN.
+//
+
+enum class VertexFormat {
+    Float,              // GL_FLOAT
+    Half,               // GL_HALF_FLOAT, 2 bytes per component
+    Snorm16,            // GL_SHORT normalized: [-1, 1], 2 bytes per component
+    Unorm16,            // GL_UNSIGNED_SHORT normalized: [0, 1], 2 bytes per component
+    Snorm10_10_10_2,    // GL_INT_2_10_10_10_REV normalized: xyz in [-1, 1],
+                        // w in {-1, 0, 1}; 4 bytes per vertex
+    Unorm10_10_10_2     // GL_UNSIGNED_INT_2_10_10_10_REV normalized: xyz in
+                        // [0, 1], w in {0, 1/3, 2/3, 1}; 4 bytes per vertex
+};
+
+// Bytes per vertex of n (1 to 4) components
+constexpr size_t VertexBytes(VertexFormat f, int n) {
+    switch (f) {
+        case VertexFormat::Float: return 4 * size_t(n);
+        case VertexFormat::Half:
+        case VertexFormat::Snorm16:
+        case VertexFormat::Unorm16: return 2 * size_t(n);
+        default: return 4;
+    }
+}
+
+// count vertices of n floats each to f; out holds count * VertexBytes(f, n)
+// bytes.  10_10_10_2 vertices with n < 4 get 0 for missing xyz and w = 1.
+void PackVertices(VertexFormat f, int n, const GLfloat* in, void* out, size_t count);
+
+// The reverse: n floats per vertex
+void UnpackVertices(VertexFormat f, int n, const void* in, GLfloat* out, size_t count);
+
+template<int N>
+void PackVertices(VertexFormat f, const vec<N>* in, void* out, size_t count) {
+    static_assert(sizeof(vec<N>) == N * sizeof(GLfloat), "[PackVertices] : vec<N> is padded");
+    PackVertices(f, N, static_cast<const GLfloat*>(in[0]), out, count);
+}
+
+template<int N>
+void UnpackVertices(VertexFormat f, const void* in, vec<N>* out, size_t count) {
+    static_assert(sizeof(vec<N>) == N * sizeof(GLfloat), "[UnpackVertices] : vec<N> is padded");
+    UnpackVertices(f, N, in, static_cast<GLfloat*>(out[0]), count);
+}
+
+// Element-wise kernels over count values
+void PackHalf(const GLfloat* in, uint16_t* out, size_t count);
+void UnpackHalf(const uint16_t* in, GLfloat* out, size_t count);
+void PackSnorm16(const GLfloat* in, int16_t* out, size_t count);
+void UnpackSnorm16(const int16_t* in, GLfloat* out, size_t count);
+void PackUnorm16(const GLfloat* in, uint16_t* out, size_t count);
+void UnpackUnorm16(const uint16_t* in, GLfloat* out, size_t count);
+
+// The glVertexAttribPointer arguments for n components per vertex stored as f
+struct VertexAttribType {
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+};
+
+VertexAttribType AttribType(VertexFormat f, int n);
+
+// glVertexAttribPointer for n components per vertex stored as f
+void VertexAttribPointer(GLuint index, int n, VertexFormat f, GLsizei stride = 0,
+                         const GLvoid* offset = BUFFER_OFFSET(0));
+
+} // namespace Sand
+
+#endif // __VERTEX_FORMAT_H__
@@ -0,0 +1,207 @@
+#ifndef __VERTEX_STREAM_H__
+#define __VERTEX_STREAM_H__
+
+#include "sand.h"
+#include "spsc_queue.h"
+#include "vertex_format.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+namespace Sand {
+
+//
+//  Vertices produced by worker threads while the GL thread draws.
+//
+//  start() sizes a GL buffer for every chunk and starts the workers.
+//  Each worker claims chunk indices from a shared counter, has the
+//  producer write a chunk of vertices, packs it to the stream's format and
+//  pushes it through its own SpscQueue to the GL thread.  Once per frame
+//  the GL thread calls append(), which takes finished chunks from the
+//  queues and copies them to the end of the buffer with glBufferSubData,
+//  until its time budget runs out; then it draws the first size()
+//  vertices.  The picture refines while the workers run, and a slow
+//  producer never stalls a frame.
+//
+//  Chunks land in the buffer in the order they finish, not by index.
+//  Each worker owns queueDepth chunk buffers, handed back through a
+//  second queue once uploaded, so the workers wait (and nothing
+//  allocates) when the GL thread falls behind.
+//
+//      VertexStream stream(2, VertexFormat::Snorm16, ChaosGame<2>::chunk);
+//      stream.start([&](uint64_t chunk, GLfloat* out) { ...; return count; }, chunks);
+//      VertexAttribPointer(loc, 2, VertexFormat::Snorm16);
+//      ...
+//      void display() {
+//          stream.append(0.004);       // at most ~4 ms of uploads
+//          glDrawArrays(GL_POINTS, 0, GLsizei(stream.size()));
+//      }
+//
+//  The buffer belongs to the caller: the stream never deletes it.
+//
+
+class VertexStream {
+public:
+    // Writes chunk `chunk`: up to chunkVertices() vertices of components()
+    // floats each, interleaved, to out; returns how many.  Called on the
+    // worker threads, concurrently.
+    typedef std::function<size_t(uint64_t chunk, GLfloat* out)> Producer;
+
+    struct Metrics {
+        uint64_t chunks = 0, vertices = 0;      // appended so far
+        size_t queued = 0;                      // chunks waiting at the last append()
+        size_t maxQueued = 0;
+        double meanQueued = 0;                  // over append() calls
+        double latency = 0;                     // seconds from a chunk being pushed to its upload:
+        double meanLatency = 0, maxLatency = 0; // of the last one, the mean, the most
+        double appendSeconds = 0;               // spent in the last append()
+        uint64_t overBudget = 0;                // append() calls that ran past their budget
+        uint64_t producerWaits = 0;             // 200 us naps of workers short of a free chunk buffer
+    };
+
+    VertexStream(int components, VertexFormat format, size_t chunkVertices,
+                 unsigned threads = 0, size_t queueDepth = 4);
+    VertexStream(const VertexStream&) = delete;
+    VertexStream& operator = (const VertexStream&) = delete;
+    ~VertexStream() { stop(); }
+
+    // On the GL thread: creates a buffer for chunks * chunkVertices
+    // vertices, leaves it bound to GL_ARRAY_BUFFER, and starts producing
+    // chunks 0 ... chunks - 1.  A running stream is stopped first.
+    void start(Producer produce, uint64_t chunks);
+
+    // Stops the workers; the buffer keeps what was appended
+    void stop();
+
+    // On the GL thread: uploads queued chunks until `budget` seconds have
+    // passed (at least one chunk, if any is waiting); the vertices added
+    size_t append(double budget);
+
+    // Every chunk is produced and appended
+    bool done() const { return appended == total && total != 0; }
+
+    GLuint buffer() const { return buf; }
+    size_t size() const { return count; }      // vertices in the buffer
+    int components() const { return n; }
+    VertexFormat format() const { return fmt; }
+    size_t chunkVertices() const { return chunkSize; }
+
+    const Metrics& metrics() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Chunk {
+        std::vector<unsigned char> data;    // packed vertices
+        size_t count = 0;
+        Clock::time_point pushed;
+    };
+
+    struct Worker {
+        SpscQueue<Chunk*> full, empty;      // to the GL thread, and back
+        std::vector<Chunk> chunks;
+        std::thread thread;
+        Worker(size_t depth) : full(depth), empty(depth), chunks(depth) {}
+    };
+
+    int n;
+    VertexFormat fmt;
+    size_t chunkSize, stride;
+    unsigned threadCount;
+    size_t depth;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<uint64_t> next{0};
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> waits{0};
+    uint64_t total = 0, appended = 0;
+    size_t rotate = 0;                      // worker append() starts at, for fairness
+
+    GLuint buf = 0;
+    size_t count = 0;
+
+    mutable Metrics m;
+    uint64_t appendCalls = 0;
+    double latencySum = 0;
+    double queuedSum = 0;
+
+    void produce(Worker& w, const Producer& f);
+};
+
+std::ostream& operator << (std::ostream& os, const VertexStream::Metrics& m);
+
+
+//
+//  Fixed-timestep frame pacing.
+//
+//  Simulation runs in steps of `step` seconds however long frames take:
+//  advance() adds the wall time since its last call to an accumulator and
+//  returns how many whole steps it holds, and alpha() is the fraction of
+//  a step left over, to interpolate what is drawn.  After a long stall at
+//  most maxSteps are returned and the rest of the time is dropped, so a
+//  slow frame cannot snowball into ever more steps.  untilNext() is the
+//  wait before the next step is due, for glutTimerFunc.
+//
+
+class FixedTimestep {
+public:
+    struct Stats {
+        uint64_t frames = 0, steps = 0;
+        double frameSeconds = 0;            // the last frame
+        double meanFrameSeconds = 0, maxFrameSeconds = 0;
+        double droppedSeconds = 0;          // time discarded past maxSteps
+    };
+
+    explicit FixedTimestep(double step = 1.0 / 60, unsigned maxSteps = 5)
+        : dt(step), maxSteps(maxSteps), last(Clock::now()) {}
+
+    // Steps to run for this frame
+    unsigned advance() {
+        Clock::time_point t = Clock::now();
+        double elapsed = std::chrono::duration<double>(t - last).count();
+        last = t;
+        acc += elapsed;
+
+        unsigned steps = unsigned(std::min(acc / dt, double(maxSteps)));
+        acc -= steps * dt;
+        if (steps == maxSteps && acc >= dt) {
+            st.droppedSeconds += acc - std::fmod(acc, dt);
+            acc = std::fmod(acc, dt);
+        }
+
+        st.frames++;
+        st.steps += steps;
+        st.frameSeconds = elapsed;
+        st.meanFrameSeconds += (elapsed - st.meanFrameSeconds) / double(st.frames);
+        st.maxFrameSeconds = std::max(st.maxFrameSeconds, elapsed);
+        return steps;
+    }
+
+    double step() const { return dt; }
+    double alpha() const { return acc / dt; }
+
+    // Seconds until advance() would return a step
+    double untilNext() const {
+        double since = std::chrono::duration<double>(Clock::now() - last).count();
+        return std::max(0.0, dt - acc - since);
+    }
+
+    const Stats& stats() const { return st; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    double dt;
+    unsigned maxSteps;
+    Clock::time_point last;
+    double acc = 0;
+    Stats st;
+};
+
+std::ostream& operator << (std::ostream& os, const FixedTimestep::Stats& s);
+
+} // namespace Sand
+
+#endif // __VERTEX_STREAM_H__
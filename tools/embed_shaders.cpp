@@ -0,0 +1,137 @@
+//
+//  Writes GLSL files into a header as Sand::EmbeddedShader constants, for
+//  the InitShader overload that reads no files.  Includes are expanded
+//  as InitShader would expand them; --minify also strips comments and
+//  whitespace (MinifyGLSL).
+//
+//      tools/embed_shaders [--minify] -o embedded_shaders.h vshader21.glsl ...
+//
+//  gives, for each file, its name made an identifier:
+//
+//      namespace Sand::shaders {
+//          inline constexpr EmbeddedShader vshader21_glsl = {"vshader21.glsl", "..."};
+//          ...
+//          inline constexpr EmbeddedShader All[] = {vshader21_glsl, ...};
+//      }
+//
+//  The Makefile runs it over every *.glsl before building the examples.
+//
+
+#include "sand.h"
+#include "shader_source.h"
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+// "dir/my-shader.glsl" -> dir_my_shader_glsl
+std::string Identifier(const std::string& file) {
+    std::string id;
+    for (char c : file) id += std::isalnum((unsigned char)c) ? c : '_';
+    if (id.empty() || std::isdigit((unsigned char)id[0])) id = "_" + id;
+    return id;
+}
+
+// text as C++ string literals, one per source line
+std::string Literal(const std::string& text) {
+    std::string out = "        \"";
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = text[i];
+        switch (c) {
+            case '\n':
+                out += "\\n\"";
+                if (i + 1 < text.size()) out += "\n        \"";
+                continue;
+            case '\t': out += "\\t"; break;
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            default:
+                if (c < 0x20 || c >= 0x7f) {
+                    // octal, always three digits so a following digit cannot join it
+                    char esc[8];
+                    std::snprintf(esc, sizeof(esc), "\\%03o", c);
+                    out += esc;
+                } else {
+                    out += char(c);
+                }
+        }
+    }
+    if (text.empty() || text.back() != '\n') out += '"';
+    return out;
+}
+
+void Usage(const char* program) {
+    std::fprintf(stderr, "usage: %s [--minify] -o OUTPUT.h FILE.glsl...\n", program);
+    std::exit(EXIT_FAILURE);
+}
+
+}   // namespace
+
+int main(int argc, char** argv) {
+    bool minify = false;
+    std::string output;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--minify") == 0) {
+            minify = true;
+        } else if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (argv[i][0] == '-') {
+            Usage(argv[0]);
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (output.empty()) Usage(argv[0]);
+
+    std::ostringstream out;
+    out << "// Generated by tools/embed_shaders" << (minify ? " --minify" : "") << "; do not edit.\n"
+        << "\n"
+        << "#ifndef __EMBEDDED_SHADERS_H__\n"
+        << "#define __EMBEDDED_SHADERS_H__\n"
+        << "\n"
+        << "#include \"sand.h\"\n"
+        << "\n"
+        << "namespace Sand {\n"
+        << "namespace shaders {\n";
+
+    size_t before = 0, after = 0;
+    for (const std::string& file : files) {
+        const std::string* text = GetShaderSources().get(file);
+        if (text == NULL) return EXIT_FAILURE;
+        std::string source = minify ? MinifyGLSL(*text) : *text;
+        before += text->size();
+        after += source.size();
+
+        out << "\n"
+            << "inline constexpr EmbeddedShader " << Identifier(file) << " = {\"" << file << "\",\n"
+            << Literal(source) << "};\n";
+    }
+
+    if (!files.empty()) {
+        out << "\n"
+            << "inline constexpr EmbeddedShader All[] = {";
+        for (size_t i = 0; i < files.size(); i++) out << (i ? ", " : "") << Identifier(files[i]);
+        out << "};\n";
+    }
+    out << "\n"
+        << "} // namespace shaders\n"
+        << "} // namespace Sand\n"
+        << "\n"
+        << "#endif // __EMBEDDED_SHADERS_H__\n";
+
+    // written whole, so a failed run leaves no half header behind
+    std::ofstream fout(output);
+    fout << out.str();
+    fout.close();
+    if (!fout) {
+        std::fprintf(stderr, "Failed to write %s\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+    std::printf("%s: %zu shaders, %zu bytes%s\n", output.c_str(), files.size(), after,
+                minify ? (" (" + std::to_string(before) + " before minifying)").c_str() : "");
+    return EXIT_SUCCESS;
+}